@@ -24,9 +24,19 @@ struct AdapterConfig {
     int8_t pin_mode_jp;
     int8_t pin_led;
     int8_t pin_bt_led;
+    int8_t pin_capture_clk; // DMA snoop sample clock, driven and read back on one spare pad (-1 = no DMA snoop)
 
     // --- Terminal settings ---
     bool use_mode_jumper; // true = read from hardware jumper
+    char keymap[24];      // Keymap blob to use by name (empty = built-in Wyse 50 map)
+
+    // --- Scan engine ---
+    bool scan_isolated_core;   // true = scan responder owns CPU 1, never yields
+    uint16_t scan_settle_ns;   // New address must hold this long before Key Return follows (0 = off)
+    bool scan_predict;         // Commit Key Return for the learned next address on bus change
+    bool scan_edge;            // Answer from an address-line interrupt instead of the polling loop
+    uint8_t scan_latch_frames; // Frames a new press stays asserted whatever its release (0 = off)
+    uint8_t scan_rollover;     // Non-modifier keys asserted at once, the rest queued (0 = no cap)
 
     // --- Features ---
     bool enable_usb;
@@ -51,21 +61,31 @@ struct AdapterConfig {
 
 static void setDefaultConfig(AdapterConfig &cfg) {
     // Scan interface pins (match J3 wiring table — avoid GPIOs 6-11 on ESP32)
-    cfg.pin_addr[0]    = 4;   // A0 — J3 pin 6
-    cfg.pin_addr[1]    = 5;   // A1 — J3 pin 5
-    cfg.pin_addr[2]    = 14;  // A2 — J3 pin 4
-    cfg.pin_addr[3]    = 15;  // A3 — J3 pin 7
-    cfg.pin_addr[4]    = 13;  // A4 — J3 pin 10
-    cfg.pin_addr[5]    = 16;  // A5 — J3 pin 8
-    cfg.pin_addr[6]    = 17;  // A6 — J3 pin 9
-    cfg.pin_key_return = 18;  // Key Return — J3 pin 11 (via 2N7000)
-    cfg.pin_pair_btn   = 0;
-    cfg.pin_mode_jp    = -1;  // No mode jumper by default on ESP32
-    cfg.pin_led        = 2;
-    cfg.pin_bt_led     = -1;
+    cfg.pin_addr[0]     = 4;   // A0 — J3 pin 6
+    cfg.pin_addr[1]     = 5;   // A1 — J3 pin 5
+    cfg.pin_addr[2]     = 14;  // A2 — J3 pin 4
+    cfg.pin_addr[3]     = 15;  // A3 — J3 pin 7
+    cfg.pin_addr[4]     = 13;  // A4 — J3 pin 10
+    cfg.pin_addr[5]     = 16;  // A5 — J3 pin 8
+    cfg.pin_addr[6]     = 17;  // A6 — J3 pin 9
+    cfg.pin_key_return  = 18;  // Key Return — J3 pin 11 (via 2N7000)
+    cfg.pin_pair_btn    = 0;
+    cfg.pin_mode_jp     = -1;  // No mode jumper by default on ESP32
+    cfg.pin_led         = 2;
+    cfg.pin_bt_led      = -1;
+    cfg.pin_capture_clk = -1;  // Any free output-capable GPIO, left unconnected
 
     // Terminal
     cfg.use_mode_jumper = false;
+    cfg.keymap[0]       = '\0';
+
+    // Scan engine (shared core 0 with frame-gap yielding)
+    cfg.scan_isolated_core = false;
+    cfg.scan_settle_ns     = 0;
+    cfg.scan_predict       = true;
+    cfg.scan_edge          = false;
+    cfg.scan_latch_frames  = 2;
+    cfg.scan_rollover      = 0;
 
     // Features
     cfg.enable_usb        = true;
@@ -93,7 +113,7 @@ static Preferences prefs;
 bool saveConfig(const AdapterConfig &cfg) {
     prefs.begin("kb_cfg", false);
     size_t written = prefs.putBytes("config", &cfg, sizeof(cfg));
-    prefs.putUInt("version", 7);
+    prefs.putUInt("version", 15);
     prefs.end();
     return (written == sizeof(cfg));
 }
@@ -101,7 +121,7 @@ bool saveConfig(const AdapterConfig &cfg) {
 bool loadConfig(AdapterConfig &cfg) {
     prefs.begin("kb_cfg", true);
     uint32_t version = prefs.getUInt("version", 0);
-    if (version != 7) {
+    if (version != 15) {
         prefs.end();
         return false; // No saved config or version mismatch
     }
@@ -115,6 +135,7 @@ bool loadConfig(AdapterConfig &cfg) {
     cfg.sta_ssid[sizeof(cfg.sta_ssid) - 1]           = '\0';
     cfg.sta_password[sizeof(cfg.sta_password) - 1]   = '\0';
     cfg.hostname[sizeof(cfg.hostname) - 1]           = '\0';
+    cfg.keymap[sizeof(cfg.keymap) - 1]               = '\0';
 
     return true;
 }
@@ -139,15 +160,26 @@ String configToJson(const AdapterConfig &cfg) {
         snprintf(key, sizeof(key), "addr%d", i);
         pins[key] = cfg.pin_addr[i];
     }
-    pins["key_return"] = cfg.pin_key_return;
-    pins["pair_btn"]   = cfg.pin_pair_btn;
-    pins["mode_jp"]    = cfg.pin_mode_jp;
-    pins["led"]        = cfg.pin_led;
-    pins["bt_led"]     = cfg.pin_bt_led;
+    pins["key_return"]  = cfg.pin_key_return;
+    pins["pair_btn"]    = cfg.pin_pair_btn;
+    pins["mode_jp"]     = cfg.pin_mode_jp;
+    pins["led"]         = cfg.pin_led;
+    pins["bt_led"]      = cfg.pin_bt_led;
+    pins["capture_clk"] = cfg.pin_capture_clk;
 
     // Terminal
     JsonObject terminal         = doc["terminal"].to<JsonObject>();
     terminal["use_mode_jumper"] = cfg.use_mode_jumper;
+    terminal["keymap"]          = cfg.keymap;
+
+    // Scan engine
+    JsonObject scan       = doc["scan"].to<JsonObject>();
+    scan["isolated_core"] = cfg.scan_isolated_core;
+    scan["settle_ns"]     = cfg.scan_settle_ns;
+    scan["predict"]       = cfg.scan_predict;
+    scan["edge"]          = cfg.scan_edge;
+    scan["latch_frames"]  = cfg.scan_latch_frames;
+    scan["rollover"]      = cfg.scan_rollover;
 
     // Features
     JsonObject features    = doc["features"].to<JsonObject>();
@@ -213,12 +245,37 @@ bool jsonToConfig(const String &json, AdapterConfig &cfg) {
             int8_t v = pins["bt_led"];
             if (isValidGPIO(v)) cfg.pin_bt_led = v;
         }
+        if (pins.containsKey("capture_clk")) {
+            int8_t v = pins["capture_clk"];
+            if (isValidGPIO(v) && v < 34) cfg.pin_capture_clk = v; // 34-39 are input-only
+        }
     }
 
     // Terminal
     if (doc.containsKey("terminal")) {
         JsonObject t = doc["terminal"];
         if (t.containsKey("use_mode_jumper")) cfg.use_mode_jumper = t["use_mode_jumper"];
+        if (t.containsKey("keymap")) strlcpy(cfg.keymap, t["keymap"] | "", sizeof(cfg.keymap));
+    }
+
+    // Scan engine
+    if (doc.containsKey("scan")) {
+        JsonObject sc = doc["scan"];
+        if (sc.containsKey("isolated_core")) cfg.scan_isolated_core = sc["isolated_core"];
+        if (sc.containsKey("settle_ns")) {
+            int ns = sc["settle_ns"];
+            if (ns >= 0 && ns <= 2000) cfg.scan_settle_ns = (uint16_t)ns;
+        }
+        if (sc.containsKey("predict")) cfg.scan_predict = sc["predict"];
+        if (sc.containsKey("edge")) cfg.scan_edge = sc["edge"];
+        if (sc.containsKey("latch_frames")) {
+            int n = sc["latch_frames"];
+            if (n >= 0 && n <= 8) cfg.scan_latch_frames = (uint8_t)n;
+        }
+        if (sc.containsKey("rollover")) {
+            int n = sc["rollover"];
+            if (n >= 0 && n <= 6) cfg.scan_rollover = (uint8_t)n;
+        }
     }
 
     // Features
@@ -0,0 +1,399 @@
+/*
+ * hid_desc.h — HID report descriptor → keyboard extraction plan (portable)
+ *
+ * Keyboards do not all send the boot layout (modifier byte, reserved
+ * byte, six key slots). Report protocol puts a report ID in front of
+ * every report once a device has more than one; NKRO keyboards send a
+ * bitmap with one bit per usage; composite receivers mix keyboard,
+ * consumer-control and mouse reports on one endpoint. The report
+ * descriptor says where everything is, so it is walked once per device
+ * (hidPlanCompile) into a short list of keyboard fields per report ID:
+ *
+ *   BITS   variable 1-bit fields, bit i = usage first+i (modifiers, NKRO)
+ *   ARRAY  count slots of size bits, each a usage index (6KRO key slots)
+ *
+ * hidPlanRun then turns each input report into the 256-bit usage
+ * bitmap hid_diff.h diffs, touching only those fields. A plan that is
+ * exactly the boot layout (no report IDs, modifier byte at 0, six byte
+ * slots at 2) is flagged when it is compiled and read the way
+ * hidBootBitmap() reads it. tools/hid_plan times that at about 1.3x a
+ * direct read of the layout, against ~2.5x for walking its two fields.
+ * Reports with no keyboard fields (consumer, mouse) come back as
+ * HID_RUN_NONE and leave the keys alone.
+ *
+ * No ESP-IDF dependencies: tools/hid_plan checks it against a corpus
+ * of keyboard descriptors, or a descriptor dumped from a device.
+ */
+
+#ifndef HID_DESC_H
+#define HID_DESC_H
+
+#include "hid_diff.h"
+
+#define HID_PLAN_MAX_REPORTS 8  // Input report IDs with keyboard fields
+#define HID_PLAN_MAX_FIELDS  16 // Keyboard fields, all reports
+#define HID_PAGE_KEYBOARD    0x07
+
+enum HidFieldKind : uint8_t {
+    HID_FIELD_BITS,
+    HID_FIELD_ARRAY,
+};
+
+struct HidPlanField {
+    uint16_t bit;   // Offset in the report, after any report ID byte
+    uint16_t count; // Bits (BITS) or slots (ARRAY)
+    uint8_t kind;   // HidFieldKind
+    uint8_t size;   // Bits per slot (ARRAY)
+    uint16_t first; // Usage of bit 0 (BITS) or of a slot reading lmin (ARRAY)
+    int32_t lmin, lmax;
+};
+
+struct HidPlanReport {
+    uint8_t id; // 0 when the descriptor has no report IDs
+    uint8_t first_field, n_fields;
+};
+
+struct HidPlan {
+    bool ids;  // Reports start with a report ID byte
+    bool boot; // Exactly the boot layout: hidPlanRun() skips the field walk
+    uint8_t n_reports, n_fields;
+    uint16_t skipped; // Input fields on other pages (consumer, mouse, vendor)
+    bool truncated;   // More keyboard fields or reports than the plan holds
+    HidPlanReport reports[HID_PLAN_MAX_REPORTS];
+    HidPlanField fields[HID_PLAN_MAX_FIELDS];
+};
+
+enum HidRunResult : uint8_t {
+    HID_RUN_NONE,     // Not a keyboard report
+    HID_RUN_KEYS,     // now holds the keys down
+    HID_RUN_ROLLOVER, // Error report: now holds only modifiers (hidKeepKeys)
+};
+
+// The HID 1.11 Appendix B.1 boot keyboard: the plan for devices whose
+// descriptor cannot be read, and for interfaces put in boot protocol
+static const uint8_t HID_BOOT_KEYBOARD_DESC[] = {
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01,                         // Generic Desktop, Keyboard, Application
+    0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25, 0x01, // Modifiers E0-E7
+    0x75, 0x01, 0x95, 0x08, 0x81, 0x02,                         //   8 x 1 bit, Input (Var)
+    0x95, 0x01, 0x75, 0x08, 0x81, 0x01,                         // Reserved byte, Input (Const)
+    0x95, 0x05, 0x75, 0x01, 0x05, 0x08, 0x19, 0x01, 0x29, 0x05, // LEDs 1-5
+    0x91, 0x02, 0x95, 0x01, 0x75, 0x03, 0x91, 0x01,             //   Output (Var), padding
+    0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x25, 0x65,             // Six key slots, 0-101
+    0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00,             //   Input (Array)
+    0xC0,                                                       // End Collection
+};
+
+// ============================================================
+// COMPILER
+// ============================================================
+
+struct HidDescGlobals {
+    uint16_t page;
+    int32_t lmin, lmax;
+    uint32_t size, count;
+    uint8_t id;
+};
+
+static inline HidPlanReport *hidPlanReportFor(HidPlan &p, uint8_t id) {
+    for (int i = 0; i < p.n_reports; i++) {
+        if (p.reports[i].id == id) return &p.reports[i];
+    }
+    if (p.n_reports == HID_PLAN_MAX_REPORTS) return nullptr;
+    HidPlanReport &r = p.reports[p.n_reports++];
+    r.id             = id;
+    r.first_field    = 0;
+    r.n_fields       = 0;
+    return &r;
+}
+
+// Field list in descriptor order, report index alongside
+struct HidDescFields {
+    HidPlanField f[HID_PLAN_MAX_FIELDS];
+    uint8_t report[HID_PLAN_MAX_FIELDS];
+    uint8_t n;
+};
+
+static inline void hidDescAddField(HidPlan &p, HidDescFields &out, uint8_t id, const HidPlanField &f) {
+    HidPlanReport *r = hidPlanReportFor(p, id);
+    if (!r || out.n == HID_PLAN_MAX_FIELDS) {
+        p.truncated = true;
+        return;
+    }
+    out.report[out.n] = (uint8_t)(r - p.reports);
+    out.f[out.n++]    = f;
+}
+
+// Walk a report descriptor into p. False if it describes no keyboard
+// input at all (p is then empty).
+static inline bool hidPlanCompile(HidPlan &p, const uint8_t *desc, size_t len) {
+    memset(&p, 0, sizeof(p));
+    HidDescFields out;
+    out.n = 0;
+
+    HidDescGlobals g = {}, stack[4];
+    int depth        = 0;
+    uint32_t usages[16]; // Local state: usage list, or a min/max range
+    int n_usages     = 0;
+    uint32_t umin = 0, umax = 0;
+    bool range = false;
+    struct {
+        uint8_t id;
+        uint32_t bit;
+    } offs[16]; // Next input bit per report ID
+    int n_offs = 0;
+
+    size_t i = 0;
+    while (i < len) {
+        uint8_t prefix = desc[i++];
+        if (prefix == 0xFE) { // Long item: size, tag, data (no long items are defined)
+            if (i + 1 >= len) break;
+            i += 2 + desc[i];
+            continue;
+        }
+        int n = (prefix & 3) == 3 ? 4 : (prefix & 3);
+        if (i + n > len) break;
+        uint32_t v = 0;
+        for (int b = 0; b < n; b++) v |= (uint32_t)desc[i + b] << (8 * b);
+        int32_t sv = n == 0 ? 0 : n == 1 ? (int8_t)v : n == 2 ? (int16_t)v : (int32_t)v;
+        i += n;
+
+        uint8_t type = (prefix >> 2) & 3, tag = prefix >> 4;
+        if (type == 1) { // Global
+            switch (tag) {
+                case 0x0: g.page = (uint16_t)v; break;
+                case 0x1: g.lmin = sv; break;
+                case 0x2: // Unsigned unless the minimum is negative, as Linux reads it: 25 FF is 255
+                    g.lmax = g.lmin < 0 ? sv : (int32_t)v;
+                    break;
+                case 0x7: g.size = v; break;
+                case 0x8:
+                    g.id  = (uint8_t)v;
+                    p.ids = true;
+                    break;
+                case 0x9: g.count = v; break;
+                case 0xA:
+                    if (depth < 4) stack[depth++] = g;
+                    break;
+                case 0xB:
+                    if (depth > 0) g = stack[--depth];
+                    break;
+            }
+            continue;
+        }
+        if (type == 2) { // Local; a 4-byte usage carries its own page, others
+                         // take the one in force at the main item
+            uint32_t u = n == 4 ? v : v & 0xFFFF;
+            if (tag == 0x0 && n_usages < 16) usages[n_usages++] = u;
+            if (tag == 0x1) {
+                umin  = u;
+                range = true;
+            }
+            if (tag == 0x2) umax = u;
+            continue;
+        }
+        if (type != 0) continue;
+
+        if (tag == 0x8) { // Input
+            int o = 0;
+            while (o < n_offs && offs[o].id != g.id) o++;
+            if (o == n_offs) {
+                if (n_offs == 16) {
+                    p.truncated = true;
+                    break;
+                }
+                offs[n_offs++] = {g.id, 0};
+            }
+            uint32_t bit   = offs[o].bit;
+            uint32_t total = g.size * g.count;
+            offs[o].bit += total;
+
+            auto paged = [&](uint32_t u) { return (u >> 16) ? u : ((uint32_t)g.page << 16) | u; };
+            bool constant = v & 1, variable = v & 2;
+            uint32_t base = paged(range ? umin : n_usages ? usages[0] : 0);
+            if (constant || g.size == 0 || g.count == 0 || bit + total > 0xFFFF) {
+                // Padding
+            } else if (!variable) {
+                if ((base >> 16) == HID_PAGE_KEYBOARD && g.size <= 16 && g.lmax >= g.lmin) {
+                    HidPlanField f = {};
+                    f.bit          = (uint16_t)bit;
+                    f.count        = (uint16_t)g.count;
+                    f.kind         = HID_FIELD_ARRAY;
+                    f.size         = (uint8_t)g.size;
+                    f.first        = (uint16_t)(base & 0xFFFF);
+                    f.lmin         = g.lmin;
+                    f.lmax         = g.lmax;
+                    hidDescAddField(p, out, g.id, f);
+                } else {
+                    p.skipped++;
+                }
+            } else {
+                // One usage per element: coalesce runs of consecutive
+                // 1-bit keyboard usages into BITS fields
+                bool other = false;
+                HidPlanField run = {};
+                for (uint32_t e = 0; e < g.count; e++) {
+                    uint32_t u = 0;
+                    if (range) {
+                        u = paged(umin + e <= umax ? umin + e : umax);
+                    } else if (n_usages) {
+                        u = paged(usages[e < (uint32_t)n_usages ? e : n_usages - 1]);
+                    }
+                    bool key   = g.size == 1 && (u >> 16) == HID_PAGE_KEYBOARD && (u & 0xFFFF) < 256;
+                    uint32_t b = bit + e;
+                    if (key && run.count && run.bit + run.count == b && run.first + run.count == (u & 0xFFFF)) {
+                        run.count++;
+                        continue;
+                    }
+                    if (run.count) hidDescAddField(p, out, g.id, run);
+                    run = {};
+                    if (key) {
+                        run.bit   = (uint16_t)b;
+                        run.count = 1;
+                        run.kind  = HID_FIELD_BITS;
+                        run.size  = 1;
+                        run.first = (uint16_t)(u & 0xFFFF);
+                    } else {
+                        other = true;
+                    }
+                }
+                if (run.count) hidDescAddField(p, out, g.id, run);
+                if (other) p.skipped++;
+            }
+        }
+        // Every main item ends the local state
+        n_usages = 0;
+        umin = umax = 0;
+        range       = false;
+    }
+
+    // Group the fields by report
+    for (int r = 0; r < p.n_reports; r++) {
+        p.reports[r].first_field = p.n_fields;
+        for (int f = 0; f < out.n; f++) {
+            if (out.report[f] == r) p.fields[p.n_fields++] = out.f[f];
+        }
+        p.reports[r].n_fields = (uint8_t)(p.n_fields - p.reports[r].first_field);
+    }
+    if (!p.ids && p.n_reports) p.reports[0].id = 0;
+    const HidPlanField *f = p.fields;
+    p.boot = !p.ids && p.n_reports == 1 && p.n_fields == 2 && f[0].kind == HID_FIELD_BITS && f[0].bit == 0 &&
+             f[0].count == 8 && f[0].first == HID_USAGE_MOD_BASE && f[1].kind == HID_FIELD_ARRAY && f[1].bit == 16 &&
+             f[1].count == 6 && f[1].size == 8 && f[1].lmin == 0 && f[1].first == 0;
+    return p.n_fields > 0;
+}
+
+// ============================================================
+// EXECUTOR
+// ============================================================
+
+// Up to 24 bits starting at bit, little-endian, zeros past the report's end
+static inline uint32_t hidReadBits(const uint8_t *data, uint16_t len, uint32_t bit, uint8_t n) {
+    uint32_t byte = bit >> 3, w = 0;
+    if (byte + 4 <= len) {
+        memcpy(&w, data + byte, 4); // Little-endian host and target
+    } else {
+        for (uint32_t b = 0; byte + b < len; b++) w |= (uint32_t)data[byte + b] << (8 * b);
+    }
+    return (w >> (bit & 7)) & ((1u << n) - 1);
+}
+
+// An error report: keep only the modifiers it holds (E8-FF share their word)
+static inline uint8_t hidRunRollover(uint32_t *now) {
+    memset(now, 0, (HID_USAGE_MOD_BASE >> 5) * sizeof(uint32_t));
+    now[HID_USAGE_MOD_BASE >> 5] &= 0xFFu << (HID_USAGE_MOD_BASE & 31);
+    return HID_RUN_ROLLOVER;
+}
+
+// Usages in one keyboard input report (data without its report ID byte)
+static inline uint8_t hidPlanRun(const HidPlan &p, uint8_t id, const uint8_t *data, uint16_t len, uint32_t *now) {
+    if (p.boot && len >= 8) {
+        // hidBootBitmap(), bounded by the slots' logical maximum as the
+        // field walk would be
+        memset(now, 0, HID_KEY_WORDS * sizeof(uint32_t));
+        now[HID_USAGE_MOD_BASE >> 5] = (uint32_t)data[0] << (HID_USAGE_MOD_BASE & 31);
+        bool rollover = false;
+        for (int i = 0; i < 6; i++) {
+            uint8_t u = data[2 + i];
+            if (u == 0 || u > p.fields[1].lmax) continue;
+            rollover |= u <= HID_USAGE_ERR_MAX;
+            now[u >> 5] |= 1u << (u & 31);
+        }
+        return rollover ? hidRunRollover(now) : (uint8_t)HID_RUN_KEYS;
+    }
+    if (!p.ids) id = 0;
+    const HidPlanReport *r = nullptr;
+    for (int i = 0; i < p.n_reports; i++) {
+        if (p.reports[i].id == id) r = &p.reports[i];
+    }
+    if (!r) return HID_RUN_NONE;
+
+    memset(now, 0, HID_KEY_WORDS * sizeof(uint32_t));
+    bool rollover = false;
+    for (int i = 0; i < r->n_fields; i++) {
+        const HidPlanField f = p.fields[r->first_field + i]; // A copy: stores to now cannot alias it
+        if (f.kind == HID_FIELD_BITS && !(f.bit & 7) && !(f.first & 7)) {
+            // Byte-aligned bitmap (modifiers, NKRO): 32 bits at a time,
+            // and a run of keys all up costs one test
+            uint32_t b = f.bit >> 3, u = f.first;
+            for (uint32_t e = 0; e < f.count && b < len;) {
+                uint32_t w, step = 8;
+                if (f.count - e >= 32 && b + 4 <= len) {
+                    memcpy(&w, data + b, 4); // Little-endian host and target
+                    step = 32;
+                } else {
+                    w = data[b];
+                    if (f.count - e < 8) w &= (1u << (f.count - e)) - 1;
+                }
+                if (w) {
+                    uint64_t x = (uint64_t)w << (u & 31);
+                    now[u >> 5] |= (uint32_t)x;
+                    if ((u >> 5) + 1 < HID_KEY_WORDS) now[(u >> 5) + 1] |= (uint32_t)(x >> 32);
+                }
+                e += step;
+                b += step >> 3;
+                u += step;
+            }
+        } else if (f.kind == HID_FIELD_BITS) {
+            for (uint32_t e = 0; e < f.count; e += 24) {
+                uint8_t n  = (uint8_t)(f.count - e < 24 ? f.count - e : 24);
+                uint32_t u = f.first + e;
+                uint64_t x = (uint64_t)hidReadBits(data, len, f.bit + e, n) << (u & 31);
+                now[u >> 5] |= (uint32_t)x;
+                if ((u >> 5) + 1 < HID_KEY_WORDS) now[(u >> 5) + 1] |= (uint32_t)(x >> 32);
+            }
+        } else if (f.size == 8 && !(f.bit & 7) && f.lmin == 0) {
+            // Byte slots, the usual 6KRO layout: no bit extraction
+            const uint8_t *slot = data + (f.bit >> 3);
+            uint32_t n          = (f.bit >> 3) >= len ? 0 : len - (f.bit >> 3);
+            if (n > f.count) n = f.count;
+            for (uint32_t e = 0; e < n; e++) {
+                uint8_t v = slot[e];
+                if (v > f.lmax) continue;
+                uint32_t u = f.first + v;
+                if (u == 0 || u > 0xFF) continue;
+                if (u <= HID_USAGE_ERR_MAX) rollover = true;
+                now[u >> 5] |= 1u << (u & 31);
+            }
+        } else {
+            for (uint32_t e = 0; e < f.count; e++) {
+                int32_t v = (int32_t)hidReadBits(data, len, f.bit + e * f.size, f.size);
+                if (v < f.lmin || v > f.lmax) continue; // Out of range: empty slot
+                uint32_t u = f.first + (uint32_t)(v - f.lmin);
+                if (u == 0 || u > 0xFF) continue;
+                if (u <= HID_USAGE_ERR_MAX) rollover = true;
+                now[u >> 5] |= 1u << (u & 31);
+            }
+        }
+    }
+    return rollover ? hidRunRollover(now) : (uint8_t)HID_RUN_KEYS;
+}
+
+// A report as it arrives on the wire: report ID byte first if the
+// descriptor uses them
+static inline uint8_t hidPlanRunRaw(const HidPlan &p, const uint8_t *buf, uint16_t len, uint32_t *now) {
+    if (!p.ids) return hidPlanRun(p, 0, buf, len, now);
+    if (len < 1) return HID_RUN_NONE;
+    return hidPlanRun(p, buf[0], buf + 1, (uint16_t)(len - 1), now);
+}
+
+#endif // HID_DESC_H
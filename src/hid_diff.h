@@ -0,0 +1,104 @@
+/*
+ * hid_diff.h — HID keyboard reports to Wyse key events by bitmap diff (portable)
+ *
+ * A boot keyboard report is a modifier byte plus up to six usages. Each
+ * report becomes a 256-bit "keys down" bitmap, the modifier bits folded
+ * in as their own usages E0-E7, and XOR against the previous report's
+ * bitmap gives exactly the usages that went down or came up.
+ *
+ * Usages map to Wyse scan addresses many-to-one (Page Up and Page Down
+ * are both 0x41, KP / and / both 0x66, either Shift is Shift), so every
+ * address counts the usages holding it: it presses on the first and
+ * releases on the last, and only those transitions become events (the
+ * nested loop this replaced re-pressed every held key on every report).
+ * Each held usage remembers the address it pressed, so a mapping change
+ * while the key is down still releases the right one.
+ *
+ * No ESP-IDF dependencies: tools/hid_bench times it against the nested
+ * loop diff it replaced.
+ */
+
+#ifndef HID_DIFF_H
+#define HID_DIFF_H
+
+#include "scan_core.h"
+
+#define HID_KEY_WORDS      8    // 256 usages
+#define HID_USAGE_ERR_MAX  0x03 // 01-03: ErrorRollOver, POSTFail, ErrorUndefined
+#define HID_USAGE_MOD_BASE 0xE0 // Left Ctrl; modifier bit n is usage E0+n
+#define HID_NO_ADDR        0xFF
+
+struct HidKeyState {
+    uint32_t down[HID_KEY_WORDS];  // Usages held, bit u = usage u
+    uint8_t addr_of[256];          // Address each held usage pressed (HID_NO_ADDR = none)
+    uint8_t refs[SCAN_ADDR_COUNT]; // Held usages per address
+};
+
+static inline void hidKeyStateReset(HidKeyState &s) {
+    memset(s.down, 0, sizeof(s.down));
+    memset(s.addr_of, HID_NO_ADDR, sizeof(s.addr_of));
+    memset(s.refs, 0, sizeof(s.refs));
+}
+
+// Usages a boot-layout report holds (modifier byte, six key slots).
+// False if it carries an error usage instead of keys: the keyboard has
+// more down than it can report, and now holds only the modifiers.
+static inline bool hidBootBitmap(uint8_t modifiers, const uint8_t *keys, uint32_t *now) {
+    memset(now, 0, HID_KEY_WORDS * sizeof(uint32_t));
+    now[HID_USAGE_MOD_BASE >> 5] = (uint32_t)modifiers << (HID_USAGE_MOD_BASE & 31);
+    for (int i = 0; i < 6; i++) {
+        uint8_t u = keys[i];
+        if (u != 0 && u <= HID_USAGE_ERR_MAX) {
+            memset(now, 0, (HID_USAGE_MOD_BASE >> 5) * sizeof(uint32_t));
+            return false;
+        }
+        if (u) now[u >> 5] |= 1u << (u & 31);
+    }
+    return true;
+}
+
+// An error report says nothing about the keys: they stay as s holds
+// them, and only its modifiers (already in now) are taken
+static inline void hidKeepKeys(const HidKeyState &s, uint32_t *now) {
+    const uint32_t mod_mask = 0xFFu << (HID_USAGE_MOD_BASE & 31);
+    uint32_t mods           = now[HID_USAGE_MOD_BASE >> 5] & mod_mask;
+    memcpy(now, s.down, sizeof(s.down));
+    now[HID_USAGE_MOD_BASE >> 5] = (now[HID_USAGE_MOD_BASE >> 5] & ~mod_mask) | mods;
+}
+
+// Move s to the bitmap now, calling sink(addr, press) as each address
+// gains its first usage or loses its last. Presses go first, so a usage
+// handing an address to another in the same report (Page Up → Page
+// Down) leaves it held instead of releasing and re-pressing it.
+template <typename Sink>
+static inline void hidKeyDiff(HidKeyState &s, const uint32_t *now, const uint8_t *map, Sink sink) {
+    uint32_t changed = 0; // Words that differ, bit w = word w
+    for (int w = 0; w < HID_KEY_WORDS; w++) changed |= (uint32_t)((now[w] ^ s.down[w]) != 0) << w;
+    for (uint32_t m = changed; m; m &= m - 1) {
+        int w         = __builtin_ctz(m);
+        uint32_t came = now[w] & ~s.down[w];
+        while (came) {
+            uint8_t u = (uint8_t)(w * 32 + __builtin_ctz(came));
+            came &= came - 1;
+            uint8_t addr = map[u];
+            if (addr >= SCAN_ADDR_COUNT) continue;
+            s.addr_of[u] = addr;
+            if (s.refs[addr]++ == 0) sink(addr, true);
+        }
+    }
+    for (uint32_t m = changed; m; m &= m - 1) {
+        int w         = __builtin_ctz(m);
+        uint32_t gone = s.down[w] & ~now[w];
+        while (gone) {
+            uint8_t u = (uint8_t)(w * 32 + __builtin_ctz(gone));
+            gone &= gone - 1;
+            uint8_t addr = s.addr_of[u];
+            if (addr == HID_NO_ADDR) continue;
+            s.addr_of[u] = HID_NO_ADDR;
+            if (--s.refs[addr] == 0) sink(addr, false);
+        }
+        s.down[w] = now[w];
+    }
+}
+
+#endif // HID_DIFF_H
@@ -0,0 +1,173 @@
+/*
+ * key_blob.h — Versioned binary keymaps for the keymaps partition (portable)
+ *
+ * A blob is a keymap compiled ahead of time: a header, the KeyMap tables
+ * exactly as key_map.h looks them up, then the rules they came from.
+ * The firmware maps the partition with esp_partition_mmap() and points
+ * processHidReport() straight at a blob's tables, so lookups read flash
+ * through the cache and nothing is copied to the heap.
+ *
+ *   offset 0                   KeyBlobHeader (64 bytes)
+ *   KEY_BLOB_TABLE_OFFSET      KeyMap (4196 bytes)
+ *   KEY_BLOB_RULES_OFFSET      KeyRule[n_rules] (5 bytes each)
+ *
+ * Little-endian, as both the ESP32 and the host build it. Each blob sits
+ * in its own KEY_BLOB_SLOT_SIZE slot, so one can be rewritten without
+ * touching the others, and keymaps for several terminals coexist.
+ *
+ * tools/keymap_compile builds blobs from JSON and runs the same checks
+ * the upload endpoint does.
+ */
+
+#ifndef KEY_BLOB_H
+#define KEY_BLOB_H
+
+#include "key_map.h"
+
+#define KEY_BLOB_MAGIC        0x4D4B424Bu // "KBKM"
+#define KEY_BLOB_VERSION      1
+#define KEY_BLOB_SLOT_SIZE    0x2000 // Two flash sectors
+#define KEY_BLOB_TABLE_OFFSET 64
+#define KEY_BLOB_RULES_OFFSET (KEY_BLOB_TABLE_OFFSET + sizeof(KeyMap))
+#define KEY_BLOB_MAX_RULES    ((KEY_BLOB_SLOT_SIZE - KEY_BLOB_RULES_OFFSET) / sizeof(KeyRule))
+#define KEY_BLOB_NAME_LEN     24
+
+struct KeyBlobHeader {
+    uint32_t magic;               // KEY_BLOB_MAGIC
+    uint16_t version;             // KEY_BLOB_VERSION
+    uint16_t n_rules;             // KeyRule records after the tables
+    uint32_t length;              // Header, tables and rules
+    uint32_t crc;                 // CRC-32 of everything after the header
+    char name[KEY_BLOB_NAME_LEN]; // Selects the keymap (config terminal.keymap), NUL-terminated
+    char terminal[16];            // Terminal model it was written for, informational
+    uint8_t reserved[8];
+};
+
+// The tables are read in place, so their layout is part of the format
+static_assert(sizeof(KeyBlobHeader) == KEY_BLOB_TABLE_OFFSET, "KeyBlobHeader layout");
+static_assert(sizeof(KeyRule) == 5, "KeyRule layout");
+static_assert(sizeof(KeyMap) == 4196, "KeyMap layout changed: bump KEY_BLOB_VERSION");
+
+enum KeyBlobError {
+    KEY_BLOB_OK,
+    KEY_BLOB_EMPTY, // Erased slot
+    KEY_BLOB_MAGIC_BAD,
+    KEY_BLOB_VERSION_BAD,
+    KEY_BLOB_LENGTH_BAD,
+    KEY_BLOB_CRC_BAD,
+    KEY_BLOB_NAME_BAD,
+    KEY_BLOB_ADDR_BAD,      // Rule address off the matrix, or unknown flags
+    KEY_BLOB_ADDR_RESERVED, // Rule, Shift or Ctrl address the bus trace keeps for itself
+    KEY_BLOB_COLLISION,     // Two rules for one key in the same class, or Shift/Ctrl on one address
+    KEY_BLOB_TABLE_BAD,     // Tables are not what the rules compile to
+};
+
+static const char *const KEY_BLOB_ERRORS[] = {
+    "ok", "empty", "bad magic", "unsupported version", "bad length", "CRC mismatch", "bad name",
+    "address out of range", "address 0x7E/0x7F is reserved for the bus trace", "rules collide",
+    "tables do not match rules",
+};
+
+static inline uint32_t keyBlobCrc(const uint8_t *p, size_t n) {
+    uint32_t crc = 0xFFFFFFFFu;
+    while (n--) {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+    return ~crc;
+}
+
+static inline const KeyBlobHeader *keyBlobHeader(const uint8_t *blob) {
+    return (const KeyBlobHeader *)blob;
+}
+
+static inline const KeyMap *keyBlobMap(const uint8_t *blob) {
+    return (const KeyMap *)(blob + KEY_BLOB_TABLE_OFFSET);
+}
+
+static inline const KeyRule *keyBlobRules(const uint8_t *blob) {
+    return (const KeyRule *)(blob + KEY_BLOB_RULES_OFFSET);
+}
+
+// Rules a blob may carry: every address on the matrix and below
+// SCAN_TRACE_ADDR_RESERVED, no two rules for one key in the same class
+// (the later would silently win), Shift and Ctrl on different addresses.
+// *bad = index of the first offending rule (n if it is the Shift/Ctrl pair).
+static inline KeyBlobError keyRulesCheck(const KeyRule *rules, size_t n, uint8_t shift_addr, uint8_t ctrl_addr,
+                                         size_t *bad) {
+    *bad = n;
+    if (shift_addr >= SCAN_ADDR_COUNT || ctrl_addr >= SCAN_ADDR_COUNT) return KEY_BLOB_ADDR_BAD;
+    if (shift_addr >= SCAN_TRACE_ADDR_RESERVED || ctrl_addr >= SCAN_TRACE_ADDR_RESERVED) {
+        return KEY_BLOB_ADDR_RESERVED;
+    }
+    if (shift_addr == ctrl_addr) return KEY_BLOB_COLLISION;
+    for (size_t i = 0; i < n; i++) {
+        const KeyRule &r = rules[i];
+        *bad             = i;
+        if ((r.addr >= SCAN_ADDR_COUNT && r.addr != HID_NO_ADDR) || (r.mods >> KEY_MOD_BITS) || (r.when & ~r.mask) ||
+            r.mask >= KEY_MAP_CLASSES) {
+            return KEY_BLOB_ADDR_BAD;
+        }
+        if (r.addr >= SCAN_TRACE_ADDR_RESERVED && r.addr < SCAN_ADDR_COUNT) return KEY_BLOB_ADDR_RESERVED;
+        for (size_t j = 0; j < i; j++) {
+            if (rules[j].usage == r.usage && rules[j].when == r.when && rules[j].mask == r.mask) {
+                return KEY_BLOB_COLLISION;
+            }
+        }
+    }
+    return KEY_BLOB_OK;
+}
+
+// Header, length and CRC of the blob at p, with avail bytes readable
+static inline KeyBlobError keyBlobCheck(const uint8_t *p, size_t avail) {
+    if (avail < KEY_BLOB_RULES_OFFSET) return KEY_BLOB_LENGTH_BAD;
+    const KeyBlobHeader *h = keyBlobHeader(p);
+    if (h->magic == 0xFFFFFFFFu) return KEY_BLOB_EMPTY;
+    if (h->magic != KEY_BLOB_MAGIC) return KEY_BLOB_MAGIC_BAD;
+    if (h->version != KEY_BLOB_VERSION) return KEY_BLOB_VERSION_BAD;
+    if (h->n_rules > KEY_BLOB_MAX_RULES || h->length != KEY_BLOB_RULES_OFFSET + h->n_rules * sizeof(KeyRule) ||
+        h->length > avail) {
+        return KEY_BLOB_LENGTH_BAD;
+    }
+    if (keyBlobCrc(p + KEY_BLOB_TABLE_OFFSET, h->length - KEY_BLOB_TABLE_OFFSET) != h->crc) return KEY_BLOB_CRC_BAD;
+    if (!h->name[0] || memchr(h->name, 0, sizeof(h->name)) == NULL) return KEY_BLOB_NAME_BAD;
+    return KEY_BLOB_OK;
+}
+
+// Everything keyBlobCheck() does, plus the rules and that the stored
+// tables are exactly what they compile to (scratch: a KeyMap to compile
+// into). For a blob about to be written; a stored one only needs the CRC.
+static inline KeyBlobError keyBlobVerify(const uint8_t *p, size_t avail, KeyMap &scratch) {
+    KeyBlobError e = keyBlobCheck(p, avail);
+    if (e != KEY_BLOB_OK) return e;
+    const KeyBlobHeader *h = keyBlobHeader(p);
+    const KeyMap *m        = keyBlobMap(p);
+    size_t bad;
+    e = keyRulesCheck(keyBlobRules(p), h->n_rules, m->shift_addr, m->ctrl_addr, &bad);
+    if (e != KEY_BLOB_OK) return e;
+    keyMapCompile(scratch, keyBlobRules(p), h->n_rules, m->shift_addr, m->ctrl_addr);
+    if (memcmp(&scratch, m, sizeof(KeyMap)) != 0) return KEY_BLOB_TABLE_BAD;
+    return KEY_BLOB_OK;
+}
+
+// Compile rules into a blob at out (cap bytes, 4-byte aligned). Returns
+// its length, or 0 if it does not fit or the name is too long.
+static inline size_t keyBlobBuild(uint8_t *out, size_t cap, const char *name, const char *terminal,
+                                  const KeyRule *rules, size_t n, uint8_t shift_addr, uint8_t ctrl_addr) {
+    size_t len = KEY_BLOB_RULES_OFFSET + n * sizeof(KeyRule);
+    if (n > KEY_BLOB_MAX_RULES || len > cap || !*name || strlen(name) >= KEY_BLOB_NAME_LEN) return 0;
+    memset(out, 0, len);
+    KeyBlobHeader *h = (KeyBlobHeader *)out;
+    h->magic         = KEY_BLOB_MAGIC;
+    h->version       = KEY_BLOB_VERSION;
+    h->n_rules       = (uint16_t)n;
+    h->length        = (uint32_t)len;
+    strncpy(h->name, name, sizeof(h->name) - 1);
+    strncpy(h->terminal, terminal, sizeof(h->terminal) - 1);
+    keyMapCompile(*(KeyMap *)(out + KEY_BLOB_TABLE_OFFSET), rules, n, shift_addr, ctrl_addr);
+    memcpy(out + KEY_BLOB_RULES_OFFSET, rules, n * sizeof(KeyRule));
+    h->crc = keyBlobCrc(out + KEY_BLOB_TABLE_OFFSET, len - KEY_BLOB_TABLE_OFFSET);
+    return len;
+}
+
+#endif // KEY_BLOB_H
@@ -0,0 +1,190 @@
+/*
+ * key_map.h — Modifier-aware HID usage → Wyse key mapping (portable)
+ *
+ * A keymap is an ordered list of rules: (usage, modifier class) →
+ * (Wyse address, synthetic Shift/Ctrl). The class is which of Shift,
+ * Ctrl and the layer key are held. keyMapCompile() flattens the rules
+ * into one entry per class per usage, so a report costs one table read
+ * per usage that changed. Later rules override earlier ones for the
+ * classes they match; base rules go first, contextual ones after.
+ *
+ * The Wyse Shift and Ctrl addresses are not pressed by usages directly.
+ * A rule that maps a key to one of them makes that key a Shift (or Ctrl)
+ * holder. Each key pressed remembers the synthetic modifiers it asked
+ * for, and the address is driven from all held keys:
+ *   Shift = any key forcing Shift on, or
+ *           any Shift holder and no key forcing Shift off
+ * So Page Up sends Shift+Page even with no Shift held. A Shift+key rule
+ * that wants the unshifted Wyse key lifts Shift only while that key is
+ * down.
+ *
+ * A usage's class is taken when it goes down, from the whole report that
+ * presses it (Shift and the key in one report count as shifted), and it
+ * keeps the address it pressed until it comes up.
+ */
+
+#ifndef KEY_MAP_H
+#define KEY_MAP_H
+
+#include "hid_diff.h"
+
+#define KEY_MAP_CLASSES 8 // Shift x Ctrl x Layer
+
+// Class bits: what is held when a usage goes down. The first three
+// KEY_MOD_* bits are the same, so a holder's flags are the class it sets.
+#define KEY_CLASS_SHIFT 0x01
+#define KEY_CLASS_CTRL  0x02
+#define KEY_CLASS_LAYER 0x04
+
+// What a mapped usage does to the modifiers while it is held
+#define KEY_MOD_SHIFT     0x01 // Holds Shift (a Shift key)
+#define KEY_MOD_CTRL      0x02 // Holds Ctrl (a Ctrl key)
+#define KEY_MOD_LAYER     0x04 // Holds the layer (sets KEY_CLASS_LAYER, no address)
+#define KEY_MOD_SHIFT_ON  0x08 // Sends Shift with the key, held or not
+#define KEY_MOD_SHIFT_OFF 0x10 // Lifts held Shift while the key is down
+#define KEY_MOD_CTRL_ON   0x20
+#define KEY_MOD_CTRL_OFF  0x40
+#define KEY_MOD_BITS      7
+
+struct KeyRule {
+    uint8_t usage; // HID keyboard usage (E0-E7 = modifiers)
+    uint8_t when;  // Class bits required...
+    uint8_t mask;  // ...among these (0 = every class)
+    uint8_t addr;  // Wyse address, or HID_NO_ADDR
+    uint8_t mods;  // KEY_MOD_*
+};
+
+// A rule for every class, and one for the classes holding all of cls
+#define KEY_RULE(usage, addr, mods)         {(usage), 0, 0, (addr), (mods)}
+#define KEY_RULE_IN(cls, usage, addr, mods) {(usage), (cls), (cls), (addr), (mods)}
+
+struct KeyMap {
+    uint16_t ent[KEY_MAP_CLASSES][256]; // addr | mods << 8
+    uint32_t holds[3][HID_KEY_WORDS];   // Usages setting each class bit
+    uint8_t hold_words;                 // Words of holds with any usage, bit w = word w
+    uint8_t shift_addr, ctrl_addr;      // Driven from the held keys' modifiers
+    uint8_t reserved;                   // Zero; key_blob.h stores this struct as is
+};
+
+struct KeyMapState {
+    HidKeyState hid;            // Usages held and the addresses they pressed
+    uint8_t mods_of[256];       // KEY_MOD_* each held usage pressed with
+    uint8_t held[KEY_MOD_BITS]; // Held usages per KEY_MOD_* bit
+    uint8_t out;                // KEY_MOD_SHIFT/CTRL as last sent
+};
+
+static inline void keyMapStateReset(KeyMapState &s) {
+    hidKeyStateReset(s.hid);
+    memset(s.mods_of, 0, sizeof(s.mods_of));
+    memset(s.held, 0, sizeof(s.held));
+    s.out = 0;
+}
+
+// Flatten rules into m. A rule targeting shift_addr or ctrl_addr becomes
+// a holder of that modifier. False if any rule was malformed (address
+// off the matrix, unknown flags); those are skipped, the rest compiled.
+static inline bool keyMapCompile(KeyMap &m, const KeyRule *rules, size_t n, uint8_t shift_addr, uint8_t ctrl_addr) {
+    bool ok = true;
+    for (int c = 0; c < KEY_MAP_CLASSES; c++) {
+        for (int u = 0; u < 256; u++) m.ent[c][u] = HID_NO_ADDR;
+    }
+    m.shift_addr = shift_addr;
+    m.ctrl_addr  = ctrl_addr;
+    m.reserved   = 0;
+    for (size_t i = 0; i < n; i++) {
+        KeyRule r = rules[i];
+        if ((r.addr >= SCAN_ADDR_COUNT && r.addr != HID_NO_ADDR) || (r.mods >> KEY_MOD_BITS) ||
+            (r.when & ~r.mask) || r.mask >= KEY_MAP_CLASSES) {
+            ok = false;
+            continue;
+        }
+        if (r.addr == shift_addr) {
+            r.addr = HID_NO_ADDR;
+            r.mods |= KEY_MOD_SHIFT;
+        } else if (r.addr == ctrl_addr) {
+            r.addr = HID_NO_ADDR;
+            r.mods |= KEY_MOD_CTRL;
+        }
+        for (int c = 0; c < KEY_MAP_CLASSES; c++) {
+            if ((c & r.mask) == r.when) m.ent[c][r.usage] = (uint16_t)(r.addr | r.mods << 8);
+        }
+    }
+    // Holders as the unmodified class maps them
+    memset(m.holds, 0, sizeof(m.holds));
+    m.hold_words = 0;
+    for (int u = 0; u < 256; u++) {
+        uint8_t mods = (uint8_t)(m.ent[0][u] >> 8);
+        for (int b = 0; b < 3; b++) {
+            if (mods & (1u << b)) m.holds[b][u >> 5] |= 1u << (u & 31);
+        }
+        if (mods & (KEY_MOD_SHIFT | KEY_MOD_CTRL | KEY_MOD_LAYER)) m.hold_words |= (uint8_t)(1u << (u >> 5));
+    }
+    return ok;
+}
+
+// Any held usage pressed with flag (one KEY_MOD_* bit)
+static inline bool keyMapHeld(const KeyMapState &s, uint8_t flag) {
+    return s.held[__builtin_ctz(flag)] != 0;
+}
+
+// Class bits the usages in now set (holders normally all sit in the
+// modifier word, so this is one word per bit)
+static inline uint8_t keyMapClass(const KeyMap &m, const uint32_t *now) {
+    uint8_t cls = 0;
+    for (uint32_t ws = m.hold_words; ws; ws &= ws - 1) {
+        int w = __builtin_ctz(ws);
+        for (int b = 0; b < 3; b++) cls |= (uint8_t)(((now[w] & m.holds[b][w]) != 0) << b);
+    }
+    return cls;
+}
+
+// Move s to the bitmap now as hidKeyDiff() does, looking each new usage
+// up under the report's class, then bring the Shift and Ctrl addresses
+// in line with what the held keys ask for
+template <typename Sink>
+static inline void keyMapDiff(KeyMapState &s, const uint32_t *now, const KeyMap &m, Sink sink) {
+    HidKeyState &h   = s.hid;
+    uint32_t changed = 0; // Words that differ, bit w = word w
+    for (int w = 0; w < HID_KEY_WORDS; w++) changed |= (uint32_t)((now[w] ^ h.down[w]) != 0) << w;
+    if (!changed) return;
+    const uint16_t *ent = m.ent[keyMapClass(m, now)];
+    for (uint32_t c = changed; c; c &= c - 1) {
+        int w         = __builtin_ctz(c);
+        uint32_t came = now[w] & ~h.down[w];
+        while (came) {
+            uint8_t u = (uint8_t)(w * 32 + __builtin_ctz(came));
+            came &= came - 1;
+            uint8_t addr = (uint8_t)ent[u], mods = (uint8_t)(ent[u] >> 8);
+            s.mods_of[u] = mods;
+            for (uint8_t f = mods; f; f &= f - 1) s.held[__builtin_ctz(f)]++;
+            if (addr >= SCAN_ADDR_COUNT) continue;
+            h.addr_of[u] = addr;
+            if (h.refs[addr]++ == 0) sink(addr, true);
+        }
+    }
+    for (uint32_t c = changed; c; c &= c - 1) {
+        int w         = __builtin_ctz(c);
+        uint32_t gone = h.down[w] & ~now[w];
+        while (gone) {
+            uint8_t u = (uint8_t)(w * 32 + __builtin_ctz(gone));
+            gone &= gone - 1;
+            for (uint8_t f = s.mods_of[u]; f; f &= f - 1) s.held[__builtin_ctz(f)]--;
+            s.mods_of[u] = 0;
+            uint8_t addr = h.addr_of[u];
+            if (addr == HID_NO_ADDR) continue;
+            h.addr_of[u] = HID_NO_ADDR;
+            if (--h.refs[addr] == 0) sink(addr, false);
+        }
+        h.down[w] = now[w];
+    }
+
+    bool shift =
+        keyMapHeld(s, KEY_MOD_SHIFT_ON) || (keyMapHeld(s, KEY_MOD_SHIFT) && !keyMapHeld(s, KEY_MOD_SHIFT_OFF));
+    bool ctrl   = keyMapHeld(s, KEY_MOD_CTRL_ON) || (keyMapHeld(s, KEY_MOD_CTRL) && !keyMapHeld(s, KEY_MOD_CTRL_OFF));
+    uint8_t out = (uint8_t)((shift ? KEY_MOD_SHIFT : 0) | (ctrl ? KEY_MOD_CTRL : 0));
+    if ((out ^ s.out) & KEY_MOD_SHIFT) sink(m.shift_addr, shift);
+    if ((out ^ s.out) & KEY_MOD_CTRL) sink(m.ctrl_addr, ctrl);
+    s.out = out;
+}
+
+#endif // KEY_MAP_H
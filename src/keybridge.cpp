@@ -21,11 +21,33 @@ extern "C" bool btInUse() { return true; }
 #include "esp_log.h"
 #include "esp_wifi.h"
 #include "esp_task_wdt.h"
+#include "esp_timer.h"
+#include "esp_freertos_hooks.h"
+#include "esp_cpu.h"
+#include "esp_memory_utils.h"
+#include "esp_heap_caps.h"
 #include "soc/gpio_reg.h"
+#include "soc/gpio_periph.h"
+#include "soc/gpio_pins.h"
+#include "soc/gpio_sig_map.h"
+#include "soc/interrupts.h"
+#include "esp_intr_alloc.h"
+#include "esp_rom_gpio.h"
+#include "esp_private/periph_ctrl.h"
+#include "driver/gpio.h"
+#include "driver/ledc.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "freertos/queue.h"
+#include "esp_partition.h"
+
+// DMA snoop (ESP32 only — camera-mode I2S0 is gone from the S2/S3)
+#if CONFIG_IDF_TARGET_ESP32
+#include "soc/i2s_struct.h"
+#include "soc/i2s_reg.h"
+#include "soc/lldesc.h"
+#endif
 
 // WiFi + Web Server
 #include <WiFi.h>
@@ -54,6 +76,12 @@ extern "C" bool btInUse() { return true; }
 
 // Local headers
 #include "config.h"
+#include "scan_core.h"
+#include "scan_capture.h"
+#include "hid_desc.h"
+#include "key_blob.h"
+#include "text_inject.h"
+#include "wyse50_map.h"
 #include "web_ui.h"
 
 static const char *TAG = "KEYBRIDGE";
@@ -62,9 +90,24 @@ static const char *TAG = "KEYBRIDGE";
 // KEY EVENT QUEUE (struct declared early for Arduino prototype generation)
 // ============================================================
 
+// Key sources: each writes its own layer of the staged key image
+// (ScanKeyStage), so one never releases a key another is holding
+enum KeySource : uint8_t {
+    KEY_SRC_BT,    // Bluetooth keyboard
+    KEY_SRC_USB,   // USB keyboard
+    KEY_SRC_TEST,  // /api/scan/test
+    KEY_SRC_SWEEP, // /api/scan/sweep
+    KEY_SRC_TEXT,  // /api/text
+    KEY_SRC_COUNT,
+};
+static_assert(KEY_SRC_COUNT <= SCAN_KEY_SOURCES, "more key sources than ScanKeyStage layers");
+static const char *const KEY_SRC_NAMES[KEY_SRC_COUNT] = {"bt", "usb", "test", "sweep", "text"};
+
 typedef struct {
-    uint8_t modifiers;
-    uint8_t keys[6];
+    uint8_t source;               // KeySource
+    uint32_t down[HID_KEY_WORDS]; // Usages held, modifiers as E0-E7 (hid_desc.h)
+    bool rollover;                // Error report: keys unknown, take only the modifiers
+    bool gone;                    // Device disconnected: release everything it held
 } KeyReport;
 
 // ============================================================
@@ -110,31 +153,206 @@ void logKey(const char *fmt, ...) {
 // KEY EVENT QUEUE
 // ============================================================
 
-void submitKeyReport(uint8_t modifiers, const uint8_t *keys) {
+void submitKeyReport(uint8_t source, const uint32_t *down, bool rollover) {
     KeyReport report;
-    report.modifiers = modifiers;
-    memcpy(report.keys, keys, 6);
+    report.source = source;
+    memcpy(report.down, down, sizeof(report.down));
+    report.rollover = rollover;
+    report.gone     = false;
     if (xQueueSend(keyQueue, &report, 0) != pdTRUE) {
         ESP_LOGW(TAG, "Key queue full, event dropped");
     }
 }
 
+// Queued behind the device's last reports, so none of them can press a
+// key again after its layer is cleared
+void submitKeyGone(uint8_t source) {
+    KeyReport report = {};
+    report.source    = source;
+    report.gone      = true;
+    if (xQueueSend(keyQueue, &report, pdMS_TO_TICKS(50)) != pdTRUE) {
+        ESP_LOGW(TAG, "Key queue full, disconnect dropped");
+    }
+}
+
 // ============================================================
 // KEYBOARD SCAN EMULATION
 // ============================================================
 
-// 128-entry table: true = key at this address is currently "pressed"
-static volatile uint8_t key_state[128] = {0};
+// Packed 128-bit key table: bit set = key at this address is currently "pressed".
+// Only the scan engine writes it, committing key_stage at frame boundaries.
+static volatile uint32_t key_state[SCAN_KEY_WORDS] = {0};
+static ScanKeyStage key_stage; // Where scanKeyPress/Release and HID reports edit (see scan_core.h)
 
 // Cached GPIO pin numbers for fast access in scan loop
 static uint8_t scan_addr_pins[7];
 static uint8_t scan_return_pin;
+static ScanCore scan_core; // Decode tables + key_state binding (see scan_core.h)
+
+// Scan snoop mode — tracks which addresses the terminal is scanning. The
+// scan loop only pushes address changes into scan_snoop_ring; the snoop
+// task on the other core builds the statistics and publishes them into
+// two snapshot buffers. Handlers read the front one under scan_snoop_lock;
+// the task writes the back one and flips only if it can take the lock
+// without waiting, so neither side ever stalls the other.
+#define SNOOP_PUBLISH_MS 100 // Snapshot refresh while snooping
+
+static volatile bool scan_snoop_mode          = false;
+static ScanRing scan_snoop_ring;
+static ScanSnoopStats *scan_snoop_work        = NULL; // Snoop task only
+static ScanSnoopStats *scan_snoop_snap[2]     = {NULL, NULL};
+static volatile uint8_t scan_snoop_front      = 0;
+static SemaphoreHandle_t scan_snoop_lock      = NULL;
+static TaskHandle_t scan_snoop_task_handle    = NULL;
+static volatile uint32_t scan_snoop_epoch     = 0; // Bumped by each snoop start: reset and start over
+static volatile uint32_t scan_snoop_published = 0;
+
+// DMA snoop — I2S0 in camera mode samples A0-A6 and Key Return into two
+// ping-pong buffers with no per-sample CPU work (see scan_capture.h); the
+// snoop task decodes each finished buffer into the same stats the ring
+// feeds. The scan loop isn't involved at all, so it may still park.
+#define SNOOP_DMA_WORDS       1000 // Words per buffer: 2000 samples, 1ms at 2 MS/s
+#define SNOOP_DMA_DEFAULT_KHZ 2000
+#define SNOOP_DMA_MIN_KHZ     500  // Still two samples inside the shortest (~6us) dwell
+#define SNOOP_DMA_MAX_KHZ     4000 // Decode has to keep up on the other core
+
+static volatile bool scan_snoop_dma           = false; // Requested: snoop from the DMA engine
+static bool scan_snoop_from_dma               = false; // Source of the current stats (kept after stop)
+static volatile uint16_t scan_snoop_rate_khz  = SNOOP_DMA_DEFAULT_KHZ;
+static volatile uint32_t scan_cap_epoch       = 0;      // Snoop epoch the engine last (re)started for...
+static volatile esp_err_t scan_cap_status     = ESP_OK; // ...and how that went
+static volatile bool scan_cap_running         = false;
+static ScanCapture scan_capture;                        // Snoop task only
+#if CONFIG_IDF_TARGET_ESP32
+static lldesc_t scan_cap_desc[2];
+static uint32_t *scan_cap_buf[2]              = {NULL, NULL};
+static intr_handle_t scan_cap_intr            = NULL;
+#endif
+static volatile uint32_t scan_cap_done        = 0; // Buffers the DMA has finished (ISR)
+static uint32_t scan_cap_read                 = 0; // ...and the snoop task has decoded or written off
+static volatile uint32_t scan_cap_overruns    = 0;
+
+// Bus trace — run-length capture of every sample (see scan_core.h). The
+// buffer is heap-allocated on demand and parking is off while capturing.
+#define SCAN_TRACE_DEFAULT_KB 32
+#define SCAN_TRACE_MAX_KB     96
+static ScanTrace scan_trace;
+static uint8_t *scan_trace_buf     = NULL;
+static uint32_t scan_trace_bytes   = 0;
+static volatile bool scan_trace_on = false;
+
+// Idle parking — scan task blocks while no key is held (see scanPark)
+static TaskHandle_t scan_task_handle      = NULL;
+static volatile bool scan_parked          = false;
+static volatile uint32_t scan_park_count  = 0;
+static volatile uint64_t scan_parked_us   = 0;
+static volatile int64_t scan_task_start_us = 0;
+static volatile bool scan_text_on          = false; // Text is typing: its gap frames must be counted, so no parking
+
+// Frame-aware yielding — sleep in the terminal's inter-frame gap (see scanGapYield)
+#define SCAN_YIELD_MIN_US     100   // Shorter gaps aren't worth a context switch
+#define SCAN_YIELD_MAX_US     400   // Per-frame yield budget
+#define SCAN_WAKE_MARGIN_US   60    // esp_timer dispatch + context switch reserve
+#define SCAN_FORCE_YIELD_ITER 50000 // ~10ms without a gap yield → blind vTaskDelay(1)
+
+static ScanFrameTracker scan_frame;
+static const SCAN_DRAM ScanYieldPolicy scan_yield_policy = {SCAN_YIELD_MIN_US * SCAN_CPU_MHZ,
+                                                  SCAN_YIELD_MAX_US * SCAN_CPU_MHZ,
+                                                  SCAN_WAKE_MARGIN_US * SCAN_CPU_MHZ};
+static esp_timer_handle_t scan_wake_timer     = NULL;
+static volatile uint32_t scan_gap_yields      = 0;
+static volatile uint32_t scan_forced_yields   = 0;
+static volatile uint64_t scan_yield_us        = 0;
+
+// Core placement. The radios (BT controller, WiFi, Bluedroid), esp_timer,
+// lwIP and app_main all live on core 0. By default the scan task shares
+// it; in isolated mode (config.scan_isolated_core) it owns core 1 and
+// never yields, and every other task KeyBridge creates stays on core 0.
+// Isolated is about tasks, not interrupts: core 1 still takes its own
+// FreeRTOS tick (1 kHz), the cross-core yield and IPC interrupts (another
+// core notifying the scan task, flash writes parking it), and, in edge
+// mode, the address-line GPIO interrupt, which is allocated from the scan
+// task. Nothing here moves those; /api/scan/stats counts them per core.
+#define SYSTEM_CORE        0
+#define APP_CORE           1
+#define SCAN_CORE_SHARED   SYSTEM_CORE
+#define SCAN_CORE_ISOLATED APP_CORE
+#define SCAN_TASK_PRIORITY 20
+
+static ScanJitter scan_jitter;
+static ScanSettle scan_settle; // Address settle filter (config.scan_settle_ns)
+static ScanPredict scan_predict; // Learned scan order (config.scan_predict)
+static bool scan_predict_on = false;
+static bool scan_isolated = false; // Mode the running scan task was started in
+
+// Interrupts taken per core since the last stats reset: FreeRTOS ticks
+// from a tick hook on each core; the edge handler counts its own entries.
+static volatile uint32_t scan_irq_ticks[2] = {0, 0};
+
+static void IRAM_ATTR scanTickHook0() { scan_irq_ticks[0] = scan_irq_ticks[0] + 1; }
+static void IRAM_ATTR scanTickHook1() { scan_irq_ticks[1] = scan_irq_ticks[1] + 1; }
+
+// Edge-triggered response (config.scan_edge, POST /api/scan/mode) — a GPIO
+// interrupt on A0-A6 answers each address from scanEdgeService() and the
+// scan task only arms, disarms and refreshes it (see scanEdgeRun). The
+// handler is allocated from the scan task, so it runs on the scan core.
+#define SCAN_EDGE_IDLE_MS 100 // Scan task re-checks arming at least this often
+
+static volatile bool scan_edge_req         = false; // Requested: edge-triggered (else polling)
+static volatile bool scan_edge_on          = false; // Running edge-triggered
+static volatile bool scan_edge_armed       = false; // Interrupt enabled (off while nothing is held)
+static volatile esp_err_t scan_edge_status = ESP_OK; // How the last switch to edge went
+static ScanEdge scan_edge;
+static intr_handle_t scan_edge_intr        = NULL;
+static volatile int64_t scan_edge_since_us = 0; // Counters cover esp_timer time from here
+static portMUX_TYPE scan_edge_mux          = portMUX_INITIALIZER_UNLOCKED;
+
+// Flash-stall safety. The scan loop (SCAN_IRAM) and everything it reads
+// — scan_core tables, key_state, snoop and frame counters — are IRAM/
+// DRAM resident, checked once at task start (scan_resident). NVS writes
+// still freeze the scan core: the flash driver parks the other CPU in
+// an IPC spin for the whole erase/program, so no sample is taken however
+// the code is placed. scanFlashBegin() therefore holds each write until
+// no key is held; Key Return is then LOW, the GPIO latch keeps it LOW
+// through the freeze, and that is the correct answer for every address.
+#define SCAN_FLASH_WAIT_MS 2000 // Give up waiting for a release after this
+
+static volatile uint32_t scan_flash_seq      = 0; // Odd while an NVS write is in progress
+static uint32_t scan_flash_seen              = 0; // scan_flash_seq at the loop's last address change
+static volatile bool scan_flash_keys_held    = false;
+static volatile uint32_t scan_flash_ops      = 0;
+static volatile uint32_t scan_flash_forced   = 0; // Writes that ran with a key still held
+static volatile uint32_t scan_flash_wait_ms  = 0;
+static volatile uint32_t scan_flash_stalls   = 0; // Dwell-length sample gaps overlapping a write
+static volatile uint32_t scan_flash_unsafe   = 0; // ...of which a key was held (wrong answers possible)
+static volatile uint32_t scan_flash_max_gap  = 0; // Cycles
+static bool scan_resident                    = false;
+
+// Stall profiler — every sample gap goes into scan_jitter.hist; gaps above
+// scan_stall_top.gate are blamed and kept if among the worst. Blame uses
+// the FreeRTOS run-time counters (sdkconfig.defaults, CPU clock): a task
+// is charged only at context switches, and interrupts are charged to the
+// task they interrupt. So across a stall, a candidate whose counter grew
+// by at least half the gap preempted the loop; if no switch happened at
+// all the time went to interrupts. Candidates are the tasks that can
+// preempt the scan task on its core (priority >= its own). They're
+// listed from app_main's heartbeat and the stall endpoints, not the loop
+// (the radios start their tasks after the scan task does), and the
+// list is double-buffered like the snoop snapshots.
+#define SCAN_STALL_TASKS 12
+
+struct ScanStallTasks {
+    uint8_t n;
+    TaskHandle_t h[SCAN_STALL_TASKS];
+};
 
-// Scan snoop mode — tracks which addresses the terminal is scanning
-static volatile bool scan_snoop_mode              = false;
-static volatile uint32_t scan_addr_histogram[128] = {0};
-static volatile uint32_t scan_last_addr           = 0xFF;
-static volatile uint32_t scan_total_count          = 0;
+static ScanStallTop scan_stall_top;
+static ScanStallTasks scan_stall_tasks[2];
+static volatile uint8_t scan_stall_tasks_cur = 0;
+static volatile bool scan_stall_rebase       = true; // Baseline stale: slept, or candidates changed
+static uint8_t scan_stall_base_set           = 0;    // Candidate list the baseline was taken from
+static uint32_t scan_stall_base[SCAN_STALL_TASKS];   // Run-time counters at the baseline
+static uint32_t scan_stall_base_self         = 0;
 
 void setupScanPins() {
     // Address inputs (from terminal via TXS0108E)
@@ -150,6 +368,15 @@ void setupScanPins() {
         pinMode(config.pin_key_return, OUTPUT);
         digitalWrite(config.pin_key_return, LOW); // MOSFET off = key not pressed
     }
+    scanCoreInit(scan_core, scan_addr_pins, scan_return_pin, key_state);
+    scanKeyStageInit(key_stage, config.scan_latch_frames, config.scan_rollover);
+    scanKeyModifier(key_stage, WYSE_SHIFT);
+    scanKeyModifier(key_stage, WYSE_CTRL);
+    scanSettleInit(scan_settle, scanSettleCycles(config.scan_settle_ns));
+    scanPredictInit(scan_predict);
+    // Prediction acts on raw line changes, which is exactly what the settle
+    // filter exists to distrust — with the filter on, stay reactive
+    scan_predict_on = config.scan_predict && !scan_settle.window;
 
     if (config.pin_pair_btn >= 0) pinMode(config.pin_pair_btn, INPUT_PULLUP);
     if (config.pin_mode_jp >= 0) pinMode(config.pin_mode_jp, INPUT_PULLUP);
@@ -163,283 +390,812 @@ void setupScanPins() {
     }
 }
 
-// Press a key at the given Wyse 50 scan address
-void scanKeyPress(uint8_t addr) {
+// Press a key at the given Wyse 50 scan address, in a source's layer
+void scanKeyPress(uint8_t src, uint8_t addr) {
     if (addr < 128) {
-        key_state[addr] = 1;
+        scanKeyEditBegin(key_stage);
+        scanKeyStagePress(key_stage, src, addr);
+        scanKeyEditEnd(key_stage);
+        if (scan_task_handle) xTaskNotifyGive(scan_task_handle); // Unpark scan loop
         logKey("PRESS: addr=0x%02X", addr);
     }
 }
 
-// Release a key at the given Wyse 50 scan address
-void scanKeyRelease(uint8_t addr) {
+// Release a key at the given Wyse 50 scan address, in a source's layer.
+// Another source holding the same address keeps it pressed.
+void scanKeyRelease(uint8_t src, uint8_t addr) {
     if (addr < 128) {
-        key_state[addr] = 0;
+        scanKeyEditBegin(key_stage);
+        scanKeyStageRelease(key_stage, src, addr);
+        scanKeyEditEnd(key_stage);
     }
 }
 
-// Release all keys
+// Release every key one source holds
+void scanReleaseSource(uint8_t src) {
+    scanKeyEditBegin(key_stage);
+    scanKeyStageClear(key_stage, src);
+    scanKeyEditEnd(key_stage);
+}
+
+// Release all keys, every source
 void scanReleaseAll() {
-    memset((void *)key_state, 0, sizeof(key_state));
+    scanKeyEditBegin(key_stage);
+    for (int src = 0; src < KEY_SRC_COUNT; src++) scanKeyStageClear(key_stage, src);
+    scanKeyEditEnd(key_stage);
 }
 
 // ============================================================
 // SCAN RESPONSE TASK (core 0, highest priority)
 // ============================================================
 
-static void scan_response_task(void *arg) {
-    // Remove this task from watchdog (tight loop would trigger it)
-    esp_task_wdt_delete(NULL);
+// Block the scan task until scanKeyPress() notifies it. Only called with
+// key_state all zero and nothing staged, so the terminal must see every
+// address as released
+// — Key Return is driven LOW first. A press that lands between the idle
+// check and the take leaves a pending notification, so it is never lost.
+static SCAN_IRAM void scanPark(uint32_t return_mask) {
+    REG_WRITE(GPIO_OUT_W1TC_REG, return_mask);
+    int64_t t0  = esp_timer_get_time();
+    scan_parked = true;
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    scan_parked = false;
+    scan_parked_us += esp_timer_get_time() - t0;
+    scan_park_count++;
+}
 
-    // Pre-compute GPIO register masks for fast address reading
-    uint32_t addr_masks[7];
-    for (int i = 0; i < 7; i++) {
-        addr_masks[i] = (1UL << scan_addr_pins[i]);
+static void scanWakeCallback(void *arg) {
+    xTaskNotifyGive(scan_task_handle);
+}
+
+// Sleep for `cycles` inside the inter-frame gap. vTaskDelay() can't go
+// below one tick (1ms — longer than a whole scan frame), so a one-shot
+// esp_timer wakes the task instead. Key Return keeps the end address's
+// value, which is what the terminal sees for the rest of the gap.
+static SCAN_IRAM void scanGapYield(uint32_t cycles) {
+    uint32_t us = cycles / SCAN_CPU_MHZ;
+    int64_t t0  = esp_timer_get_time();
+    esp_timer_start_once(scan_wake_timer, us);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    esp_timer_stop(scan_wake_timer); // Woken early by a key press
+    scan_yield_us += esp_timer_get_time() - t0;
+    scan_gap_yields++;
+}
+
+static SCAN_IRAM uint32_t scanRunTime(TaskHandle_t h) {
+    TaskStatus_t st;
+    vTaskGetInfo(h, &st, pdFALSE, eReady); // Known state: skips the state lookup
+    return st.ulRunTimeCounter;
+}
+
+// Snapshot the candidates' run-time counters. Called right after an
+// address change, with this dwell's answer already on Key Return; the
+// ~1-2us it takes is kept out of the gap statistics.
+static SCAN_IRAM void scanStallRebase() {
+    uint8_t set             = scan_stall_tasks_cur;
+    const ScanStallTasks &c = scan_stall_tasks[set];
+    for (int i = 0; i < c.n; i++) scan_stall_base[i] = scanRunTime(c.h[i]);
+    scan_stall_base_self = scanRunTime(scan_task_handle);
+    scan_stall_base_set  = set;
+    scan_stall_rebase    = false;
+    scanJitterResume(scan_jitter, esp_cpu_get_ccount());
+}
+
+// Who took the last `gap` cycles: fills `who` for a task
+static SCAN_IRAM uint8_t scanStallBlame(uint32_t gap, char *who) {
+    if (scan_stall_rebase) return SCAN_STALL_UNKNOWN; // Woke since the baseline
+    const ScanStallTasks &c = scan_stall_tasks[scan_stall_base_set];
+    int best                = -1;
+    uint32_t best_run       = 0;
+    for (int i = 0; i < c.n; i++) {
+        uint32_t run = scanRunTime(c.h[i]) - scan_stall_base[i];
+        if (run > best_run) {
+            best     = i;
+            best_run = run;
+        }
+    }
+    if (best >= 0 && best_run >= gap / 2) {
+        const char *name = pcTaskGetName(c.h[best]);
+        int i            = 0;
+        for (; name[i] && i < SCAN_STALL_NAME - 1; i++) who[i] = name[i];
+        who[i] = '\0';
+        return SCAN_STALL_TASK;
     }
-    uint32_t return_mask = (1UL << scan_return_pin);
+    // No switch since the baseline: the scan task kept the time
+    return scanRunTime(scan_task_handle) == scan_stall_base_self ? SCAN_STALL_ISR : SCAN_STALL_UNKNOWN;
+}
 
-    ESP_LOGI(TAG, "[SCAN] Response task running on core %d", xPortGetCoreID());
+// Sample gap above the stall gate. A dwell-length gap during which the
+// NVS write sequence moved (or is still odd) overlapped a flash write;
+// anything that makes the worst-N table is blamed and stored.
+static SCAN_IRAM void scanNoteStall(uint32_t gap, uint8_t addr) {
+    uint8_t cause = SCAN_STALL_UNKNOWN;
+    uint32_t seq  = scan_flash_seq;
+    if (gap > SCAN_DWELL_CYCLES && (seq != scan_flash_seen || (seq & 1))) {
+        scan_flash_seen = seq;
+        scan_flash_stalls++;
+        if (scan_flash_keys_held) scan_flash_unsafe++;
+        if (gap > scan_flash_max_gap) scan_flash_max_gap = gap;
+        cause = SCAN_STALL_FLASH;
+    }
+    if (!scanStallQualifies(scan_stall_top, gap)) return;
+    ScanStall st;
+    st.gap    = gap;
+    st.at_ms  = (uint32_t)(esp_timer_get_time() / 1000);
+    st.addr   = addr;
+    st.who[0] = '\0';
+    st.cause  = cause == SCAN_STALL_FLASH ? cause : scanStallBlame(gap, st.who);
+    scanStallInsert(scan_stall_top, st);
+    scan_stall_rebase = true; // Next address change starts a fresh baseline
+    scanJitterResume(scan_jitter, esp_cpu_get_ccount()); // Don't count the blaming as a stall
+}
 
-    uint32_t yield_counter = 0;
-    while (true) {
-        // Read all GPIOs in one register read
+// Frame-boundary key commit (scanKeyCommit), shared by every loop
+// instance and the edge handler rather than inlined into each
+static SCAN_IRAM bool scanKeyFrame() {
+    return scanKeyCommit(key_stage, scan_core.key_bits);
+}
+
+// Scan loop body, instantiated once per address decoder by scanDispatch()
+// so the pin layout is compiled into the hot path.
+struct ScanResponseLoop {
+    bool isolated; // Own core: no gap yields, no parking, no forced yields
+
+    template <typename Decoder> void run() {
+        // Everything loop<Decoder> touches must survive a disabled cache
+        scan_resident = esp_ptr_in_iram((const void *)&loop<Decoder>) &&
+                        esp_ptr_in_iram((const void *)&scanPark) && esp_ptr_in_iram((const void *)&scanGapYield) &&
+                        esp_ptr_in_iram((const void *)&scanNoteStall) &&
+                        esp_ptr_in_iram((const void *)&scanStallRebase) && esp_ptr_in_dram(&scan_stall_top) &&
+                        esp_ptr_in_iram((const void *)&scanKeyFrame) &&
+                        esp_ptr_in_dram(scan_stall_tasks) && esp_ptr_in_dram(&scan_core) &&
+                        esp_ptr_in_dram((const void *)key_state) && esp_ptr_in_dram(&key_stage) &&
+                        esp_ptr_in_dram(&scan_yield_policy) &&
+                        esp_ptr_in_dram(&scan_snoop_ring) && esp_ptr_in_dram(&scan_settle) &&
+                        esp_ptr_in_dram(&scan_predict) &&
+                        esp_ptr_in_iram((const void *)&scanTraceEmit) && esp_ptr_in_dram(&scan_trace);
+        if (!scan_resident) ESP_LOGW(TAG, "[SCAN] Scan path not fully IRAM/DRAM resident");
+        loop<Decoder>(isolated);
+    }
+
+    // Back from a voluntary sleep: restart the jitter clock and resync the
+    // settle filter and predictor to whatever is on the bus now. Returns
+    // that address.
+    template <typename Decoder> static SCAN_INLINE uint8_t scanResume(uint32_t &bus_bits) {
         uint32_t gpio_in = REG_READ(GPIO_IN_REG);
+        uint32_t now     = esp_cpu_get_ccount();
+        uint8_t addr     = Decoder::decode(scan_core, gpio_in);
+        bus_bits         = gpio_in & scan_core.addr_bits;
+        scanSettleResync(scan_settle, addr, now);
+        scanPredictResync(scan_predict, scan_core, addr);
+        scanJitterResume(scan_jitter, now);
+        scan_stall_rebase = true;
+        if (scan_trace_on) scanTraceBlind(scan_trace, now);
+        return addr;
+    }
+
+    template <typename Decoder> static SCAN_IRAM void loop(bool isolated) {
+        uint32_t return_mask = scan_core.return_mask;
+        uint32_t addr_bits   = scan_core.addr_bits;
+        const bool predict   = scan_predict_on;
+
+        // Indexed by the looked-up key bit: 0 = W1TC (release), 1 = W1TS (press)
+        volatile uint32_t *const out_regs[2] = {(volatile uint32_t *)GPIO_OUT_W1TC_REG,
+                                                (volatile uint32_t *)GPIO_OUT_W1TS_REG};
+
+        uint32_t yield_counter = 0;
+        uint32_t yield_frames  = scan_frame.frames; // Frame count at the last forced yield
+        uint8_t frame_addr     = 0xFF; // Mirrors scan_frame.last_addr for the change test
+        uint32_t bus_bits      = 0;    // Address lines as last seen, for the predictive commit
+        while (true) {
+            // Read all GPIOs in one register read
+            uint32_t gpio_in = REG_READ(GPIO_IN_REG);
+
+            // Address lines moved: answer for the predicted address now,
+            // ahead of the decode (see scanPredictAdvance)
+            if (predict && (gpio_in & addr_bits) != bus_bits) {
+                *out_regs[scan_predict.level] = return_mask;
+                bus_bits                      = gpio_in & addr_bits;
+            }
+
+            // Decode + look up in the core
+            uint32_t now     = esp_cpu_get_ccount();
+            uint8_t addr     = Decoder::decode(scan_core, gpio_in);
+            if (scan_settle.window) addr = scanSettleStep(scan_settle, addr, now);
+            uint32_t pressed = scanKeyTest(scan_core.key_bits, addr);
+
+            // Drive Key Return based on key state table (branchless):
+            // HIGH = MOSFET on = key pressed, LOW = MOSFET off = not pressed
+            *out_regs[pressed] = return_mask;
+            if (scan_trace_on) scanTraceSample(scan_trace, addr, pressed, now);
+            uint32_t gap = scanJitterSample(scan_jitter, now);
+            if (gap > scan_stall_top.gate) scanNoteStall(gap, addr);
+
+            // Frame tracking runs only on address changes (~every 6us).
+            // Right after the final address of a sweep appears, sleep
+            // through the terminal's inter-frame gap; at a frame boundary
+            // with no key held and no text typing, park until the next press.
+            // In isolated mode the tracker only gathers statistics.
+            if (addr != frame_addr) {
+                if (scan_edge_req) return; // Hand over to the edge handler
+                frame_addr      = addr;
+                scan_flash_seen = scan_flash_seq;
+                if (scan_stall_rebase) scanStallRebase();
+                bool wrap = scanFrameChange(scan_frame, addr, now);
+                if (wrap && scanKeyFrame()) {
+                    pressed            = scanKeyTest(scan_core.key_bits, addr); // New frame, new report
+                    *out_regs[pressed] = return_mask;
+                }
+                if (pressed) scanKeySeen(key_stage, addr);
+                if (scan_snoop_mode) {
+                    scanRingPush(scan_snoop_ring, addr, now, (uint8_t)(wrap | (pressed << 1))); // SCAN_REC_WRAP | SCAN_REC_KEY
+                }
+                if (predict) scanPredictAdvance(scan_predict, scan_core, addr, pressed);
+                if (isolated) continue;
+                if (wrap && !scan_snoop_mode && !scan_trace_on && !scan_text_on && scanKeysIdle(scan_core.key_bits) &&
+                    !scanKeyPending(key_stage)) {
+                    scanPark(return_mask);
+                    scanFrameSlept(scan_frame);
+                    scanRingBreak(scan_snoop_ring);
+                    scanResume<Decoder>(bus_bits);
+                    yield_counter = 0;
+                    continue;
+                }
+                uint32_t window = scanYieldWindow(scan_frame, addr, scan_yield_policy);
+                if (window) {
+                    scanGapYield(window);
+                    yield_counter = 0;
+                    scanFrameWoke(scan_frame, scanResume<Decoder>(bus_bits));
+                    if (scan_frame.dirty) scanRingBreak(scan_snoop_ring); // Woke into the next frame
+                    continue;
+                }
+            }
 
-        // Decode 7-bit address from physical GPIO states
-        uint8_t addr = 0;
-        for (int i = 0; i < 7; i++) {
-            if (gpio_in & addr_masks[i]) {
-                addr |= (1 << i);
+            // Fallback when the terminal isn't scanning or never leaves a
+            // usable gap: blind 1-tick yield (or park if nothing is held)
+            // so lower-priority core 0 tasks still run. The frame tracker
+            // counts any frames this costs.
+            if (!isolated && ++yield_counter >= SCAN_FORCE_YIELD_ITER) {
+                yield_counter = 0;
+                // A whole forced-yield interval without a frame start: the
+                // bus is off or in its gap, so there's no boundary to wait for
+                if (scan_frame.frames == yield_frames) scanKeyCommitIdle(key_stage, scan_core.key_bits);
+                yield_frames = scan_frame.frames;
+                if (!scan_snoop_mode && !scan_trace_on && !scan_text_on && scanKeysIdle(scan_core.key_bits) &&
+                    !scanKeyPending(key_stage)) {
+                    scanPark(return_mask);
+                } else {
+                    vTaskDelay(1);
+                    scan_forced_yields++;
+                }
+                scanFrameSlept(scan_frame);
+                scanRingBreak(scan_snoop_ring);
+                if (scan_edge_req) return;
+                scanResume<Decoder>(bus_bits);
             }
         }
+    }
+};
+
+// ============================================================
+// EDGE-TRIGGERED RESPONSE (GPIO interrupt on the scan core)
+// ============================================================
 
-        // Snoop mode: track address histogram
-        if (scan_snoop_mode) {
-            scan_addr_histogram[addr]++;
-            scan_last_addr = addr;
-            scan_total_count++;
+// scanEdgeService() I/O against the real pins
+struct ScanEdgeGpio {
+    static SCAN_INLINE uint32_t read() { return REG_READ(GPIO_IN_REG); }
+    static SCAN_INLINE void write(uint32_t level) {
+        REG_WRITE(level ? GPIO_OUT_W1TS_REG : GPIO_OUT_W1TC_REG, scan_core.return_mask);
+    }
+    static SCAN_INLINE uint32_t now() { return esp_cpu_get_ccount(); }
+    static SCAN_INLINE void change(uint8_t addr, uint32_t level, uint32_t now) {
+        bool wrap = scanFrameChange(scan_frame, addr, now);
+        if (wrap && scanKeyFrame()) {
+            level = scanKeyTest(scan_core.key_bits, addr); // New frame, new report
+            write(level);
         }
+        if (level) scanKeySeen(key_stage, addr);
+        if (scan_snoop_mode) scanRingPush(scan_snoop_ring, addr, now, (uint8_t)(wrap | (level << 1)));
+    }
+};
+
+// Status is cleared before the bus is read, so an edge that lands while
+// the handler runs re-pends it rather than getting lost
+template <typename Decoder> static void IRAM_ATTR scanEdgeIsr(void *arg) {
+    uint32_t entry = esp_cpu_get_ccount();
+    REG_WRITE(GPIO_STATUS_W1TC_REG, scan_core.addr_bits);
+    ScanEdgeGpio io;
+    scanEdgeService<Decoder>(scan_edge, scan_core, scan_predict, io, entry);
+}
+
+// Handler instance for the configured pin layout, via scanDispatch()
+struct ScanEdgePick {
+    intr_handler_t isr;
+    template <typename Decoder> void run() { isr = scanEdgeIsr<Decoder>; }
+};
 
-        // Drive Key Return based on key state table
-        if (key_state[addr]) {
-            REG_WRITE(GPIO_OUT_W1TS_REG, return_mask); // HIGH = MOSFET on = key pressed
+// Interrupt on or off for every address pin. Disarming leaves Key Return
+// LOW (the right answer with nothing held) and the next arming starts
+// the frame tracker, snoop ring and learned order from a clean break.
+static void scanEdgeArm(bool on) {
+    for (int i = 0; i < 7; i++) {
+        if (config.pin_addr[i] < 0) continue;
+        if (on) {
+            gpio_intr_enable((gpio_num_t)config.pin_addr[i]);
         } else {
-            REG_WRITE(GPIO_OUT_W1TC_REG, return_mask); // LOW = MOSFET off = not pressed
+            gpio_intr_disable((gpio_num_t)config.pin_addr[i]);
+        }
+    }
+    if (!on) {
+        REG_WRITE(GPIO_OUT_W1TC_REG, scan_core.return_mask);
+        scanFrameSlept(scan_frame);
+        scanRingBreak(scan_snoop_ring);
+        scanEdgeResync(scan_edge, scan_predict);
+    }
+    scan_edge_armed = on;
+}
+
+// Answer for whatever is on the bus now. A press lands while the bus may
+// be holding still (the end address through the frame gap), where no
+// edge would bring the new answer out; interrupts are masked so the
+// handler can't write a newer one in between.
+static void scanEdgeRefresh() {
+    portENTER_CRITICAL(&scan_edge_mux);
+    uint8_t addr;
+    uint32_t pressed = scanStepWith<ScanDecodeLut>(scan_core, REG_READ(GPIO_IN_REG), addr);
+    REG_WRITE(pressed ? GPIO_OUT_W1TS_REG : GPIO_OUT_W1TC_REG, scan_core.return_mask);
+    portEXIT_CRITICAL(&scan_edge_mux);
+}
+
+static esp_err_t scanEdgeStart() {
+    for (int i = 0; i < 7; i++) {
+        if (config.pin_addr[i] >= 32) return ESP_ERR_NOT_SUPPORTED; // GPIO_STATUS covers 0-31 only
+    }
+    ScanEdgePick pick = {NULL};
+    scanDispatch(scan_core, pick);
+    if (!esp_ptr_in_iram((const void *)pick.isr)) return ESP_ERR_INVALID_STATE;
+    for (int i = 0; i < 7; i++) {
+        if (config.pin_addr[i] < 0) continue;
+        gpio_intr_disable((gpio_num_t)config.pin_addr[i]);
+        gpio_set_intr_type((gpio_num_t)config.pin_addr[i], GPIO_INTR_ANYEDGE);
+    }
+    esp_err_t err = gpio_isr_register(pick.isr, NULL, ESP_INTR_FLAG_IRAM | ESP_INTR_FLAG_LEVEL3, &scan_edge_intr);
+    if (err != ESP_OK) return err;
+    scanEdgeReset(scan_edge);
+    scanEdgeResync(scan_edge, scan_predict);
+    scan_edge_since_us = esp_timer_get_time();
+    scan_edge_armed    = false;
+    return ESP_OK;
+}
+
+static void scanEdgeStop() {
+    scanEdgeArm(false);
+    for (int i = 0; i < 7; i++) {
+        if (config.pin_addr[i] >= 0) gpio_set_intr_type((gpio_num_t)config.pin_addr[i], GPIO_INTR_DISABLE);
+    }
+    esp_intr_free(scan_edge_intr);
+    scan_edge_intr = NULL;
+}
+
+// Scan task body while edge-triggered. The handler needs the interrupt
+// only while a key is held or staged, text is typing (its keys are paced
+// by the frame count), or snoop wants the address stream; otherwise it
+// stays off and the core sees no scan-bus interrupts at all. Wakes on
+// every press (scanKeyPress), text and snoop start, and mode switch.
+// Key commits happen in the handler at frame starts, or here after a
+// quiet interval with no frame at all.
+static void scanEdgeRun() {
+    scan_edge_status = scanEdgeStart();
+    if (scan_edge_status != ESP_OK) {
+        ESP_LOGW(TAG, "[SCAN] Edge-triggered response unavailable: %s", esp_err_to_name(scan_edge_status));
+        scan_edge_req = false;
+        return;
+    }
+    scan_edge_on = true;
+    ESP_LOGI(TAG, "[SCAN] Edge-triggered response on core %d", xPortGetCoreID());
+    if (scan_isolated) {
+        ESP_LOGW(TAG, "[SCAN] Edge mode on the isolated core: every address change is now an interrupt on "
+                      "core %d, and the core yields between them", xPortGetCoreID());
+    }
+    uint32_t frames = scan_frame.frames;
+    while (scan_edge_req) {
+        bool want =
+            !scanKeysIdle(scan_core.key_bits) || scanKeyPending(key_stage) || scan_snoop_mode || scan_text_on;
+        if (want != scan_edge_armed) scanEdgeArm(want);
+        if (scan_edge_armed) scanEdgeRefresh();
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SCAN_EDGE_IDLE_MS)) == 0) {
+            if (scan_frame.frames == frames) {
+                portENTER_CRITICAL(&scan_edge_mux);
+                scanKeyCommitIdle(key_stage, scan_core.key_bits);
+                portEXIT_CRITICAL(&scan_edge_mux);
+            }
+            frames = scan_frame.frames;
         }
+    }
+    scanEdgeStop();
+    scan_edge_on = false;
+    ESP_LOGI(TAG, "[SCAN] Polling response on core %d", xPortGetCoreID());
+}
+
+static void scan_response_task(void *arg) {
+    // Remove this task from watchdog (tight loop would trigger it)
+    esp_task_wdt_delete(NULL);
+
+    ESP_LOGI(TAG, "[SCAN] Response task running on core %d (%s decode, %s)", xPortGetCoreID(),
+             scanLayoutName(scan_core.layout.kind), scan_isolated ? "isolated" : "shared");
+    scan_task_start_us = esp_timer_get_time();
+    scanFrameReset(scan_frame);
+    memset(&scan_jitter, 0, sizeof(scan_jitter));
+    scanStallReset(scan_stall_top);
+    scan_jitter.last_ts = esp_cpu_get_ccount();
+
+    // Isolated: IDLE1 never runs again, so stop the task watchdog watching it
+    if (scan_isolated) esp_task_wdt_delete(xTaskGetIdleTaskHandleForCPU(SCAN_CORE_ISOLATED));
 
-        // Yield briefly every ~10k iterations (~2ms at 240MHz) to let
-        // WiFi/BT tasks on core 0 run. At 1kHz tick rate, vTaskDelay(1)
-        // blocks for 1ms — the terminal rescans all addresses every ~1ms
-        // so missing one cycle is imperceptible.
-        if (++yield_counter >= 10000) {
-            yield_counter = 0;
-            vTaskDelay(1);
+    const esp_timer_create_args_t wake_args = {.callback = scanWakeCallback, .arg = NULL, .name = "scan_wake"};
+    esp_timer_create(&wake_args, &scan_wake_timer);
+
+    // Each response mode runs until the other is requested
+    ScanResponseLoop loop = {scan_isolated};
+    while (true) {
+        if (scan_edge_req) {
+            scanEdgeRun();
+            scan_stall_rebase = true;
+            scanJitterResume(scan_jitter, esp_cpu_get_ccount()); // The interrupt-driven span isn't a stall
         }
+        scanDispatch(scan_core, loop);
     }
 }
 
 // ============================================================
-// HID-TO-WYSE50 KEY ADDRESS MAPPING
+// DMA SNOOP ENGINE (I2S0 camera mode, owned by the snoop task)
 // ============================================================
-// Source: MAME wy50kb.cpp (verified against WY-50 maintenance manual schematic)
-// Address = (column * 8) + row; bits 6-3 = column (0-12), bits 2-0 = row (0-7)
-// 0xFF = no mapping (key not present on Wyse 50)
+// Camera mode latches I2S0I_DATA_IN0..7 on each rising edge of the WS
+// input. The ESP32 can't feed that from an internal clock, so LEDC
+// drives a square wave at the sample rate out of pin_capture_clk and the
+// GPIO matrix loops the same pad back into WS — nothing is wired to it.
+// VSYNC/HSYNC/HREF are tied high, so every edge stores a sample. Started
+// and stopped from the snoop task so the interrupt lands on its core.
+// Other targets have no camera-mode I2S and get stubs that refuse to
+// start, so only loop snoop is offered there.
+#if CONFIG_IDF_TARGET_ESP32
+
+// Each buffer's EOF: count it and wake the decoder. Buffers complete in
+// chain order, so scan_cap_done alone says which one is ready.
+static void IRAM_ATTR scanCapIsr(void *arg) {
+    uint32_t st      = I2S0.int_st.val;
+    I2S0.int_clr.val = st;
+    if (!(st & I2S_IN_SUC_EOF_INT_ST)) return;
+    scan_cap_done    = scan_cap_done + 1;
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(scan_snoop_task_handle, &woken);
+    if (woken) portYIELD_FROM_ISR();
+}
 
-#define WYSE_SHIFT 0x4A // Col 9, Row 2
-#define WYSE_CTRL  0x1F // Col 3, Row 7
+static void scanCapStop() {
+    if (!scan_cap_running) return;
+    I2S0.conf.rx_start      = 0;
+    I2S0.in_link.stop       = 1;
+    I2S0.int_ena.in_suc_eof = 0;
+    I2S0.int_clr.val        = UINT32_MAX;
+    if (scan_cap_intr) esp_intr_free(scan_cap_intr);
+    scan_cap_intr = NULL;
+    ledc_stop(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_7, 0);
+    gpio_reset_pin((gpio_num_t)config.pin_capture_clk);
+    periph_module_disable(PERIPH_I2S0_MODULE);
+    for (int i = 0; i < 2; i++) {
+        heap_caps_free(scan_cap_buf[i]);
+        scan_cap_buf[i] = NULL;
+    }
+    scan_cap_running = false;
+}
 
-// 0xFF = no mapping (key not present on Wyse 50)
-static uint8_t hid_to_wyse50[256];
+static esp_err_t scanCapStart(uint16_t rate_khz) {
+    int clk = config.pin_capture_clk;
+    if (clk < 0 || clk >= 34) return ESP_ERR_INVALID_ARG;
+    for (int i = 0; i < 7; i++) {
+        if (config.pin_addr[i] < 0) return ESP_ERR_INVALID_STATE;
+    }
+    for (int i = 0; i < 2; i++) {
+        scan_cap_buf[i] = (uint32_t *)heap_caps_malloc(SNOOP_DMA_WORDS * 4, MALLOC_CAP_DMA);
+        if (!scan_cap_buf[i]) {
+            heap_caps_free(scan_cap_buf[0]);
+            scan_cap_buf[0] = NULL;
+            return ESP_ERR_NO_MEM;
+        }
+    }
 
-void initKeyMap() {
-    memset(hid_to_wyse50, 0xFF, sizeof(hid_to_wyse50));
-
-    // Letters (HID 0x04-0x1D = a-z)
-    hid_to_wyse50[0x04] = 0x3F; // a → Col 7, Row 7
-    hid_to_wyse50[0x05] = 0x2E; // b → Col 5, Row 6
-    hid_to_wyse50[0x06] = 0x4E; // c → Col 9, Row 6
-    hid_to_wyse50[0x07] = 0x37; // d → Col 6, Row 7
-    hid_to_wyse50[0x08] = 0x30; // e → Col 6, Row 0
-    hid_to_wyse50[0x09] = 0x17; // f → Col 2, Row 7
-    hid_to_wyse50[0x0A] = 0x0F; // g → Col 1, Row 7
-    hid_to_wyse50[0x0B] = 0x07; // h → Col 0, Row 7
-    hid_to_wyse50[0x0C] = 0x58; // i → Col 11, Row 0
-    hid_to_wyse50[0x0D] = 0x5F; // j → Col 11, Row 7
-    hid_to_wyse50[0x0E] = 0x67; // k → Col 12, Row 7
-    hid_to_wyse50[0x0F] = 0x2F; // l → Col 5, Row 7
-    hid_to_wyse50[0x10] = 0x0E; // m → Col 1, Row 6
-    hid_to_wyse50[0x11] = 0x16; // n → Col 2, Row 6
-    hid_to_wyse50[0x12] = 0x60; // o → Col 12, Row 0
-    hid_to_wyse50[0x13] = 0x51; // p → Col 10, Row 1
-    hid_to_wyse50[0x14] = 0x38; // q → Col 7, Row 0
-    hid_to_wyse50[0x15] = 0x28; // r → Col 5, Row 0
-    hid_to_wyse50[0x16] = 0x4F; // s → Col 9, Row 7
-    hid_to_wyse50[0x17] = 0x10; // t → Col 2, Row 0
-    hid_to_wyse50[0x18] = 0x00; // u → Col 0, Row 0
-    hid_to_wyse50[0x19] = 0x36; // v → Col 6, Row 6
-    hid_to_wyse50[0x1A] = 0x48; // w → Col 9, Row 0
-    hid_to_wyse50[0x1B] = 0x3E; // x → Col 7, Row 6
-    hid_to_wyse50[0x1C] = 0x08; // y → Col 1, Row 0
-    hid_to_wyse50[0x1D] = 0x1E; // z → Col 3, Row 6
-
-    // Number row (HID 0x1E-0x27 = 1-0)
-    hid_to_wyse50[0x1E] = 0x1B; // 1/! → Col 3, Row 3
-    hid_to_wyse50[0x1F] = 0x3B; // 2/@ → Col 7, Row 3
-    hid_to_wyse50[0x20] = 0x4B; // 3/# → Col 9, Row 3
-    hid_to_wyse50[0x21] = 0x33; // 4/$ → Col 6, Row 3
-    hid_to_wyse50[0x22] = 0x2B; // 5/% → Col 5, Row 3
-    hid_to_wyse50[0x23] = 0x13; // 6/^ → Col 2, Row 3
-    hid_to_wyse50[0x24] = 0x0B; // 7/& → Col 1, Row 3
-    hid_to_wyse50[0x25] = 0x03; // 8/* → Col 0, Row 3
-    hid_to_wyse50[0x26] = 0x5B; // 9/( → Col 11, Row 3
-    hid_to_wyse50[0x27] = 0x63; // 0/) → Col 12, Row 3
-
-    // Common keys
-    hid_to_wyse50[0x28] = 0x65; // Return    → Col 12, Row 5
-    hid_to_wyse50[0x29] = 0x3C; // Escape    → Col 7, Row 4
-    hid_to_wyse50[0x2A] = 0x1A; // Backspace → Col 3, Row 2
-    hid_to_wyse50[0x2B] = 0x18; // Tab       → Col 3, Row 0
-    hid_to_wyse50[0x2C] = 0x19; // Space     → Col 3, Row 1
-
-    // Punctuation
-    hid_to_wyse50[0x2D] = 0x43; // -/_ → Col 8, Row 3
-    hid_to_wyse50[0x2E] = 0x53; // =/+ → Col 10, Row 3
-    hid_to_wyse50[0x2F] = 0x42; // [/{ → Col 8, Row 2
-    hid_to_wyse50[0x30] = 0x45; // ]/} → Col 8, Row 5
-    hid_to_wyse50[0x31] = 0x5C; // \/| → Col 11, Row 4
-    hid_to_wyse50[0x33] = 0x44; // ;/: → Col 8, Row 4
-    hid_to_wyse50[0x34] = 0x46; // '/" → Col 8, Row 6
-    hid_to_wyse50[0x35] = 0x4C; // `/~ → Col 9, Row 4
-    hid_to_wyse50[0x36] = 0x06; // ,/< → Col 0, Row 6
-    hid_to_wyse50[0x37] = 0x5E; // ./> → Col 11, Row 6
-    hid_to_wyse50[0x38] = 0x66; // //? → Col 12, Row 6
-
-    // Lock / special
-    hid_to_wyse50[0x39] = 0x3A; // Caps Lock → Col 7, Row 2
-
-    // Function keys (F1-F12 map to Wyse F1-F12)
-    hid_to_wyse50[0x3A] = 0x1D; // F1  → Col 3, Row 5
-    hid_to_wyse50[0x3B] = 0x3D; // F2  → Col 7, Row 5
-    hid_to_wyse50[0x3C] = 0x25; // F3  → Col 4, Row 5
-    hid_to_wyse50[0x3D] = 0x23; // F4  → Col 4, Row 3
-    hid_to_wyse50[0x3E] = 0x20; // F5  → Col 4, Row 0
-    hid_to_wyse50[0x3F] = 0x27; // F6  → Col 4, Row 7
-    hid_to_wyse50[0x40] = 0x26; // F7  → Col 4, Row 6
-    hid_to_wyse50[0x41] = 0x49; // F8  → Col 9, Row 1
-    hid_to_wyse50[0x42] = 0x24; // F9  → Col 4, Row 4
-    hid_to_wyse50[0x43] = 0x1C; // F10 → Col 3, Row 4
-    hid_to_wyse50[0x44] = 0x57; // F11 → Col 10, Row 7
-    hid_to_wyse50[0x45] = 0x22; // F12 → Col 4, Row 2
-
-    // Wyse-specific keys mapped to HID keys that don't conflict
-    hid_to_wyse50[0x47] = 0x0C; // Scroll Lock → SETUP (Col 1, Row 4) *** CRITICAL ***
-    hid_to_wyse50[0x48] = 0x34; // Pause/Break → Break (Col 6, Row 4)
-    hid_to_wyse50[0x49] = 0x01; // Insert      → Ins Char/Line (Col 0, Row 1)
-    hid_to_wyse50[0x4A] = 0x61; // Home        → Home (Col 12, Row 1)
-    hid_to_wyse50[0x4B] = 0x41; // Page Up     → Next/Prev Page (Col 8, Row 1)
-    hid_to_wyse50[0x4C] = 0x62; // Delete      → Del 0x7F (Col 12, Row 2)
-    hid_to_wyse50[0x4E] = 0x41; // Page Down   → Next/Prev Page (same key, shifted)
-
-    // Arrow keys
-    hid_to_wyse50[0x4F] = 0x0A; // Right → Col 1, Row 2
-    hid_to_wyse50[0x50] = 0x5A; // Left  → Col 11, Row 2
-    hid_to_wyse50[0x51] = 0x05; // Down  → Col 0, Row 5
-    hid_to_wyse50[0x52] = 0x4D; // Up    → Col 9, Row 5
-
-    // Keypad
-    hid_to_wyse50[0x54] = 0x66; // KP /     → //? (shared)
-    hid_to_wyse50[0x56] = 0x31; // KP -     → Col 6, Row 1
-    hid_to_wyse50[0x58] = 0x35; // KP Enter → Col 6, Row 5
-    hid_to_wyse50[0x59] = 0x12; // KP 1     → Col 2, Row 2
-    hid_to_wyse50[0x5A] = 0x02; // KP 2     → Col 0, Row 2
-    hid_to_wyse50[0x5B] = 0x52; // KP 3     → Col 10, Row 2
-    hid_to_wyse50[0x5C] = 0x11; // KP 4     → Col 2, Row 1
-    hid_to_wyse50[0x5D] = 0x2A; // KP 5     → Col 5, Row 2
-    hid_to_wyse50[0x5E] = 0x2C; // KP 6     → Col 5, Row 4
-    hid_to_wyse50[0x5F] = 0x14; // KP 7     → Col 2, Row 4
-    hid_to_wyse50[0x60] = 0x55; // KP 8     → Col 10, Row 5
-    hid_to_wyse50[0x61] = 0x59; // KP 9     → Col 11, Row 1
-    hid_to_wyse50[0x62] = 0x15; // KP 0     → Col 2, Row 5
-    hid_to_wyse50[0x63] = 0x29; // KP .     → Col 5, Row 1
-}
-
-// Additional Wyse keys with no obvious HID equivalent (accessible via web UI):
-// Func        = 0x39 (Col 7, Row 1)
-// Clr Line    = 0x04 (Col 0, Row 4) — Shift+Clr = Clr Scrn
-// Del Char    = 0x2D (Col 5, Row 5) — Shift+Del Char = Del Line
-// Repl/Ins    = 0x32 (Col 6, Row 2)
-// Send/Print  = 0x64 (Col 12, Row 4)
-// F13         = 0x50 (Col 10, Row 0)
-// F14         = 0x54 (Col 10, Row 4)
-// F15         = 0x56 (Col 10, Row 6)
-// F16         = 0x21 (Col 4, Row 1)
+    // Two descriptors chained into a ring: DMA fills one while the task reads the other
+    memset(scan_cap_desc, 0, sizeof(scan_cap_desc));
+    for (int i = 0; i < 2; i++) {
+        scan_cap_desc[i].size          = SNOOP_DMA_WORDS * 4;
+        scan_cap_desc[i].length        = SNOOP_DMA_WORDS * 4;
+        scan_cap_desc[i].owner         = 1;
+        scan_cap_desc[i].buf           = (uint8_t *)scan_cap_buf[i];
+        scan_cap_desc[i].empty         = (uint32_t)&scan_cap_desc[i ^ 1];
+    }
+
+    periph_module_enable(PERIPH_I2S0_MODULE);
+    I2S0.conf.rx_reset         = 1;
+    I2S0.conf.rx_reset         = 0;
+    I2S0.conf.rx_fifo_reset    = 1;
+    I2S0.conf.rx_fifo_reset    = 0;
+    I2S0.lc_conf.in_rst        = 1;
+    I2S0.lc_conf.in_rst        = 0;
+    I2S0.lc_conf.ahbm_fifo_rst = 1;
+    I2S0.lc_conf.ahbm_fifo_rst = 0;
+    I2S0.lc_conf.ahbm_rst      = 1;
+    I2S0.lc_conf.ahbm_rst      = 0;
+
+    I2S0.conf.rx_slave_mod              = 1; // Sample on the looped-back clock
+    I2S0.conf.rx_right_first            = 0;
+    I2S0.conf.rx_msb_right              = 0;
+    I2S0.conf.rx_msb_shift              = 0;
+    I2S0.conf.rx_mono                   = 0;
+    I2S0.conf.rx_short_sync             = 0;
+    I2S0.conf2.lcd_en                   = 1;
+    I2S0.conf2.camera_en                = 1;
+    I2S0.clkm_conf.clkm_div_a           = 1;
+    I2S0.clkm_conf.clkm_div_b           = 0;
+    I2S0.clkm_conf.clkm_div_num         = 2;
+    I2S0.fifo_conf.dscr_en              = 1;
+    I2S0.fifo_conf.rx_fifo_mod          = 1; // Two 8-bit samples per word (scan_capture.h layout)
+    I2S0.fifo_conf.rx_fifo_mod_force_en = 1;
+    I2S0.conf_chan.rx_chan_mod          = 1;
+    I2S0.sample_rate_conf.rx_bits_mod   = 0;
+    I2S0.timing.val                     = 0;
+    I2S0.timing.rx_dsync_sw             = 1;
+    I2S0.rx_eof_num                     = SNOOP_DMA_WORDS; // EOF per buffer
+    I2S0.in_link.addr                   = (uint32_t)&scan_cap_desc[0] & 0xFFFFF;
+
+    // Bus lines into the data inputs; Key Return is read back off its own pad
+    for (int i = 0; i < 7; i++) esp_rom_gpio_connect_in_signal(config.pin_addr[i], I2S0I_DATA_IN0_IDX + i, false);
+    if (config.pin_key_return >= 0) {
+        PIN_INPUT_ENABLE(GPIO_PIN_MUX_REG[config.pin_key_return]);
+        esp_rom_gpio_connect_in_signal(config.pin_key_return, I2S0I_DATA_IN7_IDX, false);
+    } else {
+        esp_rom_gpio_connect_in_signal(GPIO_MATRIX_CONST_ZERO_INPUT, I2S0I_DATA_IN7_IDX, false);
+    }
+    esp_rom_gpio_connect_in_signal(GPIO_MATRIX_CONST_ONE_INPUT, I2S0I_V_SYNC_IDX, false);
+    esp_rom_gpio_connect_in_signal(GPIO_MATRIX_CONST_ONE_INPUT, I2S0I_H_SYNC_IDX, false);
+    esp_rom_gpio_connect_in_signal(GPIO_MATRIX_CONST_ONE_INPUT, I2S0I_H_ENABLE_IDX, false);
+
+    // Sample clock: LEDC out, then the same pad back in as WS. ledc_channel_config()
+    // leaves the pad output-only, so input is re-enabled after it.
+    ledc_timer_config_t timer  = {};
+    timer.speed_mode           = LEDC_HIGH_SPEED_MODE;
+    timer.duty_resolution      = LEDC_TIMER_1_BIT;
+    timer.timer_num            = LEDC_TIMER_3;
+    timer.freq_hz              = (uint32_t)rate_khz * 1000;
+    timer.clk_cfg              = LEDC_AUTO_CLK;
+    ledc_channel_config_t chan = {};
+    chan.gpio_num              = clk;
+    chan.speed_mode            = LEDC_HIGH_SPEED_MODE;
+    chan.channel               = LEDC_CHANNEL_7;
+    chan.timer_sel             = LEDC_TIMER_3;
+    chan.duty                  = 1; // 50%
+    esp_err_t err              = ledc_timer_config(&timer);
+    if (err == ESP_OK) err = ledc_channel_config(&chan);
+    if (err == ESP_OK) {
+        PIN_INPUT_ENABLE(GPIO_PIN_MUX_REG[clk]);
+        esp_rom_gpio_connect_in_signal(clk, I2S0I_WS_IN_IDX, false);
+        err = esp_intr_alloc(ETS_I2S0_INTR_SOURCE, ESP_INTR_FLAG_IRAM | ESP_INTR_FLAG_LOWMED, scanCapIsr, NULL,
+                             &scan_cap_intr);
+    }
+    if (err != ESP_OK) {
+        scan_cap_running = true; // Let scanCapStop() unwind the lot
+        scanCapStop();
+        return err;
+    }
+
+    scanCaptureInit(scan_capture, SCAN_CPU_MHZ * 1000 / rate_khz);
+    scan_cap_done           = 0;
+    scan_cap_read           = 0;
+    scan_cap_overruns       = 0;
+    I2S0.int_clr.val        = UINT32_MAX;
+    I2S0.int_ena.in_suc_eof = 1;
+    I2S0.in_link.start      = 1;
+    I2S0.conf.rx_start      = 1;
+    scan_cap_running        = true;
+    return ESP_OK;
+}
+
+// Decode every buffer the DMA has finished since the last call. A buffer
+// the DMA has already come back around to is written off as a gap rather
+// than decoded half-overwritten. Returns true if the stats changed.
+static bool scanCapDecode(ScanSnoopStats &s) {
+    bool any = false;
+    while (scan_cap_read != scan_cap_done) {
+        uint32_t behind = scan_cap_done - scan_cap_read;
+        if (behind > 1) {
+            scan_cap_overruns = scan_cap_overruns + behind - 1;
+            scanCaptureLost(scan_capture, (behind - 1) * SNOOP_DMA_WORDS * 2, s);
+            scan_cap_read += behind - 1;
+        }
+        scanCaptureBuffer(scan_capture, scan_cap_buf[scan_cap_read & 1], SNOOP_DMA_WORDS, s);
+        scan_cap_read++;
+        if (scan_cap_done != scan_cap_read) { // Lapped mid-decode: DMA is back in this buffer
+            scan_cap_overruns = scan_cap_overruns + 1;
+            scanCaptureLost(scan_capture, 0, s);
+        }
+        any = true;
+    }
+    return any;
+}
+#else
+static void scanCapStop() {}
+static esp_err_t scanCapStart(uint16_t rate_khz) { return ESP_ERR_NOT_SUPPORTED; }
+static bool scanCapDecode(ScanSnoopStats &s) { return false; }
+#endif // CONFIG_IDF_TARGET_ESP32
 
 // ============================================================
-// HID REPORT PROCESSING (scan state based)
+// SNOOP ANALYTICS TASK (the core the scan task isn't on)
 // ============================================================
 
-static uint32_t ledOffTime = 0;
+// Copy the working stats into the back snapshot and make it the front.
+// Returns false (try again later) if a handler is reading the front.
+static bool scanSnoopPublish() {
+    uint8_t back = scan_snoop_front ^ 1;
+    memcpy(scan_snoop_snap[back], scan_snoop_work, sizeof(ScanSnoopStats));
+    if (xSemaphoreTake(scan_snoop_lock, 0) != pdTRUE) return false;
+    scan_snoop_front = back;
+    xSemaphoreGive(scan_snoop_lock);
+    scan_snoop_published++;
+    return true;
+}
 
-void processHidReport(const KeyReport *report) {
-    uint8_t modifiers   = report->modifiers;
-    const uint8_t *keys = report->keys;
-
-    // Track which Wyse addresses are currently held
-    static uint8_t prev_wyse_addrs[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
-    static uint8_t prev_modifiers     = 0;
-
-    // Release previous keys not in current report
-    for (int i = 0; i < 6; i++) {
-        if (prev_wyse_addrs[i] == 0xFF) continue;
-        bool still_held = false;
-        for (int j = 0; j < 6; j++) {
-            uint8_t wa = (keys[j] != 0) ? hid_to_wyse50[keys[j]] : 0xFF;
-            if (wa == prev_wyse_addrs[i]) {
-                still_held = true;
-                break;
+static void scan_snoop_task(void *arg) {
+    uint32_t epoch   = scan_snoop_epoch - 1; // Start with a reset
+    bool stale       = false;                // Working stats newer than the front snapshot
+    TickType_t t_pub = 0;
+    while (true) {
+        if (epoch != scan_snoop_epoch) {
+            epoch = scan_snoop_epoch;
+            scanCapStop();
+            scanRingDiscard(scan_snoop_ring);
+            scanSnoopReset(*scan_snoop_work);
+            if (scan_snoop_dma) {
+                scan_cap_status = scanCapStart(scan_snoop_rate_khz);
+                if (scan_cap_status != ESP_OK) scan_snoop_dma = false;
             }
+            scan_cap_epoch = epoch; // The handler waits for this
+            stale          = true;
+        }
+        if (scan_cap_running && !scan_snoop_dma) scanCapStop();
+        if (scanRingDrain(scan_snoop_ring, *scan_snoop_work)) stale = true;
+        if (scan_cap_running && scanCapDecode(*scan_snoop_work)) stale = true;
+
+        // Publish on a timer while snooping, and once more when it stops
+        bool active    = scan_snoop_mode || scan_cap_running;
+        TickType_t now = xTaskGetTickCount();
+        if (stale && (!active || now - t_pub >= pdMS_TO_TICKS(SNOOP_PUBLISH_MS)) && scanSnoopPublish()) {
+            stale = false;
+            t_pub = now;
         }
-        if (!still_held) {
-            scanKeyRelease(prev_wyse_addrs[i]);
-            prev_wyse_addrs[i] = 0xFF;
+        if (!active && !stale) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY); // Until the next snoop start
+        } else if (scan_cap_running) {
+            ulTaskNotifyTake(pdTRUE, 1); // Woken by each buffer's EOF (~1ms)
+        } else {
+            vTaskDelay(1); // ~170 records per tick at a 6us dwell; the ring holds ~12 ticks
         }
     }
+}
 
-    // Press new keys
-    for (int i = 0; i < 6; i++) {
-        if (keys[i] == 0) {
-            prev_wyse_addrs[i] = 0xFF;
-            continue;
-        }
-        uint8_t addr = hid_to_wyse50[keys[i]];
-        if (addr == 0xFF) {
-            prev_wyse_addrs[i] = 0xFF;
-            continue;
-        }
-        scanKeyPress(addr);
-        prev_wyse_addrs[i] = addr;
+// First snoop start: allocate the stats and start the task. Off the scan
+// core: with the scan task isolated on core 1 it goes to core 0, and vice
+// versa.
+static bool scanSnoopInit() {
+    if (scan_snoop_task_handle) return true;
+    if (!scan_snoop_work) scan_snoop_work = (ScanSnoopStats *)malloc(sizeof(ScanSnoopStats));
+    for (int i = 0; i < 2; i++) {
+        if (!scan_snoop_snap[i]) scan_snoop_snap[i] = (ScanSnoopStats *)malloc(sizeof(ScanSnoopStats));
     }
+    if (!scan_snoop_work || !scan_snoop_snap[0] || !scan_snoop_snap[1]) return false;
+    scanSnoopReset(*scan_snoop_snap[0]);
+    scanSnoopReset(*scan_snoop_snap[1]);
+    if (!scan_snoop_lock) scan_snoop_lock = xSemaphoreCreateMutex();
+    if (!scan_snoop_lock) return false;
+    xTaskCreatePinnedToCore(scan_snoop_task, "snoop", 3072, NULL, 5, &scan_snoop_task_handle,
+                            scan_isolated ? SYSTEM_CORE : APP_CORE);
+    return scan_snoop_task_handle != NULL;
+}
 
-    // Handle modifier keys — Shift and Ctrl have physical scan addresses
-    bool shift_now = (modifiers & 0x22) != 0; // L or R Shift
-    bool shift_was = (prev_modifiers & 0x22) != 0;
-    if (shift_now && !shift_was) scanKeyPress(WYSE_SHIFT);
-    if (!shift_now && shift_was) scanKeyRelease(WYSE_SHIFT);
+// Front snapshot for a handler, held until scanSnoopRelease(). NULL if
+// snoop has never run or the snapshot is being flipped for too long.
+static const ScanSnoopStats *scanSnoopAcquire() {
+    if (!scan_snoop_lock || xSemaphoreTake(scan_snoop_lock, pdMS_TO_TICKS(100)) != pdTRUE) return NULL;
+    return scan_snoop_snap[scan_snoop_front];
+}
 
-    bool ctrl_now = (modifiers & 0x11) != 0; // L or R Ctrl
-    bool ctrl_was = (prev_modifiers & 0x11) != 0;
-    if (ctrl_now && !ctrl_was) scanKeyPress(WYSE_CTRL);
-    if (!ctrl_now && ctrl_was) scanKeyRelease(WYSE_CTRL);
+static void scanSnoopRelease() {
+    xSemaphoreGive(scan_snoop_lock);
+}
 
-    prev_modifiers = modifiers;
+// ============================================================
+// STALL PROFILER CANDIDATES
+// ============================================================
 
-    // LED feedback
-    for (int i = 0; i < 6; i++) {
-        if (keys[i] != 0) {
-            if (config.pin_led >= 0) digitalWrite(config.pin_led, HIGH);
-            ledOffTime = millis() + 30;
-            break;
+// Re-list the tasks that can preempt the scan task into the spare
+// candidate buffer, then switch the loop over to it
+static void scanStallRefreshTasks() {
+    if (!scan_task_handle) return;
+    UBaseType_t n     = uxTaskGetNumberOfTasks() + 4; // Room for tasks created meanwhile
+    TaskStatus_t *all = (TaskStatus_t *)malloc(n * sizeof(TaskStatus_t));
+    if (!all) return;
+    n = uxTaskGetSystemState(all, n, NULL);
+
+    BaseType_t core   = scan_isolated ? SCAN_CORE_ISOLATED : SCAN_CORE_SHARED;
+    uint8_t next      = scan_stall_tasks_cur ^ 1;
+    ScanStallTasks &c = scan_stall_tasks[next];
+    c.n               = 0;
+    for (UBaseType_t i = 0; i < n && c.n < SCAN_STALL_TASKS; i++) {
+        if (all[i].xHandle == scan_task_handle) continue;
+        if (all[i].uxCurrentPriority < SCAN_TASK_PRIORITY) continue;
+        if (all[i].xCoreID != core && all[i].xCoreID != tskNO_AFFINITY) continue;
+        c.h[c.n++] = all[i].xHandle;
+    }
+    free(all);
+    scan_stall_tasks_cur = next;
+    scan_stall_rebase    = true;
+}
+
+// ============================================================
+// HID-TO-WYSE50 KEY ADDRESS MAPPING
+// ============================================================
+// The built-in rules are WYSE50_RULES (wyse50_map.h, shared with
+// tools/keymap_compile, which checks keymaps/wyse50.json against them)
+
+static KeyMap key_map;                      // Compiled from WYSE50_RULES by initKeyMap()
+static const KeyMap *key_map_active = &key_map; // key_map or a blob's tables in flash (keymapSelect)
+
+// Which usages each source holds, the addresses and modifiers they pressed
+static KeyMapState hid_state[KEY_SRC_COUNT];
+
+
+void initKeyMap() {
+    keyMapCompile(key_map, WYSE50_RULES, WYSE50_RULE_COUNT, WYSE_SHIFT, WYSE_CTRL);
+    for (int i = 0; i < KEY_SRC_COUNT; i++) keyMapStateReset(hid_state[i]);
+}
+
+// ============================================================
+// HID REPORT PROCESSING (scan state based)
+// ============================================================
+
+static uint32_t ledOffTime = 0;
+
+void processHidReport(const KeyReport *report) {
+    uint8_t src        = report->source < KEY_SRC_COUNT ? report->source : KEY_SRC_BT;
+    KeyMapState &state = hid_state[src];
+
+    if (report->gone) {
+        scanReleaseSource(src);
+        keyMapStateReset(state);
+        return;
+    }
+
+    uint32_t now[HID_KEY_WORDS];
+    memcpy(now, report->down, sizeof(now));
+    if (report->rollover) hidKeepKeys(state.hid, now);
+
+    // One edit for the whole report: the scan engine commits it at a
+    // frame boundary, never half-applied
+    bool pressed = false;
+    scanKeyEditBegin(key_stage);
+    keyMapDiff(state, now, *key_map_active, [src, &pressed](uint8_t addr, bool press) {
+        if (press) {
+            scanKeyPress(src, addr);
+            pressed = true;
+        } else {
+            scanKeyRelease(src, addr);
         }
+    });
+    scanKeyEditEnd(key_stage);
+
+    // LED feedback
+    if (pressed) {
+        if (config.pin_led >= 0) digitalWrite(config.pin_led, HIGH);
+        ledOffTime = millis() + 30;
     }
 }
 
@@ -453,10 +1209,13 @@ static usb_device_handle_t usb_dev_hdl         = NULL;
 static usb_transfer_t *usb_xfer_in             = NULL;
 static uint8_t usb_claimed_iface               = 0xFF;
 static SemaphoreHandle_t usb_device_sem        = NULL;
+static HidPlan usb_plan;                        // Where the claimed interface's keys sit in its reports
 
 static void usb_transfer_cb(usb_transfer_t *transfer) {
-    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes >= 8) {
-        submitKeyReport(transfer->data_buffer[0], &transfer->data_buffer[2]);
+    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes > 0) {
+        uint32_t down[HID_KEY_WORDS];
+        uint8_t r = hidPlanRunRaw(usb_plan, transfer->data_buffer, (uint16_t)transfer->actual_num_bytes, down);
+        if (r != HID_RUN_NONE) submitKeyReport(KEY_SRC_USB, down, r == HID_RUN_ROLLOVER);
     }
     if (usb_keyboard_connected && usb_dev_hdl != NULL) {
         if (usb_host_transfer_submit(transfer) != ESP_OK) {
@@ -484,6 +1243,7 @@ static void usb_client_event_cb(const usb_host_client_event_msg_t *msg, void *ar
                 usb_host_device_close(usb_client_hdl, usb_dev_hdl);
                 usb_dev_hdl = NULL;
             }
+            submitKeyGone(KEY_SRC_USB);
             logKey("[USB] Disconnected");
             break;
         default:
@@ -491,27 +1251,70 @@ static void usb_client_event_cb(const usb_host_client_event_msg_t *msg, void *ar
     }
 }
 
-static void usb_set_boot_protocol(usb_device_handle_t dev, uint8_t iface) {
+// Control transfer on EP0. Its completion callback runs from
+// usb_host_client_handle_events() on this same task, so wait by pumping
+// events. The transfer's context holds its state rather than pointing at
+// this frame: one that times out is left to its callback to free, since
+// it may still complete after we return. Returns the bytes of IN data
+// received, or -1.
+#define USB_CTRL_PENDING   ((void *)0)
+#define USB_CTRL_DONE      ((void *)1)
+#define USB_CTRL_ABANDONED ((void *)2)
+
+static void usb_control_cb(usb_transfer_t *t) {
+    if (t->context == USB_CTRL_ABANDONED) {
+        usb_host_transfer_free(t); // Its caller gave up on it
+    } else {
+        t->context = USB_CTRL_DONE;
+    }
+}
+
+static int usb_control_sync(usb_device_handle_t dev, const uint8_t *setup, uint8_t *in, uint16_t in_len) {
     usb_transfer_t *ctrl;
-    usb_host_transfer_alloc(64, 0, &ctrl);
-    ctrl->num_bytes        = 8;
-    ctrl->data_buffer[0]   = 0x21;
-    ctrl->data_buffer[1]   = 0x0B;
-    ctrl->data_buffer[2]   = 0x00;
-    ctrl->data_buffer[3]   = 0x00;
-    ctrl->data_buffer[4]   = iface;
-    ctrl->data_buffer[5]   = 0x00;
-    ctrl->data_buffer[6]   = 0x00;
-    ctrl->data_buffer[7]   = 0x00;
+    if (usb_host_transfer_alloc(8 + ((in_len + 63) & ~63), 0, &ctrl) != ESP_OK) return -1;
+    memcpy(ctrl->data_buffer, setup, 8);
+    ctrl->num_bytes        = 8 + in_len;
     ctrl->device_handle    = dev;
     ctrl->bEndpointAddress = 0x00;
-    SemaphoreHandle_t done = xSemaphoreCreateBinary();
-    ctrl->callback         = [](usb_transfer_t *t) { xSemaphoreGiveFromISR((SemaphoreHandle_t)t->context, NULL); };
-    ctrl->context          = (void *)done;
-    usb_host_transfer_submit_control(usb_client_hdl, ctrl);
-    xSemaphoreTake(done, pdMS_TO_TICKS(500));
-    vSemaphoreDelete(done);
+    ctrl->callback         = usb_control_cb;
+    ctrl->context          = USB_CTRL_PENDING;
+    if (usb_host_transfer_submit_control(usb_client_hdl, ctrl) != ESP_OK) {
+        usb_host_transfer_free(ctrl);
+        return -1;
+    }
+    for (int i = 0; i < 50 && ctrl->context != USB_CTRL_DONE; i++) {
+        usb_host_client_handle_events(usb_client_hdl, pdMS_TO_TICKS(10));
+    }
+    if (ctrl->context != USB_CTRL_DONE) {
+        ctrl->context = USB_CTRL_ABANDONED; // Still in flight: the callback frees it
+        return -1;
+    }
+    int got = -1;
+    if (ctrl->status == USB_TRANSFER_STATUS_COMPLETED) {
+        got = ctrl->actual_num_bytes > 8 ? ctrl->actual_num_bytes - 8 : 0;
+        if (got > in_len) got = in_len;
+        if (in && got) memcpy(in, ctrl->data_buffer + 8, got);
+    }
     usb_host_transfer_free(ctrl);
+    return got;
+}
+
+// SET_PROTOCOL: 0 = boot, 1 = report
+static void usb_set_protocol(usb_device_handle_t dev, uint8_t iface, uint8_t protocol) {
+    const uint8_t setup[8] = {0x21, 0x0B, protocol, 0x00, iface, 0x00, 0x00, 0x00};
+    usb_control_sync(dev, setup, NULL, 0);
+}
+
+// GET_DESCRIPTOR (Report) for one interface, compiled into plan
+static bool usb_compile_report_map(usb_device_handle_t dev, uint8_t iface, uint16_t len, HidPlan &plan) {
+    if (len == 0 || len > 1024) return false;
+    uint8_t *desc = (uint8_t *)malloc(len);
+    if (!desc) return false;
+    const uint8_t setup[8] = {0x81, 0x06, 0x00, 0x22, iface, 0x00, (uint8_t)len, (uint8_t)(len >> 8)};
+    int got                = usb_control_sync(dev, setup, desc, len);
+    bool ok                = got > 0 && hidPlanCompile(plan, desc, got);
+    free(desc);
+    return ok;
 }
 
 static void usb_host_daemon_task(void *arg) {
@@ -544,36 +1347,56 @@ static void usb_keyboard_task(void *arg) {
             const uint8_t *p = (const uint8_t *)ccfg;
             int off = 0, total = ccfg->wTotalLength;
             uint8_t iface = 0;
-            bool in_kbd = false, connected = false;
+            bool in_hid = false, boot_kbd = false, connected = false;
+            uint16_t map_len = 0;
 
             while (off < total && !connected) {
                 if (off + 1 >= total) break;
                 uint8_t dlen = p[off], dtype = p[off + 1];
                 if (dlen < 2 || off + dlen > total) break;
                 if (dtype == 0x04 && dlen >= 9) {
-                    iface  = p[off + 2];
-                    in_kbd = (p[off + 5] == 3 && p[off + 6] == 1 && p[off + 7] == 1);
+                    iface    = p[off + 2];
+                    in_hid   = p[off + 5] == 3;
+                    boot_kbd = in_hid && p[off + 6] == 1 && p[off + 7] == 1;
+                    map_len  = 0;
+                }
+                if (dtype == 0x21 && in_hid && dlen >= 9 && p[off + 6] == 0x22) {
+                    map_len = p[off + 7] | (p[off + 8] << 8); // HID descriptor: report map length
                 }
-                if (dtype == 0x05 && in_kbd && dlen >= 7 && (p[off + 2] & 0x80)) {
+                if (dtype == 0x05 && in_hid && dlen >= 7 && (p[off + 2] & 0x80)) {
+                    in_hid = false; // One IN endpoint per interface is enough
                     if (usb_host_interface_claim(usb_client_hdl, usb_dev_hdl, iface, 0) != ESP_OK) break;
+                    // Report protocol with the compiled report map (NKRO,
+                    // report IDs); boot protocol if a boot keyboard's map
+                    // cannot be read. Any other HID interface without keys
+                    // is skipped.
+                    bool mapped = usb_compile_report_map(usb_dev_hdl, iface, map_len, usb_plan);
+                    if (!mapped && !boot_kbd) {
+                        usb_host_interface_release(usb_client_hdl, usb_dev_hdl, iface);
+                        off += dlen;
+                        continue;
+                    }
+                    if (!mapped) hidPlanCompile(usb_plan, HID_BOOT_KEYBOARD_DESC, sizeof(HID_BOOT_KEYBOARD_DESC));
+                    usb_set_protocol(usb_dev_hdl, iface, mapped ? 1 : 0);
                     usb_claimed_iface = iface;
-                    usb_set_boot_protocol(usb_dev_hdl, iface);
+                    uint16_t mps      = (p[off + 4] | (p[off + 5] << 8)) & 0x7FF;
                     usb_host_transfer_alloc(64, 0, &usb_xfer_in);
                     usb_xfer_in->device_handle    = usb_dev_hdl;
                     usb_xfer_in->bEndpointAddress = p[off + 2];
                     usb_xfer_in->callback         = usb_transfer_cb;
-                    usb_xfer_in->num_bytes        = 8;
+                    usb_xfer_in->num_bytes        = mps && mps < 64 ? mps : 64;
                     usb_xfer_in->timeout_ms       = 0;
                     usb_keyboard_connected        = true;
                     connected                     = true;
-                    ESP_LOGI(TAG, "[USB] Keyboard connected (iface %d, ep 0x%02x)", iface, p[off + 2]);
-                    logKey("[USB] Keyboard connected");
+                    ESP_LOGI(TAG, "[USB] Keyboard connected (iface %d, ep 0x%02x, %s, %u key fields)", iface,
+                             p[off + 2], mapped ? "report map" : "boot", usb_plan.n_fields);
+                    logKey("[USB] Keyboard connected (%s)", mapped ? "report map" : "boot");
                     usb_host_transfer_submit(usb_xfer_in);
                 }
                 off += dlen;
             }
             if (!connected) {
-                ESP_LOGW(TAG, "[USB] Device is not a boot keyboard, closing");
+                ESP_LOGW(TAG, "[USB] Device has no keyboard interface, closing");
                 usb_host_device_close(usb_client_hdl, usb_dev_hdl);
                 usb_dev_hdl = NULL;
             }
@@ -583,9 +1406,10 @@ static void usb_keyboard_task(void *arg) {
 
 void startUsbHost() {
     usb_device_sem = xSemaphoreCreateBinary();
-    xTaskCreatePinnedToCore(usb_host_daemon_task, "usb_d", 4096, NULL, 5, NULL, 0);
+    xTaskCreatePinnedToCore(usb_host_daemon_task, "usb_d", 4096, NULL, 5, NULL, SYSTEM_CORE);
     vTaskDelay(pdMS_TO_TICKS(100));
-    xTaskCreatePinnedToCore(usb_keyboard_task, "usb_kb", 4096, NULL, 5, NULL, 1);
+    xTaskCreatePinnedToCore(usb_keyboard_task, "usb_kb", 4096, NULL, 5, NULL,
+                            scan_isolated ? SYSTEM_CORE : APP_CORE);
 }
 
 #endif // CONFIG_SOC_USB_OTG_SUPPORTED
@@ -597,6 +1421,35 @@ void startUsbHost() {
 static esp_hidh_dev_t *bt_hid_dev      = NULL;
 static volatile bool bt_scan_requested = false;
 
+// One plan per report map the device declares (BLE devices can have
+// several); written on open, read on input, both on the hidh event task
+#define BT_PLAN_MAPS 2
+static HidPlan bt_plans[BT_PLAN_MAPS];
+static uint8_t bt_plan_count = 0;
+
+// Maps without keyboard input stay empty, so their reports are ignored;
+// a device with no usable map at all gets the boot layout
+static void bt_compile_report_maps(esp_hidh_dev_t *dev) {
+    size_t num_maps                = 0;
+    esp_hid_raw_report_map_t *maps = NULL;
+    if (esp_hidh_dev_report_maps_get(dev, &num_maps, &maps) != ESP_OK) num_maps = 0;
+    bt_plan_count = num_maps < BT_PLAN_MAPS ? (uint8_t)num_maps : BT_PLAN_MAPS;
+    uint8_t keyed = 0, fields = 0;
+    for (int i = 0; i < bt_plan_count; i++) {
+        if (hidPlanCompile(bt_plans[i], maps[i].data, maps[i].len)) {
+            keyed++;
+            fields += bt_plans[i].n_fields;
+        }
+    }
+    if (keyed == 0) {
+        bt_plan_count = 1;
+        hidPlanCompile(bt_plans[0], HID_BOOT_KEYBOARD_DESC, sizeof(HID_BOOT_KEYBOARD_DESC));
+        logKey("[BT] Keys: boot layout");
+    } else {
+        logKey("[BT] Keys: %u field(s), %u map(s)", fields, keyed);
+    }
+}
+
 static void hidh_callback(void *handler_args, esp_event_base_t base, int32_t id, void *event_data) {
     esp_hidh_event_t event       = (esp_hidh_event_t)id;
     esp_hidh_event_data_t *param = (esp_hidh_event_data_t *)event_data;
@@ -606,6 +1459,7 @@ static void hidh_callback(void *handler_args, esp_event_base_t base, int32_t id,
             if (param->open.status == ESP_OK) {
                 bt_hid_dev            = param->open.dev;
                 bt_keyboard_connected = true;
+                bt_compile_report_maps(param->open.dev);
                 const char *name      = esp_hidh_dev_name_get(param->open.dev);
                 logKey("[BT] Connected: %s", name ? name : "unknown");
                 if (xSemaphoreTake(config_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
@@ -614,20 +1468,18 @@ static void hidh_callback(void *handler_args, esp_event_base_t base, int32_t id,
                 }
             }
             break;
-        case ESP_HIDH_INPUT_EVENT:
-            if (param->input.length >= 8) {
-                submitKeyReport(param->input.data[0], &param->input.data[2]);
-            } else if (param->input.length >= 3) {
-                uint8_t keys[6] = {0};
-                int n           = param->input.length - 2;
-                if (n > 6) n = 6;
-                if (n > 0) memcpy(keys, &param->input.data[2], n);
-                submitKeyReport(param->input.data[0], keys);
-            }
+        case ESP_HIDH_INPUT_EVENT: {
+            // data excludes the report ID; hidh passes it separately
+            const HidPlan &plan = bt_plans[param->input.map_index < bt_plan_count ? param->input.map_index : 0];
+            uint32_t down[HID_KEY_WORDS];
+            uint8_t r = hidPlanRun(plan, (uint8_t)param->input.report_id, param->input.data, param->input.length, down);
+            if (r != HID_RUN_NONE) submitKeyReport(KEY_SRC_BT, down, r == HID_RUN_ROLLOVER);
             break;
+        }
         case ESP_HIDH_CLOSE_EVENT:
             bt_hid_dev            = NULL;
             bt_keyboard_connected = false;
+            submitKeyGone(KEY_SRC_BT);
             logKey("[BT] Disconnected");
             if (xSemaphoreTake(config_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
                 if (config.pin_bt_led >= 0) digitalWrite(config.pin_bt_led, LOW);
@@ -756,7 +1608,7 @@ static void bt_init_task(void *arg) {
     }
     ESP_LOGI(TAG, "[BT] HID host initialized (heap=%lu)", (unsigned long)esp_get_free_heap_size());
 
-    xTaskCreatePinnedToCore(bt_scan_task, "bt_scan", 6144, NULL, 3, NULL, 0);
+    xTaskCreatePinnedToCore(bt_scan_task, "bt_scan", 6144, NULL, 3, NULL, SYSTEM_CORE);
     logKey("[BT] Ready. Press PAIR to connect.");
     ESP_LOGI(TAG, "[BT] Init complete");
 
@@ -764,7 +1616,196 @@ static void bt_init_task(void *arg) {
 }
 
 void startBluetooth() {
-    xTaskCreatePinnedToCore(bt_init_task, "bt_init", 8192, NULL, 3, NULL, 0);
+    xTaskCreatePinnedToCore(bt_init_task, "bt_init", 8192, NULL, 3, NULL, SYSTEM_CORE);
+}
+
+// ============================================================
+// NVS WRITE GUARD (see scan_flash_seq)
+// ============================================================
+
+// Called from app_main before any NVS write once the scan task is up.
+// Waits for every key to be released — key reports are processed here,
+// since this task is also the one that would process the releases.
+void scanFlashBegin() {
+    uint32_t t0 = millis();
+    while ((!scanKeysIdle(key_state) || scanKeyPending(key_stage)) && millis() - t0 < SCAN_FLASH_WAIT_MS) {
+        KeyReport report;
+        while (xQueueReceive(keyQueue, &report, 0) == pdTRUE) {
+            processHidReport(&report);
+        }
+        delay(5);
+    }
+    scan_flash_wait_ms += millis() - t0;
+    scan_flash_keys_held = !scanKeysIdle(key_state);
+    if (scan_flash_keys_held) {
+        scan_flash_forced++;
+        logKey("[NVS] Write with keys held");
+    }
+    scan_flash_seq++;
+}
+
+void scanFlashEnd() {
+    scan_flash_seq++;
+    scan_flash_ops++;
+}
+
+// ============================================================
+// KEYMAP BLOBS (keymaps partition, see src/key_blob.h)
+// ============================================================
+// The whole partition stays mapped and the active keymap's tables are
+// read in place. Uploads, selection and processHidReport() all run on
+// the loop task, so a remap never happens under a lookup.
+
+#define KEYMAP_PART_SUBTYPE 0x40 // partitions.csv
+
+static const esp_partition_t *keymap_part = NULL;
+static esp_partition_mmap_handle_t keymap_mmap;
+static const uint8_t *keymap_flash = NULL; // Mapped partition, NULL if none
+static uint8_t keymap_slots        = 0;
+static int8_t keymap_active_slot   = -1; // -1 = built-in
+static uint8_t *keymap_upload      = NULL; // Body of the POST /api/keymap in progress
+static size_t keymap_upload_len    = 0;
+static bool keymap_upload_over     = false; // Body larger than a slot (or not authenticated)
+
+static const uint8_t *keymapSlot(int slot) {
+    return keymap_flash + slot * KEY_BLOB_SLOT_SIZE;
+}
+
+// (Re)map the partition: after a write, so reads never see stale cache
+static bool keymapMount() {
+    key_map_active = &key_map; // Until keymapSelect() finds it again
+    if (keymap_flash) {
+        esp_partition_munmap(keymap_mmap);
+        keymap_flash = NULL;
+    }
+    if (!keymap_part) {
+        keymap_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                               (esp_partition_subtype_t)KEYMAP_PART_SUBTYPE, "keymaps");
+    }
+    if (!keymap_part) {
+        logKey("[Keymap] No keymaps partition, built-in map only");
+        return false;
+    }
+    const void *p;
+    if (esp_partition_mmap(keymap_part, 0, keymap_part->size, ESP_PARTITION_MMAP_DATA, &p, &keymap_mmap) != ESP_OK) {
+        logKey("[Keymap] Partition mmap failed");
+        return false;
+    }
+    keymap_flash = (const uint8_t *)p;
+    keymap_slots = keymap_part->size / KEY_BLOB_SLOT_SIZE;
+    return true;
+}
+
+static int keymapFind(const char *name) {
+    for (int i = 0; keymap_flash && i < keymap_slots; i++) {
+        const uint8_t *blob = keymapSlot(i);
+        if (keyBlobCheck(blob, KEY_BLOB_SLOT_SIZE) == KEY_BLOB_OK && strcmp(keyBlobHeader(blob)->name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Switch processHidReport() to a slot's tables (-1 = built-in). Keys
+// pressed under the old map come up, so no address is left held.
+static void keymapUse(int slot) {
+    if (slot != keymap_active_slot) {
+        for (int src = 0; src < KEY_SRC_COUNT; src++) {
+            uint32_t any = 0;
+            for (int w = 0; w < HID_KEY_WORDS; w++) any |= hid_state[src].hid.down[w];
+            if (!any) continue;
+            scanReleaseSource(src);
+            keyMapStateReset(hid_state[src]);
+        }
+    }
+    key_map_active     = slot < 0 ? &key_map : keyBlobMap(keymapSlot(slot));
+    keymap_active_slot = (int8_t)slot;
+}
+
+// Use the named keymap blob; empty name or not found = built-in
+static bool keymapSelect(const char *name) {
+    int slot = *name ? keymapFind(name) : -1;
+    keymapUse(slot);
+    if (*name && slot < 0) {
+        logKey("[Keymap] \"%s\" not found, using built-in", name);
+        return false;
+    }
+    if (slot >= 0) logKey("[Keymap] %s (slot %d, %u rules)", name, slot, keyBlobHeader(keymapSlot(slot))->n_rules);
+    return true;
+}
+
+// Erase a slot and write blob into it (len 0 = erase only), then remap
+static bool keymapWrite(int slot, const uint8_t *blob, size_t len) {
+    if (slot == keymap_active_slot) keymapUse(-1);
+    scanFlashBegin();
+    esp_err_t err = esp_partition_erase_range(keymap_part, slot * KEY_BLOB_SLOT_SIZE, KEY_BLOB_SLOT_SIZE);
+    if (err == ESP_OK && len) err = esp_partition_write(keymap_part, slot * KEY_BLOB_SLOT_SIZE, blob, len);
+    scanFlashEnd();
+    keymapMount();
+    keymapSelect(config.keymap);
+    return err == ESP_OK;
+}
+
+// ============================================================
+// TEXT INJECTION (text_inject.h)
+// ============================================================
+// POST /api/text types a string as the text source's key reports, one
+// character per hold + gap scan frames. It is stepped from the loop task
+// ahead of the key queue it feeds, so requests are served between steps.
+
+#define TEXT_MAX_BYTES 8192
+
+static String text_buf;           // The text being typed (text_job points into it)
+static TextInject text_job;       // TEXT_OFF until the first POST /api/text
+static const char *text_end = ""; // Why typing stopped: "done", "cancelled", "stalled"
+static uint32_t text_start_ms = 0, text_end_ms = 0;
+static uint32_t text_start_frames = 0, text_end_frames = 0;
+static uint32_t text_seen_frames = 0, text_seen_ms = 0; // Stall watch
+
+static bool textBusy() {
+    return text_job.phase != TEXT_OFF && !*text_end;
+}
+
+static void textStop(const char *why) {
+    if (text_job.phase == TEXT_HOLD) submitKeyGone(KEY_SRC_TEXT);
+    scan_text_on    = false;
+    text_end        = why;
+    text_end_ms     = millis();
+    text_end_frames = scan_frame.frames;
+    text_job.text   = NULL; // Counters stay for GET /api/text
+    text_buf        = String();
+    logKey("[Text] %s: %u typed, %u skipped", why, (unsigned)text_job.typed, (unsigned)text_job.skipped);
+}
+
+static void textStart(const char *text, uint8_t hold_frames, uint8_t gap_frames) {
+    text_buf = text;
+    textInjectStart(text_job, text_buf.c_str(), text_buf.length(), hold_frames, gap_frames);
+    text_end          = "";
+    text_start_ms     = millis();
+    text_start_frames = scan_frame.frames;
+    text_seen_frames  = text_start_frames;
+    text_seen_ms      = text_start_ms;
+    scan_text_on      = true; // The loop must stay up to count frames between keys
+    if (scan_task_handle) xTaskNotifyGive(scan_task_handle);
+    logKey("[Text] %u bytes, %u+%u frames", text_buf.length(), hold_frames, gap_frames);
+}
+
+// One step per loop pass: at most one report, and only when a frame
+// boundary has made it due
+static void textPoll() {
+    if (!textBusy()) return;
+    uint32_t frames = scan_frame.frames;
+    uint32_t now    = millis();
+    if (frames != text_seen_frames) {
+        text_seen_frames = frames;
+        text_seen_ms     = now;
+    } else if (now - text_seen_ms > TEXT_STALL_MS) {
+        textStop("stalled");
+        return;
+    }
+    uint32_t down[HID_KEY_WORDS];
+    if (textInjectStep(text_job, *key_map_active, frames, down)) submitKeyReport(KEY_SRC_TEXT, down, false);
+    if (text_job.phase == TEXT_DONE) textStop("done");
 }
 
 // ============================================================
@@ -999,8 +2040,12 @@ void startWebServer() {
         AdapterConfig newCfg = config; // Start with current
         if (jsonToConfig(body, newCfg)) {
             if (xSemaphoreTake(config_mutex, portMAX_DELAY) == pdTRUE) {
-                config     = newCfg;
+                bool new_keymap = strcmp(newCfg.keymap, config.keymap) != 0;
+                config          = newCfg;
+                if (new_keymap) keymapSelect(config.keymap); // Live, unlike most settings
+                scanFlashBegin();
                 bool saved = saveConfig(config);
+                scanFlashEnd();
                 xSemaphoreGive(config_mutex);
                 if (saved) {
                     server.send(200, "application/json", "{\"ok\":true}");
@@ -1028,6 +2073,7 @@ void startWebServer() {
         doc["hostname"]      = config.hostname;
         doc["device_name"]   = config.wifi_ssid;
         doc["auth_required"] = hasPassword();
+        doc["scan_layout"]   = scanLayoutName(scan_core.layout.kind);
         String out;
         serializeJson(doc, out);
         server.send(200, "application/json", out);
@@ -1043,7 +2089,9 @@ void startWebServer() {
     // Factory reset (auth required — destructive)
     server.on("/api/reset", HTTP_POST, []() {
         if (!isAuthenticated()) { sendUnauthorized(); return; }
+        scanFlashBegin();
         eraseConfig();
+        scanFlashEnd();
         server.send(200, "application/json", "{\"ok\":true}");
         delay(500);
         ESP.restart();
@@ -1075,33 +2123,483 @@ void startWebServer() {
         deserializeJson(doc, server.arg("plain"));
         bool enable = doc["enable"] | false;
         if (enable) {
-            memset((void *)scan_addr_histogram, 0, sizeof(scan_addr_histogram));
-            scan_total_count = 0;
-            scan_snoop_mode  = true;
+            // "loop": the scan loop reports address changes. "dma": I2S0
+            // samples the bus and the scan loop is left alone.
+            const char *source = doc["source"] | "loop";
+            bool dma           = strcmp(source, "dma") == 0;
+            uint16_t rate_khz  = doc["rate_khz"] | SNOOP_DMA_DEFAULT_KHZ;
+            if (!dma && strcmp(source, "loop") != 0) {
+                server.send(400, "application/json", "{\"error\":\"source must be loop or dma\"}");
+                return;
+            }
+#if !CONFIG_IDF_TARGET_ESP32
+            if (dma) {
+                server.send(400, "application/json", "{\"error\":\"DMA capture unsupported on this target\"}");
+                return;
+            }
+#endif
+            if (dma && (rate_khz < SNOOP_DMA_MIN_KHZ || rate_khz > SNOOP_DMA_MAX_KHZ)) {
+                server.send(400, "application/json", "{\"error\":\"rate_khz must be 500-4000\"}");
+                return;
+            }
+            if (dma && config.pin_capture_clk < 0) {
+                server.send(400, "application/json", "{\"error\":\"Set a capture clock pin first\"}");
+                return;
+            }
+            if (!scanSnoopInit()) {
+                server.send(503, "application/json", "{\"error\":\"Not enough memory for snoop\"}");
+                return;
+            }
+            scan_snoop_mode     = false; // Loop stops pushing before the snoop task starts over
+            scan_predict.hits   = 0;
+            scan_predict.misses = 0;
+            scan_predict.cold   = 0;
+            scan_snoop_ring.dropped = 0; // Producer-owned, but idle while snoop is off
+            scanRingBreak(scan_snoop_ring);
+            scan_snoop_dma      = dma;
+            scan_snoop_from_dma = dma;
+            scan_snoop_rate_khz = rate_khz;
+            uint32_t epoch      = ++scan_snoop_epoch;
+            if (!dma) scan_snoop_mode = true;
+            xTaskNotifyGive(scan_snoop_task_handle);
+            if (dma) {
+                // The snoop task brings the engine up on its own core; wait for it
+                for (int i = 0; i < 50 && scan_cap_epoch != epoch; i++) vTaskDelay(pdMS_TO_TICKS(10));
+                if (scan_cap_epoch != epoch || scan_cap_status != ESP_OK) {
+                    JsonDocument err;
+                    err["error"] = String("DMA capture failed: ") +
+                                   (scan_cap_epoch == epoch ? esp_err_to_name(scan_cap_status) : "timeout");
+                    String out;
+                    serializeJson(err, out);
+                    server.send(500, "application/json", out);
+                    return;
+                }
+            } else if (scan_task_handle) {
+                xTaskNotifyGive(scan_task_handle); // Loop snoop needs the loop running
+            }
             server.send(200, "application/json", "{\"ok\":true,\"message\":\"Snoop started\"}");
         } else {
             scan_snoop_mode = false;
+            scan_snoop_dma  = false;
+            if (scan_snoop_task_handle) xTaskNotifyGive(scan_snoop_task_handle); // Stops the DMA engine
             server.send(200, "application/json", "{\"ok\":true,\"message\":\"Snoop stopped\"}");
         }
     });
 
-    // Scan histogram — read address frequency data
+    // Scan histogram — address visits from the latest snapshot (snoop keeps running)
     server.on("/api/scan/histogram", HTTP_GET, []() {
         if (!isAuthenticated()) { sendUnauthorized(); return; }
-        scan_snoop_mode = false; // Pause while reading
+        const ScanSnoopStats *snap = scanSnoopAcquire();
+        if (!snap) {
+            server.send(409, "application/json", "{\"error\":\"Start snoop first\"}");
+            return;
+        }
         JsonDocument doc;
-        doc["total_scans"] = scan_total_count;
-        doc["last_addr"]   = scan_last_addr;
+        doc["snooping"]    = scan_snoop_mode || scan_snoop_dma;
+        doc["source"]      = scan_snoop_from_dma ? "dma" : "loop";
+        doc["total_scans"] = snap->changes; // Address changes, not samples
+        doc["last_addr"]   = snap->last_addr;
+
+        // Hand-off from the scan core: records lost to a full ring show up
+        // as gaps and unscored frames, never as made-up dwells
+        JsonObject ring   = doc["ring"].to<JsonObject>();
+        ring["size"]      = SCAN_RING_SIZE;
+        ring["max_depth"] = snap->ring_max;
+        ring["dropped"]   = scan_snoop_ring.dropped;
+        ring["gaps"]      = snap->gaps;
+        ring["snapshots"] = scan_snoop_published;
+
+        // DMA snoop: what the decoder made of the raw samples (live counters)
+        if (scan_snoop_from_dma) {
+            JsonObject cap      = doc["capture"].to<JsonObject>();
+            cap["running"]      = (bool)scan_cap_running;
+            cap["rate_khz"]     = scan_snoop_rate_khz;
+            cap["buffers"]      = scan_cap_done;
+            cap["overruns"]     = scan_cap_overruns;
+            cap["samples"]      = scan_capture.samples;
+            cap["lost_samples"] = scan_capture.lost;
+            cap["glitches"]     = scan_capture.glitches;
+        }
+
+        // Predictive Key Return, counted over the same snoop window
+        uint32_t hits      = scan_predict.hits;
+        uint32_t scored    = hits + scan_predict.misses;
+        JsonObject predict = doc["predict"].to<JsonObject>();
+        predict["enabled"] = scan_predict_on;
+        predict["hits"]    = hits;
+        predict["misses"]  = scan_predict.misses;
+        predict["cold"]    = scan_predict.cold;
+        predict["hit_pct"] = scored ? (float)(100.0 * hits / scored) : 0.0f;
+
         JsonArray addrs    = doc["addresses"].to<JsonArray>();
         for (int i = 0; i < 128; i++) {
-            if (scan_addr_histogram[i] > 0) {
-                JsonObject e = addrs.add<JsonObject>();
-                e["addr"]  = i;
-                e["count"] = scan_addr_histogram[i];
-                e["col"]   = (i >> 3) & 0x0F;
-                e["row"]   = i & 0x07;
+            if (snap->visits[i] > 0) {
+                JsonObject e  = addrs.add<JsonObject>();
+                e["addr"]     = i;
+                e["count"]    = snap->visits[i];
+                e["asserted"] = snap->asserted[i];
+                e["time_us"]  = (uint32_t)(snap->cycles[i] / SCAN_CPU_MHZ);
+                e["col"]      = (i >> 3) & 0x0F;
+                e["row"]      = i & 0x07;
             }
         }
+        scanSnoopRelease();
+        String out;
+        serializeJson(doc, out);
+        server.send(200, "application/json", out);
+    });
+
+    // Scan frame analytics — frames rebuilt while snooping, from the latest snapshot
+    server.on("/api/scan/frames", HTTP_GET, []() {
+        if (!isAuthenticated()) { sendUnauthorized(); return; }
+        const ScanSnoopStats *snap = scanSnoopAcquire();
+        if (!snap) {
+            server.send(409, "application/json", "{\"error\":\"Start snoop first\"}");
+            return;
+        }
+        const ScanFrameStats &fs = snap->frames;
+        JsonDocument doc;
+        doc["snooping"] = scan_snoop_mode || scan_snoop_dma;
+        doc["source"]   = scan_snoop_from_dma ? "dma" : "loop";
+
+        uint32_t frames      = fs.frames;
+        JsonObject period    = doc["period"].to<JsonObject>();
+        period["frames"]     = frames;
+        period["min_cycles"] = frames ? fs.period_min : 0;
+        period["avg_cycles"] = frames ? (uint32_t)(fs.period_sum / frames) : 0;
+        period["max_cycles"] = fs.period_max;
+        period["avg_us"]     = frames ? (float)fs.period_sum / frames / SCAN_CPU_MHZ : 0.0f;
+
+        JsonObject jitter = doc["jitter"].to<JsonObject>();
+        jitter["samples"] = fs.jitter_n;
+        jitter["p50_us"]  = (float)scanFrameStatsJitter(fs, 50) / SCAN_CPU_MHZ;
+        jitter["p90_us"]  = (float)scanFrameStatsJitter(fs, 90) / SCAN_CPU_MHZ;
+        jitter["p99_us"]  = (float)scanFrameStatsJitter(fs, 99) / SCAN_CPU_MHZ;
+        jitter["p999_us"] = (float)scanFrameStatsJitter(fs, 99.9) / SCAN_CPU_MHZ;
+        jitter["max_us"]  = (float)fs.jitter_max / SCAN_CPU_MHZ;
+
+        // Order of the last complete frame and how often it repeats
+        char sig[11];
+        snprintf(sig, sizeof(sig), "0x%08lX", (unsigned long)fs.last_sig);
+        uint16_t len       = fs.last_len;
+        JsonObject order   = doc["order"].to<JsonObject>();
+        order["signature"] = sig;
+        order["length"]    = len;
+        order["repeats"]   = fs.sig_repeats;
+        order["changes"]   = fs.sig_changes;
+        JsonArray seq      = order["sequence"].to<JsonArray>();
+        for (int i = 0; i < len && i < SCAN_ADDR_COUNT; i++) seq.add(fs.order[fs.cur ^ 1][i]);
+
+        // Per-address dwell, CPU cycles (the held end address includes the gap)
+        JsonArray dwell = doc["dwell"].to<JsonArray>();
+        for (int i = 0; i < SCAN_ADDR_COUNT; i++) {
+            uint32_t n = fs.dwell_n[i];
+            if (n == 0) continue;
+            JsonObject e = dwell.add<JsonObject>();
+            e["addr"]    = i;
+            e["n"]       = n;
+            e["min"]     = fs.dwell_min[i];
+            e["avg"]     = (uint32_t)(fs.dwell_sum[i] / n);
+            e["max"]     = fs.dwell_max[i];
+        }
+        scanSnoopRelease();
+        String out;
+        serializeJson(doc, out);
+        server.send(200, "application/json", out);
+    });
+
+    // Bus trace — start/stop capture. {"enable":true,"kb":32} (re)allocates
+    // the ring and starts over; {"enable":false,"free":true} also returns
+    // the memory.
+    server.on("/api/scan/trace", HTTP_POST, []() {
+        if (!isAuthenticated()) { sendUnauthorized(); return; }
+        JsonDocument doc;
+        deserializeJson(doc, server.arg("plain"));
+        bool enable   = doc["enable"] | false;
+        scan_trace_on = false;
+        vTaskDelay(pdMS_TO_TICKS(2)); // Let the loop finish a record in flight
+        if (!enable) {
+            if (doc["free"] | false) {
+                heap_caps_free(scan_trace_buf);
+                scan_trace_buf   = NULL;
+                scan_trace_bytes = 0;
+                memset(&scan_trace, 0, sizeof(scan_trace));
+            }
+            server.send(200, "application/json", "{\"ok\":true,\"message\":\"Trace stopped\"}");
+            return;
+        }
+        uint32_t kb = doc["kb"] | SCAN_TRACE_DEFAULT_KB;
+        if (kb < 1) kb = 1;
+        if (kb > SCAN_TRACE_MAX_KB) kb = SCAN_TRACE_MAX_KB;
+        uint32_t bytes = kb * 1024;
+        if (bytes != scan_trace_bytes) {
+            heap_caps_free(scan_trace_buf);
+            memset(&scan_trace, 0, sizeof(scan_trace));
+            scan_trace_buf   = (uint8_t *)heap_caps_malloc(bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+            scan_trace_bytes = scan_trace_buf ? bytes : 0;
+        }
+        if (!scan_trace_buf) {
+            server.send(503, "application/json", "{\"error\":\"Not enough internal RAM for trace\"}");
+            return;
+        }
+        scanTraceStart(scan_trace, scan_trace_buf, scan_trace_bytes, esp_cpu_get_ccount());
+        scan_trace_on = true;
+        if (scan_task_handle) xTaskNotifyGive(scan_task_handle); // Tracing needs the loop running
+        ESP_LOGI(TAG, "[SCAN] Trace started (%u KB)", (unsigned)kb);
+        server.send(200, "application/json", "{\"ok\":true,\"message\":\"Trace started\"}");
+    });
+
+    // Bus trace — stop capture and download it (decode with tools/scan_trace)
+    server.on("/api/scan/trace", HTTP_GET, []() {
+        if (!isAuthenticated()) { sendUnauthorized(); return; }
+        if (!scan_trace_buf || !scan_trace.blocks) {
+            server.send(404, "application/json", "{\"error\":\"No trace captured\"}");
+            return;
+        }
+        scan_trace_on = false;
+        vTaskDelay(pdMS_TO_TICKS(2));
+        ScanTraceFile hdr;
+        scanTraceFileHeader(scan_trace, hdr);
+        server.sendHeader("Content-Disposition", "attachment; filename=\"keybridge-trace.bin\"");
+        server.setContentLength(sizeof(hdr) + (size_t)hdr.blocks * SCAN_TRACE_BLOCK);
+        server.send(200, "application/octet-stream", "");
+        server.sendContent((const char *)&hdr, sizeof(hdr));
+        for (uint32_t i = 0; i < hdr.blocks; i++) {
+            server.sendContent((const char *)scanTraceBlockOrdered(scan_trace, i), SCAN_TRACE_BLOCK);
+        }
+    });
+
+    // Scan engine counters
+    server.on("/api/scan/stats", HTTP_GET, []() {
+        if (!isAuthenticated()) { sendUnauthorized(); return; }
+        JsonDocument doc;
+        doc["layout"] = scanLayoutName(scan_core.layout.kind);
+        doc["mode"]   = scan_isolated ? "isolated" : "shared";
+
+        int64_t up_us      = esp_timer_get_time() - scan_task_start_us;
+        uint64_t parked    = scan_parked_us;
+        JsonObject park    = doc["park"].to<JsonObject>();
+        park["parked"]     = (bool)scan_parked;
+        park["count"]      = scan_park_count;
+        park["parked_ms"]  = (uint32_t)(parked / 1000);
+        park["uptime_ms"]  = (uint32_t)(up_us / 1000);
+        park["parked_pct"] = up_us > 0 ? (float)(100.0 * parked / up_us) : 0.0f;
+
+        JsonObject frames   = doc["frames"].to<JsonObject>();
+        frames["seen"]      = scan_frame.frames;
+        frames["missed"]    = scan_frame.frames_missed;
+        frames["period_us"] = scan_frame.period_cycles / SCAN_CPU_MHZ;
+        frames["sweep_us"]  = scan_frame.sweep_cycles / SCAN_CPU_MHZ;
+        frames["locked"]    = scan_frame.locked >= 4;
+
+        JsonObject yields   = doc["yields"].to<JsonObject>();
+        yields["gap"]       = scan_gap_yields;
+        yields["forced"]    = scan_forced_yields;
+        yields["gap_ms"]    = (uint32_t)(scan_yield_us / 1000);
+        yields["budget_us"] = SCAN_YIELD_MAX_US;
+
+        JsonObject jitter       = doc["jitter"].to<JsonObject>();
+        jitter["max_gap_us"]    = (float)scan_jitter.max_cycles / SCAN_CPU_MHZ;
+        jitter["gaps_over_1us"] = scan_jitter.over_1us;
+        jitter["gaps_over_6us"] = scan_jitter.over_dwell;
+
+        // Interrupts per core next to the gaps they cause: isolated mode
+        // keeps tasks off the scan core, not these (see Core placement)
+        BaseType_t scan_cpu = scan_isolated ? SCAN_CORE_ISOLATED : SCAN_CORE_SHARED;
+        JsonArray irq       = doc["irq"].to<JsonArray>();
+        for (int c = 0; c < 2; c++) {
+            JsonObject o = irq.add<JsonObject>();
+            o["core"]    = c;
+            o["scan"]    = c == scan_cpu;
+            o["tick"]    = scan_irq_ticks[c];
+            o["edge"]    = c == scan_cpu ? scan_edge.entries : 0;
+        }
+
+        // Frame-synchronized key commits, the press latch and the rollover shaper (ScanKeyStage)
+        int latched = 0;
+        for (int i = 0; i < SCAN_KEY_WORDS; i++) latched += __builtin_popcount(key_stage.hold[i]);
+        JsonObject keys      = doc["keys"].to<JsonObject>();
+        keys["commits"]      = key_stage.commits;
+        keys["deferred"]     = key_stage.deferred;
+        keys["pending"]      = scanKeyPending(key_stage);
+        keys["latch_frames"] = key_stage.latch_frames;
+        keys["latched"]      = latched;
+        keys["saved"]        = key_stage.saved;
+        keys["rollover"]     = key_stage.rollover;
+        keys["queue"]        = key_stage.queue_n;
+        keys["queue_max"]    = key_stage.queue_max;
+        keys["queued"]       = key_stage.queued;
+        keys["dropped"]      = key_stage.dropped;
+        JsonObject sources   = keys["sources"].to<JsonObject>(); // Keys held per layer
+        for (int src = 0; src < KEY_SRC_COUNT; src++) {
+            int n = 0;
+            for (int i = 0; i < SCAN_KEY_WORDS; i++) n += __builtin_popcount(key_stage.layers[src][i]);
+            sources[KEY_SRC_NAMES[src]] = n;
+        }
+
+        JsonObject settle   = doc["settle"].to<JsonObject>();
+        settle["window_ns"] = scan_settle.window * 1000 / SCAN_CPU_MHZ;
+        settle["accepted"]  = scan_settle.accepted;
+        settle["rejected"]  = scan_settle.rejected;
+
+        JsonObject flash       = doc["flash"].to<JsonObject>();
+        flash["resident"]      = scan_resident;
+        flash["writes"]        = scan_flash_ops;
+        flash["forced"]        = scan_flash_forced;
+        flash["wait_ms"]       = scan_flash_wait_ms;
+        flash["stalls"]        = scan_flash_stalls;
+        flash["unsafe_stalls"] = scan_flash_unsafe;
+        flash["max_stall_us"]  = (float)scan_flash_max_gap / SCAN_CPU_MHZ;
+
+        JsonObject trace = doc["trace"].to<JsonObject>();
+        trace["on"]      = (bool)scan_trace_on;
+        trace["kb"]      = scan_trace_bytes / 1024;
+        trace["runs"]    = scan_trace.runs;
+        trace["blocks"]  = scanTraceValidBlocks(scan_trace);
+        trace["dropped"] = scan_trace.written - scanTraceValidBlocks(scan_trace);
+
+        // Response mode and the scan core time it costs. Polling holds the
+        // core except while parked or yielding; edge-triggered holds it
+        // only inside the handler, plus the vector/context cost per entry.
+        JsonObject resp   = doc["response"].to<JsonObject>();
+        resp["mode"]      = scan_edge_on ? "edge" : "poll";
+        resp["requested"] = scan_edge_req ? "edge" : "poll";
+        if (scan_edge_status != ESP_OK) resp["error"] = esp_err_to_name(scan_edge_status);
+        if (scan_edge_on) {
+            int64_t span_us = esp_timer_get_time() - scan_edge_since_us;
+            uint64_t busy   = scan_edge.busy + (uint64_t)scan_edge.entries * SCAN_EDGE_DISPATCH_CYCLES;
+            resp["cpu_pct"] = span_us > 0 ? (float)(100.0 * busy / SCAN_CPU_MHZ / span_us) : 0.0f;
+        } else {
+            uint64_t idle   = parked + scan_yield_us;
+            resp["cpu_pct"] = up_us > 0 && (uint64_t)up_us > idle ? (float)(100.0 * (up_us - idle) / up_us) : 0.0f;
+        }
+        JsonObject edge    = resp["edge"].to<JsonObject>();
+        edge["armed"]      = (bool)scan_edge_armed;
+        edge["entries"]    = scan_edge.entries;
+        edge["changes"]    = scan_edge.changes;
+        edge["spurious"]   = scan_edge.spurious;
+        edge["rereads"]    = scan_edge.rereads;
+        edge["missed"]     = scan_edge.missed;
+        JsonObject service = edge["service_us"].to<JsonObject>();
+        service["p50"]     = (float)scanLog2Percentile(scan_edge.lat_hist, scan_edge.lat_max, 50) / SCAN_CPU_MHZ;
+        service["p99"]     = (float)scanLog2Percentile(scan_edge.lat_hist, scan_edge.lat_max, 99) / SCAN_CPU_MHZ;
+        service["max"]     = (float)scan_edge.lat_max / SCAN_CPU_MHZ;
+        String out;
+        serializeJson(doc, out);
+        server.send(200, "application/json", out);
+    });
+
+    // Switch the response mode live: "poll" (the scan loop) or "edge"
+    // (address-line interrupt). The scan task does the switch; a polling
+    // loop notices at its next address change or forced yield, so with
+    // the terminal off and the core isolated the switch stays pending.
+    server.on("/api/scan/mode", HTTP_POST, []() {
+        if (!isAuthenticated()) { sendUnauthorized(); return; }
+        JsonDocument doc;
+        if (deserializeJson(doc, server.arg("plain"))) {
+            server.send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
+            return;
+        }
+        const char *resp = doc["response"] | "";
+        bool edge        = strcmp(resp, "edge") == 0;
+        if (!edge && strcmp(resp, "poll") != 0) {
+            server.send(400, "application/json", "{\"error\":\"response must be poll or edge\"}");
+            return;
+        }
+        if (edge) scan_edge_status = ESP_OK;
+        scan_edge_req = edge;
+        if (scan_task_handle) xTaskNotifyGive(scan_task_handle);
+        for (int i = 0; i < 50 && scan_edge_on != edge && scan_edge_req == edge; i++) vTaskDelay(pdMS_TO_TICKS(10));
+
+        JsonDocument res;
+        if (edge && scan_edge_status != ESP_OK) {
+            res["error"] = String("Edge-triggered response failed: ") + esp_err_to_name(scan_edge_status);
+            String out;
+            serializeJson(res, out);
+            server.send(500, "application/json", out);
+            return;
+        }
+        res["ok"]       = true;
+        res["response"] = scan_edge_on ? "edge" : "poll";
+        res["pending"]  = scan_edge_on != edge;
+        if (edge && scan_isolated) res["warning"] = "Isolated core: edge mode puts an interrupt on it per address";
+        String out;
+        serializeJson(res, out);
+        server.send(200, "application/json", out);
+    });
+
+    // Reset scan jitter counters (compare modes / load conditions)
+    server.on("/api/scan/stats/reset", HTTP_POST, []() {
+        if (!isAuthenticated()) { sendUnauthorized(); return; }
+        scan_jitter.max_cycles = 0;
+        scan_jitter.over_1us   = 0;
+        scan_jitter.over_dwell = 0;
+        scan_flash_stalls      = 0;
+        scan_flash_unsafe      = 0;
+        scan_flash_max_gap     = 0;
+        scan_settle.accepted   = 0;
+        scan_settle.rejected   = 0;
+        memset(scan_jitter.hist, 0, sizeof(scan_jitter.hist));
+        scanStallReset(scan_stall_top);
+        scanStallRefreshTasks();
+        scan_edge.entries  = 0; // Counters only: addr and bus_bits belong to the handler
+        scan_edge.changes  = 0;
+        scan_edge.spurious = 0;
+        scan_edge.rereads  = 0;
+        scan_edge.missed   = 0;
+        scan_edge.busy     = 0;
+        scan_edge.lat_max  = 0;
+        memset(scan_edge.lat_hist, 0, sizeof(scan_edge.lat_hist));
+        scan_edge_since_us = esp_timer_get_time();
+        scan_irq_ticks[0]  = 0;
+        scan_irq_ticks[1]  = 0;
+        server.send(200, "application/json", "{\"ok\":true}");
+    });
+
+    // Stall profiler — log2 histogram of sample gaps and the worst stalls
+    // with their cause (reset together with /api/scan/stats)
+    server.on("/api/scan/stalls", HTTP_GET, []() {
+        if (!isAuthenticated()) { sendUnauthorized(); return; }
+        ScanStallTop top = scan_stall_top; // Copy: the loop may insert meanwhile
+        uint32_t hist[SCAN_GAP_BINS];
+        memcpy(hist, (const void *)scan_jitter.hist, sizeof(hist));
+
+        JsonDocument doc;
+        uint64_t samples = 0;
+        for (int i = 0; i < SCAN_GAP_BINS; i++) samples += hist[i];
+        doc["samples"]    = samples;
+        doc["max_gap_us"] = (float)scan_jitter.max_cycles / SCAN_CPU_MHZ;
+        JsonArray bins    = doc["histogram"].to<JsonArray>();
+        for (int i = 0; i < SCAN_GAP_BINS; i++) {
+            if (!hist[i]) continue;
+            JsonObject b    = bins.add<JsonObject>();
+            b["min_cycles"] = 1UL << i;
+            b["min_us"]     = (float)(1UL << i) / SCAN_CPU_MHZ;
+            b["count"]      = hist[i];
+        }
+
+        // Worst first
+        JsonArray worst = doc["top"].to<JsonArray>();
+        bool taken[SCAN_STALL_TOP] = {false};
+        for (int k = 0; k < top.n; k++) {
+            int w = -1;
+            for (int i = 0; i < top.n; i++) {
+                if (!taken[i] && (w < 0 || top.e[i].gap > top.e[w].gap)) w = i;
+            }
+            taken[w]           = true;
+            const ScanStall &e = top.e[w];
+            JsonObject o       = worst.add<JsonObject>();
+            o["gap_us"]        = (float)e.gap / SCAN_CPU_MHZ;
+            o["at_ms"]         = e.at_ms;
+            o["addr"]          = e.addr;
+            o["cause"]         = scanStallCauseName(e.cause);
+            if (e.cause == SCAN_STALL_TASK) o["task"] = e.who;
+        }
+
+        // Tasks a stall can be blamed on
+        const ScanStallTasks &c = scan_stall_tasks[scan_stall_tasks_cur];
+        JsonArray tasks         = doc["candidates"].to<JsonArray>();
+        for (int i = 0; i < c.n; i++) tasks.add(pcTaskGetName(c.h[i]));
         String out;
         serializeJson(doc, out);
         server.send(200, "application/json", out);
@@ -1119,10 +2617,10 @@ void startWebServer() {
             return;
         }
         if (duration > 5000) duration = 5000;
-        scanKeyPress(addr);
+        scanKeyPress(KEY_SRC_TEST, addr);
         server.send(200, "application/json", "{\"ok\":true}");
         delay(duration);
-        scanKeyRelease(addr);
+        scanKeyRelease(KEY_SRC_TEST, addr);
     });
 
     // Scan sweep — test a range of addresses sequentially
@@ -1138,14 +2636,221 @@ void startWebServer() {
         server.send(200, "application/json", "{\"ok\":true,\"message\":\"Sweep started\"}");
         for (uint8_t addr = start; addr <= end && addr < 128; addr++) {
             logKey("[SCAN] addr=0x%02X (col=%d row=%d)", addr, (addr >> 3) & 0x0F, addr & 0x07);
-            scanKeyPress(addr);
+            scanKeyPress(KEY_SRC_SWEEP, addr);
             delay(hold_ms);
-            scanKeyRelease(addr);
+            scanKeyRelease(KEY_SRC_SWEEP, addr);
             delay(gap_ms);
         }
         logKey("[SCAN] Sweep complete");
     });
 
+    // Release every key one source holds ({"source":"sweep"}), or all of them
+    server.on("/api/scan/release", HTTP_POST, []() {
+        if (!isAuthenticated()) { sendUnauthorized(); return; }
+        JsonDocument doc;
+        deserializeJson(doc, server.arg("plain"));
+        const char *name = doc["source"] | "";
+        if (!*name) {
+            scanReleaseAll();
+            server.send(200, "application/json", "{\"ok\":true}");
+            return;
+        }
+        for (int src = 0; src < KEY_SRC_COUNT; src++) {
+            if (strcmp(name, KEY_SRC_NAMES[src]) != 0) continue;
+            scanReleaseSource(src);
+            server.send(200, "application/json", "{\"ok\":true}");
+            return;
+        }
+        server.send(400, "application/json",
+                    "{\"ok\":false,\"error\":\"source must be bt, usb, test, sweep or text\"}");
+    });
+
+    // Type text into the terminal ({"text":"...","hold_frames":3,"gap_frames":3})
+    server.on("/api/text", HTTP_POST, []() {
+        if (!isAuthenticated()) { sendUnauthorized(); return; }
+        JsonDocument doc;
+        deserializeJson(doc, server.arg("plain"));
+        const char *text = doc["text"] | "";
+        int hold         = doc["hold_frames"] | TEXT_HOLD_FRAMES;
+        int gap          = doc["gap_frames"] | TEXT_GAP_FRAMES;
+        size_t len       = strlen(text);
+        if (!len || len > TEXT_MAX_BYTES) {
+            server.send(400, "application/json", "{\"ok\":false,\"error\":\"text must be 1-8192 bytes\"}");
+            return;
+        }
+        if (hold < 1 || hold > 16 || gap < 1 || gap > 16) {
+            server.send(400, "application/json",
+                        "{\"ok\":false,\"error\":\"hold_frames and gap_frames must be 1-16\"}");
+            return;
+        }
+        if (textBusy()) {
+            server.send(409, "application/json", "{\"ok\":false,\"error\":\"already typing\"}");
+            return;
+        }
+        textStart(text, (uint8_t)hold, (uint8_t)gap);
+        server.send(200, "application/json", "{\"ok\":true}");
+    });
+
+    // Progress and rate of the text being typed, or the last one
+    server.on("/api/text", HTTP_GET, []() {
+        if (!isAuthenticated()) { sendUnauthorized(); return; }
+        bool busy       = textBusy();
+        uint32_t ms     = (busy ? millis() : text_end_ms) - text_start_ms;
+        uint32_t frames = (busy ? scan_frame.frames : text_end_frames) - text_start_frames;
+        JsonDocument doc;
+        doc["state"]           = text_job.phase == TEXT_OFF ? "idle" : busy ? "typing" : text_end;
+        doc["bytes"]           = text_job.len;
+        doc["done"]            = text_job.pos;
+        doc["typed"]           = text_job.typed;
+        doc["skipped"]         = text_job.skipped;
+        doc["hold_frames"]     = text_job.hold_frames;
+        doc["gap_frames"]      = text_job.gap_frames;
+        doc["ms"]              = ms;
+        doc["chars_per_sec"]   = ms ? text_job.typed * 1000.0f / ms : 0.0f;
+        doc["frames_per_char"] = text_job.typed ? (float)frames / text_job.typed : 0.0f;
+        String out;
+        serializeJson(doc, out);
+        server.send(200, "application/json", out);
+    });
+
+    // Stop typing; a key that is down comes up
+    server.on("/api/text/cancel", HTTP_POST, []() {
+        if (!isAuthenticated()) { sendUnauthorized(); return; }
+        if (textBusy()) textStop("cancelled");
+        server.send(200, "application/json", "{\"ok\":true}");
+    });
+
+    // Keymap blobs in the keymaps partition, and which one is in use
+    server.on("/api/keymaps", HTTP_GET, []() {
+        if (!isAuthenticated()) { sendUnauthorized(); return; }
+        JsonDocument doc;
+        doc["active"]        = keymap_active_slot < 0 ? "" : keyBlobHeader(keymapSlot(keymap_active_slot))->name;
+        doc["builtin_rules"] = WYSE50_RULE_COUNT;
+        JsonArray slots      = doc["slots"].to<JsonArray>();
+        for (int i = 0; keymap_flash && i < keymap_slots; i++) {
+            const uint8_t *blob = keymapSlot(i);
+            KeyBlobError e      = keyBlobCheck(blob, KEY_BLOB_SLOT_SIZE);
+            JsonObject o        = slots.add<JsonObject>();
+            o["slot"]           = i;
+            if (e != KEY_BLOB_OK) {
+                o["state"] = KEY_BLOB_ERRORS[e];
+                continue;
+            }
+            const KeyBlobHeader *h = keyBlobHeader(blob);
+            o["name"]              = h->name;
+            o["terminal"]          = h->terminal;
+            o["rules"]             = h->n_rules;
+            o["bytes"]             = h->length;
+        }
+        String out;
+        serializeJson(doc, out);
+        server.send(200, "application/json", out);
+    });
+
+    // Upload a blob from tools/keymap_compile as the raw request body
+    // (Content-Type: application/octet-stream). It replaces the slot with
+    // the same name, else takes an empty one; select it by name with
+    // terminal.keymap in /api/config.
+    server.on(
+        "/api/keymap", HTTP_POST,
+        []() {
+            uint8_t *blob = keymap_upload;
+            size_t len    = keymap_upload_len;
+            bool over     = keymap_upload_over;
+            keymap_upload = NULL;
+            if (!isAuthenticated()) {
+                free(blob);
+                sendUnauthorized();
+                return;
+            }
+            if (!keymap_flash) {
+                free(blob);
+                server.send(503, "application/json", "{\"ok\":false,\"error\":\"No keymaps partition\"}");
+                return;
+            }
+            if (!blob || !len || over) {
+                free(blob);
+                server.send(400, "application/json",
+                            "{\"ok\":false,\"error\":\"Body must be one keymap blob of at most 8 KB\"}");
+                return;
+            }
+            KeyMap *scratch = (KeyMap *)malloc(sizeof(KeyMap));
+            KeyBlobError e  = scratch ? keyBlobVerify(blob, len, *scratch) : KEY_BLOB_LENGTH_BAD;
+            free(scratch);
+            if (e != KEY_BLOB_OK) {
+                free(blob);
+                JsonDocument doc;
+                doc["ok"]    = false;
+                doc["error"] = KEY_BLOB_ERRORS[e];
+                String out;
+                serializeJson(doc, out);
+                server.send(400, "application/json", out);
+                return;
+            }
+            char name[KEY_BLOB_NAME_LEN];
+            strlcpy(name, keyBlobHeader(blob)->name, sizeof(name));
+            int slot = keymapFind(name);
+            for (int i = 0; slot < 0 && i < keymap_slots; i++) {
+                if (keyBlobCheck(keymapSlot(i), KEY_BLOB_SLOT_SIZE) != KEY_BLOB_OK) slot = i;
+            }
+            if (slot < 0) {
+                free(blob);
+                server.send(507, "application/json", "{\"ok\":false,\"error\":\"All keymap slots in use\"}");
+                return;
+            }
+            bool ok = keymapWrite(slot, blob, len);
+            free(blob);
+            if (!ok) {
+                server.send(500, "application/json", "{\"ok\":false,\"error\":\"Flash write failed\"}");
+                return;
+            }
+            logKey("[Keymap] Stored %s in slot %d", name, slot);
+            JsonDocument doc;
+            doc["ok"]     = true;
+            doc["slot"]   = slot;
+            doc["name"]   = name;
+            doc["active"] = keymap_active_slot == slot;
+            String out;
+            serializeJson(doc, out);
+            server.send(200, "application/json", out);
+        },
+        []() {
+            HTTPRaw &raw = server.raw();
+            if (raw.status == RAW_START) {
+                free(keymap_upload);
+                keymap_upload      = isAuthenticated() ? (uint8_t *)malloc(KEY_BLOB_SLOT_SIZE) : NULL;
+                keymap_upload_len  = 0;
+                keymap_upload_over = false;
+            } else if (raw.status == RAW_WRITE) {
+                if (!keymap_upload || keymap_upload_len + raw.currentSize > KEY_BLOB_SLOT_SIZE) {
+                    keymap_upload_over = true;
+                    return;
+                }
+                memcpy(keymap_upload + keymap_upload_len, raw.buf, raw.currentSize);
+                keymap_upload_len += raw.currentSize;
+            } else if (raw.status == RAW_ABORTED) {
+                free(keymap_upload);
+                keymap_upload = NULL;
+            }
+        });
+
+    // Erase a keymap blob by name ({"name":"wyse50-uk"})
+    server.on("/api/keymap/erase", HTTP_POST, []() {
+        if (!isAuthenticated()) { sendUnauthorized(); return; }
+        JsonDocument doc;
+        deserializeJson(doc, server.arg("plain"));
+        int slot = keymapFind(doc["name"] | "");
+        if (slot < 0) {
+            server.send(404, "application/json", "{\"ok\":false,\"error\":\"No keymap by that name\"}");
+            return;
+        }
+        if (!keymapWrite(slot, NULL, 0)) {
+            server.send(500, "application/json", "{\"ok\":false,\"error\":\"Flash erase failed\"}");
+            return;
+        }
+        server.send(200, "application/json", "{\"ok\":true}");
+    });
+
     // Login
     server.on("/api/login", HTTP_POST, []() {
         JsonDocument doc;
@@ -1189,7 +2894,9 @@ void startWebServer() {
 
         // Empty new password = remove password (disable auth)
         if (strlen(newpass) == 0) {
+            scanFlashBegin();
             clearAdminPass();
+            scanFlashEnd();
             server.send(200, "application/json", "{\"ok\":true}");
             return;
         }
@@ -1200,7 +2907,9 @@ void startWebServer() {
             return;
         }
         strlcpy(admin_password, newpass, sizeof(admin_password));
+        scanFlashBegin();
         saveAdminPass();
+        scanFlashEnd();
 
         // Create a session so the user stays logged in
         const char *token = createSession();
@@ -1277,12 +2986,19 @@ extern "C" void app_main() {
     loadAdminPass();
 
     initKeyMap();
+    keymapMount();
+    keymapSelect(config.keymap);
     setupScanPins();
 
-    // Start scan response on core 0.
+    // Start scan response on core 0 (shared) or core 1 (isolated).
     // Priority must be BELOW the BT controller (23) to avoid starving
     // the link-layer during ACL connection setup (ld_acl.c assertions).
-    xTaskCreatePinnedToCore(scan_response_task, "scan", 4096, NULL, 20, NULL, 0);
+    scan_isolated = config.scan_isolated_core;
+    scan_edge_req = config.scan_edge;
+    xTaskCreatePinnedToCore(scan_response_task, "scan", 4096, NULL, SCAN_TASK_PRIORITY, &scan_task_handle,
+                            scan_isolated ? SCAN_CORE_ISOLATED : SCAN_CORE_SHARED);
+    esp_register_freertos_tick_hook_for_cpu(scanTickHook0, SYSTEM_CORE);
+    esp_register_freertos_tick_hook_for_cpu(scanTickHook1, APP_CORE);
 
     ESP_LOGI(TAG, "========================================");
     ESP_LOGI(TAG, " KeyBridge  v5.0");
@@ -1318,6 +3034,7 @@ extern "C" void app_main() {
     static uint32_t lastHeartbeat = 0;
     while (true) {
         // Process key events
+        textPoll();
         KeyReport report;
         while (xQueueReceive(keyQueue, &report, 0) == pdTRUE) {
             processHidReport(&report);
@@ -1340,6 +3057,7 @@ extern "C" void app_main() {
         // Periodic heartbeat (every 10 seconds)
         if (millis() - lastHeartbeat >= 10000) {
             lastHeartbeat = millis();
+            scanStallRefreshTasks(); // Pick up tasks the radios started
             ESP_LOGI(TAG, "[HEARTBEAT] heap=%lu stations=%d",
                      (unsigned long)esp_get_free_heap_size(),
                      WiFi.softAPgetStationNum());
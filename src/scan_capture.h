@@ -0,0 +1,121 @@
+/*
+ * scan_capture.h — Decode of DMA-captured scan-bus samples (portable)
+ *
+ * The DMA snoop engine (keybridge.cpp, I2S0 in camera mode) samples
+ * A0-A6 and Key Return at a fixed rate straight into memory, with no
+ * CPU involvement per sample. This module turns those raw samples into
+ * the same address-change records the scan loop pushes through the
+ * snoop ring (ScanRingRec) and applies them to ScanSnoopStats, so
+ * /api/scan/histogram and /api/scan/frames serve either source
+ * unchanged. No ESP-IDF dependencies: tools/capture_sim runs it
+ * against synthetic DMA buffers.
+ *
+ * Sample: bits 0-6 = A0-A6, bit 7 = Key Return as driven.
+ *
+ * DMA layout (I2S rx_fifo_mod 1, lines on I2S0I_DATA_IN0..7, the same
+ * arrangement esp32-camera calls SM_0A0B_0C0D): every 32-bit word holds
+ * two samples, the earlier in bits 16-23 and the later in bits 0-7.
+ */
+
+#ifndef SCAN_CAPTURE_H
+#define SCAN_CAPTURE_H
+
+#include "scan_core.h"
+
+#define SCAN_CAP_KEY_RETURN 0x80
+#define SCAN_CAP_MIN_RUN    2 // Samples an address must hold to count (drops mid-transition mixes)
+
+struct ScanCapture {
+    uint32_t cycles_per_sample; // Timestamps stay in CPU cycles, like the scan loop's
+    uint32_t ts;                // Time of the next sample
+    uint8_t cand;               // Address the latest samples show...
+    uint8_t run;                // ...for this many samples (saturating)
+    uint32_t cand_ts;           // ...starting here
+    uint8_t cur;                // Accepted address (0xFF = none)
+    bool cur_kr;                // Key Return on cur's latest sample
+    bool pending;               // rec is accepted but waits for its Key Return level
+    bool broken;                // Samples lost since the last record
+    ScanRingRec rec;
+    ScanFrameTracker ft;
+
+    uint64_t samples;
+    uint32_t glitches; // Candidates dropped before holding SCAN_CAP_MIN_RUN samples
+    uint64_t lost;     // Samples missing from overrun buffers
+};
+
+static inline void scanCaptureInit(ScanCapture &c, uint32_t cycles_per_sample) {
+    memset(&c, 0, sizeof(c));
+    c.cycles_per_sample = cycles_per_sample ? cycles_per_sample : 1;
+    c.cand              = 0xFF;
+    c.cur               = 0xFF;
+    c.broken            = true;
+    scanFrameReset(c.ft);
+}
+
+// Hand over the previous address's record (its Key Return level is the
+// one on its last sample, where the terminal samples it) and open one
+// for the candidate
+static inline void scanCaptureAccept(ScanCapture &c, ScanSnoopStats &out) {
+    if (c.pending) {
+        if (c.cur_kr) c.rec.flags |= SCAN_REC_KEY;
+        scanSnoopApply(out, c.rec);
+    }
+    bool wrap      = scanFrameChange(c.ft, c.cand, c.cand_ts);
+    c.rec.ts       = c.cand_ts;
+    c.rec.addr     = c.cand;
+    c.rec.flags    = (wrap ? SCAN_REC_WRAP : 0) | (c.broken ? SCAN_REC_GAP : 0);
+    c.rec.reserved = 0;
+    c.pending      = true;
+    c.broken       = false;
+    c.cur          = c.cand;
+    c.cur_kr       = false;
+}
+
+static inline void scanCaptureSample(ScanCapture &c, uint8_t s, ScanSnoopStats &out) {
+    uint8_t addr = s & 0x7F;
+    if (addr != c.cand) {
+        if (c.run < SCAN_CAP_MIN_RUN && c.cand != c.cur) c.glitches++;
+        c.cand    = addr;
+        c.run     = 0;
+        c.cand_ts = c.ts;
+    }
+    if (c.run < UINT8_MAX) c.run++;
+    if (c.run == SCAN_CAP_MIN_RUN && addr != c.cur) scanCaptureAccept(c, out);
+    if (addr == c.cur) c.cur_kr = (s & SCAN_CAP_KEY_RETURN) != 0;
+    c.ts += c.cycles_per_sample;
+}
+
+// One completed DMA buffer of `words` 32-bit words, oldest first
+static inline void scanCaptureBuffer(ScanCapture &c, const uint32_t *buf, uint32_t words, ScanSnoopStats &out) {
+    for (uint32_t i = 0; i < words; i++) {
+        uint32_t w = buf[i];
+        scanCaptureSample(c, (uint8_t)(w >> 16), out);
+        scanCaptureSample(c, (uint8_t)w, out);
+    }
+    c.samples += (uint64_t)words * 2;
+}
+
+// `samples` never made it out of DMA (the decoder fell a buffer behind):
+// close what's open, skip the time, and flag the next record as a gap
+static inline void scanCaptureLost(ScanCapture &c, uint32_t samples, ScanSnoopStats &out) {
+    if (c.pending) {
+        if (c.cur_kr) c.rec.flags |= SCAN_REC_KEY;
+        scanSnoopApply(out, c.rec);
+        c.pending = false;
+    }
+    c.ts += samples * c.cycles_per_sample;
+    c.lost += samples;
+    c.broken = true;
+    c.cand   = 0xFF;
+    c.cur    = 0xFF;
+    c.run    = 0;
+    scanFrameSlept(c.ft);
+}
+
+// Build the DMA words for `n` samples (n even) — the inverse of
+// scanCaptureBuffer, for host checks
+static inline void scanCaptureEncode(const uint8_t *samples, uint32_t n, uint32_t *buf) {
+    for (uint32_t i = 0; i + 1 < n; i += 2) buf[i / 2] = (uint32_t)samples[i] << 16 | samples[i + 1];
+}
+
+#endif // SCAN_CAPTURE_H
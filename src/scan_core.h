@@ -0,0 +1,1425 @@
+/*
+ * scan_core.h — Hardware-independent Wyse 50 scan response core
+ *
+ * Address decode, key state lookup and the Key Return decision used
+ * by scan_response_task. Nothing in here touches ESP-IDF or Arduino,
+ * so the exact same code can be driven by the host-side bus simulator
+ * in tools/ (see tools/scan_sim.cpp).
+ *
+ * Per-sample work is branch-free: the GPIO_IN_REG word is split into
+ * four bytes, each byte indexes a 256-entry table built from the pin
+ * layout at startup, and the OR of the four results is the address.
+ * Key state is a packed 128-bit bitmap; the looked-up bit selects the
+ * W1TS/W1TC register to write.
+ *
+ * Common pin layouts skip the tables entirely: scanDispatch() hands the
+ * caller's loop a compile-time decoder for contiguous pins (one shift +
+ * mask) or the default J3 wiring (fixed four-run permutation), and only
+ * arbitrary layouts fall back to the table decoder.
+ *
+ * Everything the scan loop calls per sample is SCAN_INLINE (forced), so
+ * the loop compiles into one IRAM-resident function with no out-of-line
+ * helper left behind in flash (see SCAN_IRAM).
+ */
+
+#ifndef SCAN_CORE_H
+#define SCAN_CORE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define SCAN_ADDR_BITS  7   // A0-A6 from the terminal
+#define SCAN_ADDR_COUNT 128 // 2^SCAN_ADDR_BITS scan addresses
+#define SCAN_KEY_WORDS  (SCAN_ADDR_COUNT / 32)
+
+// All cycle figures assume the ESP32 running at 240 MHz
+#define SCAN_CPU_MHZ 240
+
+// Contiguous layouts with a specialized loop: A0 on GPIO 12 or 13, the
+// only starts with seven usable pins in a row. Lower ones overlap the
+// flash pins (6-11); from 14 up the run hits GPIO 20, 24 or 28-31, which
+// the ESP32 doesn't have. Each shift is another copy of the loop in IRAM.
+#define SCAN_SHIFT_MIN 12
+#define SCAN_SHIFT_MAX 13
+
+// Placement for the firmware scan path: code in IRAM, data in DRAM, so
+// a flash cache miss or cache-disabled window never stalls a sample.
+// Both are no-ops on the host.
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#define SCAN_IRAM IRAM_ATTR
+#define SCAN_DRAM DRAM_ATTR
+#else
+#define SCAN_IRAM
+#define SCAN_DRAM
+#endif
+#define SCAN_INLINE inline __attribute__((always_inline))
+
+// ============================================================
+// PACKED KEY BITMAP
+// ============================================================
+// One bit per scan address. Writers (HID processing, web API) use
+// atomic RMW so a press never tears a concurrent release in the same
+// word; the scan loop only ever does a single 32-bit load. Writers edit
+// the staged image, not the live one (see ScanKeyStage below).
+
+static inline void scanKeySet(volatile uint32_t *bits, uint8_t addr) {
+    __atomic_fetch_or(&bits[addr >> 5], 1UL << (addr & 31), __ATOMIC_RELAXED);
+}
+
+static inline void scanKeyClear(volatile uint32_t *bits, uint8_t addr) {
+    __atomic_fetch_and(&bits[addr >> 5], ~(1UL << (addr & 31)), __ATOMIC_RELAXED);
+}
+
+static SCAN_INLINE uint32_t scanKeyTest(const volatile uint32_t *bits, uint8_t addr) {
+    return (bits[addr >> 5] >> (addr & 31)) & 1;
+}
+
+static inline void scanKeyClearAll(volatile uint32_t *bits) {
+    for (int i = 0; i < SCAN_KEY_WORDS; i++) bits[i] = 0;
+}
+
+// True when no address is pressed (scan loop may park)
+static SCAN_INLINE bool scanKeysIdle(const volatile uint32_t *bits) {
+    return (bits[0] | bits[1] | bits[2] | bits[3]) == 0;
+}
+
+// ============================================================
+// FRAME-SYNCHRONIZED KEY COMMITS
+// ============================================================
+// Writers never touch the bitmap the scan engine answers from. They edit
+// a staged image between scanKeyEditBegin() and scanKeyEditEnd() — one
+// edit per HID report, so release, press and modifier changes travel
+// together — and the engine copies the staged image into its live one
+// at a frame boundary (scanKeyCommit). Every frame the terminal scans
+// then sees exactly one complete report.
+//
+// The copy is a seqlock read that never waits: an edit that was open,
+// or finished, while the engine copied leaves the live image alone and
+// the commit moves to the next boundary (`deferred`). Edits nest, and
+// any number of writers may edit at once.
+//
+// Key sources: the staged image is layered, one bitmap per source (each
+// keyboard, the test and sweep endpoints), and the commit ORs the layers
+// into the image the engine answers from. A source only ever writes its
+// own layer, so releasing a key in one never clears it in another, and a
+// source that goes away is dropped on its own (scanKeyStageClear). The
+// live image stays one flat bitmap: the scan loop's lookup is unchanged.
+//
+// Press latch: a press and its release can both land between two frame
+// starts (fast typing, batched BT reports), and the terminal would never
+// see the key. Every press the engine takes in is held in `hold` until
+// the engine has answered that address asserted in latch_frames frames
+// (scanKeySeen); the release applies at the boundary after that. Each
+// address latches on its own, so other keys commit as usual.
+//
+// Rollover shaper: the 8031 drops or misorders keys when too many are
+// down at once, so with `rollover` set at most that many non-modifier
+// keys are live in any frame. Every non-modifier press joins a queue in
+// press order (a re-press while the first is still queued gets its own
+// entry) and goes live from the front as slots free up; a live key
+// leaves once it has been seen latch_frames times and is released or
+// pressed again, so a press is delivered however short it was. A key
+// never goes live in the frame its address went up, so the terminal
+// sees a release between two presses. Each press carries the modifiers
+// of its report: when they differ from what the terminal sees, they
+// change one frame ahead of the key, and only once no live key still
+// needs the old ones. The queue stands in for `hold` as the latch.
+
+#define SCAN_KEY_MODS 8    // Modifier addresses (scanKeyModifier) a snapshot can carry
+#define SCAN_KEY_SOURCES 6 // Staged layers (key sources)
+
+struct ScanKeyQueued {
+    uint8_t addr;
+    uint8_t mods; // Modifier snapshot at press, bit n = mod_addr[n]
+    bool live;
+    bool waited;  // Counted in `queued` already
+};
+
+struct ScanKeyStage {
+    volatile uint32_t layers[SCAN_KEY_SOURCES][SCAN_KEY_WORDS]; // Staged image per source (scanKeyStagePress/Release)
+    volatile uint32_t presses[SCAN_KEY_WORDS];                  // Presses staged since the engine last took them
+    volatile uint32_t writers;                                  // Edits open
+    volatile uint32_t seq;                                      // Edits completed
+
+    // Scan engine only
+    uint32_t committed;                 // seq behind the live image
+    uint32_t image[SCAN_KEY_WORDS];     // Staged image as last committed
+    uint32_t hold[SCAN_KEY_WORDS];      // Latched: wanted whatever the image says
+    uint32_t done[SCAN_KEY_WORDS];      // ...seen enough, released at the next boundary
+    uint8_t seen[SCAN_ADDR_COUNT];      // Frames a latched address has been answered asserted
+    uint8_t latch_frames;               // 0 = no latch
+    bool expiring;                      // done has bits set
+    uint32_t commits;                   // Images swapped in
+    uint32_t deferred;                  // Boundaries an edit pushed to the next frame
+    uint32_t saved;                     // Presses released before the terminal could have seen them
+
+    // Rollover shaper (rollover = 0: off); hold = addresses of live entries
+    uint8_t rollover;                     // Non-modifier keys live at once
+    uint8_t n_mods;
+    uint8_t mod_addr[SCAN_KEY_MODS];
+    uint32_t mods[SCAN_KEY_WORDS];        // Modifier addresses, outside the cap
+    uint8_t live_mods;                    // Modifier snapshot the live image carries
+    ScanKeyQueued queue[SCAN_ADDR_COUNT]; // Presses not yet delivered, in press order
+    uint8_t in_queue[SCAN_ADDR_COUNT];    // Entries per address
+    uint8_t queue_n;
+    uint8_t queue_max;                    // Deepest queue seen
+    uint32_t queued;                      // Presses that had to wait for a slot
+    uint32_t dropped;                     // Presses turned away by a full queue
+};
+
+// A live key is held until seen, so rollover forces a latch of at least
+// one frame
+static inline void scanKeyStageInit(ScanKeyStage &s, uint8_t latch_frames, uint8_t rollover) {
+    memset((void *)&s, 0, sizeof(s));
+    s.rollover     = rollover;
+    s.latch_frames = latch_frames ? latch_frames : (rollover ? 1 : 0);
+}
+
+// Register a modifier address (before the scan engine starts)
+static inline void scanKeyModifier(ScanKeyStage &s, uint8_t addr) {
+    if (s.n_mods >= SCAN_KEY_MODS || addr >= SCAN_ADDR_COUNT) return;
+    s.mod_addr[s.n_mods++] = addr;
+    s.mods[addr >> 5] |= 1UL << (addr & 31);
+}
+
+static inline void scanKeyEditBegin(ScanKeyStage &s) {
+    __atomic_fetch_add(&s.writers, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void scanKeyEditEnd(ScanKeyStage &s) {
+    __atomic_fetch_add(&s.seq, 1, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&s.writers, 1, __ATOMIC_RELEASE);
+}
+
+// Inside an edit. A press of a key another source already holds is no
+// new keystroke for the terminal, so only the layer changes.
+static inline void scanKeyStagePress(ScanKeyStage &s, uint8_t src, uint8_t addr) {
+    bool held = false;
+    for (int l = 0; l < SCAN_KEY_SOURCES; l++) held |= l != src && scanKeyTest(s.layers[l], addr);
+    scanKeySet(s.layers[src], addr);
+    if (!held) scanKeySet(s.presses, addr);
+}
+
+static inline void scanKeyStageRelease(ScanKeyStage &s, uint8_t src, uint8_t addr) {
+    scanKeyClear(s.layers[src], addr);
+}
+
+// Release everything one source holds
+static inline void scanKeyStageClear(ScanKeyStage &s, uint8_t src) {
+    scanKeyClearAll(s.layers[src]);
+}
+
+// A completed edit, or a latch release, the live image doesn't reflect yet
+static SCAN_INLINE bool scanKeyPending(const ScanKeyStage &s) {
+    return s.seq != s.committed || s.expiring;
+}
+
+// Scan engine, after answering `addr` asserted on a new address: one more
+// frame in which a latched press was visible
+static SCAN_INLINE void scanKeySeen(ScanKeyStage &s, uint8_t addr) {
+    if (!scanKeyTest(s.hold, addr) || ++s.seen[addr] < s.latch_frames) return;
+    s.done[addr >> 5] |= 1UL << (addr & 31);
+    s.expiring = true;
+}
+
+static SCAN_INLINE uint8_t scanKeyModSnap(const ScanKeyStage &s, const uint32_t *img) {
+    uint8_t m = 0;
+    for (int i = 0; i < s.n_mods; i++) m |= scanKeyTest(img, s.mod_addr[i]) << i;
+    return m;
+}
+
+// New presses join the shaper's queue in address order within a report
+// (a report carries no order of its own)
+static SCAN_INLINE void scanKeyEnqueue(ScanKeyStage &s, const uint32_t *press, const uint32_t *img) {
+    uint8_t snap = scanKeyModSnap(s, img);
+    for (int i = 0; i < SCAN_KEY_WORDS; i++) {
+        for (uint32_t m = press[i] & ~s.mods[i]; m; m &= m - 1) {
+            uint8_t addr = (uint8_t)(i * 32 + __builtin_ctz(m));
+            if (s.queue_n >= SCAN_ADDR_COUNT) {
+                s.dropped++;
+                continue;
+            }
+            s.queue[s.queue_n++] = {addr, snap, false, false};
+            s.in_queue[addr]++;
+        }
+    }
+    if (s.queue_n > s.queue_max) s.queue_max = s.queue_n;
+}
+
+// Take in a complete staged image, if one is waiting and no edit gets in
+// the way. Presses are taken with it so a latch never starts ahead of
+// the rest of its report.
+static SCAN_INLINE bool scanKeyTake(ScanKeyStage &s) {
+    uint32_t seq = __atomic_load_n(&s.seq, __ATOMIC_ACQUIRE);
+    if (seq == s.committed) return false;
+    if (__atomic_load_n(&s.writers, __ATOMIC_ACQUIRE) != 0) {
+        s.deferred++;
+        return false;
+    }
+    uint32_t img[SCAN_KEY_WORDS], press[SCAN_KEY_WORDS];
+    for (int i = 0; i < SCAN_KEY_WORDS; i++) press[i] = __atomic_exchange_n(&s.presses[i], 0, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < SCAN_KEY_WORDS; i++) {
+        img[i] = 0;
+        for (int l = 0; l < SCAN_KEY_SOURCES; l++) img[i] |= s.layers[l][i];
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s.writers, __ATOMIC_RELAXED) != 0 || __atomic_load_n(&s.seq, __ATOMIC_RELAXED) != seq) {
+        for (int i = 0; i < SCAN_KEY_WORDS; i++) {
+            if (press[i]) __atomic_fetch_or(&s.presses[i], press[i], __ATOMIC_RELAXED); // Next time
+        }
+        s.deferred++;
+        return false;
+    }
+    for (int i = 0; i < SCAN_KEY_WORDS; i++) {
+        s.image[i] = img[i];
+        if (!s.latch_frames || s.rollover || !press[i]) continue;
+        s.hold[i] |= press[i]; // A press again while latched starts its count over
+        s.done[i] &= ~press[i];
+        for (uint32_t m = press[i]; m; m &= m - 1) s.seen[i * 32 + __builtin_ctz(m)] = 0;
+    }
+    if (s.rollover) scanKeyEnqueue(s, press, img);
+    s.committed = seq;
+    s.commits++;
+    return true;
+}
+
+// The shaper's live image: retire delivered entries, make waiting ones
+// live from the front of the queue until one can't go, then add the
+// modifiers. Asks for another boundary while anything is waiting.
+static SCAN_INLINE void scanKeyShape(ScanKeyStage &s, uint32_t *live) {
+    uint32_t gone[SCAN_KEY_WORDS] = {0}; // Went up at this boundary
+    int n = 0, live_n = 0, need = -1;    // need: modifiers an undelivered live key carries
+    for (int q = 0; q < s.queue_n; q++) {
+        ScanKeyQueued e = s.queue[q];
+        uint32_t bit    = 1UL << (e.addr & 31);
+        int w           = e.addr >> 5;
+        if (e.live && (s.done[w] & bit) && (!(s.image[w] & bit) || s.in_queue[e.addr] > 1)) {
+            s.hold[w] &= ~bit;
+            s.done[w] &= ~bit;
+            gone[w] |= bit;
+            s.in_queue[e.addr]--;
+            continue;
+        }
+        if (e.live) live_n++;
+        if (e.live && !(s.done[w] & bit)) need = e.mods;
+        s.queue[n++] = e;
+    }
+    s.queue_n    = (uint8_t)n;
+    bool blocked = false, waiting = false;
+    for (int q = 0; q < s.queue_n; q++) {
+        ScanKeyQueued &e = s.queue[q];
+        if (e.live) continue;
+        uint32_t bit = 1UL << (e.addr & 31);
+        int w        = e.addr >> 5;
+        if (!blocked && live_n < s.rollover && !((s.hold[w] | gone[w]) & bit)) {
+            if (e.mods == s.live_mods) {
+                e.live = true;
+                s.hold[w] |= bit;
+                s.seen[e.addr] = 0;
+                live_n++;
+                need = e.mods;
+                continue;
+            }
+            if (need < 0) s.live_mods = e.mods; // Modifiers this frame, the key the next
+        }
+        blocked = true;
+        waiting = true;
+        if (!e.waited) s.queued++;
+        e.waited = true;
+    }
+    if (!waiting && need < 0) s.live_mods = scanKeyModSnap(s, s.image);
+    for (int i = 0; i < SCAN_KEY_WORDS; i++) live[i] = s.hold[i];
+    for (int m = 0; m < s.n_mods; m++) {
+        uint8_t addr = s.mod_addr[m];
+        if ((s.live_mods >> m) & 1) live[addr >> 5] |= 1UL << (addr & 31);
+    }
+    s.expiring = waiting;
+}
+
+// Scan engine, at a frame boundary: take in a waiting image, release
+// latches that have been seen, and rebuild `live`. Returns true if any
+// live bit changed.
+static SCAN_INLINE bool scanKeyCommit(ScanKeyStage &s, volatile uint32_t *live) {
+    bool fresh = scanKeyTake(s);
+    if (!fresh && !s.expiring) return false;
+    if (s.expiring && !s.rollover) {
+        for (int i = 0; i < SCAN_KEY_WORDS; i++) {
+            for (uint32_t m = s.done[i] & ~s.image[i]; m; m &= m - 1) s.saved++;
+            s.hold[i] &= ~s.done[i];
+            s.done[i] = 0;
+        }
+        s.expiring = false;
+    }
+    uint32_t next[SCAN_KEY_WORDS];
+    if (s.rollover) {
+        scanKeyShape(s, next);
+    } else {
+        for (int i = 0; i < SCAN_KEY_WORDS; i++) next[i] = s.image[i] | s.hold[i];
+    }
+    uint32_t diff = 0;
+    for (int i = 0; i < SCAN_KEY_WORDS; i++) {
+        diff |= live[i] ^ next[i];
+        live[i] = next[i];
+    }
+    return diff != 0;
+}
+
+// Bus idle: no frames are coming to show the latched presses, so drop
+// them and commit whatever is staged
+static SCAN_INLINE bool scanKeyCommitIdle(ScanKeyStage &s, volatile uint32_t *live) {
+    for (int i = 0; i < SCAN_KEY_WORDS; i++) {
+        s.hold[i] = 0;
+        s.done[i] = 0;
+    }
+    for (int q = 0; q < s.queue_n; q++) s.in_queue[s.queue[q].addr] = 0;
+    s.queue_n   = 0;
+    s.live_mods = 0;
+    s.expiring = true; // Rebuild live without them
+    return scanKeyCommit(s, live);
+}
+
+// ============================================================
+// SCAN CORE STATE
+// ============================================================
+
+enum ScanLayoutKind : uint8_t {
+    SCAN_LAYOUT_GENERIC,    // Arbitrary pins — byte-slice lookup tables
+    SCAN_LAYOUT_CONTIGUOUS, // A0-A6 on consecutive GPIOs — single shift + mask
+    SCAN_LAYOUT_J3,         // Default J3 wiring (setDefaultConfig) — fixed permutation
+};
+
+struct ScanLayout {
+    ScanLayoutKind kind;
+    uint8_t shift; // GPIO of A0 for SCAN_LAYOUT_CONTIGUOUS
+};
+
+struct ScanCore {
+    ScanLayout layout;
+    uint8_t addr_lut[4][256];            // GPIO_IN_REG byte n → address bits it carries
+    uint32_t addr_masks[SCAN_ADDR_BITS]; // GPIO_IN_REG bit for each address line (0 = unwired)
+    uint32_t addr_bits;                  // OR of addr_masks: "did the bus move?" test
+    uint32_t return_mask;                // GPIO_OUT bit for Key Return
+    volatile uint32_t *key_bits;         // SCAN_KEY_WORDS packed bitmap, 1 = pressed
+};
+
+// GPIO_IN_REG only covers GPIO 0-31. Pins outside that range (including
+// -1 = unassigned, which arrives here as 0xFF) read as a constant 0.
+static inline uint32_t scanPinMask(uint8_t pin) {
+    return (pin < 32) ? (1UL << pin) : 0;
+}
+
+// Reference decoder: one test per address line. Used to build the
+// lookup tables and by host tools as the known-good baseline.
+static inline uint8_t scanDecodeAddrLoop(const ScanCore &core, uint32_t gpio_in) {
+    uint8_t addr = 0;
+    for (int i = 0; i < SCAN_ADDR_BITS; i++) {
+        if (gpio_in & core.addr_masks[i]) {
+            addr |= (1 << i);
+        }
+    }
+    return addr;
+}
+
+// Default J3 wiring: A0-A6 = GPIO 4, 5, 14, 15, 13, 16, 17
+static const uint8_t SCAN_J3_PINS[SCAN_ADDR_BITS] = {4, 5, 14, 15, 13, 16, 17};
+
+static ScanLayout scanClassifyLayout(const uint8_t *addr_pins) {
+    ScanLayout layout = {SCAN_LAYOUT_GENERIC, 0};
+    if (memcmp(addr_pins, SCAN_J3_PINS, SCAN_ADDR_BITS) == 0) {
+        layout.kind = SCAN_LAYOUT_J3;
+        return layout;
+    }
+    uint8_t base = addr_pins[0];
+    if (base < SCAN_SHIFT_MIN || base > SCAN_SHIFT_MAX) return layout;
+    for (int i = 1; i < SCAN_ADDR_BITS; i++) {
+        if (addr_pins[i] != base + i) return layout;
+    }
+    layout.kind  = SCAN_LAYOUT_CONTIGUOUS;
+    layout.shift = base;
+    return layout;
+}
+
+static inline const char *scanLayoutName(ScanLayoutKind kind) {
+    switch (kind) {
+        case SCAN_LAYOUT_CONTIGUOUS: return "contiguous";
+        case SCAN_LAYOUT_J3: return "j3";
+        default: return "generic";
+    }
+}
+
+static inline void scanCoreInit(ScanCore &core, const uint8_t *addr_pins, uint8_t return_pin,
+                                volatile uint32_t *key_bits) {
+    core.addr_bits = 0;
+    for (int i = 0; i < SCAN_ADDR_BITS; i++) {
+        core.addr_masks[i] = scanPinMask(addr_pins[i]);
+        core.addr_bits |= core.addr_masks[i];
+    }
+    core.return_mask = scanPinMask(return_pin);
+    core.key_bits    = key_bits;
+    core.layout      = scanClassifyLayout(addr_pins);
+
+    for (int b = 0; b < 4; b++) {
+        for (int v = 0; v < 256; v++) {
+            core.addr_lut[b][v] = scanDecodeAddrLoop(core, (uint32_t)v << (8 * b));
+        }
+    }
+}
+
+// ============================================================
+// PER-SAMPLE DECODE + LOOKUP
+// ============================================================
+
+// Decode 7-bit address from one GPIO_IN_REG sample (4 loads, no branches)
+static SCAN_INLINE uint8_t scanDecodeAddr(const ScanCore &core, uint32_t gpio_in) {
+    return core.addr_lut[0][gpio_in & 0xFF] | core.addr_lut[1][(gpio_in >> 8) & 0xFF] |
+           core.addr_lut[2][(gpio_in >> 16) & 0xFF] | core.addr_lut[3][gpio_in >> 24];
+}
+
+// One scan iteration: decode the sampled address and look up its key.
+// Returns the Key Return level as 0/1, suitable for indexing the
+// {W1TC, W1TS} register pair.
+static SCAN_INLINE uint32_t scanStep(const ScanCore &core, uint32_t gpio_in, uint8_t &addr) {
+    addr = scanDecodeAddr(core, gpio_in);
+    return scanKeyTest(core.key_bits, addr);
+}
+
+// ============================================================
+// LAYOUT-SPECIALIZED DECODERS
+// ============================================================
+// Each decoder is a type with a static decode(); loops templated on the
+// decoder get the pin layout folded in as constants.
+
+struct ScanDecodeLut {
+    static SCAN_INLINE uint8_t decode(const ScanCore &core, uint32_t gpio_in) { return scanDecodeAddr(core, gpio_in); }
+};
+
+template <uint8_t SHIFT> struct ScanDecodeShift {
+    static SCAN_INLINE uint8_t decode(const ScanCore &, uint32_t gpio_in) {
+        return (uint8_t)((gpio_in >> SHIFT) & (SCAN_ADDR_COUNT - 1));
+    }
+};
+
+// GPIO 4,5 → A0,A1   GPIO 14,15 → A2,A3   GPIO 13 → A4   GPIO 16,17 → A5,A6
+struct ScanDecodeJ3 {
+    static SCAN_INLINE uint8_t decode(const ScanCore &, uint32_t gpio_in) {
+        return (uint8_t)(((gpio_in >> 4) & 0x03) | ((gpio_in >> 12) & 0x0C) | ((gpio_in >> 9) & 0x10) |
+                         ((gpio_in >> 11) & 0x60));
+    }
+};
+
+template <typename Decoder> static SCAN_INLINE uint32_t scanStepWith(const ScanCore &core, uint32_t gpio_in, uint8_t &addr) {
+    addr = Decoder::decode(core, gpio_in);
+    return scanKeyTest(core.key_bits, addr);
+}
+
+// Walks SHIFT up from SCAN_SHIFT_MIN until it matches the runtime shift
+template <uint8_t SHIFT> struct ScanShiftDispatch {
+    template <typename Loop> static void run(uint8_t shift, Loop &loop) {
+        if (shift == SHIFT) {
+            loop.template run<ScanDecodeShift<SHIFT> >();
+        } else {
+            ScanShiftDispatch<SHIFT + 1>::run(shift, loop);
+        }
+    }
+};
+
+template <> struct ScanShiftDispatch<SCAN_SHIFT_MAX + 1> {
+    template <typename Loop> static void run(uint8_t, Loop &loop) { loop.template run<ScanDecodeLut>(); }
+};
+
+// Calls loop.run<Decoder>() with the fastest decoder for core.layout.
+// Loop is any type with a `template <typename D> void run()` member.
+template <typename Loop> static void scanDispatch(const ScanCore &core, Loop &loop) {
+    switch (core.layout.kind) {
+        case SCAN_LAYOUT_J3:
+            loop.template run<ScanDecodeJ3>();
+            break;
+        case SCAN_LAYOUT_CONTIGUOUS:
+            ScanShiftDispatch<SCAN_SHIFT_MIN>::run(core.layout.shift, loop);
+            break;
+        default:
+            loop.template run<ScanDecodeLut>();
+            break;
+    }
+}
+
+// ============================================================
+// ADDRESS SETTLE FILTER
+// ============================================================
+// The seven address lines arrive through the level shifter with a few
+// ns of skew, so a sample taken mid-transition can decode an address
+// that was never on the bus and briefly answer for the wrong key. With
+// the filter on, a new address must be read on two consecutive samples
+// at least `window` cycles apart before Key Return follows it; until
+// then the previous settled address keeps driving the output. A window
+// of 1 cycle is plain double-read agreement.
+
+#define SCAN_SETTLE_MAX_NS 2000 // A third of the ~6us dwell
+
+struct ScanSettle {
+    uint32_t window;   // Cycles; 0 = filter off
+    uint8_t addr;      // Settled address (drives Key Return)
+    uint8_t cand;      // Most recent raw address, waiting to settle
+    uint32_t cand_ts;  // Cycle count when cand was first read
+    uint32_t accepted; // Transitions that settled
+    uint32_t rejected; // Candidates replaced before settling (skew glitches)
+};
+
+static inline void scanSettleInit(ScanSettle &s, uint32_t window_cycles) {
+    memset(&s, 0, sizeof(s));
+    s.window = window_cycles; // addr/cand start at 0: always a valid key_bits index
+}
+
+static inline uint32_t scanSettleCycles(uint16_t ns) {
+    if (ns > SCAN_SETTLE_MAX_NS) ns = SCAN_SETTLE_MAX_NS;
+    return ns ? ((uint32_t)ns * SCAN_CPU_MHZ + 999) / 1000 : 0;
+}
+
+// Feed one raw decode; returns the address to answer for. The steady
+// state (raw == cand == addr) is two compares.
+static SCAN_INLINE uint8_t scanSettleStep(ScanSettle &s, uint8_t raw, uint32_t now) {
+    if (raw != s.cand) {
+        if (s.cand != s.addr) s.rejected++; // Previous candidate never settled
+        s.cand    = raw;
+        s.cand_ts = now;
+        return s.addr;
+    }
+    if (raw != s.addr && now - s.cand_ts >= s.window) {
+        s.addr = raw;
+        s.accepted++;
+    }
+    return s.addr;
+}
+
+// ============================================================
+// PREDICTIVE KEY RETURN
+// ============================================================
+// The 8031 walks its addresses in a fixed order, so the successor of
+// each address is learned from live traffic. After every transition
+// the loop looks up the level for the expected next address; when the
+// address lines next move, that level is written before the new address
+// is even decoded. The reactive decode + lookup still runs right after
+// and overwrites it, so a misprediction costs one decode time of the
+// wrong level — the same window the reactive path leaves the previous
+// address's level up for.
+//
+// A successor is only replaced after the same new successor is seen
+// twice in a row, so a one-off glitch or a skipped address can't
+// retrain the table.
+
+#define SCAN_PREDICT_NONE 0xFF
+
+struct ScanPredict {
+    uint8_t next[SCAN_ADDR_COUNT];    // Learned successor (SCAN_PREDICT_NONE = unknown)
+    uint8_t pending[SCAN_ADDR_COUNT]; // Candidate successor awaiting confirmation
+    uint8_t prev;                     // Address before the current one
+    uint8_t addr;                     // Predicted next address
+    uint32_t level;                   // Key Return level to commit on the next bus change
+    uint32_t hits;                    // Prediction matched the decoded address
+    uint32_t misses;                  // Prediction made but wrong
+    uint32_t cold;                    // No prediction available (still learning)
+};
+
+static inline void scanPredictInit(ScanPredict &p) {
+    memset(&p, 0, sizeof(p));
+    memset(p.next, SCAN_PREDICT_NONE, sizeof(p.next));
+    memset(p.pending, SCAN_PREDICT_NONE, sizeof(p.pending));
+    p.prev = SCAN_PREDICT_NONE;
+    p.addr = SCAN_PREDICT_NONE;
+}
+
+// Called once per decoded address change with the new address and its
+// Key Return level. Scores the last prediction, learns the transition
+// and prepares p.level for the next one. With nothing learned yet the
+// prepared level is the current one, so the early commit is a no-op.
+static SCAN_INLINE void scanPredictAdvance(ScanPredict &p, const ScanCore &core, uint8_t addr, uint32_t level) {
+    if (p.addr == addr) {
+        p.hits++;
+    } else if (p.addr == SCAN_PREDICT_NONE) {
+        p.cold++;
+    } else {
+        p.misses++;
+    }
+    if (p.prev < SCAN_ADDR_COUNT) {
+        if (p.next[p.prev] == addr) {
+            p.pending[p.prev] = SCAN_PREDICT_NONE;
+        } else if (p.pending[p.prev] == addr) {
+            p.next[p.prev] = addr;
+        } else {
+            p.pending[p.prev] = addr;
+        }
+    }
+    p.prev  = addr;
+    p.addr  = p.next[addr];
+    p.level = p.addr < SCAN_ADDR_COUNT ? scanKeyTest(core.key_bits, p.addr) : level;
+}
+
+// After a sleep the previous address is stale: restart from the current
+// one without scoring or learning the gap as a transition.
+static SCAN_INLINE void scanPredictResync(ScanPredict &p, const ScanCore &core, uint8_t addr) {
+    p.prev  = addr;
+    p.addr  = p.next[addr];
+    p.level = scanKeyTest(core.key_bits, p.addr < SCAN_ADDR_COUNT ? p.addr : addr);
+}
+
+// After a voluntary sleep the settled address is from before it; take
+// the first post-wake read as settled rather than answer for a stale one.
+static SCAN_INLINE void scanSettleResync(ScanSettle &s, uint8_t raw, uint32_t now) {
+    s.addr    = raw;
+    s.cand    = raw;
+    s.cand_ts = now;
+}
+
+// ============================================================
+// SCAN FRAME TRACKING + YIELD WINDOWS
+// ============================================================
+// The 8031 sweeps its addresses upward, then leaves the last one on the
+// bus while it does other work. Fed only on address changes (with a CPU
+// cycle timestamp), the tracker finds frame boundaries (address wraps),
+// learns the frame period and where in the frame the last address
+// appears, and counts frames the responder slept through. From that,
+// scanYieldWindow() says how long the loop can sleep right after the
+// final address of a sweep without the next frame seeing stale state.
+
+struct ScanFrameTracker {
+    uint8_t last_addr;       // Address at the previous change (0xFF = none yet)
+    uint8_t end_addr;        // Final address of a sweep, held through the gap
+    uint8_t locked;          // Consecutive clean frames (saturates at 255)
+    bool dirty;              // Responder slept since the last change
+    bool frame_valid;        // frame_ts is a promptly observed frame start
+    uint32_t frame_ts;       // Cycle count at last frame start
+    uint32_t period_cycles;  // Frame period (EWMA, 1/8)
+    uint32_t sweep_cycles;   // Frame start → end_addr appears (EWMA, 1/8)
+    uint32_t frames;         // Frame boundaries observed
+    uint32_t frames_missed;  // Frames slept through or entered late
+};
+
+struct ScanYieldPolicy {
+    uint32_t min_cycles;    // Shorter windows aren't worth a context switch
+    uint32_t max_cycles;    // Per-yield budget
+    uint32_t margin_cycles; // Wake-up latency reserve before the next frame
+};
+
+static SCAN_INLINE void scanEwma(uint32_t &avg, uint32_t x) {
+    avg = (avg == 0) ? x : avg - (avg >> 3) + (x >> 3);
+}
+
+static inline void scanFrameReset(ScanFrameTracker &ft) {
+    memset(&ft, 0, sizeof(ft));
+    ft.last_addr = 0xFF;
+}
+
+// Feed an address change. Returns true at a frame boundary.
+static SCAN_INLINE bool scanFrameChange(ScanFrameTracker &ft, uint8_t addr, uint32_t now) {
+    bool wrap = ft.last_addr != 0xFF && addr < ft.last_addr;
+    if (wrap) {
+        uint32_t period = now - ft.frame_ts;
+        bool clean      = !ft.dirty;
+        if (ft.period_cycles && period > ft.period_cycles + ft.period_cycles / 2) {
+            ft.frames_missed += (period + ft.period_cycles / 2) / ft.period_cycles - 1;
+            clean = false;
+        } else if (clean && ft.frame_valid) {
+            // Both ends are real frame starts — a usable period sample
+            if (ft.period_cycles == 0 || period < ft.period_cycles - ft.period_cycles / 4) {
+                ft.period_cycles = period; // First sample, or baseline was inflated by a stall
+            } else {
+                scanEwma(ft.period_cycles, period);
+            }
+        }
+        ft.locked      = clean ? (ft.locked < 255 ? ft.locked + 1 : 255) : 0;
+        ft.end_addr    = ft.last_addr;
+        ft.frame_ts    = now;
+        ft.frame_valid = !ft.dirty;
+        ft.frames++;
+    } else if (addr == ft.end_addr && !ft.dirty && ft.frame_valid) {
+        scanEwma(ft.sweep_cycles, now - ft.frame_ts);
+    }
+    ft.last_addr = addr;
+    ft.dirty     = false;
+    return wrap;
+}
+
+// Responder was blocked (yield, park, stall) — timings now unreliable
+static SCAN_INLINE void scanFrameSlept(ScanFrameTracker &ft) {
+    ft.dirty       = true;
+    ft.frame_valid = false;
+    ft.locked      = 0;
+}
+
+// Responder woke from a gap yield and sampled `addr`. Anything other
+// than the held end address means the next frame already started.
+static SCAN_INLINE void scanFrameWoke(ScanFrameTracker &ft, uint8_t addr) {
+    if (addr != ft.end_addr) {
+        ft.frames_missed++;
+        scanFrameSlept(ft);
+    }
+}
+
+// Cycles the loop may sleep now that `addr` just appeared (0 = don't)
+static SCAN_INLINE uint32_t scanYieldWindow(const ScanFrameTracker &ft, uint8_t addr, const ScanYieldPolicy &p) {
+    if (addr != ft.end_addr || ft.locked < 4 || ft.sweep_cycles >= ft.period_cycles) return 0;
+    uint32_t w = ft.period_cycles - ft.sweep_cycles;
+    if (w <= p.margin_cycles) return 0;
+    w -= p.margin_cycles;
+    if (w > p.max_cycles) w = p.max_cycles;
+    return (w >= p.min_cycles) ? w : 0;
+}
+
+// ============================================================
+// SAMPLE-GAP JITTER
+// ============================================================
+// Cycles between consecutive GPIO samples. Voluntary sleeps (gap yields,
+// parking) are excluded via scanJitterResume(), so what remains is time
+// the responder was involuntarily dark: preemption, ISRs, cache stalls.
+// Every gap also lands in a log2 histogram (one NSAU and an increment).
+
+#define SCAN_DWELL_CYCLES (6 * SCAN_CPU_MHZ) // One terminal address dwell
+#define SCAN_GAP_BINS     32                 // Bin i = gaps of [2^i, 2^(i+1)) cycles
+
+struct ScanJitter {
+    uint32_t last_ts;
+    uint32_t max_cycles; // Worst gap seen
+    uint32_t over_1us;   // Gaps long enough to delay a response noticeably
+    uint32_t over_dwell; // Gaps spanning a whole ~6us address dwell
+    uint32_t hist[SCAN_GAP_BINS];
+};
+
+static SCAN_INLINE uint32_t scanLog2(uint32_t v) {
+    return 31 - __builtin_clz(v | 1);
+}
+
+// Returns the gap so the caller can act on outliers (> SCAN_DWELL_CYCLES)
+static SCAN_INLINE uint32_t scanJitterSample(ScanJitter &j, uint32_t now) {
+    uint32_t gap = now - j.last_ts;
+    j.last_ts    = now;
+    j.hist[scanLog2(gap)]++;
+    if (gap > j.max_cycles) j.max_cycles = gap;
+    j.over_1us += gap > 1 * SCAN_CPU_MHZ;
+    j.over_dwell += gap > SCAN_DWELL_CYCLES;
+    return gap;
+}
+
+static SCAN_INLINE void scanJitterResume(ScanJitter &j, uint32_t now) {
+    j.last_ts = now;
+}
+
+// ============================================================
+// STALL TABLE
+// ============================================================
+// The SCAN_STALL_TOP worst sample gaps, with when they happened, the
+// address being answered and what the firmware blamed them on. The
+// loop only compares each gap against `gate`; everything else runs for
+// gaps that will actually take a slot.
+
+#define SCAN_STALL_TOP  8
+#define SCAN_STALL_MIN  (2 * SCAN_CPU_MHZ) // Smallest gap worth a slot
+#define SCAN_STALL_NAME 16                 // configMAX_TASK_NAME_LEN
+
+enum ScanStallCause : uint8_t {
+    SCAN_STALL_UNKNOWN = 0, // No baseline (just woke) or nothing accounted for it
+    SCAN_STALL_TASK,        // A higher-priority task ran (name in who)
+    SCAN_STALL_ISR,         // Time stayed charged to the scan task: interrupt(s)
+    SCAN_STALL_FLASH,       // Overlapped an NVS write (cache off, CPU parked)
+};
+
+struct ScanStall {
+    uint32_t gap;   // Cycles
+    uint32_t at_ms; // Uptime when it ended
+    uint8_t addr;   // Address the loop was answering
+    uint8_t cause;  // ScanStallCause
+    char who[SCAN_STALL_NAME];
+};
+
+struct ScanStallTop {
+    uint32_t gate; // Loop calls in above this: min(smallest held, one dwell)
+    uint8_t n;
+    ScanStall e[SCAN_STALL_TOP];
+};
+
+static inline void scanStallReset(ScanStallTop &t) {
+    memset(&t, 0, sizeof(t));
+    t.gate = SCAN_STALL_MIN;
+}
+
+// Would a gap of this size take a slot?
+static SCAN_INLINE bool scanStallQualifies(const ScanStallTop &t, uint32_t gap) {
+    if (t.n < SCAN_STALL_TOP) return gap > SCAN_STALL_MIN;
+    for (int i = 0; i < SCAN_STALL_TOP; i++) {
+        if (t.e[i].gap < gap) return true;
+    }
+    return false;
+}
+
+// Store a qualifying stall over the smallest one held and re-derive the
+// gate. The gate never rises above one dwell so dwell-length gaps still
+// reach the caller (flash-write accounting).
+static SCAN_INLINE void scanStallInsert(ScanStallTop &t, const ScanStall &s) {
+    int slot = t.n;
+    if (t.n < SCAN_STALL_TOP) {
+        t.n++;
+    } else {
+        slot = 0;
+        for (int i = 1; i < SCAN_STALL_TOP; i++) {
+            if (t.e[i].gap < t.e[slot].gap) slot = i;
+        }
+    }
+    t.e[slot]      = s;
+    uint32_t floor = SCAN_STALL_MIN;
+    if (t.n == SCAN_STALL_TOP) {
+        floor = t.e[0].gap;
+        for (int i = 1; i < SCAN_STALL_TOP; i++) {
+            if (t.e[i].gap < floor) floor = t.e[i].gap;
+        }
+    }
+    t.gate = floor < SCAN_DWELL_CYCLES ? floor : SCAN_DWELL_CYCLES;
+}
+
+static inline const char *scanStallCauseName(uint8_t cause) {
+    switch (cause) {
+        case SCAN_STALL_TASK: return "task";
+        case SCAN_STALL_ISR: return "isr";
+        case SCAN_STALL_FLASH: return "flash";
+        default: return "unknown";
+    }
+}
+
+// ============================================================
+// EDGE-TRIGGERED RESPONSE
+// ============================================================
+// Alternative to the polling loop: an interrupt on any address-line edge
+// reads the bus and drives Key Return, and the core is free in between.
+// The answer is the loop's own scanStepWith<Decoder>() lookup; only when
+// it runs differs. One entry re-reads until the lines hold still, so the
+// later skewed edges of a transition, and an address that lands while
+// the handler runs, are answered before it returns (their re-pended
+// interrupt then finds nothing new: `spurious`).
+//
+// The handler can't see when the edge happened, only when it got in, so
+// `lat_hist` is entry → Key Return written. An address the bus left
+// before the handler got to it is a missed transition; the learned scan
+// order (ScanPredict) shows it as a skipped successor.
+
+#define SCAN_EDGE_PASSES          4   // Re-reads per entry before giving the core back
+#define SCAN_EDGE_DISPATCH_CYCLES 200 // Vector + context save/restore around the handler (estimate)
+
+struct ScanEdge {
+    uint8_t addr;       // Address last answered (0xFF = none)
+    uint32_t bus_bits;  // Address lines as last read
+    uint32_t entries;   // Interrupt entries
+    uint32_t changes;   // Address changes answered
+    uint32_t spurious;  // Entries that found nothing new
+    uint32_t rereads;   // Extra passes for edges that landed mid-service
+    uint32_t missed;    // Changes off the learned order: a skipped dwell, or a mid-skew mix
+    uint64_t busy;      // Cycles inside the handler
+    uint32_t lat_max;   // Entry → Key Return, worst
+    uint32_t lat_hist[SCAN_GAP_BINS]; // ...log2 histogram
+};
+
+static inline void scanEdgeReset(ScanEdge &e) {
+    memset(&e, 0, sizeof(e));
+    e.addr = 0xFF;
+}
+
+// One interrupt entry at `entry` (cycle count). Io supplies read() → the
+// GPIO_IN word, write(level) → Key Return, now() → cycles, and
+// change(addr, level, now) for everything that follows an address change
+// (frame tracking, snoop). Returns the changes answered.
+template <typename Decoder, typename Io>
+static SCAN_INLINE uint32_t scanEdgeService(ScanEdge &e, const ScanCore &core, ScanPredict &order, Io &io,
+                                            uint32_t entry) {
+    uint32_t served = 0;
+    for (int pass = 0; pass < SCAN_EDGE_PASSES; pass++) {
+        uint32_t gpio_in = io.read();
+        uint32_t bits    = gpio_in & core.addr_bits;
+        if (pass && bits == e.bus_bits) break;
+        e.rereads += pass != 0;
+        e.bus_bits = bits;
+        uint8_t addr;
+        uint32_t pressed = scanStepWith<Decoder>(core, gpio_in, addr);
+        io.write(pressed);
+        if (addr == e.addr) continue;
+        uint32_t now = io.now();
+        if (!served) {
+            uint32_t lat = now - entry;
+            e.lat_hist[scanLog2(lat)]++;
+            if (lat > e.lat_max) e.lat_max = lat;
+        }
+        e.missed += order.addr < SCAN_ADDR_COUNT && order.addr != addr;
+        scanPredictAdvance(order, core, addr, pressed);
+        e.addr = addr;
+        e.changes++;
+        served++;
+        io.change(addr, pressed, now);
+    }
+    e.entries++;
+    e.spurious += served == 0;
+    e.busy += io.now() - entry;
+    return served;
+}
+
+// Interrupts were off (disarmed while idle): the next change isn't a
+// transition from the last one answered
+static SCAN_INLINE void scanEdgeResync(ScanEdge &e, ScanPredict &order) {
+    e.addr     = 0xFF;
+    order.addr = SCAN_PREDICT_NONE;
+    order.prev = SCAN_PREDICT_NONE;
+}
+
+// Percentile (0-100) of a log2 cycle histogram, as the upper edge of its
+// bin capped at the worst seen
+static inline uint32_t scanLog2Percentile(const uint32_t *hist, uint32_t max, double pct) {
+    uint64_t n = 0;
+    for (int i = 0; i < SCAN_GAP_BINS; i++) n += hist[i];
+    if (n == 0) return 0;
+    uint64_t target = (uint64_t)(n * pct / 100.0);
+    uint64_t seen   = 0;
+    for (int i = 0; i < SCAN_GAP_BINS; i++) {
+        seen += hist[i];
+        if (seen > target) {
+            uint32_t edge = i >= 31 ? UINT32_MAX : (2UL << i) - 1;
+            return edge < max ? edge : max;
+        }
+    }
+    return max;
+}
+
+// ============================================================
+// SCAN FRAME ANALYTICS (snoop mode)
+// ============================================================
+// Rebuilds whole frames from the address-change stream: per-address
+// dwell in cycles, frame period, frame-to-frame period jitter and a
+// signature of the scan order. Fed with the address-change stream off
+// the snoop ring (see below), so it runs on the analytics task rather
+// than the scan core. Only frames seen from start to end without the
+// responder sleeping (or the ring overflowing) are scored.
+
+#define SCAN_JITTER_BINS       256           // Frame-to-frame |period change|, last bin = overflow
+#define SCAN_JITTER_BIN_CYCLES 32            // ~133ns per bin, ~34us range
+#define SCAN_SIG_SEED          0x811C9DC5UL  // FNV-1a over the frame's address sequence
+#define SCAN_SIG_PRIME         0x01000193UL
+
+struct ScanFrameStats {
+    uint8_t addr;       // Address since the last change (0xFF = none / after a sleep)
+    bool dwell_ok;      // ...and the change that brought it in was seen promptly
+    bool in_frame;      // Current frame watched since its start
+    uint8_t cur;        // order[] slot being filled
+    uint16_t len;       // Addresses so far in the current frame
+    uint32_t change_ts; // Cycle count at the last change
+    uint32_t frame_ts;  // Cycle count at the current frame's start
+    uint32_t sig;       // Running signature of the current frame
+
+    uint64_t dwell_sum[SCAN_ADDR_COUNT];
+    uint32_t dwell_n[SCAN_ADDR_COUNT];
+    uint32_t dwell_min[SCAN_ADDR_COUNT];
+    uint32_t dwell_max[SCAN_ADDR_COUNT];
+
+    uint32_t frames;      // Complete frames scored
+    uint32_t last_period; // 0 = previous frame not scored
+    uint32_t period_min;
+    uint32_t period_max;
+    uint64_t period_sum;
+    uint32_t jitter_hist[SCAN_JITTER_BINS];
+    uint32_t jitter_n;
+    uint32_t jitter_max;
+
+    uint32_t last_sig;      // Signature of the last complete frame
+    uint16_t last_len;
+    uint32_t sig_repeats;   // Frames whose order matched the one before
+    uint32_t sig_changes;   // ...and ones that didn't
+    uint8_t order[2][SCAN_ADDR_COUNT]; // Current frame / last complete frame
+};
+
+static inline void scanFrameStatsReset(ScanFrameStats &fs) {
+    memset(&fs, 0, sizeof(fs));
+    fs.addr       = 0xFF;
+    fs.period_min = UINT32_MAX;
+    for (int i = 0; i < SCAN_ADDR_COUNT; i++) fs.dwell_min[i] = UINT32_MAX;
+}
+
+// Frame ended at `now` (a wrap); score it if it was watched whole
+static inline void scanFrameStatsClose(ScanFrameStats &fs, uint32_t now) {
+    if (!fs.in_frame) {
+        fs.last_period = 0;
+        return;
+    }
+    uint32_t period = now - fs.frame_ts;
+    fs.frames++;
+    fs.period_sum += period;
+    if (period < fs.period_min) fs.period_min = period;
+    if (period > fs.period_max) fs.period_max = period;
+    if (fs.last_period) {
+        uint32_t d   = period > fs.last_period ? period - fs.last_period : fs.last_period - period;
+        uint32_t bin = d / SCAN_JITTER_BIN_CYCLES;
+        fs.jitter_hist[bin < SCAN_JITTER_BINS ? bin : SCAN_JITTER_BINS - 1]++;
+        fs.jitter_n++;
+        if (d > fs.jitter_max) fs.jitter_max = d;
+    }
+    fs.last_period = period;
+    if (fs.last_len) {
+        if (fs.sig == fs.last_sig && fs.len == fs.last_len) {
+            fs.sig_repeats++;
+        } else {
+            fs.sig_changes++;
+        }
+    }
+    fs.last_sig = fs.sig;
+    fs.last_len = fs.len;
+    fs.cur ^= 1; // The frame just filled becomes order[!cur]
+}
+
+// Feed an address change (with scanFrameChange()'s wrap result)
+static inline void scanFrameStatsChange(ScanFrameStats &fs, uint8_t addr, uint32_t now, bool wrap) {
+    bool prompt = fs.addr < SCAN_ADDR_COUNT; // Previous address watched right up to now
+    if (prompt && fs.dwell_ok) {
+        uint32_t d = now - fs.change_ts;
+        fs.dwell_sum[fs.addr] += d;
+        fs.dwell_n[fs.addr]++;
+        if (d < fs.dwell_min[fs.addr]) fs.dwell_min[fs.addr] = d;
+        if (d > fs.dwell_max[fs.addr]) fs.dwell_max[fs.addr] = d;
+    }
+    if (wrap) {
+        scanFrameStatsClose(fs, now);
+        fs.in_frame = prompt;
+        fs.frame_ts = now;
+        fs.sig      = SCAN_SIG_SEED;
+        fs.len      = 0;
+    }
+    fs.sig = (fs.sig ^ addr) * SCAN_SIG_PRIME;
+    if (fs.len < SCAN_ADDR_COUNT) fs.order[fs.cur][fs.len] = addr;
+    if (fs.len < UINT16_MAX) fs.len++;
+    fs.addr      = addr;
+    fs.dwell_ok  = prompt;
+    fs.change_ts = now;
+}
+
+// Responder slept: the dwell in progress and the current frame are unknown
+static inline void scanFrameStatsSlept(ScanFrameStats &fs) {
+    fs.addr     = 0xFF;
+    fs.in_frame = false;
+}
+
+// Jitter percentile (0-100) in cycles, as the upper edge of its bin
+// (capped at the worst seen); the overflow bin reports the worst seen
+static inline uint32_t scanFrameStatsJitter(const ScanFrameStats &fs, double pct) {
+    if (fs.jitter_n == 0) return 0;
+    uint64_t target = (uint64_t)(fs.jitter_n * pct / 100.0);
+    uint64_t seen   = 0;
+    for (uint32_t i = 0; i < SCAN_JITTER_BINS - 1; i++) {
+        seen += fs.jitter_hist[i];
+        if (seen > target) {
+            uint32_t edge = (i + 1) * SCAN_JITTER_BIN_CYCLES;
+            return edge < fs.jitter_max ? edge : fs.jitter_max;
+        }
+    }
+    return fs.jitter_max;
+}
+
+// ============================================================
+// SNOOP RING (scan core → analytics task)
+// ============================================================
+// Snoop mode keeps the scan loop's share down to one record per address
+// change: scanRingPush() into a single-producer/single-consumer ring,
+// with no per-sample work at all. A task on the other core drains it
+// with scanRingDrain() into ScanSnoopStats — visit and dwell histograms
+// plus the frame analytics above — and publishes snapshots for the web
+// handlers. head is written only by the producer and tail only by the
+// consumer; acquire/release ordering makes a record visible no earlier
+// than the index that covers it. A full ring drops the record, counts
+// it, and flags the next one SCAN_REC_GAP so the consumer treats the
+// hole like a responder sleep instead of inventing a dwell across it.
+
+#define SCAN_RING_SIZE  2048 // Records, power of two (~12ms of address changes)
+#define SCAN_REC_WRAP   0x01 // Change started a frame (scanFrameChange)
+#define SCAN_REC_KEY    0x02 // Key Return driven active for the new address
+#define SCAN_REC_GAP    0x04 // Stream broken before this record (sleep or overflow)
+
+struct ScanRingRec {
+    uint32_t ts; // Cycle count of the change
+    uint8_t addr;
+    uint8_t flags;
+    uint16_t reserved;
+};
+
+struct ScanRing {
+    uint32_t head;    // Next slot to write (producer)
+    uint32_t tail;    // Next slot to read (consumer)
+    uint32_t dropped; // Records lost to a full ring (producer)
+    bool broken;      // Producer: a record was dropped or skipped since the last push
+    ScanRingRec rec[SCAN_RING_SIZE];
+};
+
+static inline void scanRingReset(ScanRing &r) {
+    r.head    = 0;
+    r.tail    = 0;
+    r.dropped = 0;
+    r.broken  = true;
+}
+
+// Producer side: mark a hole (the responder slept) for the next record
+static SCAN_INLINE void scanRingBreak(ScanRing &r) {
+    r.broken = true;
+}
+
+static SCAN_INLINE void scanRingPush(ScanRing &r, uint8_t addr, uint32_t now, uint8_t flags) {
+    uint32_t h = r.head;
+    if (h - __atomic_load_n(&r.tail, __ATOMIC_ACQUIRE) >= SCAN_RING_SIZE) {
+        r.dropped++;
+        r.broken = true;
+        return;
+    }
+    ScanRingRec &e = r.rec[h & (SCAN_RING_SIZE - 1)];
+    e.ts           = now;
+    e.addr         = addr;
+    e.flags        = flags | (r.broken ? SCAN_REC_GAP : 0);
+    r.broken       = false;
+    __atomic_store_n(&r.head, h + 1, __ATOMIC_RELEASE);
+}
+
+struct ScanSnoopStats {
+    uint32_t visits[SCAN_ADDR_COUNT];  // Address changes onto each address
+    uint64_t cycles[SCAN_ADDR_COUNT];  // Time on each address (watched dwells only)
+    uint32_t asserted[SCAN_ADDR_COUNT]; // ...visits answered with Key Return active
+    uint32_t changes;  // Records consumed
+    uint32_t gaps;     // ...of which followed a hole
+    uint8_t last_addr; // 0xFF = none / after a hole
+    uint32_t last_ts;
+    uint32_t ring_max; // Deepest backlog seen at a drain
+    ScanFrameStats frames;
+};
+
+static inline void scanSnoopReset(ScanSnoopStats &s) {
+    memset(&s, 0, sizeof(s));
+    s.last_addr = 0xFF;
+    scanFrameStatsReset(s.frames);
+}
+
+static inline void scanSnoopApply(ScanSnoopStats &s, const ScanRingRec &e) {
+    if (e.flags & SCAN_REC_GAP) {
+        s.gaps++;
+        s.last_addr = 0xFF;
+        scanFrameStatsSlept(s.frames);
+    }
+    if (s.last_addr < SCAN_ADDR_COUNT) s.cycles[s.last_addr] += e.ts - s.last_ts;
+    s.visits[e.addr]++;
+    if (e.flags & SCAN_REC_KEY) s.asserted[e.addr]++;
+    s.changes++;
+    scanFrameStatsChange(s.frames, e.addr, e.ts, e.flags & SCAN_REC_WRAP);
+    s.last_addr = e.addr;
+    s.last_ts   = e.ts;
+}
+
+// Consumer side: apply everything published so far, then free the slots.
+// Returns the number of records consumed.
+static inline uint32_t scanRingDrain(ScanRing &r, ScanSnoopStats &s) {
+    uint32_t t = r.tail;
+    uint32_t h = __atomic_load_n(&r.head, __ATOMIC_ACQUIRE);
+    if (h - t > s.ring_max) s.ring_max = h - t;
+    for (uint32_t i = t; i != h; i++) scanSnoopApply(s, r.rec[i & (SCAN_RING_SIZE - 1)]);
+    __atomic_store_n(&r.tail, h, __ATOMIC_RELEASE);
+    return h - t;
+}
+
+// Consumer side: throw away whatever is queued (snoop restarted)
+static inline void scanRingDiscard(ScanRing &r) {
+    __atomic_store_n(&r.tail, __atomic_load_n(&r.head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+// ============================================================
+// BUS TRACE CAPTURE
+// ============================================================
+// Full-rate record of what the responder saw and answered, run-length
+// encoded as it is written: every sample feeds scanTraceSample(), but a
+// record is only emitted when the (address, Key Return) pair changes.
+// A record is one header byte (bit 7 = Key Return, bits 0-6 = address)
+// and an LEB128 varint run length in units of 16 cycles, so a normal
+// ~6us dwell costs two bytes and 32 KB holds ~150 frames.
+//
+// The buffer is a ring of fixed-size blocks. Each block starts with the
+// cycle count of its first record, so it decodes on its own and the
+// writer can overwrite the oldest block once the ring is full. A header
+// of SCAN_TRACE_BLIND marks time the responder spent asleep; it and
+// SCAN_TRACE_NONE take the headers of addresses 0x7E/0x7F with Key
+// Return active. Those two can't be told apart from a real keypress, so
+// a keymap may not put a key on either (keyRulesCheck() refuses it).
+//
+// File layout (little-endian): ScanTraceFile, then `blocks` blocks of
+// block_size bytes, oldest first.
+
+#define SCAN_TRACE_MAGIC         0x5254424BUL // "KBTR"
+#define SCAN_TRACE_VERSION       1
+#define SCAN_TRACE_BLOCK         1024 // Bytes per block, header included
+#define SCAN_TRACE_SHIFT         4    // Run length unit: 1 << 4 = 16 cycles (~67ns)
+#define SCAN_TRACE_BLIND         0xFF // Header: responder asleep (not a real address + Key Return)
+#define SCAN_TRACE_NONE          0xFE // No run open
+#define SCAN_TRACE_ADDR_RESERVED 0x7E // Addresses from here up: their Key Return headers are the two above
+#define SCAN_TRACE_REC_MAX       6    // Header + 5-byte varint
+
+struct ScanTraceFile {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t block_size;
+    uint16_t cpu_mhz;
+    uint8_t shift;
+    uint8_t reserved;
+    uint32_t blocks;  // Blocks that follow
+    uint32_t dropped; // Older blocks overwritten before download
+};
+
+struct ScanTraceBlock {
+    uint32_t start_ts; // Cycle count at the start of the first record
+    uint16_t used;     // Bytes in use, header included
+    uint16_t reserved;
+};
+
+struct ScanTrace {
+    uint8_t *buf;      // blocks * SCAN_TRACE_BLOCK bytes
+    uint32_t blocks;
+    uint32_t head;     // Block being written
+    uint32_t written;  // Blocks started since scanTraceStart()
+    uint16_t pos;      // Write offset in the head block
+    uint8_t run_key;   // Header of the open run (SCAN_TRACE_NONE = none)
+    uint32_t run_ts;   // Start of the open run (advanced in whole units)
+    uint32_t last_ts;  // Most recent sample
+    uint32_t runs;     // Records written
+};
+
+static inline ScanTraceBlock *scanTraceBlockAt(const ScanTrace &t, uint32_t i) {
+    return (ScanTraceBlock *)(t.buf + (size_t)i * SCAN_TRACE_BLOCK);
+}
+
+// `now` is only provisional: CCOUNT is per core, so the first sample
+// re-anchors the clock on the core that actually samples (scanTraceAnchor)
+static inline void scanTraceStart(ScanTrace &t, uint8_t *buf, uint32_t bytes, uint32_t now) {
+    t.buf     = buf;
+    t.blocks  = bytes / SCAN_TRACE_BLOCK;
+    t.head    = 0;
+    t.written = 1;
+    t.pos     = sizeof(ScanTraceBlock);
+    t.run_key = SCAN_TRACE_NONE;
+    t.run_ts  = now;
+    t.last_ts = now;
+    t.runs    = 0;
+    ScanTraceBlock *b = scanTraceBlockAt(t, 0);
+    b->start_ts       = now;
+    b->used           = sizeof(ScanTraceBlock);
+    b->reserved       = 0;
+}
+
+static SCAN_INLINE void scanTraceAnchor(ScanTrace &t, uint32_t now) {
+    t.run_ts                         = now;
+    scanTraceBlockAt(t, 0)->start_ts = now;
+}
+
+// Close the open run at `end` and write its record. Out of line (and in
+// IRAM on the ESP32): it runs once per run, not per sample.
+static SCAN_IRAM void scanTraceEmit(ScanTrace &t, uint8_t key, uint32_t end) {
+    uint32_t units = (end - t.run_ts) >> SCAN_TRACE_SHIFT;
+    if (t.pos + SCAN_TRACE_REC_MAX > SCAN_TRACE_BLOCK) {
+        scanTraceBlockAt(t, t.head)->used = t.pos;
+        t.head = (t.head + 1 < t.blocks) ? t.head + 1 : 0;
+        t.written++;
+        t.pos             = sizeof(ScanTraceBlock);
+        ScanTraceBlock *b = scanTraceBlockAt(t, t.head);
+        b->start_ts       = t.run_ts;
+        b->reserved       = 0;
+    }
+    uint8_t *p = t.buf + (size_t)t.head * SCAN_TRACE_BLOCK + t.pos;
+    uint8_t n  = 0;
+    uint32_t v = units;
+    p[n++]     = key;
+    do {
+        uint8_t byte = v & 0x7F;
+        v >>= 7;
+        p[n++] = byte | (v ? 0x80 : 0);
+    } while (v);
+    t.pos += n;
+    scanTraceBlockAt(t, t.head)->used = t.pos;
+    t.run_ts += units << SCAN_TRACE_SHIFT; // Sub-unit remainder carries into the next run
+    t.runs++;
+}
+
+// Per sample: one store and one compare unless the run changes
+static SCAN_INLINE void scanTraceSample(ScanTrace &t, uint8_t addr, uint32_t key_return, uint32_t now) {
+    uint8_t key = addr | (uint8_t)(key_return << 7);
+    t.last_ts   = now;
+    if (key != t.run_key) {
+        if (t.run_key != SCAN_TRACE_NONE) {
+            scanTraceEmit(t, t.run_key, now);
+        } else if (!t.runs) {
+            scanTraceAnchor(t, now);
+        }
+        t.run_key = key;
+    }
+}
+
+// Responder slept from its last sample until `now`: close the run there
+// and log the blind stretch, so replayed time stays continuous
+static SCAN_INLINE void scanTraceBlind(ScanTrace &t, uint32_t now) {
+    if (t.run_key != SCAN_TRACE_NONE) {
+        scanTraceEmit(t, t.run_key, t.last_ts);
+    } else if (!t.runs) {
+        scanTraceAnchor(t, now); // Nothing sampled yet: nothing to mark
+        t.last_ts = now;
+        return;
+    }
+    scanTraceEmit(t, SCAN_TRACE_BLIND, now);
+    t.run_key = SCAN_TRACE_NONE;
+    t.last_ts = now;
+}
+
+static inline uint32_t scanTraceValidBlocks(const ScanTrace &t) {
+    return t.written < t.blocks ? t.written : t.blocks;
+}
+
+// i-th block in chronological order (0 = oldest still held)
+static inline const ScanTraceBlock *scanTraceBlockOrdered(const ScanTrace &t, uint32_t i) {
+    uint32_t first = (t.written <= t.blocks) ? 0 : (t.head + 1) % t.blocks;
+    return scanTraceBlockAt(t, (first + i) % t.blocks);
+}
+
+static inline void scanTraceFileHeader(const ScanTrace &t, ScanTraceFile &f) {
+    f.magic      = SCAN_TRACE_MAGIC;
+    f.version    = SCAN_TRACE_VERSION;
+    f.block_size = SCAN_TRACE_BLOCK;
+    f.cpu_mhz    = SCAN_CPU_MHZ;
+    f.shift      = SCAN_TRACE_SHIFT;
+    f.reserved   = 0;
+    f.blocks     = scanTraceValidBlocks(t);
+    f.dropped    = t.written - f.blocks;
+}
+
+// Walk one block's records: fn(start_cycle, header, run_cycles). Returns
+// false if the block is malformed (truncated varint, bad length).
+template <typename Fn> static bool scanTraceDecodeBlock(const uint8_t *block, Fn fn) {
+    const ScanTraceBlock *b = (const ScanTraceBlock *)block;
+    if (b->used < sizeof(ScanTraceBlock) || b->used > SCAN_TRACE_BLOCK) return false;
+    uint32_t ts = b->start_ts;
+    uint16_t i  = sizeof(ScanTraceBlock);
+    while (i < b->used) {
+        uint8_t key    = block[i++];
+        uint32_t units = 0;
+        for (int sh = 0;; sh += 7) {
+            if (i >= b->used || sh > 28) return false;
+            uint8_t byte = block[i++];
+            units |= (uint32_t)(byte & 0x7F) << sh;
+            if (!(byte & 0x80)) break;
+        }
+        uint32_t cycles = units << SCAN_TRACE_SHIFT;
+        fn(ts, key, cycles);
+        ts += cycles;
+    }
+    return true;
+}
+
+// Inverse of scanDecodeAddr — builds the GPIO_IN_REG image the terminal
+// would produce for an address. Used by host-side simulation only.
+static inline uint32_t scanEncodeAddr(const ScanCore &core, uint8_t addr) {
+    uint32_t gpio_in = 0;
+    for (int i = 0; i < SCAN_ADDR_BITS; i++) {
+        if (addr & (1 << i)) gpio_in |= core.addr_masks[i];
+    }
+    return gpio_in;
+}
+
+#endif // SCAN_CORE_H
@@ -0,0 +1,152 @@
+/*
+ * text_inject.h — Typing text into the terminal, paced by scan frames (portable)
+ *
+ * Text is typed the way a keyboard would type it: each character becomes
+ * the HID usage and modifiers a US keyboard sends for it, and that report
+ * goes through the active keymap like any other. Whatever turns a typist's
+ * keys into Wyse addresses and synthetic Shift/Ctrl does the same for
+ * pasted text, so a keymap blob that moves a key moves it here too. A
+ * character the keymap has no key for (or that is not ASCII) is skipped.
+ *
+ *   printable ASCII   US layout, Shift where the keyboard needs it
+ *   CR, LF, CR LF     Return (once)
+ *   TAB BS ESC DEL    Tab, Backspace, Escape, Delete
+ *   other ^A-^Z       Ctrl + letter
+ *
+ * Pacing is counted in frame boundaries (ScanFrameTracker::frames), the
+ * terminal's own sweeps, not in milliseconds. A report takes effect at the
+ * next boundary, and the terminal believes a key once two sweeps agree,
+ * so a key held for 2 boundaries is the least it can decode; every key is
+ * then up for gap_frames boundaries so a repeated character is two
+ * presses. Each character costs hold + gap frames whatever the terminal's
+ * scan rate, and a slower terminal is typed into more slowly.
+ */
+
+#ifndef TEXT_INJECT_H
+#define TEXT_INJECT_H
+
+#include "key_map.h"
+
+#define TEXT_HOLD_FRAMES 3 // One frame over what the terminal's debounce needs
+#define TEXT_GAP_FRAMES  3
+#define TEXT_STALL_MS    500 // No frame boundary this long while typing: the terminal has stopped scanning
+#define TEXT_MOD_CTRL    0x01 // HID modifier bits: usage E0 + bit
+#define TEXT_MOD_SHIFT   0x02
+
+// Usage for each printable character 0x20-0x7E; 0x80 = with Shift
+static const uint8_t TEXT_ASCII_KEYS[95] = {
+    0x2C, 0x9E, 0xB4, 0xA0, 0xA1, 0xA2, 0xA4, 0x34, 0xA6, 0xA7, 0xA5, 0xAE, 0x36, 0x2D, 0x37, 0x38, //  !"#$%&'()*+,-./
+    0x27, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0xB3, 0x33, 0xB6, 0x2E, 0xB7, 0xB8, // 0-9 :;<=>?
+    0x9F, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8A, 0x8B, 0x8C, 0x8D, 0x8E, 0x8F, 0x90, 0x91, 0x92, // @A-O
+    0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0x9B, 0x9C, 0x9D, 0x2F, 0x31, 0x30, 0xA3, 0xAD, // P-Z [\]^_
+    0x35, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12, // `a-o
+    0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0xAF, 0xB1, 0xB0, 0xB5,       // p-z {|}~
+};
+
+// Usage | TEXT_MOD_* << 8 for an ASCII byte, 0 if no key types it
+static inline uint16_t textKeyOf(uint8_t c) {
+    if (c >= 0x20 && c < 0x7F) {
+        uint8_t k = TEXT_ASCII_KEYS[c - 0x20];
+        return (uint16_t)((k & 0x7F) | (k & 0x80 ? TEXT_MOD_SHIFT << 8 : 0));
+    }
+    switch (c) {
+    case '\r':
+    case '\n': return 0x28;
+    case '\t': return 0x2B;
+    case 0x08: return 0x2A;
+    case 0x1B: return 0x29;
+    case 0x7F: return 0x4C;
+    }
+    if (c >= 0x01 && c <= 0x1A) return (uint16_t)((0x04 + c - 1) | TEXT_MOD_CTRL << 8);
+    return 0;
+}
+
+// The report a keyboard sends with that key down
+static inline void textKeyReport(uint16_t key, uint32_t *down) {
+    memset(down, 0, HID_KEY_WORDS * sizeof(uint32_t));
+    uint8_t u = (uint8_t)key, mods = (uint8_t)(key >> 8);
+    down[u >> 5] |= 1u << (u & 31);
+    for (; mods; mods &= mods - 1) {
+        uint8_t m = (uint8_t)(HID_USAGE_MOD_BASE + __builtin_ctz(mods));
+        down[m >> 5] |= 1u << (m & 31);
+    }
+}
+
+enum TextPhase : uint8_t {
+    TEXT_OFF,  // No text
+    TEXT_NEXT, // Press the next character now
+    TEXT_HOLD, // A key is down
+    TEXT_GAP,  // Everything is up
+    TEXT_DONE,
+};
+
+struct TextInject {
+    const char *text;    // Not owned
+    size_t len, pos;     // Bytes, and the next one to read
+    uint32_t typed;      // Characters pressed and released
+    uint32_t skipped;    // Characters with no key (not ASCII, or not in the keymap)
+    uint32_t mark;       // Frame count at the last report
+    uint8_t hold_frames; // Frame boundaries a key is down
+    uint8_t gap_frames;  // ...and everything is up after it
+    uint8_t phase;       // TextPhase
+};
+
+static inline void textInjectStart(TextInject &t, const char *text, size_t len, uint8_t hold_frames,
+                                   uint8_t gap_frames) {
+    memset(&t, 0, sizeof(t));
+    t.text        = text;
+    t.len         = len;
+    t.hold_frames = hold_frames;
+    t.gap_frames  = gap_frames;
+    t.phase       = TEXT_NEXT;
+}
+
+// Next character's key, 0 if it has none. A UTF-8 sequence is one
+// character; CR LF is one Return.
+static inline uint16_t textNextKey(TextInject &t) {
+    uint8_t c = (uint8_t)t.text[t.pos++];
+    if (c >= 0x80) {
+        while (t.pos < t.len && ((uint8_t)t.text[t.pos] & 0xC0) == 0x80) t.pos++;
+        return 0;
+    }
+    if (c == '\r' && t.pos < t.len && t.text[t.pos] == '\n') t.pos++;
+    return textKeyOf(c);
+}
+
+// Advance t to frame count frames. True if down holds a report to send
+// (a character's keys, or all keys up); the caller feeds it to the keymap
+// as the text source's next report. m is only read to skip characters it
+// has no key for.
+static inline bool textInjectStep(TextInject &t, const KeyMap &m, uint32_t frames, uint32_t *down) {
+    switch (t.phase) {
+    case TEXT_HOLD:
+        if (frames - t.mark < t.hold_frames) return false;
+        memset(down, 0, HID_KEY_WORDS * sizeof(uint32_t));
+        t.typed++;
+        t.phase = TEXT_GAP;
+        t.mark  = frames;
+        return true;
+    case TEXT_GAP:
+        if (frames - t.mark < t.gap_frames) return false;
+        // fall through
+    case TEXT_NEXT:
+        while (t.pos < t.len) {
+            uint16_t key = textNextKey(t);
+            if (key) {
+                textKeyReport(key, down);
+                if ((uint8_t)m.ent[keyMapClass(m, down)][(uint8_t)key] < SCAN_ADDR_COUNT) {
+                    t.phase = TEXT_HOLD;
+                    t.mark  = frames;
+                    return true;
+                }
+            }
+            t.skipped++;
+        }
+        t.phase = TEXT_DONE;
+        return false;
+    default:
+        return false;
+    }
+}
+
+#endif // TEXT_INJECT_H
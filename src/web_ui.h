@@ -99,6 +99,20 @@ button{padding:7px 18px;border:none;border-radius:4px;cursor:pointer;font-size:.
       <span class="hint">Disabling requires reflash to re-enable</span></div>
     <div class="row"><label>Use hardware jumper</label><input type="checkbox" id="use_mode_jumper">
       <span class="hint">Mode jumper input on GPIO below</span></div>
+    <div class="row"><label>Keymap</label><input type="text" id="keymap" maxlength="23" placeholder="built-in">
+      <span class="hint">Name of a keymap uploaded to /api/keymap (see /api/keymaps); empty = built-in Wyse 50 map</span></div>
+    <div class="row"><label>Isolated scan core</label><input type="checkbox" id="scan_isolated">
+      <span class="hint">Scan responder owns CPU 1 and never yields (reboot required)</span></div>
+    <div class="row"><label>Address settle (ns)</label><input type="number" id="scan_settle_ns" min="0" max="2000">
+      <span class="hint">Ignore address glitches shorter than this; 0 = off (reboot required)</span></div>
+    <div class="row"><label>Predictive Key Return</label><input type="checkbox" id="scan_predict">
+      <span class="hint">Answer for the learned next address as soon as the bus moves; off while settle is on (reboot required)</span></div>
+    <div class="row"><label>Edge-triggered response</label><input type="checkbox" id="scan_edge">
+      <span class="hint">Answer from an address-line interrupt instead of polling; mode at boot, switch live from Scan Engine</span></div>
+    <div class="row"><label>Minimum press (frames)</label><input type="number" id="scan_latch_frames" min="0" max="8">
+      <span class="hint">Keep each new press asserted until the terminal has scanned it this many times, so quick taps aren't lost; 0 = off (reboot required)</span></div>
+    <div class="row"><label>Rollover cap</label><input type="number" id="scan_rollover" min="0" max="6">
+      <span class="hint">Most non-modifier keys down at once; extra keys wait their turn in press order. 0 = no cap (reboot required)</span></div>
   </div>
 
   <div class="group">
@@ -125,6 +139,8 @@ button{padding:7px 18px;border:none;border-radius:4px;cursor:pointer;font-size:.
     <div class="row"><label>Addr 4 (bit 4)</label><input type="number" id="pin_addr4" min="-1" max="39"></div>
     <div class="row"><label>Addr 5 (bit 5)</label><input type="number" id="pin_addr5" min="-1" max="39"></div>
     <div class="row"><label>Addr 6 (bit 6, MSB)</label><input type="number" id="pin_addr6" min="-1" max="39"></div>
+    <div class="row"><label>Scan decode</label><strong id="scanLayoutLabel">--</strong>
+      <span class="hint" id="scanLayoutHint"></span></div>
   </div>
   <div class="group">
     <div class="group-title">Key Return Output</div>
@@ -141,6 +157,11 @@ button{padding:7px 18px;border:none;border-radius:4px;cursor:pointer;font-size:.
     <div class="row"><label>Activity LED</label><input type="number" id="pin_led" min="-1" max="39"></div>
     <div class="row"><label>Bluetooth LED</label><input type="number" id="pin_bt_led" min="-1" max="39"></div>
   </div>
+  <div class="group">
+    <div class="group-title">DMA Snoop (-1 = disabled)</div>
+    <div class="row"><label>Capture clock</label><input type="number" id="pin_capture_clk" min="-1" max="33">
+      <span class="hint">Spare GPIO, left unconnected &mdash; drives and reads back the I2S sample clock</span></div>
+  </div>
   <div class="actions">
     <button class="btn-primary" onclick="saveAll()">&#x1F4BE; Save &amp; Apply</button>
   </div>
@@ -190,15 +211,68 @@ button{padding:7px 18px;border:none;border-radius:4px;cursor:pointer;font-size:.
     </div>
   </div>
 
+  <div class="group" style="margin-top:12px">
+    <div class="group-title">Type Text</div>
+    <p class="hint" style="margin-bottom:8px">Type ASCII text into the terminal through the active keymap, one key per hold + gap scan frames. The terminal debounces over two sweeps, so 2 + 2 is the fastest it can take; characters with no key are skipped.</p>
+    <textarea id="textBody" rows="5" style="width:100%" class="mono"></textarea>
+    <div class="row">
+      <label>Hold (frames)</label>
+      <input type="number" id="textHold" min="1" max="16" value="3" style="width:60px">
+    </div>
+    <div class="row">
+      <label>Gap (frames)</label>
+      <input type="number" id="textGap" min="1" max="16" value="3" style="width:60px">
+    </div>
+    <div class="actions" style="margin-top:8px">
+      <button class="btn-primary btn-sm" onclick="textType()">Type</button>
+      <button class="btn-secondary btn-sm" onclick="textCancel()">Cancel</button>
+    </div>
+    <div id="textStatus" class="mono" style="display:none;margin-top:8px"></div>
+  </div>
+
   <div class="group" style="margin-top:12px">
     <div class="group-title">Scan Snoop</div>
-    <p class="hint" style="margin-bottom:8px">Monitor which addresses the terminal is scanning. Start snoop, wait a few seconds, then read the histogram to see active scan addresses.</p>
-    <div class="actions">
+    <p class="hint" style="margin-bottom:8px">Monitor which addresses the terminal is scanning. Start snoop, wait a few seconds, then read the histogram to see active scan addresses, or the frames view for period, jitter and per-address dwell. DMA capture samples the bus in hardware instead of in the scan loop (needs the capture clock pin).</p>
+    <div class="row"><label>DMA capture</label><input type="checkbox" id="snoopDma"></div>
+    <div class="row">
+      <label>Sample rate (kHz)</label>
+      <input type="number" id="snoopRate" min="500" max="4000" value="2000" style="width:70px">
+    </div>
+    <div class="actions" style="margin-top:8px">
       <button class="btn-secondary btn-sm" onclick="snoopStart()">Start Snoop</button>
+      <button class="btn-secondary btn-sm" onclick="snoopStop()">Stop</button>
       <button class="btn-secondary btn-sm" onclick="snoopRead()">Read Histogram</button>
+      <button class="btn-secondary btn-sm" onclick="snoopFrames()">Read Frames</button>
     </div>
     <div id="histogramBox" style="display:none">Waiting...</div>
   </div>
+
+  <div class="group" style="margin-top:12px">
+    <div class="group-title">Bus Trace</div>
+    <p class="hint" style="margin-bottom:8px">Record every address and Key Return change at full rate into a RAM ring (oldest data is overwritten). Download stops the capture; decode the file with <code>tools/scan_trace</code>. Idle parking is off while tracing.</p>
+    <div class="row">
+      <label>Buffer (KB)</label>
+      <input type="number" id="traceKb" min="1" max="96" value="32" style="width:70px">
+    </div>
+    <div class="actions" style="margin-top:8px">
+      <button class="btn-secondary btn-sm" onclick="traceStart()">Start Trace</button>
+      <button class="btn-secondary btn-sm" onclick="traceStop()">Stop</button>
+      <button class="btn-secondary btn-sm" onclick="location.href='/api/scan/trace'">Download</button>
+    </div>
+  </div>
+
+  <div class="group" style="margin-top:12px">
+    <div class="group-title">Scan Engine</div>
+    <p class="hint" style="margin-bottom:8px">Scan loop counters: decoder, idle parking and timing statistics. Stalls shows how long the responder went dark between samples and what ran instead. Poll/Edge switch the response mode live.</p>
+    <div class="actions">
+      <button class="btn-secondary btn-sm" onclick="scanStats()">Read Stats</button>
+      <button class="btn-secondary btn-sm" onclick="scanStalls()">Read Stalls</button>
+      <button class="btn-secondary btn-sm" onclick="scanStatsReset()">Reset Jitter</button>
+      <button class="btn-secondary btn-sm" onclick="scanMode('poll')">Poll</button>
+      <button class="btn-secondary btn-sm" onclick="scanMode('edge')">Edge</button>
+    </div>
+    <div id="scanStatsBox" class="mono" style="display:none;white-space:pre;margin-top:8px">Waiting...</div>
+  </div>
 </div>
 
 <!-- WIFI / SETTINGS TAB -->
@@ -334,9 +408,16 @@ async function loadConfig() {
 function populateForm() {
   // General
   chk('use_mode_jumper', cfg.terminal?.use_mode_jumper);
+  val('keymap', cfg.terminal?.keymap);
   chk('feat_bt', cfg.features?.bt_classic);
   chk('feat_ble', cfg.features?.ble);
   chk('feat_wifi', cfg.features?.wifi);
+  chk('scan_isolated', cfg.scan?.isolated_core);
+  val('scan_settle_ns', cfg.scan?.settle_ns);
+  chk('scan_predict', cfg.scan?.predict);
+  chk('scan_edge', cfg.scan?.edge);
+  val('scan_latch_frames', cfg.scan?.latch_frames);
+  val('scan_rollover', cfg.scan?.rollover);
 
   // Pins
   for (let i = 0; i < 7; i++) val('pin_addr'+i, cfg.pins?.['addr'+i]);
@@ -345,6 +426,7 @@ function populateForm() {
   val('pin_mode_jp', cfg.pins?.mode_jp);
   val('pin_led', cfg.pins?.led);
   val('pin_bt_led', cfg.pins?.bt_led);
+  val('pin_capture_clk', cfg.pins?.capture_clk);
 
   // WiFi / Settings
   val('device_name', cfg.wifi?.ap_ssid);
@@ -357,7 +439,16 @@ function populateForm() {
 // --- Gather form data ---
 function gatherConfig() {
   cfg.terminal = {
-    use_mode_jumper: gchk('use_mode_jumper')
+    use_mode_jumper: gchk('use_mode_jumper'),
+    keymap: gval('keymap')
+  };
+  cfg.scan = {
+    isolated_core: gchk('scan_isolated'),
+    settle_ns: gnum('scan_settle_ns'),
+    predict: gchk('scan_predict'),
+    edge: gchk('scan_edge'),
+    latch_frames: gnum('scan_latch_frames'),
+    rollover: gnum('scan_rollover')
   };
   cfg.features = {
     bt_classic: gchk('feat_bt'),
@@ -366,7 +457,8 @@ function gatherConfig() {
   cfg.pins = {
     key_return: gnum('pin_key_return'),
     pair_btn: gnum('pin_pair_btn'), mode_jp: gnum('pin_mode_jp'),
-    led: gnum('pin_led'), bt_led: gnum('pin_bt_led')
+    led: gnum('pin_led'), bt_led: gnum('pin_bt_led'),
+    capture_clk: gnum('pin_capture_clk')
   };
   for (let i = 0; i < 7; i++) cfg.pins['addr'+i] = gnum('pin_addr'+i);
 
@@ -464,36 +556,207 @@ async function scanSweep() {
   } catch(e) { toast('Error: ' + e, false); }
 }
 
+let textPoll = null;
+async function textType() {
+  const text = document.getElementById('textBody').value;
+  const hold = parseInt(document.getElementById('textHold').value) || 3;
+  const gap = parseInt(document.getElementById('textGap').value) || 3;
+  if (!text) { toast('Nothing to type', false); return; }
+  try {
+    const r = await fetch('/api/text', {
+      method: 'POST', headers: {'Content-Type':'application/json'},
+      body: JSON.stringify({text: text, hold_frames: hold, gap_frames: gap})
+    });
+    const result = await r.json();
+    if (!result.ok) { toast(result.error || 'Failed', false); return; }
+    if (!textPoll) textPoll = setInterval(textStatus, 500);
+  } catch(e) { toast('Error: ' + e, false); }
+}
+
+async function textStatus() {
+  try {
+    const s = await (await fetch('/api/text')).json();
+    const box = document.getElementById('textStatus');
+    box.style.display = 'block';
+    box.textContent = s.state + ': ' + s.done + '/' + s.bytes + ' bytes, ' + s.typed + ' typed, ' +
+      s.skipped + ' skipped, ' + s.chars_per_sec.toFixed(1) + ' chars/s, ' + s.frames_per_char.toFixed(2) + ' frames/char';
+    if (s.state !== 'typing' && textPoll) { clearInterval(textPoll); textPoll = null; }
+  } catch(e) { clearInterval(textPoll); textPoll = null; }
+}
+
+async function textCancel() {
+  try {
+    await fetch('/api/text/cancel', {method: 'POST'});
+    textStatus();
+  } catch(e) { toast('Error: ' + e, false); }
+}
+
 async function snoopStart() {
+  const dma = document.getElementById('snoopDma').checked;
+  const rate = parseInt(document.getElementById('snoopRate').value) || 2000;
   try {
-    await fetch('/api/scan/snoop', {
+    const r = await fetch('/api/scan/snoop', {
       method: 'POST', headers: {'Content-Type':'application/json'},
-      body: JSON.stringify({enable: true})
+      body: JSON.stringify({enable: true, source: dma ? 'dma' : 'loop', rate_khz: rate})
     });
+    const result = await r.json();
+    if (!r.ok) throw new Error(result.error || 'HTTP ' + r.status);
     toast('Snoop started — wait a few seconds, then Read Histogram', true);
   } catch(e) { toast('Error: ' + e, false); }
 }
 
+async function snoopStop() {
+  try {
+    await fetch('/api/scan/snoop', {
+      method: 'POST', headers: {'Content-Type':'application/json'},
+      body: JSON.stringify({enable: false})
+    });
+    toast('Snoop stopped', true);
+  } catch(e) { toast('Error: ' + e, false); }
+}
+
 async function snoopRead() {
   try {
     const r = await fetch('/api/scan/histogram');
+    if (r.status === 409) throw new Error('start snoop first');
     if (!r.ok) throw new Error('HTTP ' + r.status);
     const data = await r.json();
     const box = document.getElementById('histogramBox');
     box.style.display = 'block';
     let lines = 'Total scans: ' + (data.total_scans||0) + '  Last addr: 0x'
               + ((data.last_addr||0).toString(16).toUpperCase().padStart(2,'0')) + '\n';
-    lines += 'Addr  Col Row  Count\n';
-    lines += '----  --- ---  -----\n';
+    if (data.ring) {
+      lines += 'Ring: ' + data.ring.dropped + ' dropped, ' + data.ring.gaps + ' gaps, max depth '
+             + data.ring.max_depth + '/' + data.ring.size + (data.snooping ? '' : '  (snoop stopped)') + '\n';
+    }
+    if (data.capture) {
+      const c = data.capture;
+      lines += 'DMA: ' + c.rate_khz + ' kHz, ' + c.samples + ' samples, ' + c.glitches + ' glitches, '
+             + c.overruns + ' overruns (' + c.lost_samples + ' samples lost)' + (c.running ? '' : '  (stopped)') + '\n';
+    }
+    if (data.predict) {
+      const p = data.predict;
+      lines += 'Prediction: ' + (p.enabled ? p.hit_pct.toFixed(2) + '% hit (' + p.hits + ' hit, '
+             + p.misses + ' miss, ' + p.cold + ' learning)' : 'off') + '\n';
+    }
+    lines += 'Addr  Col Row  Visits   Asserted  Time (us)\n';
+    lines += '----  --- ---  -------  --------  ---------\n';
     (data.addresses || []).forEach(a => {
       lines += '0x' + a.addr.toString(16).toUpperCase().padStart(2,'0')
             + '   ' + String(a.col).padStart(2) + '   ' + a.row
-            + '    ' + a.count + '\n';
+            + '    ' + String(a.count).padEnd(9) + String(a.asserted).padEnd(10) + a.time_us + '\n';
+    });
+    box.textContent = lines;
+  } catch(e) { toast('Error: ' + e, false); }
+}
+
+async function snoopFrames() {
+  try {
+    const r = await fetch('/api/scan/frames');
+    if (r.status === 409) throw new Error('start snoop first');
+    if (!r.ok) throw new Error('HTTP ' + r.status);
+    const d = await r.json();
+    const box = document.getElementById('histogramBox');
+    box.style.display = 'block';
+    const p = d.period, j = d.jitter, o = d.order;
+    let lines = 'Frames: ' + p.frames + '  period ' + p.avg_us.toFixed(1) + 'us (' + p.min_cycles
+              + '-' + p.max_cycles + ' cyc)\n';
+    lines += 'Jitter: p50 ' + j.p50_us + 'us  p90 ' + j.p90_us + 'us  p99 ' + j.p99_us
+           + 'us  p99.9 ' + j.p999_us + 'us  max ' + j.max_us.toFixed(2) + 'us\n';
+    lines += 'Order:  ' + o.signature + '  len ' + o.length + '  repeats ' + o.repeats
+           + '  changes ' + o.changes + '\n';
+    lines += 'Addr   Dwell min/avg/max (cycles)   n\n';
+    lines += '----   --------------------------   -----\n';
+    (d.dwell || []).forEach(e => {
+      lines += '0x' + e.addr.toString(16).toUpperCase().padStart(2,'0') + '   '
+            + (e.min + '/' + e.avg + '/' + e.max).padEnd(29) + e.n + '\n';
+    });
+    box.textContent = lines;
+  } catch(e) { toast('Error: ' + e, false); }
+}
+
+async function traceSet(body) {
+  try {
+    const r = await fetch('/api/scan/trace', {
+      method: 'POST', headers: {'Content-Type':'application/json'},
+      body: JSON.stringify(body)
+    });
+    const result = await r.json();
+    toast(result.message || result.error, r.ok);
+  } catch(e) { toast('Error: ' + e, false); }
+}
+
+function traceStart() {
+  traceSet({enable: true, kb: parseInt(document.getElementById('traceKb').value) || 32});
+}
+
+function traceStop() {
+  traceSet({enable: false});
+}
+
+// Flatten nested stats JSON into "section.key  value" lines
+function flattenStats(obj, prefix, out) {
+  Object.keys(obj).forEach(k => {
+    const v = obj[k], name = prefix ? prefix + '.' + k : k;
+    if (v !== null && typeof v === 'object' && !Array.isArray(v)) flattenStats(v, name, out);
+    else out.push(name.padEnd(28) + (Array.isArray(v) ? v.join(' ') : v));
+  });
+  return out;
+}
+
+async function scanStalls() {
+  try {
+    const r = await fetch('/api/scan/stalls');
+    if (!r.ok) throw new Error('HTTP ' + r.status);
+    const d = await r.json();
+    const box = document.getElementById('scanStatsBox');
+    box.style.display = 'block';
+    let lines = 'Samples: ' + d.samples + '  worst gap ' + d.max_gap_us.toFixed(2) + 'us\n';
+    lines += 'Gap >=         Count\n';
+    (d.histogram || []).forEach(b => {
+      lines += (b.min_us.toFixed(3) + 'us').padEnd(15) + b.count + '\n';
     });
+    lines += '\nWorst stalls   At (ms)     Addr  Cause\n';
+    (d.top || []).forEach(e => {
+      lines += (e.gap_us.toFixed(2) + 'us').padEnd(15) + String(e.at_ms).padEnd(12) + '0x'
+            + e.addr.toString(16).toUpperCase().padStart(2,'0') + '  ' + e.cause
+            + (e.task ? ' (' + e.task + ')' : '') + '\n';
+    });
+    lines += '\nCandidates: ' + (d.candidates || []).join(' ');
     box.textContent = lines;
   } catch(e) { toast('Error: ' + e, false); }
 }
 
+async function scanStats() {
+  try {
+    const r = await fetch('/api/scan/stats');
+    if (!r.ok) throw new Error('HTTP ' + r.status);
+    const box = document.getElementById('scanStatsBox');
+    box.style.display = 'block';
+    box.textContent = flattenStats(await r.json(), '', []).join('\n');
+  } catch(e) { toast('Error: ' + e, false); }
+}
+
+async function scanMode(response) {
+  try {
+    const r = await fetch('/api/scan/mode', {
+      method: 'POST', headers: {'Content-Type':'application/json'},
+      body: JSON.stringify({response})
+    });
+    const d = await r.json();
+    if (!r.ok) throw new Error(d.error || ('HTTP ' + r.status));
+    toast(d.pending ? 'Switch pending (waiting for the bus)' : 'Response: ' + d.response, true);
+    scanStats();
+  } catch(e) { toast('Error: ' + e, false); }
+}
+
+async function scanStatsReset() {
+  try {
+    await fetch('/api/scan/stats/reset', {method: 'POST'});
+    toast('Jitter counters reset', true);
+  } catch(e) { toast('Error: ' + e, false); }
+}
+
 // --- Password ---
 async function changePassword() {
   const cur = document.getElementById('cur_pass').value;
@@ -538,9 +801,19 @@ async function updateStatus() {
     if (s.wifi_mode) document.getElementById('wifiModeLabel').textContent = s.wifi_mode;
     if (s.wifi_ip) document.getElementById('wifiIpLabel').textContent = s.wifi_ip;
     if (s.hostname) document.getElementById('wifiHostLabel').textContent = s.hostname + '.local';
+    if (s.scan_layout) showScanLayout(s.scan_layout);
   } catch(e) {}
 }
 
+// Active address decoder (from running pins — edits apply after reboot)
+function showScanLayout(layout) {
+  const names = {j3: 'Default J3 wiring', contiguous: 'Contiguous pins', generic: 'Generic lookup'};
+  document.getElementById('scanLayoutLabel').textContent = names[layout] || layout;
+  document.getElementById('scanLayoutHint').textContent = layout === 'generic'
+    ? 'No fast path — use the J3 default or A0-A6 on GPIO 12-18 or 13-19'
+    : 'Fast path';
+}
+
 function startLogPoll() {
   logPoll = setInterval(async () => {
     try {
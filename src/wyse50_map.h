@@ -0,0 +1,167 @@
+/*
+ * wyse50_map.h — The built-in Wyse 50 keymap rules (portable)
+ *
+ * The rules the firmware compiles at boot (initKeyMap) and falls back to
+ * when no keymap blob is selected. keymaps/wyse50.json is the same map
+ * for keymap_compile; its self-check compiles both and fails if the
+ * tables differ, so an edit to one has to be made to the other.
+ *
+ * Source: MAME wy50kb.cpp (verified against WY-50 maintenance manual schematic)
+ * Address = (column * 8) + row; bits 6-3 = column (0-12), bits 2-0 = row (0-7)
+ * Usages without a rule are not on the Wyse 50 (see key_map.h for the
+ * rule format and how Shift/Ctrl are driven).
+ */
+
+#ifndef WYSE50_MAP_H
+#define WYSE50_MAP_H
+
+#include "key_map.h"
+
+// Modifier scan addresses: key_map.h drives them from the held keys, and
+// the rollover shaper keeps them outside its cap
+#define WYSE_SHIFT 0x4A // Col 9, Row 2
+#define WYSE_CTRL  0x1F // Col 3, Row 7
+
+static const KeyRule WYSE50_RULES[] = {
+    // Letters (HID 0x04-0x1D = a-z)
+    KEY_RULE(0x04, 0x3F, 0), // a → Col 7, Row 7
+    KEY_RULE(0x05, 0x2E, 0), // b → Col 5, Row 6
+    KEY_RULE(0x06, 0x4E, 0), // c → Col 9, Row 6
+    KEY_RULE(0x07, 0x37, 0), // d → Col 6, Row 7
+    KEY_RULE(0x08, 0x30, 0), // e → Col 6, Row 0
+    KEY_RULE(0x09, 0x17, 0), // f → Col 2, Row 7
+    KEY_RULE(0x0A, 0x0F, 0), // g → Col 1, Row 7
+    KEY_RULE(0x0B, 0x07, 0), // h → Col 0, Row 7
+    KEY_RULE(0x0C, 0x58, 0), // i → Col 11, Row 0
+    KEY_RULE(0x0D, 0x5F, 0), // j → Col 11, Row 7
+    KEY_RULE(0x0E, 0x67, 0), // k → Col 12, Row 7
+    KEY_RULE(0x0F, 0x2F, 0), // l → Col 5, Row 7
+    KEY_RULE(0x10, 0x0E, 0), // m → Col 1, Row 6
+    KEY_RULE(0x11, 0x16, 0), // n → Col 2, Row 6
+    KEY_RULE(0x12, 0x60, 0), // o → Col 12, Row 0
+    KEY_RULE(0x13, 0x51, 0), // p → Col 10, Row 1
+    KEY_RULE(0x14, 0x38, 0), // q → Col 7, Row 0
+    KEY_RULE(0x15, 0x28, 0), // r → Col 5, Row 0
+    KEY_RULE(0x16, 0x4F, 0), // s → Col 9, Row 7
+    KEY_RULE(0x17, 0x10, 0), // t → Col 2, Row 0
+    KEY_RULE(0x18, 0x00, 0), // u → Col 0, Row 0
+    KEY_RULE(0x19, 0x36, 0), // v → Col 6, Row 6
+    KEY_RULE(0x1A, 0x48, 0), // w → Col 9, Row 0
+    KEY_RULE(0x1B, 0x3E, 0), // x → Col 7, Row 6
+    KEY_RULE(0x1C, 0x08, 0), // y → Col 1, Row 0
+    KEY_RULE(0x1D, 0x1E, 0), // z → Col 3, Row 6
+
+    // Number row (HID 0x1E-0x27 = 1-0)
+    KEY_RULE(0x1E, 0x1B, 0), // 1/! → Col 3, Row 3
+    KEY_RULE(0x1F, 0x3B, 0), // 2/@ → Col 7, Row 3
+    KEY_RULE(0x20, 0x4B, 0), // 3/# → Col 9, Row 3
+    KEY_RULE(0x21, 0x33, 0), // 4/$ → Col 6, Row 3
+    KEY_RULE(0x22, 0x2B, 0), // 5/% → Col 5, Row 3
+    KEY_RULE(0x23, 0x13, 0), // 6/^ → Col 2, Row 3
+    KEY_RULE(0x24, 0x0B, 0), // 7/& → Col 1, Row 3
+    KEY_RULE(0x25, 0x03, 0), // 8/* → Col 0, Row 3
+    KEY_RULE(0x26, 0x5B, 0), // 9/( → Col 11, Row 3
+    KEY_RULE(0x27, 0x63, 0), // 0/) → Col 12, Row 3
+
+    // Common keys
+    KEY_RULE(0x28, 0x65, 0), // Return    → Col 12, Row 5
+    KEY_RULE(0x29, 0x3C, 0), // Escape    → Col 7, Row 4
+    KEY_RULE(0x2A, 0x1A, 0), // Backspace → Col 3, Row 2
+    KEY_RULE(0x2B, 0x18, 0), // Tab       → Col 3, Row 0
+    KEY_RULE(0x2C, 0x19, 0), // Space     → Col 3, Row 1
+
+    // Punctuation
+    KEY_RULE(0x2D, 0x43, 0), // -/_ → Col 8, Row 3
+    KEY_RULE(0x2E, 0x53, 0), // =/+ → Col 10, Row 3
+    KEY_RULE(0x2F, 0x42, 0), // [/{ → Col 8, Row 2
+    KEY_RULE(0x30, 0x45, 0), // ]/} → Col 8, Row 5
+    KEY_RULE(0x31, 0x5C, 0), // \/| → Col 11, Row 4
+    KEY_RULE(0x33, 0x44, 0), // ;/: → Col 8, Row 4
+    KEY_RULE(0x34, 0x46, 0), // '/" → Col 8, Row 6
+    KEY_RULE(0x35, 0x4C, 0), // `/~ → Col 9, Row 4
+    KEY_RULE(0x36, 0x06, 0), // ,/< → Col 0, Row 6
+    KEY_RULE(0x37, 0x5E, 0), // ./> → Col 11, Row 6
+    KEY_RULE(0x38, 0x66, 0), // //? → Col 12, Row 6
+
+    // Lock / special
+    KEY_RULE(0x39, 0x3A, 0), // Caps Lock → Col 7, Row 2
+
+    // Function keys (F1-F12 map to Wyse F1-F12)
+    KEY_RULE(0x3A, 0x1D, 0), // F1  → Col 3, Row 5
+    KEY_RULE(0x3B, 0x3D, 0), // F2  → Col 7, Row 5
+    KEY_RULE(0x3C, 0x25, 0), // F3  → Col 4, Row 5
+    KEY_RULE(0x3D, 0x23, 0), // F4  → Col 4, Row 3
+    KEY_RULE(0x3E, 0x20, 0), // F5  → Col 4, Row 0
+    KEY_RULE(0x3F, 0x27, 0), // F6  → Col 4, Row 7
+    KEY_RULE(0x40, 0x26, 0), // F7  → Col 4, Row 6
+    KEY_RULE(0x41, 0x49, 0), // F8  → Col 9, Row 1
+    KEY_RULE(0x42, 0x24, 0), // F9  → Col 4, Row 4
+    KEY_RULE(0x43, 0x1C, 0), // F10 → Col 3, Row 4
+    KEY_RULE(0x44, 0x57, 0), // F11 → Col 10, Row 7
+    KEY_RULE(0x45, 0x22, 0), // F12 → Col 4, Row 2
+
+    // Wyse-specific keys mapped to HID keys that don't conflict
+    KEY_RULE(0x47, 0x0C, 0), // Scroll Lock → SETUP (Col 1, Row 4) *** CRITICAL ***
+    KEY_RULE(0x48, 0x34, 0), // Pause/Break → Break (Col 6, Row 4)
+    KEY_RULE(0x49, 0x01, 0), // Insert      → Ins Char/Line (Col 0, Row 1)
+    KEY_RULE(0x4A, 0x61, 0), // Home        → Home (Col 12, Row 1)
+    KEY_RULE(0x4C, 0x62, 0), // Delete      → Del 0x7F (Col 12, Row 2)
+    KEY_RULE(0x4D, 0x04, 0), // End         → Clr Line (Col 0, Row 4); Shift = Clr Scrn
+    KEY_RULE(0x46, 0x64, 0), // Print Scrn  → Send/Print (Col 12, Row 4)
+    KEY_RULE(0x65, 0x39, 0), // Application → Func (Col 7, Row 1)
+
+    // One Wyse key, Next Page unshifted and Prev Page shifted: each PC
+    // key sends its own half whatever Shift is doing
+    KEY_RULE(0x4E, 0x41, KEY_MOD_SHIFT_OFF), // Page Down → Next Page (Col 8, Row 1)
+    KEY_RULE(0x4B, 0x41, KEY_MOD_SHIFT_ON),  // Page Up   → Prev Page (Shift + Col 8, Row 1)
+
+    // F13-F16, for keyboards that have them
+    KEY_RULE(0x68, 0x50, 0), // F13 → Col 10, Row 0
+    KEY_RULE(0x69, 0x54, 0), // F14 → Col 10, Row 4
+    KEY_RULE(0x6A, 0x56, 0), // F15 → Col 10, Row 6
+    KEY_RULE(0x6B, 0x21, 0), // F16 → Col 4, Row 1
+
+    // Arrow keys
+    KEY_RULE(0x4F, 0x0A, 0), // Right → Col 1, Row 2
+    KEY_RULE(0x50, 0x5A, 0), // Left  → Col 11, Row 2
+    KEY_RULE(0x51, 0x05, 0), // Down  → Col 0, Row 5
+    KEY_RULE(0x52, 0x4D, 0), // Up    → Col 9, Row 5
+
+    // Keypad
+    KEY_RULE(0x54, 0x66, 0), // KP /     → //? (shared)
+    KEY_RULE(0x56, 0x31, 0), // KP -     → Col 6, Row 1
+    KEY_RULE(0x58, 0x35, 0), // KP Enter → Col 6, Row 5
+    KEY_RULE(0x59, 0x12, 0), // KP 1     → Col 2, Row 2
+    KEY_RULE(0x5A, 0x02, 0), // KP 2     → Col 0, Row 2
+    KEY_RULE(0x5B, 0x52, 0), // KP 3     → Col 10, Row 2
+    KEY_RULE(0x5C, 0x11, 0), // KP 4     → Col 2, Row 1
+    KEY_RULE(0x5D, 0x2A, 0), // KP 5     → Col 5, Row 2
+    KEY_RULE(0x5E, 0x2C, 0), // KP 6     → Col 5, Row 4
+    KEY_RULE(0x5F, 0x14, 0), // KP 7     → Col 2, Row 4
+    KEY_RULE(0x60, 0x55, 0), // KP 8     → Col 10, Row 5
+    KEY_RULE(0x61, 0x59, 0), // KP 9     → Col 11, Row 1
+    KEY_RULE(0x62, 0x15, 0), // KP 0     → Col 2, Row 5
+    KEY_RULE(0x63, 0x29, 0), // KP .     → Col 5, Row 1
+
+    // Modifiers (usages 0xE0-0xE7; hid_diff.h folds the modifier byte into these).
+    // Shift and Ctrl make these keys holders, key_map.h drives the addresses.
+    KEY_RULE(0xE0, WYSE_CTRL, 0),               // Left Ctrl
+    KEY_RULE(0xE1, WYSE_SHIFT, 0),              // Left Shift
+    KEY_RULE(0xE4, WYSE_CTRL, 0),               // Right Ctrl
+    KEY_RULE(0xE5, WYSE_SHIFT, 0),              // Right Shift
+    KEY_RULE(0xE6, HID_NO_ADDR, KEY_MOD_LAYER), // Right Alt → Wyse layer
+
+    // Wyse layer (Right Alt held): keys a PC keyboard has no place for.
+    // Shift still applies, so Right Alt+Shift+Delete is Del Line.
+    KEY_RULE_IN(KEY_CLASS_LAYER, 0x3A, 0x50, 0), // F1     → F13
+    KEY_RULE_IN(KEY_CLASS_LAYER, 0x3B, 0x54, 0), // F2     → F14
+    KEY_RULE_IN(KEY_CLASS_LAYER, 0x3C, 0x56, 0), // F3     → F15
+    KEY_RULE_IN(KEY_CLASS_LAYER, 0x3D, 0x21, 0), // F4     → F16
+    KEY_RULE_IN(KEY_CLASS_LAYER, 0x4C, 0x2D, 0), // Delete → Del Char (Col 5, Row 5)
+    KEY_RULE_IN(KEY_CLASS_LAYER, 0x49, 0x32, 0), // Insert → Repl/Ins (Col 6, Row 2)
+    KEY_RULE_IN(KEY_CLASS_LAYER, 0x2C, 0x39, 0), // Space  → Func
+};
+
+#define WYSE50_RULE_COUNT (sizeof(WYSE50_RULES) / sizeof(WYSE50_RULES[0]))
+
+#endif // WYSE50_MAP_H
@@ -0,0 +1,192 @@
+/*
+ * bus_model.h — Simulated Wyse 50 8031 keyboard scan bus (host only)
+ *
+ * Models the terminal side of J3: the 8031 puts a 7-bit address on the
+ * bus, holds it for one dwell period and samples Key Return near the
+ * end of the dwell. Time is measured in ESP32 CPU cycles (240 MHz) so
+ * the responder model can be costed in the same units as the firmware.
+ *
+ * Each address line can lag the others by a fixed skew (level shifter
+ * and trace mismatch), so a sample taken during a transition sees a mix
+ * of the old and new address — see busGpioAt().
+ */
+
+#ifndef BUS_MODEL_H
+#define BUS_MODEL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scan_core.h"
+
+#define SIM_CPU_MHZ SCAN_CPU_MHZ
+
+// ============================================================
+// TERMINAL (8031) TIMING
+// ============================================================
+
+struct BusModel {
+    uint32_t dwell_cycles;      // Address hold time (~6us)
+    uint32_t sample_cycles;     // Key Return sample point, from start of dwell
+    uint32_t frame_gap_cycles;  // Idle time after a full sweep (last address held)
+    uint16_t frame_len;         // Addresses per frame
+    uint8_t order[SCAN_ADDR_COUNT];
+    uint32_t skew_cycles[SCAN_ADDR_BITS]; // Per-line propagation delay (A0-A6)
+};
+
+static inline void busModelInit(BusModel &bus, double dwell_us, double sample_us, double gap_us, uint16_t frame_len) {
+    if (frame_len == 0 || frame_len > SCAN_ADDR_COUNT) frame_len = SCAN_ADDR_COUNT;
+    bus.dwell_cycles     = (uint32_t)(dwell_us * SIM_CPU_MHZ);
+    bus.sample_cycles    = (uint32_t)(sample_us * SIM_CPU_MHZ);
+    bus.frame_gap_cycles = (uint32_t)(gap_us * SIM_CPU_MHZ);
+    bus.frame_len        = frame_len;
+    for (int i = 0; i < frame_len; i++) bus.order[i] = (uint8_t)i; // 8031 sweeps upward
+    memset(bus.skew_cycles, 0, sizeof(bus.skew_cycles));
+}
+
+static inline uint64_t busFramePeriod(const BusModel &bus) {
+    return (uint64_t)bus.frame_len * bus.dwell_cycles + bus.frame_gap_cycles;
+}
+
+// Start of dwell for slot `slot` of frame `frame`
+static inline uint64_t busSlotStart(const BusModel &bus, uint64_t frame, uint16_t slot) {
+    return frame * busFramePeriod(bus) + (uint64_t)slot * bus.dwell_cycles;
+}
+
+// Address on the bus at time t (the last address stays up during the gap)
+static inline uint8_t busAddrAt(const BusModel &bus, uint64_t t) {
+    uint64_t off  = t % busFramePeriod(bus);
+    uint64_t slot = off / bus.dwell_cycles;
+    if (slot >= bus.frame_len) slot = bus.frame_len - 1;
+    return bus.order[slot];
+}
+
+// GPIO_IN_REG image at time t with per-line skew applied: line i still
+// shows the address that was on the bus skew_cycles[i] ago.
+static inline uint32_t busGpioAt(const BusModel &bus, const ScanCore &core, uint64_t t) {
+    uint32_t gpio_in = 0;
+    for (int i = 0; i < SCAN_ADDR_BITS; i++) {
+        uint64_t seen = t >= bus.skew_cycles[i] ? t - bus.skew_cycles[i] : 0;
+        if (busAddrAt(bus, seen) & (1 << i)) gpio_in |= core.addr_masks[i];
+    }
+    return gpio_in;
+}
+
+// ============================================================
+// SIMULATION RESULTS
+// ============================================================
+
+#define SIM_LAT_BUCKETS 4096 // Latency histogram resolution: 1 cycle, clamped
+
+struct SimStats {
+    uint64_t samples;       // Key Return samples taken by the terminal
+    uint64_t held_samples;  // ...of which the addressed key was held
+    uint64_t keys_missed;   // Key held, Key Return read inactive
+    uint64_t wrong_addr;    // Key not held, Key Return read active
+    uint64_t stale_slots;   // Dwell ended with no responder sample at all
+    uint64_t gap_yields;    // Sleeps placed in an inter-frame gap
+    uint64_t forced_yields; // Blind vTaskDelay-style sleeps
+    uint64_t yield_cycles;  // Total time the responder slept
+    uint64_t sim_cycles;    // Total simulated time
+    uint32_t frames_seen;   // Frame boundaries the responder's tracker saw
+    uint32_t frames_missed; // ...and frames it reported missing
+    uint64_t phantom_addrs;   // Responder answered for an address not on the bus
+    uint64_t phantom_asserts; // ...and drove Key Return active for it (phantom key)
+    uint64_t settle_rejected; // Transitions the settle filter threw away
+    uint64_t predict_hits;    // Predictive Key Return guessed the next address
+    uint64_t predict_misses;
+    uint64_t lat_count;
+    uint64_t lat_sum;
+    uint32_t lat_min;
+    uint32_t lat_max;
+    uint32_t lat_hist[SIM_LAT_BUCKETS];
+};
+
+static inline void simStatsReset(SimStats &s) {
+    memset(&s, 0, sizeof(s));
+    s.lat_min = UINT32_MAX;
+}
+
+static inline void simStatsLatency(SimStats &s, uint32_t cycles) {
+    s.lat_count++;
+    s.lat_sum += cycles;
+    if (cycles < s.lat_min) s.lat_min = cycles;
+    if (cycles > s.lat_max) s.lat_max = cycles;
+    s.lat_hist[cycles < SIM_LAT_BUCKETS ? cycles : SIM_LAT_BUCKETS - 1]++;
+}
+
+static inline uint32_t simStatsPercentile(const SimStats &s, double pct) {
+    if (s.lat_count == 0) return 0;
+    uint64_t target = (uint64_t)(s.lat_count * pct / 100.0);
+    uint64_t seen   = 0;
+    for (uint32_t i = 0; i < SIM_LAT_BUCKETS; i++) {
+        seen += s.lat_hist[i];
+        if (seen > target) return i;
+    }
+    return SIM_LAT_BUCKETS - 1;
+}
+
+static inline void simStatsPrint(const SimStats &s) {
+    printf("  samples          %llu (%llu with key held)\n", (unsigned long long)s.samples,
+           (unsigned long long)s.held_samples);
+    printf("  keys missed      %llu\n", (unsigned long long)s.keys_missed);
+    printf("  wrong-address    %llu\n", (unsigned long long)s.wrong_addr);
+    printf("  stale dwells     %llu\n", (unsigned long long)s.stale_slots);
+    if (s.gap_yields || s.forced_yields) {
+        printf("  yields           %llu gap, %llu forced (%.1f%% of time asleep)\n",
+               (unsigned long long)s.gap_yields, (unsigned long long)s.forced_yields,
+               s.sim_cycles ? 100.0 * s.yield_cycles / (double)s.sim_cycles : 0.0);
+    }
+    if (s.phantom_addrs || s.settle_rejected) {
+        printf("  phantom answers  %llu (%llu asserted), %llu rejected by settle filter\n",
+               (unsigned long long)s.phantom_addrs, (unsigned long long)s.phantom_asserts,
+               (unsigned long long)s.settle_rejected);
+    }
+    if (s.predict_hits || s.predict_misses) {
+        printf("  prediction       %llu hit, %llu miss (%.2f%%)\n", (unsigned long long)s.predict_hits,
+               (unsigned long long)s.predict_misses,
+               100.0 * s.predict_hits / (double)(s.predict_hits + s.predict_misses));
+    }
+    if (s.frames_seen) {
+        printf("  frames tracked   %u seen, %u reported missed\n", s.frames_seen, s.frames_missed);
+    }
+    if (s.lat_count) {
+        printf("  latency (cycles) min %u  avg %.1f  p50 %u  p99 %u  max %u\n", s.lat_min,
+               (double)s.lat_sum / s.lat_count, simStatsPercentile(s, 50), simStatsPercentile(s, 99),
+               s.lat_max);
+    }
+}
+
+// "--name=value" command-line lookup shared by the host tools
+static inline double simArgNum(int argc, char **argv, const char *name, double def) {
+    size_t n = strlen(name);
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) == 0 && strncmp(argv[i] + 2, name, n) == 0 && argv[i][2 + n] == '=') {
+            return atof(argv[i] + 3 + n);
+        }
+    }
+    return def;
+}
+
+// "--name=value" string lookup (NULL if absent)
+static inline const char *simArgStr(int argc, char **argv, const char *name) {
+    size_t n = strlen(name);
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) == 0 && strncmp(argv[i] + 2, name, n) == 0 && argv[i][2 + n] == '=') {
+            return argv[i] + 3 + n;
+        }
+    }
+    return NULL;
+}
+
+// Small deterministic PRNG so runs are reproducible across hosts
+static inline uint32_t simRand(uint32_t &state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+#endif // BUS_MODEL_H
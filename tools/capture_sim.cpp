@@ -0,0 +1,163 @@
+/*
+ * capture_sim.cpp — Host check of the DMA snoop decoder (scan_capture.h)
+ *
+ * Samples the simulated scan bus the way the I2S0 camera-mode capture
+ * does (fixed rate, A0-A6 plus Key Return, two samples per DMA word),
+ * cuts the stream into ping-pong buffers of an awkward size so dwells
+ * and frames straddle buffer boundaries, and runs the buffers through
+ * the firmware decoder. The decoded histogram and frame analytics are
+ * checked against the bus model; exit status is non-zero on mismatch.
+ *
+ *   capture_sim [--rate-khz=2000] [--skew-ns=40] [--dwell=6] [--gap=200]
+ *               [--frames=400] [--words=997] [--drop-every=0]
+ *
+ * --skew-ns     worst per-line propagation skew (spread across A0-A6)
+ * --words       32-bit words per DMA buffer (firmware: 1000)
+ * --drop-every  lose every Nth buffer, as an overrun would (0 = never)
+ */
+
+#include <chrono>
+
+#include "bus_model.h"
+#include "scan_capture.h"
+
+#define CAP_KR_DELAY_CYCLES 24 // Responder answer time after the address settles
+#define CAP_PHASE_CYCLES    37 // Capture clock isn't locked to the 8031's
+
+static const uint8_t held_keys[] = {0x05, 0x2A, 0x41, 0x7E};
+
+static bool keyHeld(uint8_t addr) {
+    for (uint8_t k : held_keys) {
+        if (k == addr) return true;
+    }
+    return false;
+}
+
+// One capture sample at time t: skewed address lines plus Key Return
+// as the responder drives it for the address it saw CAP_KR_DELAY earlier
+static uint8_t sampleAt(const BusModel &bus, uint64_t t) {
+    uint8_t s = 0;
+    for (int i = 0; i < SCAN_ADDR_BITS; i++) {
+        uint64_t seen = t >= bus.skew_cycles[i] ? t - bus.skew_cycles[i] : 0;
+        s |= busAddrAt(bus, seen) & (1 << i);
+    }
+    uint64_t ans = t >= CAP_KR_DELAY_CYCLES ? t - CAP_KR_DELAY_CYCLES : 0;
+    if (keyHeld(busAddrAt(bus, ans))) s |= SCAN_CAP_KEY_RETURN;
+    return s;
+}
+
+struct CheckResult {
+    int failures = 0;
+    void expect(bool ok, const char *what) {
+        if (ok) return;
+        printf("  FAIL: %s\n", what);
+        failures++;
+    }
+};
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0) {
+            printf("usage: capture_sim [--rate-khz=2000] [--skew-ns=40] [--dwell=6] [--gap=200]\n"
+                   "                   [--frames=400] [--words=997] [--drop-every=0]\n");
+            return 0;
+        }
+    }
+    double rate_khz   = simArgNum(argc, argv, "rate-khz", 2000);
+    double skew_ns    = simArgNum(argc, argv, "skew-ns", 40);
+    double dwell_us   = simArgNum(argc, argv, "dwell", 6);
+    double gap_us     = simArgNum(argc, argv, "gap", 200);
+    uint32_t frames   = (uint32_t)simArgNum(argc, argv, "frames", 400);
+    uint32_t words    = (uint32_t)simArgNum(argc, argv, "words", 997);
+    uint32_t drop     = (uint32_t)simArgNum(argc, argv, "drop-every", 0);
+    uint32_t cps      = (uint32_t)(SCAN_CPU_MHZ * 1000 / rate_khz);
+    if (cps == 0 || words == 0 || frames < 3) {
+        fprintf(stderr, "bad arguments\n");
+        return 1;
+    }
+
+    BusModel bus;
+    busModelInit(bus, dwell_us, dwell_us * 0.8, gap_us, SCAN_ADDR_COUNT);
+    for (int i = 0; i < SCAN_ADDR_BITS; i++) {
+        bus.skew_cycles[i] = (uint32_t)(skew_ns * SCAN_CPU_MHZ / 1000 * i / (SCAN_ADDR_BITS - 1));
+    }
+
+    // Sample the whole run, then cut it into DMA buffers
+    uint64_t span       = busFramePeriod(bus) * frames;
+    uint64_t n_samples  = (span / cps) & ~1ULL;
+    uint32_t n_bufs     = (uint32_t)((n_samples / 2 + words - 1) / words);
+    uint8_t *samples    = (uint8_t *)calloc((size_t)n_bufs * words * 2, 1);
+    uint32_t *dma       = (uint32_t *)malloc((size_t)n_bufs * words * 4);
+    for (uint64_t k = 0; k < n_samples; k++) samples[k] = sampleAt(bus, k * cps + CAP_PHASE_CYCLES);
+    for (uint64_t k = n_samples; k < (uint64_t)n_bufs * words * 2; k++) samples[k] = samples[n_samples - 1];
+    scanCaptureEncode(samples, n_bufs * words * 2, dma);
+
+    static ScanCapture cap;
+    static ScanSnoopStats snoop;
+    scanCaptureInit(cap, cps);
+    scanSnoopReset(snoop);
+    uint32_t dropped = 0;
+    auto t0          = std::chrono::steady_clock::now();
+    for (uint32_t b = 0; b < n_bufs; b++) {
+        if (drop && b % drop == drop - 1) {
+            scanCaptureLost(cap, words * 2, snoop);
+            dropped++;
+            continue;
+        }
+        scanCaptureBuffer(cap, dma + (size_t)b * words, words, snoop);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+
+    const ScanFrameStats &fs = snoop.frames;
+    printf("capture_sim: %.0f kS/s (%u cyc/sample), skew %.0f ns, dwell %.1f us, gap %.0f us\n", rate_khz, cps,
+           skew_ns, dwell_us, gap_us);
+    printf("  buffers          %u x %u words, %u dropped\n", n_bufs, words, dropped);
+    printf("  samples          %llu decoded, %llu lost, %u glitches rejected\n",
+           (unsigned long long)cap.samples, (unsigned long long)cap.lost, cap.glitches);
+    printf("  decode           %.2f ns/sample on this host\n", cap.samples ? ns / cap.samples : 0.0);
+    printf("  records          %u changes, %u gaps\n", snoop.changes, snoop.gaps);
+    if (fs.frames) {
+        printf("  frames           %u scored, period %.2f us (%u-%u cyc, model %llu)\n", fs.frames,
+               (double)fs.period_sum / fs.frames / SCAN_CPU_MHZ, fs.period_min, fs.period_max,
+               (unsigned long long)busFramePeriod(bus));
+    }
+
+    // What the bus model says the decoder should have seen
+    CheckResult r;
+    uint64_t period = busFramePeriod(bus);
+    uint32_t tol    = cps + bus.skew_cycles[SCAN_ADDR_BITS - 1];
+    r.expect(fs.frames > 0, "no frames scored");
+    r.expect(fs.period_min + tol >= period && fs.period_max <= period + tol, "frame period off the model");
+    r.expect(fs.sig_changes == 0, "frame order changed between frames");
+
+    uint32_t visits = 0, phantoms = 0, kr_wrong = 0, dwell_bad = 0;
+    for (int a = 0; a < SCAN_ADDR_COUNT; a++) {
+        visits += snoop.visits[a];
+        bool on_bus = false;
+        for (int i = 0; i < bus.frame_len; i++) on_bus |= bus.order[i] == a;
+        if (!on_bus) phantoms += snoop.visits[a];
+        if (keyHeld(a) ? snoop.asserted[a] != snoop.visits[a] : snoop.asserted[a] != 0) kr_wrong++;
+        if (a == bus.order[bus.frame_len - 1] || !fs.dwell_n[a]) continue; // Held through the gap
+        if (fs.dwell_min[a] + tol < bus.dwell_cycles || fs.dwell_max[a] > bus.dwell_cycles + tol) dwell_bad++;
+    }
+    printf("  addresses        %u visits, %u phantom, %u with wrong Key Return, %u with dwell off model\n",
+           visits, phantoms, kr_wrong, dwell_bad);
+    r.expect(phantoms == 0, "transition mixes decoded as addresses");
+    r.expect(kr_wrong == 0, "Key Return attributed to the wrong addresses");
+    r.expect(dwell_bad == 0, "dwell off the model");
+    r.expect(snoop.gaps == dropped + 1, "each lost buffer should leave exactly one gap");
+
+    // Frames that straddle a lost buffer must go unscored, not mis-scored
+    uint32_t whole = frames - 1;
+    if (dropped) {
+        r.expect(fs.frames < whole, "frames across a lost buffer were scored");
+    } else {
+        r.expect(fs.frames + 1 >= whole, "frames missing with no buffers lost");
+        r.expect(visits + 1 >= frames * bus.frame_len, "address changes missing with no buffers lost");
+    }
+
+    free(samples);
+    free(dma);
+    printf("%s\n", r.failures ? "FAILED" : "ok");
+    return r.failures ? 1 : 0;
+}
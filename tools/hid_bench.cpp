@@ -0,0 +1,320 @@
+/*
+ * hid_bench.cpp — Host benchmark of the HID report diff (host only)
+ *
+ * Replays a stream of boot keyboard reports (typing with rollover,
+ * Shift and Ctrl chords, keys that share a Wyse address, the occasional
+ * ErrorRollOver report) through:
+ *   nested — the 6x6 loop over previous mapped addresses that
+ *            processHidReport() used before hid_diff.h
+ *   bitmap — hid_diff.h: 256-bit usage bitmap, XOR diff, per-address
+ *            reference counts
+ *   keymap — key_map.h: the same diff through compiled rules, Shift and
+ *            Ctrl driven from the held keys
+ * and reports reports/second for each, plus how many reports left the
+ * source's key layer different from the keys actually held. Then a few
+ * scripted reports check the keymap's contextual rules (synthetic Shift,
+ * Shift lifted, the layer key, a mapping taken at press).
+ *
+ *   hid_bench [--reports=N] [--seed=1]
+ *
+ * Exit status is non-zero if the bitmap or keymap diff gets any report
+ * wrong.
+ */
+
+#include <chrono>
+
+#include "bus_model.h"
+#include "key_map.h"
+
+#define BENCH_REPORTS 4096 // Pre-generated reports (power of 2)
+
+#define BENCH_SHIFT 0x4A // Same addresses as wyse50_map.h
+#define BENCH_CTRL  0x1F
+
+struct BenchReport {
+    uint8_t modifiers;
+    uint8_t keys[6];
+    uint32_t expect[SCAN_KEY_WORDS]; // Addresses the held keys should hold
+};
+
+// Key layer the diff's events build, as ScanKeyStage keeps per source
+struct BenchLayer {
+    uint32_t bits[SCAN_KEY_WORDS];
+    uint64_t events;
+
+    void apply(uint8_t addr, bool press) {
+        if (press) {
+            bits[addr >> 5] |= 1u << (addr & 31);
+        } else {
+            bits[addr >> 5] &= ~(1u << (addr & 31));
+        }
+        events++;
+    }
+};
+
+// --- Nested-loop diff (pre-hid_diff.h processHidReport) ---
+
+struct NestedState {
+    uint8_t prev_addrs[6];
+    uint8_t prev_mods;
+};
+
+static void nestedDiff(NestedState &s, uint8_t modifiers, const uint8_t *keys, const uint8_t *map, BenchLayer &l) {
+    for (int i = 0; i < 6; i++) {
+        if (s.prev_addrs[i] == 0xFF) continue;
+        bool still_held = false;
+        for (int j = 0; j < 6; j++) {
+            uint8_t wa = (keys[j] != 0) ? map[keys[j]] : 0xFF;
+            if (wa == s.prev_addrs[i]) {
+                still_held = true;
+                break;
+            }
+        }
+        if (!still_held) {
+            l.apply(s.prev_addrs[i], false);
+            s.prev_addrs[i] = 0xFF;
+        }
+    }
+    for (int i = 0; i < 6; i++) {
+        uint8_t addr = keys[i] ? map[keys[i]] : 0xFF;
+        s.prev_addrs[i] = addr;
+        if (addr != 0xFF) l.apply(addr, true);
+    }
+    bool shift_now = (modifiers & 0x22) != 0, shift_was = (s.prev_mods & 0x22) != 0;
+    if (shift_now != shift_was) l.apply(BENCH_SHIFT, shift_now);
+    bool ctrl_now = (modifiers & 0x11) != 0, ctrl_was = (s.prev_mods & 0x11) != 0;
+    if (ctrl_now != ctrl_was) l.apply(BENCH_CTRL, ctrl_now);
+    s.prev_mods = modifiers;
+}
+
+// --- Bitmap diff (hid_diff.h) ---
+
+static void bitmapDiff(HidKeyState &s, uint8_t modifiers, const uint8_t *keys, const uint8_t *map, BenchLayer &l) {
+    uint32_t now[HID_KEY_WORDS];
+    if (!hidBootBitmap(modifiers, keys, now)) hidKeepKeys(s, now);
+    hidKeyDiff(s, now, map, [&l](uint8_t addr, bool press) { l.apply(addr, press); });
+}
+
+// --- Compiled keymap (key_map.h) ---
+
+static void keymapDiff(KeyMapState &s, uint8_t modifiers, const uint8_t *keys, const KeyMap &m, BenchLayer &l) {
+    uint32_t now[HID_KEY_WORDS];
+    if (!hidBootBitmap(modifiers, keys, now)) hidKeepKeys(s.hid, now);
+    keyMapDiff(s, now, m, [&l](uint8_t addr, bool press) { l.apply(addr, press); });
+}
+
+// The flat map as one base rule per usage
+static void compileFlat(KeyMap &m, const uint8_t *map) {
+    static KeyRule rules[256];
+    size_t n = 0;
+    for (int u = 0; u < 256; u++) {
+        if (map[u] != 0xFF) rules[n++] = KEY_RULE((uint8_t)u, map[u], 0);
+    }
+    keyMapCompile(m, rules, n, BENCH_SHIFT, BENCH_CTRL);
+}
+
+// Usages 04-63 onto distinct addresses, except the pairs the Wyse
+// layout shares: Page Up/Page Down and KP / and /
+static void buildMap(uint8_t *map) {
+    memset(map, 0xFF, 256);
+    uint8_t next = 0;
+    for (int u = 0x04; u <= 0x63; u++) {
+        while (next == BENCH_SHIFT || next == BENCH_CTRL) next++;
+        map[u] = next++;
+    }
+    map[0x4E] = map[0x4B];
+    map[0x38] = map[0x54];
+    map[0xE0] = map[0xE4] = BENCH_CTRL;
+    map[0xE1] = map[0xE5] = BENCH_SHIFT;
+}
+
+static void expectImage(BenchReport &r, const uint8_t *held, int n, const uint8_t *map) {
+    memset(r.expect, 0, sizeof(r.expect));
+    for (int i = 0; i < n; i++) r.expect[map[held[i]] >> 5] |= 1u << (map[held[i]] & 31);
+    if (r.modifiers & 0x22) r.expect[BENCH_SHIFT >> 5] |= 1u << (BENCH_SHIFT & 31);
+    if (r.modifiers & 0x11) r.expect[BENCH_CTRL >> 5] |= 1u << (BENCH_CTRL & 31);
+}
+
+// Typing: mostly one key at a time, overlapping rolls, shared-address
+// pairs held together, a seventh key now and then
+static void buildReports(BenchReport *reports, const uint8_t *map, uint32_t &rng) {
+    static const uint8_t shared[4] = {0x4B, 0x4E, 0x54, 0x38};
+    uint8_t held[6];
+    int n        = 0;
+    uint8_t mods = 0;
+    for (int i = 0; i < BENCH_REPORTS; i++) {
+        BenchReport &r = reports[i];
+        uint32_t pick  = simRand(rng) % 16;
+        bool rollover  = false;
+        if (pick < 7 && n < 6) {
+            uint8_t u  = pick < 2 ? shared[simRand(rng) % 4] : (uint8_t)(0x04 + simRand(rng) % 0x60);
+            bool again = false;
+            for (int k = 0; k < n; k++) again |= held[k] == u;
+            if (!again) held[n++] = u;
+        } else if (pick < 7) {
+            rollover = true;
+        } else if (pick < 13 && n) {
+            int k = (int)(simRand(rng) % n);
+            memmove(&held[k], &held[k + 1], n - k - 1);
+            n--;
+        } else if (pick >= 13) {
+            mods ^= (uint8_t)(1u << (simRand(rng) % 8)) & 0x33;
+        }
+        r.modifiers = mods;
+        for (int k = 0; k < 6; k++) r.keys[k] = rollover ? 0x01 : (k < n ? held[k] : 0);
+        expectImage(r, held, n, map);
+    }
+}
+
+// Scripted reports against contextual rules: each step's modifier byte
+// and keys, and the addresses that must then be held
+#define CASE_PAGE  0x41
+#define CASE_DEL   0x62
+#define CASE_DELCH 0x2D
+#define CASE_A     0x3F
+#define CASE_NONE  0xFF
+
+struct KeymapStep {
+    const char *what;
+    uint8_t modifiers;
+    uint8_t keys[6];
+    uint8_t expect[4]; // Addresses held, CASE_NONE-terminated
+};
+
+static int keymapCases() {
+    static const KeyRule rules[] = {
+        KEY_RULE(0x04, CASE_A, 0),
+        KEY_RULE(0x4C, CASE_DEL, 0),
+        KEY_RULE(0x4E, CASE_PAGE, KEY_MOD_SHIFT_OFF),
+        KEY_RULE(0x4B, CASE_PAGE, KEY_MOD_SHIFT_ON),
+        KEY_RULE(0xE0, BENCH_CTRL, 0),
+        KEY_RULE(0xE1, BENCH_SHIFT, 0),
+        KEY_RULE(0xE5, BENCH_SHIFT, 0),
+        KEY_RULE(0xE6, HID_NO_ADDR, KEY_MOD_LAYER),
+        KEY_RULE_IN(KEY_CLASS_LAYER, 0x4C, CASE_DELCH, 0),
+    };
+    static const KeymapStep steps[] = {
+        {"Page Up alone sends Shift", 0x00, {0x4B}, {CASE_PAGE, BENCH_SHIFT, CASE_NONE}},
+        {"...and lets it go", 0x00, {0}, {CASE_NONE}},
+        {"Shift+Page Down lifts Shift", 0x02, {0x4E}, {CASE_PAGE, CASE_NONE}},
+        {"Shift is back once it is up", 0x02, {0}, {BENCH_SHIFT, CASE_NONE}},
+        {"Page Up over held Shift keeps it", 0x22, {0x4B}, {CASE_PAGE, BENCH_SHIFT, CASE_NONE}},
+        {"both Shifts up, Page Up still shifts", 0x00, {0x4B}, {CASE_PAGE, BENCH_SHIFT, CASE_NONE}},
+        {"Page Up and Page Down: on beats off", 0x00, {0x4B, 0x4E}, {CASE_PAGE, BENCH_SHIFT, CASE_NONE}},
+        {"all up", 0x00, {0}, {CASE_NONE}},
+        {"layer and Delete in one report", 0x40, {0x4C}, {CASE_DELCH, CASE_NONE}},
+        {"Delete keeps its address after the layer", 0x00, {0x4C}, {CASE_DELCH, CASE_NONE}},
+        {"Delete again, no layer", 0x00, {0}, {CASE_NONE}},
+        {"plain Delete", 0x00, {0x4C}, {CASE_DEL, CASE_NONE}},
+        {"Shift+Ctrl+a", 0x03, {0x4C, 0x04}, {CASE_DEL, CASE_A, BENCH_SHIFT, BENCH_CTRL}},
+        {"ErrorRollOver keeps keys, takes Shift up", 0x01, {0x01, 0x01, 0x01}, {CASE_DEL, CASE_A, BENCH_CTRL, CASE_NONE}},
+        {"all up", 0x00, {0}, {CASE_NONE}},
+    };
+    static KeyMap m;
+    if (!keyMapCompile(m, rules, sizeof(rules) / sizeof(rules[0]), BENCH_SHIFT, BENCH_CTRL)) {
+        printf("  keymap rules rejected\n");
+        return 1;
+    }
+    static KeyMapState s;
+    keyMapStateReset(s);
+    BenchLayer l = {};
+    int failed   = 0;
+    for (const KeymapStep &st : steps) {
+        keymapDiff(s, st.modifiers, st.keys, m, l);
+        uint32_t want[SCAN_KEY_WORDS] = {0};
+        for (int i = 0; i < 4 && st.expect[i] != CASE_NONE; i++) want[st.expect[i] >> 5] |= 1u << (st.expect[i] & 31);
+        if (memcmp(l.bits, want, sizeof(want)) != 0) {
+            printf("  keymap FAIL: %s\n", st.what);
+            failed++;
+        }
+    }
+    printf("  keymap  %d/%d contextual steps right\n", (int)(sizeof(steps) / sizeof(steps[0])) - failed,
+           (int)(sizeof(steps) / sizeof(steps[0])));
+    return failed ? 1 : 0;
+}
+
+template <typename F> static double timeReportsPerSec(F fn, uint64_t reports) {
+    auto t0 = std::chrono::steady_clock::now();
+    fn();
+    auto t1 = std::chrono::steady_clock::now();
+    return (double)reports / std::chrono::duration<double>(t1 - t0).count();
+}
+
+int main(int argc, char **argv) {
+    uint64_t reports = (uint64_t)simArgNum(argc, argv, "reports", 20e6);
+    uint32_t rng     = (uint32_t)simArgNum(argc, argv, "seed", 1);
+    if (rng == 0) rng = 1;
+
+    static uint8_t map[256];
+    buildMap(map);
+    static BenchReport stream[BENCH_REPORTS];
+    buildReports(stream, map, rng);
+    static KeyMap keymap;
+    compileFlat(keymap, map);
+
+    // One pass from idle, checking each report's layer against the keys held
+    NestedState nested;
+    memset(nested.prev_addrs, 0xFF, sizeof(nested.prev_addrs));
+    nested.prev_mods = 0;
+    static HidKeyState bitmap;
+    hidKeyStateReset(bitmap);
+    static KeyMapState mapped;
+    keyMapStateReset(mapped);
+    BenchLayer ln = {}, lb = {}, lk = {};
+    uint32_t wrong_nested = 0, wrong_bitmap = 0, wrong_keymap = 0, errors = 0, wrong_on_error = 0;
+    for (int i = 0; i < BENCH_REPORTS; i++) {
+        const BenchReport &r = stream[i];
+        nestedDiff(nested, r.modifiers, r.keys, map, ln);
+        bitmapDiff(bitmap, r.modifiers, r.keys, map, lb);
+        keymapDiff(mapped, r.modifiers, r.keys, keymap, lk);
+        bool bad = memcmp(ln.bits, r.expect, sizeof(r.expect)) != 0;
+        wrong_nested += bad;
+        wrong_bitmap += memcmp(lb.bits, r.expect, sizeof(r.expect)) != 0;
+        wrong_keymap += memcmp(lk.bits, r.expect, sizeof(r.expect)) != 0;
+        errors += r.keys[0] == 0x01;
+        wrong_on_error += bad && r.keys[0] == 0x01;
+    }
+
+    // Throughput over the same stream, repeated
+    memset(nested.prev_addrs, 0xFF, sizeof(nested.prev_addrs));
+    hidKeyStateReset(bitmap);
+    keyMapStateReset(mapped);
+    ln = {};
+    lb = {};
+    lk = {};
+    double rps_nested = timeReportsPerSec(
+        [&] {
+            for (uint64_t n = 0; n < reports; n++) {
+                const BenchReport &r = stream[n & (BENCH_REPORTS - 1)];
+                nestedDiff(nested, r.modifiers, r.keys, map, ln);
+            }
+        },
+        reports);
+    double rps_bitmap = timeReportsPerSec(
+        [&] {
+            for (uint64_t n = 0; n < reports; n++) {
+                const BenchReport &r = stream[n & (BENCH_REPORTS - 1)];
+                bitmapDiff(bitmap, r.modifiers, r.keys, map, lb);
+            }
+        },
+        reports);
+    double rps_keymap = timeReportsPerSec(
+        [&] {
+            for (uint64_t n = 0; n < reports; n++) {
+                const BenchReport &r = stream[n & (BENCH_REPORTS - 1)];
+                keymapDiff(mapped, r.modifiers, r.keys, keymap, lk);
+            }
+        },
+        reports);
+
+    printf("hid_bench: %llu reports (%d distinct, %u ErrorRollOver)\n", (unsigned long long)reports, BENCH_REPORTS,
+           errors);
+    printf("  nested  %7.2f M reports/s  %8llu events  %4u/%d reports wrong (%u on ErrorRollOver)\n",
+           rps_nested / 1e6, (unsigned long long)ln.events, wrong_nested, BENCH_REPORTS, wrong_on_error);
+    printf("  bitmap  %7.2f M reports/s  %8llu events  %4u/%d reports wrong  %.2fx\n", rps_bitmap / 1e6,
+           (unsigned long long)lb.events, wrong_bitmap, BENCH_REPORTS, rps_bitmap / rps_nested);
+    printf("  keymap  %7.2f M reports/s  %8llu events  %4u/%d reports wrong  %.2fx\n", rps_keymap / 1e6,
+           (unsigned long long)lk.events, wrong_keymap, BENCH_REPORTS, rps_keymap / rps_nested);
+    int cases_failed = keymapCases();
+    return wrong_bitmap || wrong_keymap || cases_failed ? 1 : 0;
+}
@@ -0,0 +1,311 @@
+/*
+ * hid_plan.cpp — Report-descriptor compiler checks and timing (host only)
+ *
+ * Compiles a corpus of keyboard report descriptors with hid_desc.h,
+ * prints each plan, runs reports through it and compares the usages it
+ * extracts with what each report holds. The corpus covers the layouts
+ * keyboards ship: the HID 1.11 boot keyboard, a QMK-style shared
+ * endpoint (NKRO bitmap, consumer and system control behind report
+ * IDs), a receiver with keyboard, mouse and consumer collections, and a
+ * 6KRO-plus-bitmap gaming layout with Push/Pop and late Usage Page,
+ * and byte slots whose logical 0 is a key. A boot-layout plan's
+ * shortcut is checked against the field walk on random reports. Then
+ * times the plan against reading the boot layout directly.
+ *
+ *   hid_plan [--reports=N]
+ *   hid_plan --desc=report_descriptor [--report=hex...]
+ *
+ * --desc     compile a descriptor dumped from a device (on Linux,
+ *            /sys/bus/hid/devices/<dev>/report_descriptor) and print the
+ *            plan; --report=01000400 runs one report through it
+ *
+ * Exit status is non-zero if any corpus report decodes wrong.
+ */
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "bus_model.h"
+#include "hid_desc.h"
+
+struct PlanCase {
+    std::vector<uint8_t> report; // As on the wire, report ID first
+    uint8_t result;              // HidRunResult
+    std::vector<uint8_t> usages; // Expected in the bitmap
+};
+
+struct PlanCorpus {
+    const char *name;
+    std::vector<uint8_t> desc;
+    std::vector<PlanCase> cases;
+};
+
+static std::vector<PlanCorpus> buildCorpus() {
+    std::vector<PlanCorpus> c;
+
+    c.push_back({"boot keyboard (HID 1.11 B.1)",
+                 std::vector<uint8_t>(HID_BOOT_KEYBOARD_DESC,
+                                      HID_BOOT_KEYBOARD_DESC + sizeof(HID_BOOT_KEYBOARD_DESC)),
+                 {
+                     {{0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00}, HID_RUN_KEYS, {0x04}},
+                     {{0x22, 0x00, 0x04, 0x05, 0x65, 0x00, 0x00, 0x00}, HID_RUN_KEYS, {0xE1, 0xE5, 0x04, 0x05, 0x65}},
+                     {{0x01, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01}, HID_RUN_ROLLOVER, {0xE0}},
+                     {{0x00, 0x00, 0x66, 0x00, 0x00, 0x00, 0x00, 0x00}, HID_RUN_KEYS, {}}, // Past Logical Max
+                     {{0x02, 0x00, 0x2C}, HID_RUN_KEYS, {0xE1, 0x2C}},                      // Short BLE report
+                 }});
+
+    // Shared endpoint: system control (ID 2), consumer (ID 3), NKRO (ID 6)
+    c.push_back({"shared endpoint, NKRO bitmap",
+                 {
+                     0x05, 0x01, 0x09, 0x80, 0xA1, 0x01, 0x85, 0x02, 0x19, 0x01, 0x2A, 0xB7, 0x00, 0x15, 0x01,
+                     0x26, 0xB7, 0x00, 0x95, 0x01, 0x75, 0x10, 0x81, 0x00, 0xC0, //
+                     0x05, 0x0C, 0x09, 0x01, 0xA1, 0x01, 0x85, 0x03, 0x19, 0x01, 0x2A, 0xA0, 0x02, 0x15, 0x01,
+                     0x26, 0xA0, 0x02, 0x95, 0x01, 0x75, 0x10, 0x81, 0x00, 0xC0, //
+                     0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x85, 0x06, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15,
+                     0x00, 0x25, 0x01, 0x95, 0x08, 0x75, 0x01, 0x81, 0x02, 0x05, 0x07, 0x19, 0x00, 0x29, 0xF7,
+                     0x15, 0x00, 0x25, 0x01, 0x95, 0xF8, 0x75, 0x01, 0x81, 0x02, 0x05, 0x08, 0x19, 0x01, 0x29,
+                     0x05, 0x95, 0x05, 0x75, 0x01, 0x91, 0x02, 0x95, 0x01, 0x75, 0x03, 0x91, 0x03, 0xC0,
+                 },
+                 {
+                     {{0x06, 0x02, 0x30, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                       0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                       0x00},
+                      HID_RUN_KEYS,
+                      {0xE1, 0x04, 0x05}},
+                     // Eighteen letters at once (a-r), Keypad 1 (0x59) and F24 (0x73)
+                     {{0x06, 0x00, 0xF0, 0xFF, 0x3F, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00,
+                       0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                       0x00},
+                      HID_RUN_KEYS,
+                      {0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12, 0x13,
+                       0x14, 0x15, 0x59, 0x73}},
+                     {{0x03, 0xE9, 0x00}, HID_RUN_NONE, {}}, // Volume Up
+                     {{0x02, 0x82, 0x00}, HID_RUN_NONE, {}}, // System Sleep
+                 }});
+
+    // Receiver: keyboard (ID 1, 16-bit logical range), mouse (ID 2), consumer (ID 3)
+    c.push_back({"receiver, keyboard + mouse + consumer",
+                 {
+                     0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x85, 0x01, 0x95, 0x08, 0x75, 0x01, 0x15, 0x00, 0x25,
+                     0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x81, 0x02, 0x95, 0x01, 0x75, 0x08, 0x81, 0x03,
+                     0x95, 0x05, 0x75, 0x01, 0x05, 0x08, 0x19, 0x01, 0x29, 0x05, 0x91, 0x02, 0x95, 0x01, 0x75,
+                     0x03, 0x91, 0x03, 0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x26, 0xFF, 0x00, 0x05, 0x07, 0x19,
+                     0x00, 0x2A, 0xFF, 0x00, 0x81, 0x00, 0xC0, //
+                     0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x85, 0x02, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09, 0x19,
+                     0x01, 0x29, 0x10, 0x15, 0x00, 0x25, 0x01, 0x95, 0x10, 0x75, 0x01, 0x81, 0x02, 0x05, 0x01,
+                     0x16, 0x01, 0xF8, 0x26, 0xFF, 0x07, 0x75, 0x0C, 0x95, 0x02, 0x09, 0x30, 0x09, 0x31, 0x81,
+                     0x06, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x01, 0x09, 0x38, 0x81, 0x06, 0xC0, 0xC0, //
+                     0x05, 0x0C, 0x09, 0x01, 0xA1, 0x01, 0x85, 0x03, 0x75, 0x10, 0x95, 0x02, 0x15, 0x01, 0x26,
+                     0xFF, 0x02, 0x19, 0x01, 0x2A, 0xFF, 0x02, 0x81, 0x00, 0xC0,
+                 },
+                 {
+                     {{0x01, 0x10, 0x00, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00}, HID_RUN_KEYS, {0xE4, 0x06}},
+                     {{0x01, 0x00, 0x00, 0x4B, 0x4E, 0xE3, 0x00, 0x00, 0x00}, HID_RUN_KEYS, {0x4B, 0x4E, 0xE3}},
+                     {{0x02, 0x01, 0x00, 0x05, 0x30, 0x00, 0x00}, HID_RUN_NONE, {}}, // Left button, moved
+                     {{0x03, 0xCD, 0x00, 0x00, 0x00}, HID_RUN_NONE, {}},             // Play/Pause
+                 }});
+
+    // Gaming layout: modifiers, 6 slots, then a bitmap of 0x00-0x67 in
+    // the same report. LEDs under Push/Pop; the slots' usage range is
+    // read under Generic Desktop and only becomes Keyboard at the Input.
+    c.push_back({"6KRO + bitmap, Push/Pop, late Usage Page",
+                 {
+                     0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25,
+                     0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0xA4, 0x05, 0x08, 0x19, 0x01, 0x29, 0x03, 0x95,
+                     0x03, 0x91, 0x02, 0x95, 0x05, 0x91, 0x01, 0xB4, 0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x25,
+                     0x65, 0x05, 0x01, 0x19, 0x00, 0x29, 0x65, 0x05, 0x07, 0x81, 0x00, 0x75, 0x01, 0x95, 0x68,
+                     0x15, 0x00, 0x25, 0x01, 0x19, 0x00, 0x29, 0x67, 0x81, 0x02, 0xC0,
+                 },
+                 {
+                     {{0x80, 0x29, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                       0x00, 0x00, 0x00, 0x00},
+                      HID_RUN_KEYS,
+                      {0xE7, 0x29}},
+                     // Slots hold a and b, the bitmap adds c and Enter (0x28)
+                     {{0x00, 0x04, 0x05, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+                       0x00, 0x00, 0x00, 0x00},
+                      HID_RUN_KEYS,
+                      {0x04, 0x05, 0x06, 0x28}},
+                 }});
+
+    // Boot layout with key slots 0..255 as a 1-byte Logical Maximum
+    // (25 FF): read signed it would be -1 and the slots dropped
+    c.push_back({"boot layout, Logical Maximum 25 FF",
+                 {
+                     0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25,
+                     0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01, 0x75, 0x08, 0x81, 0x01, 0x95, 0x06,
+                     0x75, 0x08, 0x15, 0x00, 0x25, 0xFF, 0x05, 0x07, 0x19, 0x00, 0x29, 0xFF, 0x81, 0x00, 0xC0,
+                 },
+                 {
+                     {{0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00}, HID_RUN_KEYS, {0x04}},
+                     {{0x01, 0x00, 0x04, 0x87, 0xA4, 0x00, 0x00, 0x00}, HID_RUN_KEYS, {0xE0, 0x04, 0x87, 0xA4}},
+                 }});
+
+    // Byte slots whose logical 0 is a key: Usage Minimum 04, so an empty
+    // slot would read as "a" (the byte-slot path must agree with the
+    // general one)
+    c.push_back({"byte slots from Usage Minimum 04",
+                 {
+                     0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25,
+                     0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01, 0x75, 0x08, 0x81, 0x01, 0x95, 0x06,
+                     0x75, 0x08, 0x15, 0x00, 0x25, 0x61, 0x05, 0x07, 0x19, 0x04, 0x29, 0x65, 0x81, 0x00, 0xC0,
+                 },
+                 {
+                     {{0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01}, HID_RUN_KEYS, {0x05}},
+                     {{0x02, 0x00, 0x00, 0x61, 0x01, 0x01, 0x01, 0x01}, HID_RUN_KEYS, {0xE1, 0x04, 0x05, 0x65}},
+                     {{0x00, 0x00, 0x62, 0x62, 0x62, 0x62, 0x62, 0x62}, HID_RUN_KEYS, {}}, // Past Logical Max
+                 }});
+    return c;
+}
+
+static void printPlan(const HidPlan &p) {
+    printf("  %u report(s)%s, %u keyboard field(s), %u other input field(s)%s%s\n", p.n_reports,
+           p.ids ? " with IDs" : "", p.n_fields, p.skipped, p.truncated ? ", TRUNCATED" : "",
+           p.boot ? ", boot layout" : "");
+    for (int r = 0; r < p.n_reports; r++) {
+        for (int i = 0; i < p.reports[r].n_fields; i++) {
+            const HidPlanField &f = p.fields[p.reports[r].first_field + i];
+            if (f.kind == HID_FIELD_BITS) {
+                printf("    id %3u  bit %4u  bits   %3u x 1   usages %02X-%02X\n", p.reports[r].id, f.bit, f.count,
+                       f.first, f.first + f.count - 1);
+            } else {
+                printf("    id %3u  bit %4u  array  %3u x %-2u  usages %02X+ (logical %d..%d)\n", p.reports[r].id,
+                       f.bit, f.count, f.size, f.first, f.lmin, f.lmax);
+            }
+        }
+    }
+}
+
+static const char *resultName(uint8_t r) {
+    switch (r) {
+        case HID_RUN_KEYS: return "keys";
+        case HID_RUN_ROLLOVER: return "rollover";
+        default: return "none";
+    }
+}
+
+static void printUsages(const uint32_t *now) {
+    for (int u = 0; u < 256; u++) {
+        if (now[u >> 5] & (1u << (u & 31))) printf(" %02X", u);
+    }
+}
+
+// Timed paths, kept out of line so each costs a call like the firmware's
+static HidPlan timed_boot, timed_nkro;
+
+__attribute__((noinline)) static uint8_t runDirect(const uint8_t *rep, uint16_t, uint32_t *now) {
+    return hidBootBitmap(rep[0], rep + 2, now) ? HID_RUN_KEYS : HID_RUN_ROLLOVER;
+}
+
+__attribute__((noinline)) static uint8_t runBoot(const uint8_t *rep, uint16_t len, uint32_t *now) {
+    return hidPlanRunRaw(timed_boot, rep, len, now);
+}
+
+__attribute__((noinline)) static uint8_t runNkro(const uint8_t *rep, uint16_t len, uint32_t *now) {
+    return hidPlanRunRaw(timed_nkro, rep, len, now);
+}
+
+static double timeNs(uint8_t (*fn)(const uint8_t *, uint16_t, uint32_t *), const std::vector<uint8_t> &rep,
+                     uint64_t reports) {
+    uint32_t now[HID_KEY_WORDS];
+    volatile uint32_t sink = 0;
+    auto t0                = std::chrono::steady_clock::now();
+    for (uint64_t n = 0; n < reports; n++) {
+        fn(rep.data(), (uint16_t)rep.size(), now);
+        sink = sink + now[n & (HID_KEY_WORDS - 1)];
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() * 1e9 / reports;
+}
+
+static std::vector<uint8_t> parseHex(const char *s) {
+    std::vector<uint8_t> out;
+    for (; s[0] && s[1]; s += 2) out.push_back((uint8_t)strtoul(std::string(s, 2).c_str(), nullptr, 16));
+    return out;
+}
+
+int main(int argc, char **argv) {
+    const char *desc_path = simArgStr(argc, argv, "desc");
+    if (desc_path) {
+        FILE *f = fopen(desc_path, "rb");
+        if (!f) {
+            perror(desc_path);
+            return 1;
+        }
+        std::vector<uint8_t> desc(4096);
+        desc.resize(fread(desc.data(), 1, desc.size(), f));
+        fclose(f);
+        static HidPlan plan;
+        bool ok = hidPlanCompile(plan, desc.data(), desc.size());
+        printf("%s: %zu bytes, %s\n", desc_path, desc.size(), ok ? "keyboard" : "no keyboard input");
+        printPlan(plan);
+        const char *hex = simArgStr(argc, argv, "report");
+        if (ok && hex) {
+            std::vector<uint8_t> rep = parseHex(hex);
+            uint32_t now[HID_KEY_WORDS];
+            uint8_t r = hidPlanRunRaw(plan, rep.data(), (uint16_t)rep.size(), now);
+            printf("  report %s →", hex);
+            if (r != HID_RUN_NONE) printUsages(now);
+            printf("  (%s)\n", resultName(r));
+        }
+        return ok ? 0 : 1;
+    }
+
+    uint64_t reports = (uint64_t)simArgNum(argc, argv, "reports", 50e6);
+    int wrong        = 0;
+    for (const PlanCorpus &c : buildCorpus()) {
+        static HidPlan plan;
+        bool ok = hidPlanCompile(plan, c.desc.data(), c.desc.size());
+        printf("%s (%zu bytes)%s\n", c.name, c.desc.size(), ok ? "" : "  NO KEYBOARD");
+        printPlan(plan);
+        wrong += !ok;
+        for (const PlanCase &k : c.cases) {
+            uint32_t now[HID_KEY_WORDS], expect[HID_KEY_WORDS] = {};
+            for (uint8_t u : k.usages) expect[u >> 5] |= 1u << (u & 31);
+            uint8_t r = hidPlanRunRaw(plan, k.report.data(), (uint16_t)k.report.size(), now);
+            bool good = r == k.result && (r == HID_RUN_NONE || memcmp(now, expect, sizeof(now)) == 0);
+            if (!good) {
+                printf("    MISMATCH report of %zu bytes: %s,", k.report.size(), resultName(r));
+                printUsages(now);
+                printf("\n");
+            }
+            wrong += !good;
+        }
+        printf("    %zu report(s) checked\n", c.cases.size());
+
+        // The boot-layout shortcut against the field walk it stands in for
+        if (plan.boot) {
+            static HidPlan walk;
+            walk            = plan;
+            walk.boot       = false;
+            uint32_t rng    = 1;
+            uint32_t differ = 0;
+            for (int n = 0; n < 100000; n++) {
+                uint8_t rep[8]; // Mostly in-range usages, some anything
+                for (uint8_t &x : rep) x = (uint8_t)(simRand(rng) % 4 ? simRand(rng) % 0x70 : simRand(rng));
+                uint32_t a[HID_KEY_WORDS], b[HID_KEY_WORDS];
+                uint8_t ra = hidPlanRunRaw(plan, rep, sizeof(rep), a);
+                uint8_t rb = hidPlanRunRaw(walk, rep, sizeof(rep), b);
+                differ += ra != rb || memcmp(a, b, sizeof(a)) != 0;
+            }
+            printf("    boot layout shortcut vs field walk: %u of 100000 random reports differ\n", differ);
+            wrong += differ != 0;
+        }
+    }
+
+    // Per-report cost: plan vs the boot layout read directly
+    std::vector<PlanCorpus> corpus = buildCorpus();
+    hidPlanCompile(timed_boot, HID_BOOT_KEYBOARD_DESC, sizeof(HID_BOOT_KEYBOARD_DESC));
+    hidPlanCompile(timed_nkro, corpus[1].desc.data(), corpus[1].desc.size());
+    const std::vector<uint8_t> &boot_rep = corpus[0].cases[1].report;
+    const std::vector<uint8_t> &nkro_rep = corpus[1].cases[1].report;
+    double ns_direct = timeNs(runDirect, boot_rep, reports);
+    double ns_boot   = timeNs(runBoot, boot_rep, reports);
+    double ns_nkro   = timeNs(runNkro, nkro_rep, reports);
+    printf("per report (%llu reports)\n", (unsigned long long)reports);
+    printf("  boot layout, direct   %6.2f ns\n", ns_direct);
+    printf("  boot layout, plan     %6.2f ns  %.2fx\n", ns_boot, ns_boot / ns_direct);
+    printf("  NKRO bitmap, plan     %6.2f ns  %.2fx\n", ns_nkro, ns_nkro / ns_direct);
+    if (wrong) printf("FAIL: %d mismatch(es)\n", wrong);
+    return wrong ? 1 : 0;
+}
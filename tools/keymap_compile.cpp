@@ -0,0 +1,557 @@
+/*
+ * keymap_compile.cpp — JSON keymaps to key_blob.h blobs (host only)
+ *
+ * Compiles a human-edited keymap into the blob POST /api/keymap takes,
+ * after the same checks the firmware makes: addresses on the matrix, no
+ * two rules for one key in the same class, tables matching the rules.
+ *
+ *   keymap_compile                               # self-check (below)
+ *   keymap_compile --json=map.json --out=map.kbm
+ *   keymap_compile --check=map.kbm               # verify a blob, print it back as JSON
+ *
+ * A keymap (keymaps/wyse50.json is the firmware's built-in one):
+ *
+ *   {"name": "wyse50", "terminal": "Wyse 50", "shift": "0x4A", "ctrl": "0x1F",
+ *    "rules": [
+ *      {"key": "0x04", "addr": "0x3F", "comment": "a"},
+ *      {"key": "0x4B", "addr": "0x41", "mods": ["shift_on"]},
+ *      {"key": "0xE6", "mods": ["layer"]},
+ *      {"key": "0x3A", "when": ["layer"], "not": ["shift"], "addr": "0x50"}]}
+ *
+ * key is the HID usage, addr the Wyse address (omit for none; 0x7E and
+ * 0x7F are the bus trace's, see scan_core.h); numbers may be JSON
+ * numbers or "0x" strings. when/not list the classes (shift,
+ * ctrl, layer) that must be held / not held; mods are shift, ctrl,
+ * layer (the key is one) and shift_on, shift_off, ctrl_on, ctrl_off
+ * (see key_map.h). Later rules override earlier ones.
+ *
+ * With no arguments, compiles every keymap in keymaps/ and a set of
+ * inline samples: good ones must build, round-trip through --check's
+ * JSON to the same bytes and pass keyBlobVerify(); bad ones must be
+ * rejected for the expected reason. keymaps/wyse50.json must also compile
+ * to the same tables as the firmware's built-in WYSE50_RULES
+ * (wyse50_map.h). Exit status is non-zero on failure.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+
+#include <string>
+#include <vector>
+
+#include "bus_model.h"
+#include "key_blob.h"
+#include "wyse50_map.h"
+
+// --- Minimal JSON reader (objects, arrays, strings, integers) ---
+
+struct Json {
+    enum Kind { NUL, NUM, STR, ARR, OBJ, BOOL };
+    Kind kind = NUL;
+    long num  = 0;
+    std::string str;
+    std::vector<Json> items;                           // ARR
+    std::vector<std::pair<std::string, Json>> members; // OBJ
+
+    const Json *get(const char *key) const {
+        for (const auto &m : members) {
+            if (m.first == key) return &m.second;
+        }
+        return NULL;
+    }
+};
+
+struct JsonReader {
+    const char *p = NULL;
+    int line      = 1;
+    std::string err;
+
+    void ws() {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') line += *p++ == '\n';
+    }
+    bool fail(const char *what) {
+        if (err.empty()) err = "line " + std::to_string(line) + ": " + what;
+        return false;
+    }
+    bool string(std::string &out) {
+        if (*p != '"') return fail("expected string");
+        p++;
+        while (*p && *p != '"') {
+            if (*p == '\n') return fail("newline in string");
+            if (*p == '\\' && p[1]) p++; // Escapes kept literally; keymaps need none
+            out += *p++;
+        }
+        if (*p != '"') return fail("unterminated string");
+        p++;
+        return true;
+    }
+    bool value(Json &v) {
+        ws();
+        if (*p == '{') {
+            v.kind = Json::OBJ;
+            p++;
+            ws();
+            if (*p == '}') return p++, true;
+            for (;;) {
+                ws();
+                std::pair<std::string, Json> m;
+                if (!string(m.first)) return false;
+                ws();
+                if (*p++ != ':') return fail("expected ':'");
+                if (!value(m.second)) return false;
+                v.members.push_back(m);
+                ws();
+                if (*p == ',') {
+                    p++;
+                    continue;
+                }
+                if (*p++ != '}') return fail("expected ',' or '}'");
+                return true;
+            }
+        }
+        if (*p == '[') {
+            v.kind = Json::ARR;
+            p++;
+            ws();
+            if (*p == ']') return p++, true;
+            for (;;) {
+                Json item;
+                if (!value(item)) return false;
+                v.items.push_back(item);
+                ws();
+                if (*p == ',') {
+                    p++;
+                    continue;
+                }
+                if (*p++ != ']') return fail("expected ',' or ']'");
+                return true;
+            }
+        }
+        if (*p == '"') {
+            v.kind = Json::STR;
+            return string(v.str);
+        }
+        if (*p == '-' || (*p >= '0' && *p <= '9')) {
+            char *end;
+            v.kind = Json::NUM;
+            v.num  = strtol(p, &end, 10);
+            p      = end;
+            return true;
+        }
+        if (!strncmp(p, "true", 4) || !strncmp(p, "false", 5)) {
+            v.kind = Json::BOOL;
+            v.num  = *p == 't';
+            p += v.num ? 4 : 5;
+            return true;
+        }
+        if (!strncmp(p, "null", 4)) {
+            p += 4;
+            return true;
+        }
+        return fail("unexpected character");
+    }
+};
+
+// --- Keymap JSON ↔ rules ---
+
+static const char *const CLASS_NAMES[] = {"shift", "ctrl", "layer"};
+static const char *const MOD_NAMES[]   = {"shift", "ctrl", "layer", "shift_on", "shift_off", "ctrl_on", "ctrl_off"};
+
+struct Keymap {
+    std::string name, terminal;
+    uint8_t shift = 0xFF, ctrl = 0xFF;
+    std::vector<KeyRule> rules;
+};
+
+// JSON number or "0x.." / decimal string, within [0, max]
+static bool number(const Json *v, long max, long &out) {
+    if (!v) return false;
+    if (v->kind == Json::NUM) {
+        out = v->num;
+    } else if (v->kind == Json::STR && !v->str.empty()) {
+        char *end;
+        out = strtol(v->str.c_str(), &end, 0);
+        if (*end) return false;
+    } else {
+        return false;
+    }
+    return out >= 0 && out <= max;
+}
+
+// Names from table as bits; false on an unknown name
+static bool flags(const Json *v, const char *const *table, int n, uint8_t &out) {
+    out = 0;
+    if (!v) return true;
+    if (v->kind != Json::ARR) return false;
+    for (const Json &item : v->items) {
+        int b = 0;
+        while (b < n && (item.kind != Json::STR || item.str != table[b])) b++;
+        if (b == n) return false;
+        out |= (uint8_t)(1u << b);
+    }
+    return true;
+}
+
+static bool parseKeymap(const std::string &text, Keymap &km, std::string &err) {
+    Json root;
+    JsonReader r;
+    r.p = text.c_str();
+    if (!r.value(root)) {
+        err = r.err;
+        return false;
+    }
+    if (root.kind != Json::OBJ) {
+        err = "top level must be an object";
+        return false;
+    }
+    for (const auto &m : root.members) {
+        if (m.first != "name" && m.first != "terminal" && m.first != "shift" && m.first != "ctrl" &&
+            m.first != "rules" && m.first != "comment") {
+            err = "unknown field \"" + m.first + "\"";
+            return false;
+        }
+    }
+    const Json *name = root.get("name"), *terminal = root.get("terminal"), *rules = root.get("rules");
+    if (!name || name->kind != Json::STR || name->str.empty() || name->str.size() >= KEY_BLOB_NAME_LEN) {
+        err = "name: 1-" + std::to_string(KEY_BLOB_NAME_LEN - 1) + " characters required";
+        return false;
+    }
+    km.name     = name->str;
+    km.terminal = terminal && terminal->kind == Json::STR ? terminal->str.substr(0, 15) : "";
+    long v;
+    if (!number(root.get("shift"), 0xFF, v)) {
+        err = "shift: address required";
+        return false;
+    }
+    km.shift = (uint8_t)v;
+    if (!number(root.get("ctrl"), 0xFF, v)) {
+        err = "ctrl: address required";
+        return false;
+    }
+    km.ctrl = (uint8_t)v;
+    if (!rules || rules->kind != Json::ARR) {
+        err = "rules: array required";
+        return false;
+    }
+    for (size_t i = 0; i < rules->items.size(); i++) {
+        const Json &j = rules->items[i];
+        std::string at = "rule " + std::to_string(i) + ": ";
+        if (j.kind != Json::OBJ) {
+            err = at + "must be an object";
+            return false;
+        }
+        for (const auto &m : j.members) {
+            if (m.first != "key" && m.first != "addr" && m.first != "when" && m.first != "not" &&
+                m.first != "mods" && m.first != "comment") {
+                err = at + "unknown field \"" + m.first + "\"";
+                return false;
+            }
+        }
+        KeyRule kr;
+        if (!number(j.get("key"), 0xFF, v)) {
+            err = at + "key: HID usage 0-255 required";
+            return false;
+        }
+        kr.usage = (uint8_t)v;
+        kr.addr  = HID_NO_ADDR;
+        if (j.get("addr")) {
+            if (!number(j.get("addr"), 0xFF, v)) {
+                err = at + "addr: not a number";
+                return false;
+            }
+            kr.addr = (uint8_t)v; // Range is keyRulesCheck()'s call, as on the device
+        }
+        uint8_t when, unless;
+        if (!flags(j.get("when"), CLASS_NAMES, 3, when) || !flags(j.get("not"), CLASS_NAMES, 3, unless) ||
+            (when & unless)) {
+            err = at + "when/not: shift, ctrl or layer, each in one list";
+            return false;
+        }
+        kr.when = when;
+        kr.mask = when | unless;
+        if (!flags(j.get("mods"), MOD_NAMES, KEY_MOD_BITS, kr.mods)) {
+            err = at + "mods: unknown name";
+            return false;
+        }
+        km.rules.push_back(kr);
+    }
+    return true;
+}
+
+static void appendNames(std::string &out, const char *field, uint8_t bits, const char *const *table, int n) {
+    if (!bits) return;
+    out += ", \"";
+    out += field;
+    out += "\": [";
+    bool first = true;
+    for (int b = 0; b < n; b++) {
+        if (!(bits & (1u << b))) continue;
+        out += first ? "\"" : ", \"";
+        out += table[b];
+        out += "\"";
+        first = false;
+    }
+    out += "]";
+}
+
+// The blob's rules back as keymap JSON
+static std::string blobToJson(const uint8_t *blob) {
+    const KeyBlobHeader *h = keyBlobHeader(blob);
+    const KeyMap *m        = keyBlobMap(blob);
+    char buf[128];
+    snprintf(buf, sizeof(buf),
+             "{\"name\": \"%s\", \"terminal\": \"%.16s\", \"shift\": \"0x%02X\", \"ctrl\": \"0x%02X\",\n", h->name,
+             h->terminal, m->shift_addr, m->ctrl_addr);
+    std::string out = buf;
+    out += " \"rules\": [\n";
+    for (int i = 0; i < h->n_rules; i++) {
+        const KeyRule &r = keyBlobRules(blob)[i];
+        snprintf(buf, sizeof(buf), "  {\"key\": \"0x%02X\"", r.usage);
+        out += buf;
+        if (r.addr != HID_NO_ADDR) {
+            snprintf(buf, sizeof(buf), ", \"addr\": \"0x%02X\"", r.addr);
+            out += buf;
+        }
+        appendNames(out, "when", r.when, CLASS_NAMES, 3);
+        appendNames(out, "not", r.mask & ~r.when, CLASS_NAMES, 3);
+        appendNames(out, "mods", r.mods, MOD_NAMES, KEY_MOD_BITS);
+        out += i + 1 < h->n_rules ? "},\n" : "}\n";
+    }
+    out += " ]}\n";
+    return out;
+}
+
+// --- Compile and verify ---
+
+static uint32_t blob_buf[KEY_BLOB_SLOT_SIZE / 4]; // Aligned as the partition is
+
+// Keymap JSON to a verified blob in blob_buf; 0 and err on failure
+static size_t compile(const std::string &text, std::string &err, KeyBlobError &code) {
+    Keymap km;
+    code = KEY_BLOB_OK;
+    if (!parseKeymap(text, km, err)) return 0;
+    size_t bad;
+    code = keyRulesCheck(km.rules.data(), km.rules.size(), km.shift, km.ctrl, &bad);
+    if (code != KEY_BLOB_OK) {
+        err = KEY_BLOB_ERRORS[code];
+        if (bad < km.rules.size()) err += " (rule " + std::to_string(bad) + ")";
+        return 0;
+    }
+    uint8_t *blob = (uint8_t *)blob_buf;
+    size_t len    = keyBlobBuild(blob, sizeof(blob_buf), km.name.c_str(), km.terminal.c_str(), km.rules.data(),
+                                 km.rules.size(), km.shift, km.ctrl);
+    if (!len) {
+        code = KEY_BLOB_LENGTH_BAD;
+        err  = "more than " + std::to_string(KEY_BLOB_MAX_RULES) + " rules";
+        return 0;
+    }
+    static KeyMap scratch;
+    code = keyBlobVerify(blob, len, scratch);
+    if (code != KEY_BLOB_OK) {
+        err = KEY_BLOB_ERRORS[code];
+        return 0;
+    }
+    return len;
+}
+
+static bool readFile(const char *path, std::string &out) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.append(buf, n);
+    fclose(f);
+    return true;
+}
+
+// --- Self-check ---
+
+struct Sample {
+    const char *what;
+    const char *json;
+    bool good;           // Must compile
+    KeyBlobError expect; // Else why not (KEY_BLOB_OK = the JSON itself)
+};
+
+static const Sample SAMPLES[] = {
+    {"contextual rules",
+     R"({"name": "sample", "terminal": "Wyse 50", "shift": "0x4A", "ctrl": 31, "rules": [
+        {"key": "0x04", "addr": "0x3F"}, {"key": "0xE1", "addr": "0x4A"}, {"key": "0xE0", "addr": "0x1F"},
+        {"key": "0x4B", "addr": "0x41", "mods": ["shift_on"]}, {"key": "0xE6", "mods": ["layer"]},
+        {"key": "0x3A", "when": ["layer"], "not": ["shift"], "addr": "0x50"},
+        {"key": "0x3A", "when": ["layer", "shift"], "addr": "0x54", "mods": ["shift_off"]}]})",
+     true, KEY_BLOB_OK},
+    {"address off the matrix", R"({"name": "x", "shift": 74, "ctrl": 31, "rules": [{"key": 4, "addr": 128}]})",
+     false, KEY_BLOB_ADDR_BAD},
+    {"Shift off the matrix", R"({"name": "x", "shift": 200, "ctrl": 31, "rules": []})", false, KEY_BLOB_ADDR_BAD},
+    {"key on a trace-reserved address",
+     R"({"name": "x", "shift": 74, "ctrl": 31, "rules": [{"key": 4, "addr": "0x7E"}]})", false,
+     KEY_BLOB_ADDR_RESERVED},
+    {"Ctrl on a trace-reserved address", R"({"name": "x", "shift": 74, "ctrl": "0x7F", "rules": []})", false,
+     KEY_BLOB_ADDR_RESERVED},
+    {"one key twice in a class",
+     R"({"name": "x", "shift": 74, "ctrl": 31, "rules": [{"key": 4, "addr": 1}, {"key": 4, "addr": 2}]})",
+     false, KEY_BLOB_COLLISION},
+    {"Shift and Ctrl on one address", R"({"name": "x", "shift": 74, "ctrl": 74, "rules": []})", false,
+     KEY_BLOB_COLLISION},
+    {"no name", R"({"shift": 74, "ctrl": 31, "rules": []})", false, KEY_BLOB_OK},
+    {"unknown modifier", R"({"name": "x", "shift": 74, "ctrl": 31, "rules": [{"key": 4, "mods": ["alt"]}]})",
+     false, KEY_BLOB_OK},
+    {"misspelt field", R"({"name": "x", "shift": 74, "ctrl": 31, "rules": [{"key": 4, "adr": 1}]})",
+     false, KEY_BLOB_OK},
+};
+
+// Good keymap: builds, verifies, and --check's JSON compiles to the same bytes
+static bool roundTrip(const char *what, const std::string &json) {
+    std::string err;
+    KeyBlobError code;
+    size_t len = compile(json, err, code);
+    if (!len) {
+        printf("  FAIL %s: %s\n", what, err.c_str());
+        return false;
+    }
+    std::vector<uint8_t> first((uint8_t *)blob_buf, (uint8_t *)blob_buf + len);
+    std::string back = blobToJson(first.data());
+    size_t len2      = compile(back, err, code);
+    if (len2 != len || memcmp(first.data(), blob_buf, len) != 0) {
+        printf("  FAIL %s: JSON round trip differs\n", what);
+        return false;
+    }
+    // One flipped table byte must be caught by the CRC, and by the
+    // table check once the CRC is patched over it
+    uint8_t *blob = first.data();
+    blob[KEY_BLOB_TABLE_OFFSET + 2] ^= 1;
+    static KeyMap scratch;
+    bool crc_caught = keyBlobCheck(blob, len) == KEY_BLOB_CRC_BAD;
+    ((KeyBlobHeader *)blob)->crc = keyBlobCrc(blob + KEY_BLOB_TABLE_OFFSET, len - KEY_BLOB_TABLE_OFFSET);
+    bool table_caught            = keyBlobVerify(blob, len, scratch) == KEY_BLOB_TABLE_BAD;
+    if (!crc_caught || !table_caught) {
+        printf("  FAIL %s: corrupted table accepted\n", what);
+        return false;
+    }
+    printf("  ok   %-34s %4u rules, %5zu bytes\n", what, keyBlobHeader((uint8_t *)blob_buf)->n_rules, len);
+    return true;
+}
+
+// keymaps/wyse50.json against the rules the firmware builds in: same
+// tables, or the file and wyse50_map.h have drifted apart
+static bool matchesBuiltin(const char *what, const std::string &json) {
+    std::string err;
+    KeyBlobError code;
+    if (!compile(json, err, code)) return false; // roundTrip() has said why
+    static KeyMap builtin;
+    keyMapCompile(builtin, WYSE50_RULES, WYSE50_RULE_COUNT, WYSE_SHIFT, WYSE_CTRL);
+    const KeyMap *m = keyBlobMap((uint8_t *)blob_buf);
+    if (m->shift_addr != builtin.shift_addr || m->ctrl_addr != builtin.ctrl_addr) {
+        printf("  FAIL %s: Shift/Ctrl 0x%02X/0x%02X, built in 0x%02X/0x%02X\n", what, m->shift_addr, m->ctrl_addr,
+               builtin.shift_addr, builtin.ctrl_addr);
+        return false;
+    }
+    for (int c = 0; c < KEY_MAP_CLASSES; c++) {
+        for (int u = 0; u < 256; u++) {
+            if (m->ent[c][u] == builtin.ent[c][u]) continue;
+            printf("  FAIL %s: usage 0x%02X class %d is 0x%04X, built in 0x%04X\n", what, u, c, m->ent[c][u],
+                   builtin.ent[c][u]);
+            return false;
+        }
+    }
+    if (memcmp(m, &builtin, sizeof(KeyMap)) != 0) {
+        printf("  FAIL %s: holder tables differ from the built-in map\n", what);
+        return false;
+    }
+    printf("  ok   %-34s same tables as WYSE50_RULES\n", what);
+    return true;
+}
+
+static int selfCheck() {
+    int failed = 0;
+#ifdef KEYMAPS_DIR
+    DIR *d = opendir(KEYMAPS_DIR);
+    if (!d) {
+        printf("  FAIL %s: %s\n", KEYMAPS_DIR, strerror(errno));
+        failed++;
+    }
+    bool builtin = false;
+    for (struct dirent *e; d && (e = readdir(d)) != NULL;) {
+        std::string file = e->d_name;
+        if (file.size() < 5 || file.compare(file.size() - 5, 5, ".json") != 0) continue;
+        std::string text, what = "keymaps/" + file;
+        readFile((std::string(KEYMAPS_DIR) + "/" + file).c_str(), text);
+        failed += !roundTrip(what.c_str(), text);
+        if (file == "wyse50.json") {
+            builtin = true;
+            failed += !matchesBuiltin(what.c_str(), text);
+        }
+    }
+    if (d) closedir(d);
+    if (d && !builtin) {
+        printf("  FAIL keymaps/wyse50.json: missing\n");
+        failed++;
+    }
+#endif
+    for (const Sample &s : SAMPLES) {
+        if (s.good) {
+            failed += !roundTrip(s.what, s.json);
+            continue;
+        }
+        std::string err;
+        KeyBlobError code;
+        bool rejected = compile(s.json, err, code) == 0;
+        bool right    = rejected && code == s.expect;
+        printf("  %s %-34s %s\n", right ? "ok  " : "FAIL", s.what, rejected ? err.c_str() : "accepted");
+        failed += !right;
+    }
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    const char *json_path = simArgStr(argc, argv, "json");
+    const char *out_path  = simArgStr(argc, argv, "out");
+    const char *blob_path = simArgStr(argc, argv, "check");
+
+    if (blob_path) {
+        std::string data;
+        if (!readFile(blob_path, data)) {
+            perror(blob_path);
+            return 1;
+        }
+        size_t len = data.size() < sizeof(blob_buf) ? data.size() : sizeof(blob_buf);
+        memcpy(blob_buf, data.data(), len);
+        static KeyMap scratch;
+        KeyBlobError e = keyBlobVerify((uint8_t *)blob_buf, len, scratch);
+        if (e != KEY_BLOB_OK) {
+            fprintf(stderr, "%s: %s\n", blob_path, KEY_BLOB_ERRORS[e]);
+            return 1;
+        }
+        fputs(blobToJson((uint8_t *)blob_buf).c_str(), stdout);
+        return 0;
+    }
+
+    if (json_path) {
+        std::string text, err;
+        if (!readFile(json_path, text)) {
+            perror(json_path);
+            return 1;
+        }
+        KeyBlobError code;
+        size_t len = compile(text, err, code);
+        if (!len) {
+            fprintf(stderr, "%s: %s\n", json_path, err.c_str());
+            return 1;
+        }
+        const KeyBlobHeader *h = keyBlobHeader((uint8_t *)blob_buf);
+        printf("%s: \"%s\", %u rules, %zu bytes\n", json_path, h->name, h->n_rules, len);
+        if (!out_path) return 0;
+        FILE *f = fopen(out_path, "wb");
+        if (!f || fwrite(blob_buf, 1, len, f) != len) {
+            perror(out_path);
+            return 1;
+        }
+        fclose(f);
+        return 0;
+    }
+
+    printf("keymap_compile self-check\n");
+    int failed = selfCheck();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,477 @@
+/*
+ * mcs51.h — Instruction-level 8031/8051 (MCS-51) emulator (host only)
+ *
+ * Enough of the terminal's CPU to run a keyboard scan routine cycle by
+ * cycle: the full MCS-51 instruction set with its machine-cycle costs,
+ * 128 bytes of internal RAM, the SFRs the scan path touches, and the
+ * four ports as quasi-bidirectional pins. There are no timers or
+ * interrupts; the routine polls, like the Wyse scan loop does between
+ * its other work.
+ *
+ * The host sees the outside world through two hooks: pin_in() is asked
+ * for a port's external level whenever code reads the pins (a 0 pulls
+ * the pin low whatever the latch says), and io_out() is told about every
+ * port latch and SBUF write. Both get the machine cycle the access lands
+ * on: reads sample in an instruction's last cycle, writes land after it.
+ */
+
+#ifndef MCS51_H
+#define MCS51_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Special function registers (direct addresses 0x80-0xFF)
+#define MCS_P0   0x80
+#define MCS_SP   0x81
+#define MCS_DPL  0x82
+#define MCS_DPH  0x83
+#define MCS_P1   0x90
+#define MCS_SBUF 0x99
+#define MCS_P2   0xA0
+#define MCS_P3   0xB0
+#define MCS_PSW  0xD0
+#define MCS_ACC  0xE0
+#define MCS_B    0xF0
+
+// PSW bits
+#define MCS_CY 0x80
+#define MCS_AC 0x40
+#define MCS_OV 0x04
+#define MCS_P  0x01
+
+#define MCS_CODE_SIZE 4096 // The 8031 runs from external ROM; the scan routine is small
+#define MCS_XRAM_SIZE 256
+
+struct Mcs51 {
+    uint8_t code[MCS_CODE_SIZE];
+    uint8_t iram[128];
+    uint8_t sfr[128]; // Direct 0x80-0xFF; port entries are the output latches
+    uint8_t xram[MCS_XRAM_SIZE];
+    uint16_t pc;
+    uint64_t cycles; // Machine cycles executed
+    uint64_t io_t;   // Cycle the current instruction's port access lands on
+    bool fault;      // Reserved opcode, or the PC ran off the ROM
+
+    void *ctx;
+    uint8_t (*pin_in)(void *ctx, uint8_t port, uint64_t t);            // External level, bit 0 = pulled low
+    void (*io_out)(void *ctx, uint8_t sfr, uint8_t value, uint64_t t); // Port latch or SBUF write
+};
+
+// Machine cycles per opcode (MUL/DIV 4, branches/calls/MOVC/MOVX and
+// most direct-to-direct moves 2, the rest 1)
+static const uint8_t MCS_CYCLES[256] = {
+    1, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x00
+    2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x10
+    2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x20
+    2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x30
+    2, 2, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x40
+    2, 2, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x50
+    2, 2, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x60
+    2, 2, 2, 2, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x70
+    2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, // 0x80
+    2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x90
+    2, 2, 1, 2, 4, 1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, // 0xA0
+    2, 2, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, // 0xB0
+    2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xC0
+    2, 2, 1, 1, 1, 2, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, // 0xD0
+    2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xE0
+    2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xF0
+};
+
+static inline void mcsReset(Mcs51 &m) {
+    memset(m.iram, 0, sizeof(m.iram));
+    memset(m.sfr, 0, sizeof(m.sfr));
+    m.sfr[MCS_SP - 0x80] = 0x07;
+    for (int p = MCS_P0; p <= MCS_P3; p += 0x10) m.sfr[p - 0x80] = 0xFF; // Ports reset high
+    m.pc     = 0;
+    m.cycles = 0;
+    m.fault  = false;
+}
+
+static inline void mcsLoad(Mcs51 &m, const uint8_t *rom, size_t len) {
+    memset(m.code, 0, sizeof(m.code));
+    memcpy(m.code, rom, len < MCS_CODE_SIZE ? len : MCS_CODE_SIZE);
+}
+
+static inline uint8_t &mcsSfr(Mcs51 &m, uint8_t addr) {
+    return m.sfr[addr - 0x80];
+}
+
+static inline bool mcsPort(uint8_t addr) {
+    return addr == MCS_P0 || addr == MCS_P1 || addr == MCS_P2 || addr == MCS_P3;
+}
+
+// Direct read. Read-modify-write instructions see a port's latch, the
+// rest see its pins.
+static inline uint8_t mcsRead(Mcs51 &m, uint8_t addr, bool latch = false) {
+    if (addr < 0x80) return m.iram[addr];
+    uint8_t v = mcsSfr(m, addr);
+    if (mcsPort(addr) && !latch && m.pin_in) v &= m.pin_in(m.ctx, (uint8_t)((addr - MCS_P0) >> 4), m.io_t);
+    return v;
+}
+
+static inline void mcsWrite(Mcs51 &m, uint8_t addr, uint8_t v) {
+    if (addr < 0x80) {
+        m.iram[addr] = v;
+        return;
+    }
+    mcsSfr(m, addr) = v;
+    if ((mcsPort(addr) || addr == MCS_SBUF) && m.io_out) m.io_out(m.ctx, addr, v, m.io_t + 1);
+}
+
+// Indirect (@Ri, stack): internal RAM only; the 8031 has no upper 128
+static inline uint8_t &mcsInd(Mcs51 &m, uint8_t addr) {
+    return m.iram[addr & 0x7F];
+}
+
+static inline uint8_t &mcsReg(Mcs51 &m, int n) {
+    return m.iram[(mcsSfr(m, MCS_PSW) & 0x18) + n];
+}
+
+static inline uint8_t mcsBitByte(uint8_t bit) {
+    return bit < 0x80 ? 0x20 + (bit >> 3) : (bit & 0xF8);
+}
+
+static inline bool mcsGetBit(Mcs51 &m, uint8_t bit, bool latch = false) {
+    return (mcsRead(m, mcsBitByte(bit), latch) >> (bit & 7)) & 1;
+}
+
+static inline void mcsSetBit(Mcs51 &m, uint8_t bit, bool v) {
+    uint8_t a = mcsBitByte(bit);
+    uint8_t b = mcsRead(m, a, true);
+    mcsWrite(m, a, v ? (uint8_t)(b | (1 << (bit & 7))) : (uint8_t)(b & ~(1 << (bit & 7))));
+}
+
+static inline bool mcsCarry(Mcs51 &m) {
+    return (mcsSfr(m, MCS_PSW) & MCS_CY) != 0;
+}
+
+static inline void mcsSetCarry(Mcs51 &m, bool c) {
+    uint8_t &psw = mcsSfr(m, MCS_PSW);
+    psw          = c ? (psw | MCS_CY) : (psw & ~MCS_CY);
+}
+
+static inline void mcsPush(Mcs51 &m, uint8_t v) {
+    uint8_t &sp    = mcsSfr(m, MCS_SP);
+    mcsInd(m, ++sp) = v;
+}
+
+static inline uint8_t mcsPop(Mcs51 &m) {
+    uint8_t &sp = mcsSfr(m, MCS_SP);
+    return mcsInd(m, sp--);
+}
+
+static inline void mcsAdd(Mcs51 &m, uint8_t v, bool with_carry) {
+    uint8_t &a  = mcsSfr(m, MCS_ACC);
+    uint8_t &psw = mcsSfr(m, MCS_PSW);
+    int c       = with_carry && (psw & MCS_CY);
+    int r       = a + v + c;
+    psw &= ~(MCS_CY | MCS_AC | MCS_OV);
+    if (r > 0xFF) psw |= MCS_CY;
+    if ((a & 0x0F) + (v & 0x0F) + c > 0x0F) psw |= MCS_AC;
+    if (~(a ^ v) & (a ^ r) & 0x80) psw |= MCS_OV;
+    a = (uint8_t)r;
+}
+
+static inline void mcsSubb(Mcs51 &m, uint8_t v) {
+    uint8_t &a  = mcsSfr(m, MCS_ACC);
+    uint8_t &psw = mcsSfr(m, MCS_PSW);
+    int c       = (psw & MCS_CY) != 0;
+    int r       = a - v - c;
+    psw &= ~(MCS_CY | MCS_AC | MCS_OV);
+    if (r < 0) psw |= MCS_CY;
+    if ((a & 0x0F) < (v & 0x0F) + c) psw |= MCS_AC;
+    if ((a ^ v) & (a ^ r) & 0x80) psw |= MCS_OV;
+    a = (uint8_t)r;
+}
+
+// Execute one instruction; returns its machine cycles
+static inline int mcsStep(Mcs51 &m) {
+    if (m.pc >= MCS_CODE_SIZE) {
+        m.fault = true;
+        return 0;
+    }
+    uint8_t op  = m.code[m.pc];
+    int cyc     = MCS_CYCLES[op];
+    m.io_t      = m.cycles + cyc - 1;
+    uint16_t at = m.pc;
+    auto fetch  = [&]() -> uint8_t { return m.code[++m.pc & (MCS_CODE_SIZE - 1)]; };
+    auto rel    = [&](int8_t off) { m.pc = (uint16_t)(m.pc + off); };
+    uint8_t &a  = mcsSfr(m, MCS_ACC);
+    int n       = op & 7;  // Rn
+    int i       = op & 1;  // @Ri
+    int lo      = op & 15;
+
+    // Source operand for the regular ALU rows (x4 #imm, x5 dir, x6-7 @Ri, x8-F Rn)
+    auto src = [&]() -> uint8_t {
+        if (lo == 4) return fetch();
+        if (lo == 5) return mcsRead(m, fetch());
+        if (lo < 8) return mcsInd(m, mcsReg(m, i));
+        return mcsReg(m, n);
+    };
+
+    if ((op & 0x1F) == 0x01) { // AJMP
+        uint8_t lo8 = fetch();
+        m.pc        = (uint16_t)(((m.pc + 1) & 0xF800) | ((op & 0xE0) << 3) | lo8);
+        m.cycles += cyc;
+        return cyc;
+    }
+    if ((op & 0x1F) == 0x11) { // ACALL
+        uint8_t lo8 = fetch();
+        uint16_t rt = m.pc + 1;
+        mcsPush(m, rt & 0xFF);
+        mcsPush(m, rt >> 8);
+        m.pc = (uint16_t)((rt & 0xF800) | ((op & 0xE0) << 3) | lo8);
+        m.cycles += cyc;
+        return cyc;
+    }
+
+    switch (op) {
+        case 0x00: break; // NOP
+        case 0x02: {      // LJMP
+            uint8_t h = fetch(), l = fetch();
+            m.pc      = (uint16_t)((h << 8) | l);
+            m.cycles += cyc;
+            return cyc;
+        }
+        case 0x12: { // LCALL
+            uint8_t h = fetch(), l = fetch();
+            uint16_t rt = m.pc + 1;
+            mcsPush(m, rt & 0xFF);
+            mcsPush(m, rt >> 8);
+            m.pc = (uint16_t)((h << 8) | l);
+            m.cycles += cyc;
+            return cyc;
+        }
+        case 0x22: // RET
+        case 0x32: { // RETI (no interrupt priority state to unwind)
+            uint8_t h = mcsPop(m), l = mcsPop(m);
+            m.pc      = (uint16_t)((h << 8) | l);
+            m.cycles += cyc;
+            return cyc;
+        }
+        case 0x03: a = (uint8_t)((a >> 1) | (a << 7)); break; // RR A
+        case 0x13: { // RRC A
+            bool c = a & 1;
+            a      = (uint8_t)((a >> 1) | (mcsCarry(m) << 7));
+            mcsSetCarry(m, c);
+            break;
+        }
+        case 0x23: a = (uint8_t)((a << 1) | (a >> 7)); break; // RL A
+        case 0x33: { // RLC A
+            bool c = a & 0x80;
+            a      = (uint8_t)((a << 1) | mcsCarry(m));
+            mcsSetCarry(m, c);
+            break;
+        }
+        case 0x04: a++; break;
+        case 0x14: a--; break;
+        case 0x05: { uint8_t d = fetch(); mcsWrite(m, d, mcsRead(m, d, true) + 1); break; }
+        case 0x15: { uint8_t d = fetch(); mcsWrite(m, d, mcsRead(m, d, true) - 1); break; }
+        case 0x06: case 0x07: mcsInd(m, mcsReg(m, i))++; break;
+        case 0x16: case 0x17: mcsInd(m, mcsReg(m, i))--; break;
+        case 0x10: { // JBC bit,rel
+            uint8_t b = fetch();
+            int8_t r  = (int8_t)fetch();
+            if (mcsGetBit(m, b, true)) {
+                mcsSetBit(m, b, false);
+                rel(r);
+            }
+            break;
+        }
+        case 0x20: case 0x30: { // JB / JNB bit,rel
+            uint8_t b = fetch();
+            int8_t r  = (int8_t)fetch();
+            if (mcsGetBit(m, b) == (op == 0x20)) rel(r);
+            break;
+        }
+        case 0x40: { int8_t r = (int8_t)fetch(); if (mcsCarry(m)) rel(r); break; }  // JC
+        case 0x50: { int8_t r = (int8_t)fetch(); if (!mcsCarry(m)) rel(r); break; } // JNC
+        case 0x60: { int8_t r = (int8_t)fetch(); if (a == 0) rel(r); break; }       // JZ
+        case 0x70: { int8_t r = (int8_t)fetch(); if (a != 0) rel(r); break; }       // JNZ
+        case 0x80: { int8_t r = (int8_t)fetch(); rel(r); break; }                   // SJMP
+        case 0x73: // JMP @A+DPTR
+            m.pc = (uint16_t)(((mcsSfr(m, MCS_DPH) << 8) | mcsSfr(m, MCS_DPL)) + a);
+            m.cycles += cyc;
+            return cyc;
+        case 0x42: case 0x52: case 0x62: { // ORL/ANL/XRL dir,A
+            uint8_t d = fetch(), v = mcsRead(m, d, true);
+            mcsWrite(m, d, op == 0x42 ? (v | a) : op == 0x52 ? (v & a) : (v ^ a));
+            break;
+        }
+        case 0x43: case 0x53: case 0x63: { // ORL/ANL/XRL dir,#imm
+            uint8_t d = fetch(), k = fetch(), v = mcsRead(m, d, true);
+            mcsWrite(m, d, op == 0x43 ? (v | k) : op == 0x53 ? (v & k) : (v ^ k));
+            break;
+        }
+        case 0x72: { uint8_t b = fetch(); mcsSetCarry(m, mcsCarry(m) || mcsGetBit(m, b)); break; }  // ORL C,bit
+        case 0xA0: { uint8_t b = fetch(); mcsSetCarry(m, mcsCarry(m) || !mcsGetBit(m, b)); break; } // ORL C,/bit
+        case 0x82: { uint8_t b = fetch(); mcsSetCarry(m, mcsCarry(m) && mcsGetBit(m, b)); break; }  // ANL C,bit
+        case 0xB0: { uint8_t b = fetch(); mcsSetCarry(m, mcsCarry(m) && !mcsGetBit(m, b)); break; } // ANL C,/bit
+        case 0x74: a = fetch(); break;                                                            // MOV A,#imm
+        case 0x75: { uint8_t d = fetch(), k = fetch(); mcsWrite(m, d, k); break; }                // MOV dir,#imm
+        case 0x76: case 0x77: mcsInd(m, mcsReg(m, i)) = fetch(); break;                           // MOV @Ri,#imm
+        case 0x83: a = m.code[(uint16_t)(m.pc + 1 + a) & (MCS_CODE_SIZE - 1)]; break;             // MOVC A,@A+PC
+        case 0x93: a = m.code[(uint16_t)(((mcsSfr(m, MCS_DPH) << 8) | mcsSfr(m, MCS_DPL)) + a) & (MCS_CODE_SIZE - 1)]; break;
+        case 0x84: { // DIV AB
+            uint8_t &b   = mcsSfr(m, MCS_B);
+            uint8_t &psw = mcsSfr(m, MCS_PSW);
+            psw &= ~(MCS_CY | MCS_OV);
+            if (b == 0) {
+                psw |= MCS_OV;
+            } else {
+                uint8_t q = a / b, r = a % b;
+                a         = q;
+                b         = r;
+            }
+            break;
+        }
+        case 0xA4: { // MUL AB
+            uint8_t &b   = mcsSfr(m, MCS_B);
+            uint8_t &psw = mcsSfr(m, MCS_PSW);
+            uint16_t r   = (uint16_t)(a * b);
+            psw &= ~(MCS_CY | MCS_OV);
+            if (r > 0xFF) psw |= MCS_OV;
+            a = r & 0xFF;
+            b = r >> 8;
+            break;
+        }
+        case 0x85: { uint8_t s = fetch(), d = fetch(); mcsWrite(m, d, mcsRead(m, s)); break; } // MOV dir,dir
+        case 0x86: case 0x87: { uint8_t d = fetch(); mcsWrite(m, d, mcsInd(m, mcsReg(m, i))); break; }
+        case 0x90: { // MOV DPTR,#imm16
+            uint8_t h = fetch(), l = fetch();
+            mcsSfr(m, MCS_DPH) = h;
+            mcsSfr(m, MCS_DPL) = l;
+            break;
+        }
+        case 0x92: { uint8_t b = fetch(); mcsSetBit(m, b, mcsCarry(m)); break; } // MOV bit,C
+        case 0xA2: { uint8_t b = fetch(); mcsSetCarry(m, mcsGetBit(m, b)); break; } // MOV C,bit
+        case 0xA3: { // INC DPTR
+            uint16_t d         = (uint16_t)(((mcsSfr(m, MCS_DPH) << 8) | mcsSfr(m, MCS_DPL)) + 1);
+            mcsSfr(m, MCS_DPH) = d >> 8;
+            mcsSfr(m, MCS_DPL) = d & 0xFF;
+            break;
+        }
+        case 0xA5: m.fault = true; return 0; // Reserved
+        case 0xA6: case 0xA7: mcsInd(m, mcsReg(m, i)) = mcsRead(m, fetch()); break; // MOV @Ri,dir
+        case 0xB2: { uint8_t b = fetch(); mcsSetBit(m, b, !mcsGetBit(m, b, true)); break; } // CPL bit
+        case 0xB3: mcsSetCarry(m, !mcsCarry(m)); break;
+        case 0xC2: { uint8_t b = fetch(); mcsSetBit(m, b, false); break; } // CLR bit
+        case 0xC3: mcsSetCarry(m, false); break;
+        case 0xD2: { uint8_t b = fetch(); mcsSetBit(m, b, true); break; } // SETB bit
+        case 0xD3: mcsSetCarry(m, true); break;
+        case 0xB4: case 0xB5: case 0xB6: case 0xB7: case 0xB8: case 0xB9: case 0xBA: case 0xBB:
+        case 0xBC: case 0xBD: case 0xBE: case 0xBF: { // CJNE
+            uint8_t x, y;
+            if (op == 0xB4) {
+                x = a;
+                y = fetch();
+            } else if (op == 0xB5) {
+                x = a;
+                y = mcsRead(m, fetch());
+            } else {
+                x = op < 0xB8 ? mcsInd(m, mcsReg(m, i)) : mcsReg(m, n);
+                y = fetch();
+            }
+            int8_t r = (int8_t)fetch();
+            mcsSetCarry(m, x < y);
+            if (x != y) rel(r);
+            break;
+        }
+        case 0xC0: mcsPush(m, mcsRead(m, fetch())); break; // PUSH
+        case 0xD0: { uint8_t d = fetch(); mcsWrite(m, d, mcsPop(m)); break; } // POP
+        case 0xC4: a = (uint8_t)((a << 4) | (a >> 4)); break; // SWAP A
+        case 0xC5: { uint8_t d = fetch(), v = mcsRead(m, d); mcsWrite(m, d, a); a = v; break; } // XCH A,dir
+        case 0xC6: case 0xC7: { uint8_t &r = mcsInd(m, mcsReg(m, i)); uint8_t v = r; r = a; a = v; break; }
+        case 0xD4: { // DA A
+            uint8_t &psw = mcsSfr(m, MCS_PSW);
+            int v        = a;
+            if ((v & 0x0F) > 9 || (psw & MCS_AC)) v += 0x06;
+            if (v > 0xFF) psw |= MCS_CY;
+            if (((v >> 4) & 0x1F) > 9 || (psw & MCS_CY)) {
+                v += 0x60;
+                psw |= MCS_CY;
+            }
+            a = (uint8_t)v;
+            break;
+        }
+        case 0xD5: { // DJNZ dir,rel
+            uint8_t d = fetch();
+            int8_t r  = (int8_t)fetch();
+            uint8_t v = mcsRead(m, d, true) - 1;
+            mcsWrite(m, d, v);
+            if (v) rel(r);
+            break;
+        }
+        case 0xD6: case 0xD7: { // XCHD A,@Ri
+            uint8_t &r = mcsInd(m, mcsReg(m, i));
+            uint8_t v  = r;
+            r          = (uint8_t)((r & 0xF0) | (a & 0x0F));
+            a          = (uint8_t)((a & 0xF0) | (v & 0x0F));
+            break;
+        }
+        case 0xE0: a = m.xram[mcsSfr(m, MCS_DPL) % MCS_XRAM_SIZE]; break; // MOVX A,@DPTR
+        case 0xE2: case 0xE3: a = m.xram[mcsReg(m, i) % MCS_XRAM_SIZE]; break;
+        case 0xF0: m.xram[mcsSfr(m, MCS_DPL) % MCS_XRAM_SIZE] = a; break;
+        case 0xF2: case 0xF3: m.xram[mcsReg(m, i) % MCS_XRAM_SIZE] = a; break;
+        case 0xE4: a = 0; break;
+        case 0xF4: a = (uint8_t)~a; break;
+        case 0xE5: { uint8_t d = fetch(); a = mcsRead(m, d); break; } // MOV A,dir
+        case 0xE6: case 0xE7: a = mcsInd(m, mcsReg(m, i)); break;
+        case 0xF5: { uint8_t d = fetch(); mcsWrite(m, d, a); break; } // MOV dir,A
+        case 0xF6: case 0xF7: mcsInd(m, mcsReg(m, i)) = a; break;
+        default:
+            if (op >= 0x08 && op < 0x10) {
+                mcsReg(m, n)++;
+            } else if (op >= 0x18 && op < 0x20) {
+                mcsReg(m, n)--;
+            } else if (op >= 0x24 && op < 0x30) {
+                mcsAdd(m, src(), false);
+            } else if (op >= 0x34 && op < 0x40) {
+                mcsAdd(m, src(), true);
+            } else if (op >= 0x44 && op < 0x50) {
+                a |= src();
+            } else if (op >= 0x54 && op < 0x60) {
+                a &= src();
+            } else if (op >= 0x64 && op < 0x70) {
+                a ^= src();
+            } else if (op >= 0x78 && op < 0x80) {
+                mcsReg(m, n) = fetch(); // MOV Rn,#imm
+            } else if (op >= 0x88 && op < 0x90) {
+                mcsWrite(m, fetch(), mcsReg(m, n)); // MOV dir,Rn
+            } else if (op >= 0x94 && op < 0xA0) {
+                mcsSubb(m, src());
+            } else if (op >= 0xA8 && op < 0xB0) {
+                mcsReg(m, n) = mcsRead(m, fetch()); // MOV Rn,dir
+            } else if (op >= 0xC8 && op < 0xD0) {
+                uint8_t v    = mcsReg(m, n);
+                mcsReg(m, n) = a;
+                a            = v;
+            } else if (op >= 0xD8 && op < 0xE0) { // DJNZ Rn,rel
+                int8_t r = (int8_t)fetch();
+                if (--mcsReg(m, n)) rel(r);
+            } else if (op >= 0xE8 && op < 0xF0) {
+                a = mcsReg(m, n); // MOV A,Rn
+            } else if (op >= 0xF8) {
+                mcsReg(m, n) = a;
+            } else {
+                m.fault = true;
+                m.pc    = at;
+                return 0;
+            }
+            break;
+    }
+    m.pc++;
+    // Parity tracks the accumulator
+    uint8_t par = a;
+    par ^= par >> 4;
+    par ^= par >> 2;
+    par ^= par >> 1;
+    uint8_t &psw = mcsSfr(m, MCS_PSW);
+    psw          = (uint8_t)((psw & ~MCS_P) | (par & 1));
+    m.cycles += cyc;
+    return cyc;
+}
+
+#endif // MCS51_H
@@ -0,0 +1,153 @@
+/*
+ * scan_bench.cpp — Host microbenchmark of scan-loop decode paths
+ *
+ * Compares the per-sample cost of:
+ *   legacy — 7-iteration bit loop, byte-per-key table, branch on W1TS/W1TC
+ *   lut    — byte-sliced lookup tables, packed key bitmap, indexed register
+ *            write (scan_core.h generic fallback)
+ *   j3     — compile-time permutation for the default J3 wiring
+ *   shift  — single shift + mask for A0-A6 on consecutive GPIOs 12-18
+ *
+ * Host ns/sample is not ESP32 cycles, but the ratio between paths is a
+ * useful proxy; feed the result into scan_sim --loop-cycles.
+ *
+ *   scan_bench [--samples=N] [--keys=8] [--seed=1]
+ */
+
+#include <chrono>
+
+#include "bus_model.h"
+
+#define BENCH_WORDS 4096 // Pre-generated GPIO_IN samples (power of 2)
+
+static volatile uint32_t sink_w1ts, sink_w1tc; // Stand-ins for GPIO_OUT_W1TS/W1TC_REG
+
+template <typename F> static double timeNs(F fn, uint64_t samples, uint64_t &hits) {
+    auto t0  = std::chrono::steady_clock::now();
+    hits     = fn();
+    auto t1  = std::chrono::steady_clock::now();
+    double s = std::chrono::duration<double>(t1 - t0).count();
+    return s * 1e9 / (double)samples;
+}
+
+// --- Legacy path (pre-LUT scan_response_task) ---
+
+struct LegacyState {
+    uint32_t addr_masks[SCAN_ADDR_BITS];
+    volatile uint8_t key_state[SCAN_ADDR_COUNT];
+};
+
+static uint64_t runLegacy(const LegacyState &ls, const uint32_t *words, uint64_t samples, uint32_t return_mask) {
+    uint64_t hits = 0;
+    for (uint64_t n = 0; n < samples; n++) {
+        uint32_t gpio_in = words[n & (BENCH_WORDS - 1)];
+        uint8_t addr     = 0;
+        for (int i = 0; i < SCAN_ADDR_BITS; i++) {
+            if (gpio_in & ls.addr_masks[i]) {
+                addr |= (1 << i);
+            }
+        }
+        if (ls.key_state[addr]) {
+            sink_w1ts = return_mask;
+            hits++;
+        } else {
+            sink_w1tc = return_mask;
+        }
+    }
+    return hits;
+}
+
+// --- LUT + bitmap path (scan_core.h) ---
+
+template <typename Decoder> static uint64_t runCore(const ScanCore &core, const uint32_t *words, uint64_t samples) {
+    volatile uint32_t *const out_regs[2] = {&sink_w1tc, &sink_w1ts};
+    uint64_t hits                        = 0;
+    for (uint64_t n = 0; n < samples; n++) {
+        uint8_t addr;
+        uint32_t pressed = scanStepWith<Decoder>(core, words[n & (BENCH_WORDS - 1)], addr);
+        *out_regs[pressed] = core.return_mask;
+        hits += pressed;
+    }
+    return hits;
+}
+
+// scanDispatch() target: checks the chosen decoder, then times it
+struct BenchLoop {
+    const ScanCore *core;
+    const uint32_t *words;
+    uint64_t samples;
+    uint64_t hits;
+    double ns;
+    bool ok;
+
+    template <typename Decoder> void run() {
+        ok = true;
+        for (int i = 0; i < BENCH_WORDS; i++) {
+            if (Decoder::decode(*core, words[i]) != scanDecodeAddrLoop(*core, words[i])) ok = false;
+        }
+        ns = timeNs([&] { return runCore<Decoder>(*core, words, samples); }, samples, hits);
+    }
+};
+
+int main(int argc, char **argv) {
+    uint64_t samples = (uint64_t)simArgNum(argc, argv, "samples", 200e6);
+    int keys         = (int)simArgNum(argc, argv, "keys", 8);
+    uint32_t rng     = (uint32_t)simArgNum(argc, argv, "seed", 1);
+    if (rng == 0) rng = 1;
+
+    // Default J3 wiring (config.h setDefaultConfig) and a contiguous layout
+    const uint8_t contig_pins[SCAN_ADDR_BITS] = {12, 13, 14, 15, 16, 17, 18};
+    static volatile uint32_t key_bits[SCAN_KEY_WORDS];
+    static ScanCore core, contig;
+    scanCoreInit(core, SCAN_J3_PINS, 19, key_bits);
+    scanCoreInit(contig, contig_pins, 19, key_bits);
+    const uint8_t gap_pins[SCAN_ADDR_BITS] = {14, 15, 16, 17, 18, 19, 20}; // No GPIO 20: no fast path
+    if (core.layout.kind != SCAN_LAYOUT_J3 || contig.layout.kind != SCAN_LAYOUT_CONTIGUOUS ||
+        scanClassifyLayout(gap_pins).kind != SCAN_LAYOUT_GENERIC) {
+        fprintf(stderr, "scan_bench: layout classification failed\n");
+        return 1;
+    }
+
+    static LegacyState legacy;
+    memcpy(legacy.addr_masks, core.addr_masks, sizeof(legacy.addr_masks));
+    for (int i = 0; i < keys; i++) {
+        uint8_t a = simRand(rng) % 104;
+        scanKeySet(key_bits, a);
+        legacy.key_state[a] = 1;
+    }
+
+    // Addresses in scan order with unrelated GPIO noise in the other bits,
+    // the way GPIO_IN_REG looks with Key Return, LEDs and strapping pins live
+    static uint32_t words[BENCH_WORDS], contig_words[BENCH_WORDS];
+    uint32_t addr_bits = 0, contig_bits = 0;
+    for (int i = 0; i < SCAN_ADDR_BITS; i++) {
+        addr_bits |= core.addr_masks[i];
+        contig_bits |= contig.addr_masks[i];
+    }
+    for (int i = 0; i < BENCH_WORDS; i++) {
+        uint8_t a       = (uint8_t)((i / 8) % 104);
+        uint32_t noise  = simRand(rng);
+        words[i]        = scanEncodeAddr(core, a) | (noise & ~addr_bits);
+        contig_words[i] = scanEncodeAddr(contig, a) | (noise & ~contig_bits);
+    }
+
+    uint64_t hits_legacy = 0, hits_lut = 0;
+    double ns_legacy = timeNs([&] { return runLegacy(legacy, words, samples, core.return_mask); }, samples, hits_legacy);
+    double ns_lut    = timeNs([&] { return runCore<ScanDecodeLut>(core, words, samples); }, samples, hits_lut);
+    BenchLoop j3     = {&core, words, samples, 0, 0, false};
+    BenchLoop shift  = {&contig, contig_words, samples, 0, 0, false};
+    scanDispatch(core, j3);
+    scanDispatch(contig, shift);
+
+    printf("scan_bench: %llu samples, %d keys held\n", (unsigned long long)samples, keys);
+    printf("  legacy  %6.3f ns/sample  (%llu hits)\n", ns_legacy, (unsigned long long)hits_legacy);
+    printf("  lut     %6.3f ns/sample  (%llu hits)  %.2fx\n", ns_lut, (unsigned long long)hits_lut,
+           ns_legacy / ns_lut);
+    printf("  j3      %6.3f ns/sample  (%llu hits)  %.2fx%s\n", j3.ns, (unsigned long long)j3.hits,
+           ns_legacy / j3.ns, j3.ok ? "" : "  DECODE MISMATCH");
+    printf("  shift   %6.3f ns/sample  (%llu hits)  %.2fx%s\n", shift.ns, (unsigned long long)shift.hits,
+           ns_legacy / shift.ns, shift.ok ? "" : "  DECODE MISMATCH");
+
+    bool agree = hits_lut == hits_legacy && j3.hits == hits_legacy && shift.hits == hits_legacy;
+    return (agree && j3.ok && shift.ok) ? 0 : 1;
+}
@@ -0,0 +1,757 @@
+/*
+ * scan_sim.cpp — Host-side Wyse 50 scan-bus simulator + latency benchmark
+ *
+ * Drives the firmware's scan core (src/scan_core.h) with a simulated
+ * 8031 that presents a new address every dwell period and samples Key
+ * Return near the end of it. The responder loop is costed in ESP32
+ * cycles (per-iteration cost, jitter, periodic vTaskDelay), so changes
+ * to the hot loop can be checked without flashing a board.
+ *
+ *   scan_sim [--frames=N] [--dwell-us=6] [--sample-us=5] [--gap-us=0]
+ *            [--frame-len=104] [--loop-cycles=60] [--jitter=8]
+ *            [--yield-every=10000] [--yield-us=1000] [--keys=2]
+ *            [--hold-frames=4] [--seed=1] [--policy=blind|frame]
+ *            [--yield-min-us=100] [--yield-max-us=400] [--wake-us=40]
+ *            [--margin-us=60] [--skew-ns=0] [--settle-ns=0]
+ *            [--predict] [--predict-cycles=12] [--analytics]
+ *            [--drain-us=1000] [--trace=FILE] [--trace-kb=32]
+ *            [--edge] [--irq-us=2] [--irq-jitter-us=1]
+ *            [--reports-us=0] [--apply-us=4] [--direct] [--latch=2]
+ *            [--rollover=0]
+ *
+ * --policy=frame yields only in the gap after a full sweep (the firmware
+ * policy, scanYieldWindow) and uses --yield-every as the forced-yield
+ * fallback; try it with --gap-us set to the terminal's idle time.
+ *
+ * --skew-ns gives each address line a random fixed lag of 0..N ns, so
+ * samples during a transition decode intermediate addresses; compare
+ * "phantom answers" with and without --settle-ns (scanSettleStep).
+ *
+ * --predict writes the learned next address's level as soon as the
+ * address lines move, --predict-cycles after the sample that saw it;
+ * the reactive write still follows one loop later.
+ *
+ * --analytics prints the frame analytics the firmware would serve from
+ * /api/scan/frames for the same traffic. Address changes go through the
+ * snoop ring (scanRingPush) and are drained every --drain-us, as the
+ * snoop task does once per tick; a slow drain shows up as ring drops.
+ *
+ * --edge replaces the polling responder with the edge-triggered one
+ * (scanEdgeService): every address-line edge raises an interrupt that
+ * enters --irq-us later (+0..--irq-jitter-us), and the core is idle in
+ * between. Prints the handler's counters and the CPU share it used.
+ *
+ * --reports-us delivers a HID report every N us at any point in the
+ * frame instead of changing keys at frame starts. Each report releases
+ * and presses keys one at a time over --apply-us, as processHidReport()
+ * does, into the staged image the responder commits at frame starts
+ * (scanKeyCommit); --direct writes the live bitmap instead, as the
+ * firmware once did. "torn frames" counts frames whose Key Return
+ * pattern matches no single report, among frames with no stale dwell.
+ * --latch holds each staged press for N frames the responder answered
+ * it in (0 = off); "never read asserted" counts keystrokes lost anyway.
+ * --rollover caps the non-modifier keys live at once (the shaper in
+ * ScanKeyStage); keystrokes must then still arrive, in press order and
+ * with the Shift state of the report that pressed them.
+ *
+ * --loop-cycles is the modelled cost of one firmware iteration; use
+ * scan_bench to compare the relative cost of decode paths.
+ */
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "bus_model.h"
+
+struct ResponderModel {
+    uint32_t loop_cycles; // Cost of one scan iteration (read, decode, lookup, write)
+    uint32_t jitter;      // Extra 0..jitter cycles per iteration (bus/cache effects)
+    uint32_t yield_every; // Iterations between vTaskDelay(1) (0 = never); forced-yield
+                          // interval when frame_policy is set
+    uint32_t yield_cycles;
+    bool frame_policy;       // Yield in inter-frame gaps (scanYieldWindow)
+    ScanYieldPolicy policy;
+    uint32_t wake_cycles;    // Extra wake-up latency after a gap yield (0..wake_cycles)
+    uint32_t settle_cycles;  // Address settle window (0 = filter off)
+    bool predict;            // Predictive Key Return (scanPredictAdvance)
+    uint32_t predict_cycles; // Bus-change test + predicted write, from the sample
+};
+
+// Pick a fresh random set of held keys from the addresses the bus visits
+static void randomizeKeys(volatile uint32_t *key_bits, const BusModel &bus, int max_keys, uint32_t &rng) {
+    scanKeyClearAll(key_bits);
+    int n = (int)(simRand(rng) % (uint32_t)(max_keys + 1));
+    for (int i = 0; i < n; i++) {
+        scanKeySet(key_bits, bus.order[simRand(rng) % bus.frame_len]);
+    }
+}
+
+// HID reports arriving at any point in the frame (--reports-us)
+#define SIM_REPORT_IMAGES 256 // Recent reports a scanned frame may match
+
+struct ReportFeed {
+    uint64_t every_cycles; // Report interval (0 = keys change at frame starts only)
+    uint64_t apply_cycles; // First key write to last, within one report
+    bool direct;           // Write the live bitmap, no staging
+    uint8_t latch_frames;  // Press latch (ScanKeyStage), staged only
+    uint8_t rollover;      // Rollover shaper cap, staged only (0 = off)
+};
+
+struct ReportStats {
+    uint32_t reports;
+    uint32_t frames;      // Frames checked against the reports (every dwell answered fresh)
+    uint32_t torn;        // ...whose pattern matched no single report
+    uint32_t commits;
+    uint32_t deferred;
+    uint32_t keystrokes;  // Non-modifier presses delivered
+    uint32_t lost;        // ...released without the terminal ever reading them asserted
+    uint32_t reordered;   // ...first read in an earlier frame than the key pressed before them
+    uint32_t wrong_shift; // ...first read in a frame whose Shift differs from their report's
+    uint32_t saved;       // Press latch: released early but held on
+    uint32_t peak;        // Most non-modifier keys read asserted in one frame
+    uint32_t queued;      // Rollover shaper: presses that waited for a slot
+    uint32_t queue_max;
+    uint32_t dropped;
+    uint32_t left;        // Still queued at the end
+};
+
+struct SimKeystroke {
+    uint8_t addr;
+    bool shifted;   // Shift in the report that pressed it
+    uint32_t frame; // Responder frame the terminal first read it asserted in (UINT32_MAX = never)
+};
+
+// The producer side: each report becomes one staged edit (or a run of
+// direct writes), with its key writes spread over apply_cycles. Half the
+// reports hold Shift, at a fixed address the random keys never use.
+struct ReportSource {
+    const ReportFeed &feed;
+    const BusModel &bus;
+    volatile uint32_t *live;
+    ScanKeyStage stage;
+    uint32_t images[SIM_REPORT_IMAGES][SCAN_KEY_WORDS];
+    uint32_t n_images;
+    uint8_t ops[2 * SCAN_ADDR_COUNT]; // Address | 0x80 = press
+    uint32_t n_ops, done;
+    uint64_t start, next;
+    uint64_t stop; // No reports begin after this
+    bool open;
+    uint8_t shift;
+    bool shifted; // Current report holds Shift
+    std::vector<SimKeystroke> ks;
+    std::deque<uint32_t> unseen[SCAN_ADDR_COUNT]; // Keystrokes pressed here, not yet read asserted, oldest first
+
+    void begin(uint64_t t, int max_keys, uint32_t &rng) {
+        uint32_t img[SCAN_KEY_WORDS] = {0};
+        int n = (int)(simRand(rng) % (uint32_t)(max_keys + 1));
+        for (int i = 0; i < n; i++) {
+            uint8_t a = bus.order[simRand(rng) % bus.frame_len];
+            if (a != shift) scanKeySet(img, a);
+        }
+        shifted = simRand(rng) & 1;
+        if (shifted) scanKeySet(img, shift);
+        const uint32_t *prev = images[(n_images - 1) % SIM_REPORT_IMAGES];
+        n_ops                = 0;
+        for (int a = 0; a < SCAN_ADDR_COUNT; a++) { // Releases first, like processHidReport()
+            if (scanKeyTest(prev, (uint8_t)a) && !scanKeyTest(img, (uint8_t)a)) ops[n_ops++] = (uint8_t)a;
+        }
+        for (int a = 0; a < SCAN_ADDR_COUNT; a++) {
+            if (!scanKeyTest(prev, (uint8_t)a) && scanKeyTest(img, (uint8_t)a)) ops[n_ops++] = (uint8_t)(a | 0x80);
+        }
+        memcpy(images[n_images++ % SIM_REPORT_IMAGES], img, sizeof(img));
+        done  = 0;
+        start = t;
+        open  = true;
+        if (!feed.direct) scanKeyEditBegin(stage);
+    }
+
+    // Everything due by `t`
+    void advance(uint64_t t, int max_keys, uint32_t &rng) {
+        while (true) {
+            if (!open) {
+                if (next > t || next > stop) return;
+                begin(next, max_keys, rng);
+                next += feed.every_cycles;
+            }
+            while (done < n_ops && start + feed.apply_cycles * (done + 1) / (n_ops + 1) <= t) {
+                volatile uint32_t *bits = feed.direct ? live : stage.layers[0];
+                uint8_t op              = ops[done++];
+                if (op & 0x80) {
+                    uint8_t a = op & 0x7F;
+                    if (a != shift) {
+                        unseen[a].push_back((uint32_t)ks.size());
+                        ks.push_back({a, shifted, UINT32_MAX});
+                    }
+                    if (feed.direct) {
+                        scanKeySet(bits, a);
+                    } else {
+                        scanKeyStagePress(stage, 0, a);
+                    }
+                } else if (feed.direct) {
+                    scanKeyClear(bits, op);
+                } else {
+                    scanKeyStageRelease(stage, 0, op);
+                }
+            }
+            if (start + feed.apply_cycles > t) return;
+            if (!feed.direct) scanKeyEditEnd(stage);
+            open = false;
+        }
+    }
+
+    // Any recent report, outside addresses the latch held this frame
+    bool matches(const uint32_t *seen, const uint32_t *latched) const {
+        uint32_t n = n_images < SIM_REPORT_IMAGES ? n_images : SIM_REPORT_IMAGES;
+        for (uint32_t i = 0; i < n; i++) {
+            const uint32_t *img = images[(n_images - 1 - i) % SIM_REPORT_IMAGES];
+            bool same           = true;
+            for (int w = 0; w < SCAN_KEY_WORDS; w++) same &= ((img[w] ^ seen[w]) & ~latched[w]) == 0;
+            if (same) return true;
+        }
+        return false;
+    }
+};
+
+static void runSim(const ScanCore &core, const BusModel &bus, const ResponderModel &rm, uint32_t frames,
+                   int max_keys, uint32_t hold_frames, uint32_t seed, SimStats &st, ScanRing &ring,
+                   ScanSnoopStats &snoop, uint64_t drain_cycles, ScanTrace *trace, const ReportFeed &feed,
+                   ReportStats &rs) {
+    uint32_t rng = seed ? seed : 1;
+    simStatsReset(st);
+    memset(&rs, 0, sizeof(rs));
+    ReportSource src{feed, bus, core.key_bits, {}, {}, 0, {}, 0, 0, 0, 0, 0, false, 0, false, {}, {}};
+    src.shift = bus.order[bus.frame_len / 2];
+    scanKeyStageInit(src.stage, feed.latch_frames, feed.rollover);
+    scanKeyModifier(src.stage, src.shift);
+    uint32_t wraps                     = 0;     // Frame boundaries the responder committed at
+    uint32_t prev_seen[SCAN_KEY_WORDS] = {0}; // Key Return as read the frame before
+    scanKeyClearAll(core.key_bits);
+    memset(src.images, 0, sizeof(src.images));
+    src.n_images = 1; // The empty image: nothing held at the start
+    src.next     = feed.every_cycles;
+    src.stop     = UINT64_MAX;
+    // The shaper runs behind a fast feed; the last quarter lets it drain
+    if (feed.rollover) src.stop = busSlotStart(bus, frames * 3 / 4, 0);
+    const bool staged = feed.every_cycles && !feed.direct;
+
+    uint64_t t           = 0;     // Start of the responder's next iteration
+    uint32_t iter        = 0;
+    bool line            = false; // Key Return as the terminal sees it
+    bool pending         = false; // Written by an iteration still in flight
+    bool pending_val     = false;
+    uint64_t pending_t   = 0;
+    uint64_t pending_smp = 0;     // Sample time the in-flight value was based on
+    uint64_t fresh_t     = 0;     // Sample time behind the current line value
+    bool woke            = false; // Previous iteration ended in a gap yield
+    bool early           = false; // Predictive write in flight (lands before `pending`)
+    bool early_val       = false;
+    uint64_t early_t     = 0;
+    uint32_t bus_bits    = 0;     // Address lines as last seen by the predictor
+    uint8_t pred_last    = 0xFF;  // Last decoded address fed to the predictor
+    ScanFrameTracker ft;
+    scanFrameReset(ft);
+    ScanSettle settle;
+    scanSettleInit(settle, rm.settle_cycles);
+    static ScanPredict pred;
+    scanPredictInit(pred);
+    ScanFrameTracker aft; // Wrap detection for the analytics, independent of --policy
+    scanFrameReset(aft);
+    scanRingReset(ring);
+    scanSnoopReset(snoop);
+    uint64_t next_drain = drain_cycles;
+
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        if (!feed.every_cycles && frame % hold_frames == 0) randomizeKeys(core.key_bits, bus, max_keys, rng);
+        uint32_t seen[SCAN_KEY_WORDS]    = {0}; // Key Return as the terminal read it this frame
+        uint32_t latched[SCAN_KEY_WORDS] = {0}; // Addresses the press latch held this frame
+        bool stale                       = false;
+
+        for (uint16_t slot = 0; slot < bus.frame_len; slot++) {
+            uint64_t start    = busSlotStart(bus, frame, slot);
+            uint64_t sample_t = start + bus.sample_cycles;
+            bool timed        = false;
+
+            while (t <= sample_t) {
+                if (feed.every_cycles) src.advance(t, max_keys, rng);
+                if (early && early_t <= t) {
+                    line    = early_val;
+                    fresh_t = pending_smp;
+                    early   = false;
+                }
+                if (pending && pending_t <= t) {
+                    line    = pending_val;
+                    fresh_t = pending_smp;
+                    pending = false;
+                }
+                uint32_t gpio_in = busGpioAt(bus, core, t);
+                bool committed   = false; // Predictive write issued this iteration
+                uint8_t guessed  = pred.addr;
+                if (rm.predict && (gpio_in & core.addr_bits) != bus_bits) {
+                    bus_bits  = gpio_in & core.addr_bits;
+                    early     = true;
+                    early_val = pred.level != 0;
+                    early_t   = t + rm.predict_cycles;
+                    committed = true;
+                }
+                uint8_t addr = scanDecodeAddr(core, gpio_in);
+                if (settle.window) addr = scanSettleStep(settle, addr, (uint32_t)t);
+                bool changed = addr != aft.last_addr;
+                bool wrap    = changed && scanFrameChange(aft, addr, (uint32_t)t);
+                wraps += wrap;
+                if (wrap && staged) {
+                    scanKeyCommit(src.stage, core.key_bits);
+                    memcpy(latched, src.stage.hold, sizeof(latched));
+                }
+                bool pressed = scanKeyTest(core.key_bits, addr) != 0;
+                if (changed && pressed && staged) scanKeySeen(src.stage, addr);
+                if (trace) scanTraceSample(*trace, addr, pressed, (uint32_t)t);
+
+                // Answering for the previous address is ordinary lag; anything
+                // else came from a mid-transition sample
+                uint8_t on_bus = busAddrAt(bus, t);
+                if (addr != on_bus && (t < bus.dwell_cycles || addr != busAddrAt(bus, t - bus.dwell_cycles))) {
+                    st.phantom_addrs++;
+                    if (pressed && !scanKeyTest(core.key_bits, on_bus)) st.phantom_asserts++;
+                }
+                if (changed) scanRingPush(ring, addr, (uint32_t)t, (uint8_t)(wrap | (pressed << 1)));
+                if (t >= next_drain) {
+                    scanRingDrain(ring, snoop);
+                    next_drain = t + drain_cycles;
+                }
+                if (rm.predict && addr != pred_last) {
+                    pred_last = addr;
+                    scanPredictAdvance(pred, core, addr, pressed);
+                }
+                uint32_t cost    = rm.loop_cycles + (rm.jitter ? simRand(rng) % (rm.jitter + 1) : 0);
+                uint32_t window  = 0;
+                if (rm.frame_policy) {
+                    if (woke) scanFrameWoke(ft, addr);
+                    woke = false;
+                    if (addr != ft.last_addr) {
+                        scanFrameChange(ft, addr, (uint32_t)t);
+                        window = scanYieldWindow(ft, addr, rm.policy);
+                    }
+                }
+
+                pending     = true;
+                pending_val = pressed;
+                pending_t   = t + cost;
+                pending_smp = t;
+                // First answer for this dwell's address: the predictive write
+                // if it guessed right, else the reactive one
+                if (!timed && t >= start && committed && guessed == on_bus) {
+                    simStatsLatency(st, (uint32_t)(early_t - start));
+                    timed = true;
+                } else if (!timed && t >= start && addr == on_bus) {
+                    simStatsLatency(st, (uint32_t)(pending_t - start));
+                    timed = true;
+                }
+
+                t += cost;
+                bool slept = true;
+                if (window) {
+                    uint32_t late = rm.wake_cycles ? simRand(rng) % (rm.wake_cycles + 1) : 0;
+                    iter          = 0;
+                    woke          = true;
+                    if (busAddrAt(bus, t + window + late) != addr) scanRingBreak(ring); // Woke late
+                    t += window + late;
+                    st.gap_yields++;
+                    st.yield_cycles += window + late;
+                } else if (rm.yield_every && ++iter >= rm.yield_every) {
+                    iter = 0;
+                    t += rm.yield_cycles;
+                    scanFrameSlept(ft);
+                    scanRingBreak(ring);
+                    st.forced_yields++;
+                    st.yield_cycles += rm.yield_cycles;
+                } else {
+                    slept = false;
+                }
+                if (slept) {
+                    if (trace) scanTraceBlind(*trace, (uint32_t)t);
+                    uint32_t now_in = busGpioAt(bus, core, t);
+                    uint8_t now     = scanDecodeAddr(core, now_in);
+                    if (settle.window) scanSettleResync(settle, now, (uint32_t)t);
+                    scanPredictResync(pred, core, now);
+                    bus_bits  = now_in & core.addr_bits;
+                    pred_last = now;
+                }
+            }
+            if (early && early_t <= sample_t) {
+                line    = early_val;
+                fresh_t = pending_smp;
+                early   = false;
+            }
+            if (pending && pending_t <= sample_t) {
+                line    = pending_val;
+                fresh_t = pending_smp;
+                pending = false;
+            }
+
+            if (feed.every_cycles) src.advance(sample_t, max_keys, rng);
+
+            uint8_t addr  = bus.order[slot];
+            bool expected = scanKeyTest(core.key_bits, addr) != 0;
+            st.samples++;
+            if (expected) st.held_samples++;
+            if (fresh_t < start) st.stale_slots++;
+            if (expected && !line) st.keys_missed++;
+            if (!expected && line) st.wrong_addr++;
+            if (line) scanKeySet(seen, addr);
+            // Asserted after a frame up: the oldest press not yet read,
+            // in the responder's frame and against the Shift it shows
+            if (line && !scanKeyTest(prev_seen, addr) && !src.unseen[addr].empty()) {
+                uint32_t k = src.unseen[addr].front();
+                src.unseen[addr].pop_front();
+                src.ks[k].frame = wraps;
+                rs.wrong_shift += src.ks[k].shifted != (scanKeyTest(core.key_bits, src.shift) != 0);
+            }
+            stale |= fresh_t < start;
+        }
+        if (!feed.every_cycles) continue;
+        memcpy(prev_seen, seen, sizeof(prev_seen));
+        // A slept-through dwell is a miss, not a tear. The first frame
+        // may start before the responder's first commit.
+        if (frame == 0 || stale) continue;
+        uint32_t keys_on = 0;
+        for (int w = 0; w < SCAN_KEY_WORDS; w++) {
+            for (uint32_t m = seen[w]; m; m &= m - 1) keys_on++;
+        }
+        keys_on -= scanKeyTest(seen, src.shift) != 0;
+        if (keys_on > rs.peak) rs.peak = keys_on;
+        // The shaper shows subsets of reports by design
+        if (!feed.rollover) {
+            rs.frames++;
+            if (!src.matches(seen, latched)) rs.torn++;
+        }
+    }
+    // Lost: never read, and released (or pressed again) since
+    const uint32_t *last = src.images[(src.n_images - 1) % SIM_REPORT_IMAGES];
+    uint32_t prev_frame  = 0; // Of the last keystroke read, in press order
+    for (const SimKeystroke &e : src.ks) {
+        if (e.frame == UINT32_MAX) continue;
+        rs.reordered += e.frame < prev_frame;
+        prev_frame = e.frame;
+    }
+    int64_t latest[SCAN_ADDR_COUNT];
+    std::fill(latest, latest + SCAN_ADDR_COUNT, -1);
+    for (size_t k = 0; k < src.ks.size(); k++) latest[src.ks[k].addr] = (int64_t)k;
+    for (int a = 0; a < SCAN_ADDR_COUNT; a++) {
+        const std::deque<uint32_t> &q = src.unseen[a];
+        bool held = !q.empty() && scanKeyTest(last, (uint8_t)a) && (int64_t)q.back() == latest[a]; // Not up yet
+        rs.lost += (uint32_t)q.size() - held;
+    }
+    rs.reports    = src.n_images - 1;
+    rs.commits    = src.stage.commits;
+    rs.deferred   = src.stage.deferred;
+    rs.keystrokes = (uint32_t)src.ks.size();
+    rs.saved      = src.stage.saved;
+    rs.queued     = src.stage.queued;
+    rs.queue_max  = src.stage.queue_max;
+    rs.dropped    = src.stage.dropped;
+    rs.left       = src.stage.queue_n;
+    scanRingDrain(ring, snoop);
+    st.sim_cycles    = t;
+    st.frames_seen   = ft.frames;
+    st.frames_missed = ft.frames_missed;
+    st.settle_rejected = settle.rejected;
+    st.predict_hits    = pred.hits;
+    st.predict_misses  = pred.misses;
+}
+
+// Interrupt-driven responder (--edge)
+#define SIM_EDGE_READ_CYCLES  30 // GPIO_IN over APB + decode + lookup
+#define SIM_EDGE_WRITE_CYCLES 8  // W1TS/W1TC store
+
+struct EdgeModel {
+    uint32_t irq_cycles; // Edge → handler entry
+    uint32_t irq_jitter; // Extra 0..irq_jitter (other interrupts, critical sections)
+};
+
+struct SimWrite {
+    uint64_t t;
+    uint8_t addr; // Address the level was looked up for
+    bool level;
+};
+
+// scanEdgeService()'s view of the simulated bus: time advances with each
+// register access, and every Key Return write is kept for the terminal
+struct SimEdgeIo {
+    const BusModel &bus;
+    const ScanCore &core;
+    SimStats &st;
+    uint64_t t;
+    uint32_t last_in;
+    uint64_t timed; // Last dwell (frame * len + slot) given a latency sample
+    std::vector<SimWrite> writes;
+
+    uint32_t read() {
+        last_in = busGpioAt(bus, core, t);
+        t += SIM_EDGE_READ_CYCLES;
+        return last_in;
+    }
+    void write(uint32_t level) {
+        t += SIM_EDGE_WRITE_CYCLES;
+        writes.push_back({t, scanDecodeAddr(core, last_in), level != 0});
+    }
+    uint32_t now() { return (uint32_t)t; }
+    void change(uint8_t addr, uint32_t, uint32_t) {
+        if (addr != busAddrAt(bus, t)) return;
+        uint64_t period = busFramePeriod(bus);
+        uint64_t frame  = t / period;
+        uint64_t slot   = (t % period) / bus.dwell_cycles;
+        if (slot >= bus.frame_len) slot = bus.frame_len - 1;
+        uint64_t dwell = frame * bus.frame_len + slot;
+        if (dwell == timed) return;
+        timed = dwell;
+        simStatsLatency(st, (uint32_t)(t - busSlotStart(bus, frame, (uint16_t)slot)));
+    }
+};
+
+static void runEdgeSim(const ScanCore &core, const BusModel &bus, const EdgeModel &em, uint32_t frames,
+                       int max_keys, uint32_t hold_frames, uint32_t seed, SimStats &st, ScanEdge &edge) {
+    uint32_t rng = seed ? seed : 1;
+    simStatsReset(st);
+    scanEdgeReset(edge);
+    static ScanPredict order;
+    scanPredictInit(order);
+    SimEdgeIo io{bus, core, st, 0, 0, UINT64_MAX, {}};
+    io.writes.push_back({0, 0xFF, false});
+    size_t cursor = 0;
+
+    // The GPIO status bit latches an edge until the handler clears it on
+    // entry; an edge after that re-pends the interrupt for after exit
+    uint64_t next_entry = UINT64_MAX, last_entry = 0, last_exit = 0;
+    auto serve          = [&](uint64_t until) {
+        while (next_entry <= until) {
+            io.t = next_entry;
+            scanEdgeService<ScanDecodeLut>(edge, core, order, io, (uint32_t)next_entry);
+            last_entry = next_entry;
+            last_exit  = io.t;
+            next_entry = UINT64_MAX;
+        }
+    };
+    auto edgeAt = [&](uint64_t e) {
+        serve(e);
+        if (next_entry != UINT64_MAX || e <= last_entry) return;
+        uint64_t from = e > last_exit ? e : last_exit;
+        next_entry    = from + em.irq_cycles + (em.irq_jitter ? simRand(rng) % (em.irq_jitter + 1) : 0);
+    };
+
+    uint8_t prev = 0xFF;
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        if (frame % hold_frames == 0) randomizeKeys(core.key_bits, bus, max_keys, rng);
+        for (uint16_t slot = 0; slot < bus.frame_len; slot++) {
+            uint64_t start = busSlotStart(bus, frame, slot);
+            uint8_t addr   = bus.order[slot];
+            uint64_t edges[SCAN_ADDR_BITS];
+            int n = 0;
+            for (int i = 0; i < SCAN_ADDR_BITS; i++) {
+                if ((addr ^ prev) & (1 << i)) edges[n++] = start + bus.skew_cycles[i];
+            }
+            std::sort(edges, edges + n);
+            for (int i = 0; i < n; i++) edgeAt(edges[i]);
+            prev = addr;
+
+            uint64_t sample_t = start + bus.sample_cycles;
+            serve(sample_t);
+            while (cursor + 1 < io.writes.size() && io.writes[cursor + 1].t <= sample_t) cursor++;
+            const SimWrite &w = io.writes[cursor];
+            bool expected     = scanKeyTest(core.key_bits, addr) != 0;
+            st.samples++;
+            if (expected) st.held_samples++;
+            if (w.addr != addr) st.stale_slots++;
+            if (expected && !w.level) st.keys_missed++;
+            if (!expected && w.level) st.wrong_addr++;
+            if (cursor > 4096) {
+                io.writes.erase(io.writes.begin(), io.writes.begin() + cursor);
+                cursor = 0;
+            }
+        }
+    }
+    st.sim_cycles = busFramePeriod(bus) * frames;
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            printf("usage: scan_sim [--frames=N] [--dwell-us=6] [--sample-us=5] [--gap-us=0]\n"
+                   "                [--frame-len=104] [--loop-cycles=60] [--jitter=8]\n"
+                   "                [--yield-every=10000] [--yield-us=1000] [--keys=2]\n"
+                   "                [--hold-frames=4] [--seed=1] [--policy=blind|frame]\n"
+                   "                [--yield-min-us=100] [--yield-max-us=400] [--wake-us=40]\n"
+                   "                [--margin-us=60] [--skew-ns=0] [--settle-ns=0]\n"
+                   "                [--predict] [--predict-cycles=12] [--analytics]\n"
+                   "                [--drain-us=1000] [--trace=FILE] [--trace-kb=32]\n"
+                   "                [--edge] [--irq-us=2] [--irq-jitter-us=1]\n"
+                   "                [--reports-us=0] [--apply-us=4] [--direct] [--latch=2]\n"
+                   "                [--rollover=0]\n");
+            return 0;
+        }
+    }
+
+    uint32_t frames      = (uint32_t)simArgNum(argc, argv, "frames", 2000);
+    double dwell_us      = simArgNum(argc, argv, "dwell-us", 6.0);
+    double sample_us     = simArgNum(argc, argv, "sample-us", 5.0);
+    double gap_us        = simArgNum(argc, argv, "gap-us", 0.0);
+    uint16_t frame_len   = (uint16_t)simArgNum(argc, argv, "frame-len", 104);
+    int max_keys         = (int)simArgNum(argc, argv, "keys", 2);
+    uint32_t hold_frames = (uint32_t)simArgNum(argc, argv, "hold-frames", 4);
+    uint32_t seed        = (uint32_t)simArgNum(argc, argv, "seed", 1);
+    if (hold_frames == 0) hold_frames = 1;
+    if (sample_us > dwell_us) sample_us = dwell_us;
+
+    ResponderModel rm;
+    rm.loop_cycles  = (uint32_t)simArgNum(argc, argv, "loop-cycles", 60);
+    rm.jitter       = (uint32_t)simArgNum(argc, argv, "jitter", 8);
+    rm.yield_every  = (uint32_t)simArgNum(argc, argv, "yield-every", 10000);
+    rm.yield_cycles = (uint32_t)(simArgNum(argc, argv, "yield-us", 1000) * SIM_CPU_MHZ);
+    if (rm.loop_cycles == 0) rm.loop_cycles = 1;
+    rm.frame_policy = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--policy=frame") == 0) rm.frame_policy = true;
+    }
+    rm.policy.min_cycles    = (uint32_t)(simArgNum(argc, argv, "yield-min-us", 100) * SIM_CPU_MHZ);
+    rm.policy.max_cycles    = (uint32_t)(simArgNum(argc, argv, "yield-max-us", 400) * SIM_CPU_MHZ);
+    rm.policy.margin_cycles = (uint32_t)(simArgNum(argc, argv, "margin-us", 60) * SIM_CPU_MHZ);
+    rm.wake_cycles          = (uint32_t)(simArgNum(argc, argv, "wake-us", 40) * SIM_CPU_MHZ);
+    rm.settle_cycles        = scanSettleCycles((uint16_t)simArgNum(argc, argv, "settle-ns", 0));
+    rm.predict_cycles       = (uint32_t)simArgNum(argc, argv, "predict-cycles", 12);
+    rm.predict              = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--predict") == 0) rm.predict = true;
+    }
+    double skew_ns          = simArgNum(argc, argv, "skew-ns", 0);
+
+    BusModel bus;
+    busModelInit(bus, dwell_us, sample_us, gap_us, frame_len);
+    uint32_t skew_max = (uint32_t)(skew_ns * SIM_CPU_MHZ / 1000.0 + 0.5);
+    uint32_t skew_rng = seed ? seed : 1;
+    for (int i = 0; skew_max && i < SCAN_ADDR_BITS; i++) {
+        bus.skew_cycles[i] = simRand(skew_rng) % (skew_max + 1);
+    }
+
+    // Default J3 wiring (config.h setDefaultConfig)
+    static volatile uint32_t key_bits[SCAN_KEY_WORDS];
+    const uint8_t addr_pins[SCAN_ADDR_BITS] = {4, 5, 14, 15, 13, 16, 17};
+    static ScanCore core;
+    scanCoreInit(core, addr_pins, 18, key_bits);
+
+    printf("scan_sim: %u frames x %u addrs, dwell %.2fus, sample @%.2fus, gap %.2fus\n", frames,
+           bus.frame_len, dwell_us, sample_us, gap_us);
+
+    bool edge_mode = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--edge") == 0) edge_mode = true;
+    }
+    if (edge_mode) {
+        EdgeModel em;
+        em.irq_cycles = (uint32_t)(simArgNum(argc, argv, "irq-us", 2) * SIM_CPU_MHZ);
+        em.irq_jitter = (uint32_t)(simArgNum(argc, argv, "irq-jitter-us", 1) * SIM_CPU_MHZ);
+        printf("  responder: edge-triggered, entry %u cyc after the edge (+0..%u)\n", em.irq_cycles, em.irq_jitter);
+        if (skew_max) printf("  address lines: skew 0..%u cyc\n", skew_max);
+        static SimStats st;
+        static ScanEdge edge;
+        runEdgeSim(core, bus, em, frames, max_keys, hold_frames, seed, st, edge);
+        simStatsPrint(st);
+        uint64_t busy = edge.busy + (uint64_t)edge.entries * SCAN_EDGE_DISPATCH_CYCLES;
+        printf("  edge handler     %u entries (%u spurious, %u re-reads), %u changes, %u missed transitions\n",
+               edge.entries, edge.spurious, edge.rereads, edge.changes, edge.missed);
+        printf("  service (cycles) p50 %u  p99 %u  max %u (entry to Key Return)\n",
+               scanLog2Percentile(edge.lat_hist, edge.lat_max, 50),
+               scanLog2Percentile(edge.lat_hist, edge.lat_max, 99), edge.lat_max);
+        printf("  cpu              %.1f%% of the scan core\n", 100.0 * busy / (double)st.sim_cycles);
+        return 0;
+    }
+    printf("  responder: %u cyc/iter (+0..%u), yield %u cyc every %u iters%s\n", rm.loop_cycles, rm.jitter,
+           rm.yield_cycles, rm.yield_every, rm.frame_policy ? " (forced), gap yields on" : "");
+    if (skew_max || rm.settle_cycles) {
+        printf("  address lines: skew 0..%u cyc, settle window %u cyc\n", skew_max, rm.settle_cycles);
+    }
+
+    // --trace=FILE: capture the responder's view the way the firmware's
+    // trace mode does (decode it with scan_trace)
+    const char *trace_path = simArgStr(argc, argv, "trace");
+    uint32_t trace_bytes   = (uint32_t)simArgNum(argc, argv, "trace-kb", 32) * 1024;
+    static ScanTrace trace;
+    uint8_t *trace_buf = NULL;
+    if (trace_path) {
+        if (trace_bytes < SCAN_TRACE_BLOCK) trace_bytes = SCAN_TRACE_BLOCK;
+        trace_buf = (uint8_t *)calloc(1, trace_bytes);
+        scanTraceStart(trace, trace_buf, trace_bytes, 0);
+    }
+
+    uint64_t drain_cycles = (uint64_t)(simArgNum(argc, argv, "drain-us", 1000) * SIM_CPU_MHZ);
+    if (drain_cycles == 0) drain_cycles = 1;
+    ReportFeed feed;
+    feed.every_cycles = (uint64_t)(simArgNum(argc, argv, "reports-us", 0) * SIM_CPU_MHZ);
+    feed.apply_cycles = (uint64_t)(simArgNum(argc, argv, "apply-us", 4) * SIM_CPU_MHZ);
+    feed.direct       = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--direct") == 0) feed.direct = true;
+    }
+    feed.latch_frames = (uint8_t)simArgNum(argc, argv, "latch", 2);
+    feed.rollover     = (uint8_t)simArgNum(argc, argv, "rollover", 0);
+    if (feed.every_cycles && feed.apply_cycles >= feed.every_cycles) feed.apply_cycles = feed.every_cycles - 1;
+
+    static SimStats st;
+    static ScanRing ring;
+    static ScanSnoopStats snoop;
+    static ReportStats rs;
+    runSim(core, bus, rm, frames, max_keys, hold_frames, seed, st, ring, snoop, drain_cycles,
+           trace_path ? &trace : NULL, feed, rs);
+    simStatsPrint(st);
+    if (feed.every_cycles) {
+        printf("  reports          %u (%s), %u commits, %u deferred by an open edit\n", rs.reports,
+               feed.direct ? "direct writes" : "staged", rs.commits, rs.deferred);
+        if (!feed.rollover) printf("  torn frames      %u of %u\n", rs.torn, rs.frames);
+        printf("  keystrokes       %u: %u never read asserted, %u out of order, %u with the wrong Shift\n",
+               rs.keystrokes, rs.lost, rs.reordered, rs.wrong_shift);
+        printf("  shaping          peak %u keys in a frame, ", rs.peak);
+        if (feed.rollover && !feed.direct) {
+            printf("cap %u: %u waited (queue max %u, %u dropped, %u left)\n", feed.rollover, rs.queued, rs.queue_max,
+                   rs.dropped, rs.left);
+        } else {
+            printf("%u held on by the latch\n", rs.saved);
+        }
+    }
+
+    if (trace_path) {
+        ScanTraceFile hdr;
+        scanTraceFileHeader(trace, hdr);
+        FILE *f = fopen(trace_path, "wb");
+        if (!f) {
+            perror(trace_path);
+            return 1;
+        }
+        fwrite(&hdr, sizeof(hdr), 1, f);
+        for (uint32_t i = 0; i < hdr.blocks; i++) fwrite(scanTraceBlockOrdered(trace, i), SCAN_TRACE_BLOCK, 1, f);
+        fclose(f);
+        printf("  trace            %u runs, %u blocks (%u dropped) -> %s\n", trace.runs, hdr.blocks, hdr.dropped,
+               trace_path);
+        free(trace_buf);
+    }
+
+    // What /api/scan/frames would report for this run
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--analytics") != 0) continue;
+        const ScanFrameStats &fs = snoop.frames;
+        uint8_t last = fs.last_len ? fs.order[fs.cur ^ 1][(fs.last_len < SCAN_ADDR_COUNT ? fs.last_len : SCAN_ADDR_COUNT) - 1] : 0;
+        printf("  analytics        %u frames, period %.2fus (%u-%u cyc)\n", fs.frames,
+               fs.frames ? (double)fs.period_sum / fs.frames / SIM_CPU_MHZ : 0.0, fs.frames ? fs.period_min : 0,
+               fs.period_max);
+        printf("    ring           %u changes, %u dropped, %u gaps, max depth %u/%u\n", snoop.changes,
+               ring.dropped, snoop.gaps, snoop.ring_max, SCAN_RING_SIZE);
+        printf("    jitter         p50 %u  p99 %u  p99.9 %u  max %u cyc (%u samples)\n",
+               scanFrameStatsJitter(fs, 50), scanFrameStatsJitter(fs, 99), scanFrameStatsJitter(fs, 99.9),
+               fs.jitter_max, fs.jitter_n);
+        printf("    order          sig 0x%08X len %u, %u repeats, %u changes\n", fs.last_sig, fs.last_len,
+               fs.sig_repeats, fs.sig_changes);
+        printf("    dwell 0x00     %u/%llu/%u cyc; end 0x%02X %u/%llu/%u cyc\n", fs.dwell_min[0],
+               fs.dwell_n[0] ? (unsigned long long)(fs.dwell_sum[0] / fs.dwell_n[0]) : 0ULL, fs.dwell_max[0], last,
+               fs.dwell_min[last], fs.dwell_n[last] ? (unsigned long long)(fs.dwell_sum[last] / fs.dwell_n[last]) : 0ULL,
+               fs.dwell_max[last]);
+    }
+    return 0;
+}
@@ -0,0 +1,209 @@
+/*
+ * scan_trace.cpp — Decoder for KeyBridge scan-bus trace captures
+ *
+ * Reads the run-length encoded trace served by GET /api/scan/trace (or
+ * written by scan_sim --trace) and prints a summary, a CSV of runs, or
+ * a replay of the runs through the firmware's scan core: frame tracker,
+ * frame analytics, scan-order predictor and gap-yield policy.
+ *
+ *   scan_trace FILE              summary
+ *   scan_trace FILE --csv        one row per run
+ *   scan_trace FILE --replay     what the scan engine would make of it
+ */
+
+#include "bus_model.h"
+
+// Gap-yield policy the firmware runs with (keybridge.cpp SCAN_YIELD_*)
+#define REPLAY_YIELD_MIN_US   100
+#define REPLAY_YIELD_MAX_US   400
+#define REPLAY_WAKE_MARGIN_US 60
+
+struct TraceFile {
+    ScanTraceFile hdr;
+    uint8_t *blocks;
+};
+
+static bool loadTrace(const char *path, TraceFile &tf) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    bool ok = fread(&tf.hdr, sizeof(tf.hdr), 1, f) == 1 && tf.hdr.magic == SCAN_TRACE_MAGIC;
+    if (!ok) {
+        fprintf(stderr, "%s: not a KeyBridge trace\n", path);
+    } else if (tf.hdr.version != SCAN_TRACE_VERSION || tf.hdr.block_size != SCAN_TRACE_BLOCK ||
+               tf.hdr.shift != SCAN_TRACE_SHIFT) {
+        fprintf(stderr, "%s: unsupported trace v%u (block %u, shift %u)\n", path, tf.hdr.version,
+                tf.hdr.block_size, tf.hdr.shift);
+        ok = false;
+    } else {
+        tf.blocks = (uint8_t *)malloc((size_t)tf.hdr.blocks * SCAN_TRACE_BLOCK + 1);
+        ok        = fread(tf.blocks, SCAN_TRACE_BLOCK, tf.hdr.blocks, f) == tf.hdr.blocks;
+        if (!ok) fprintf(stderr, "%s: truncated\n", path);
+    }
+    fclose(f);
+    return ok;
+}
+
+// Every run in file order: fn(start_cycle, header, run_cycles)
+template <typename Fn> static bool forEachRun(const TraceFile &tf, Fn fn) {
+    for (uint32_t i = 0; i < tf.hdr.blocks; i++) {
+        if (!scanTraceDecodeBlock(tf.blocks + (size_t)i * SCAN_TRACE_BLOCK, fn)) {
+            fprintf(stderr, "block %u: malformed\n", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+static double cyclesToUs(uint64_t c) {
+    return (double)c / SCAN_CPU_MHZ;
+}
+
+static int printCsv(const TraceFile &tf) {
+    printf("start_cycles,start_us,addr,key_return,cycles,us\n");
+    bool first     = true;
+    uint32_t base  = 0;
+    bool ok        = forEachRun(tf, [&](uint32_t ts, uint8_t key, uint32_t cycles) {
+        if (first) base = ts;
+        first           = false;
+        uint32_t rel    = ts - base;
+        if (key == SCAN_TRACE_BLIND) {
+            printf("%u,%.3f,blind,,%u,%.3f\n", rel, cyclesToUs(rel), cycles, cyclesToUs(cycles));
+        } else {
+            printf("%u,%.3f,%u,%u,%u,%.3f\n", rel, cyclesToUs(rel), key & 0x7F, key >> 7, cycles,
+                   cyclesToUs(cycles));
+        }
+    });
+    return ok ? 0 : 1;
+}
+
+static int printSummary(const TraceFile &tf) {
+    uint64_t runs = 0, blind_runs = 0, span = 0, blind = 0, wraps = 0;
+    uint64_t addr_runs[SCAN_ADDR_COUNT] = {0}, addr_cycles[SCAN_ADDR_COUNT] = {0}, kr_cycles[SCAN_ADDR_COUNT] = {0};
+    uint8_t last = 0xFF;
+    bool ok      = forEachRun(tf, [&](uint32_t, uint8_t key, uint32_t cycles) {
+        span += cycles;
+        if (key == SCAN_TRACE_BLIND) {
+            blind_runs++;
+            blind += cycles;
+            last = 0xFF;
+            return;
+        }
+        uint8_t addr = key & 0x7F;
+        runs++;
+        addr_runs[addr]++;
+        addr_cycles[addr] += cycles;
+        if (key & 0x80) kr_cycles[addr] += cycles;
+        if (last != 0xFF && addr < last) wraps++;
+        last = addr;
+    });
+
+    printf("trace: %u blocks of %u bytes (%u older blocks dropped)\n", tf.hdr.blocks, tf.hdr.block_size,
+           tf.hdr.dropped);
+    printf("  runs             %llu (%.2f bytes/run)\n", (unsigned long long)runs,
+           runs ? (double)tf.hdr.blocks * SCAN_TRACE_BLOCK / (double)(runs + blind_runs) : 0.0);
+    printf("  span             %.3f ms, %.3f ms blind in %llu sleeps\n", cyclesToUs(span) / 1000,
+           cyclesToUs(blind) / 1000, (unsigned long long)blind_runs);
+    printf("  address wraps    %llu\n", (unsigned long long)wraps);
+    printf("  Addr  Runs    Avg dwell us  Key Return us\n");
+    for (int a = 0; a < SCAN_ADDR_COUNT; a++) {
+        if (!addr_runs[a]) continue;
+        printf("  0x%02X  %-7llu %-13.3f %.3f\n", a, (unsigned long long)addr_runs[a],
+               cyclesToUs(addr_cycles[a]) / addr_runs[a], cyclesToUs(kr_cycles[a]));
+    }
+    return ok ? 0 : 1;
+}
+
+// Feed the runs to the same frame tracker, analytics and predictor the
+// firmware runs on address changes
+static int replay(const TraceFile &tf) {
+    static volatile uint32_t key_bits[SCAN_KEY_WORDS];
+    static ScanCore core;
+    scanCoreInit(core, SCAN_J3_PINS, 0xFF, key_bits);
+
+    ScanFrameTracker ft;
+    static ScanFrameStats fs;
+    static ScanPredict pred;
+    scanFrameReset(ft);
+    scanFrameStatsReset(fs);
+    scanPredictInit(pred);
+    const ScanYieldPolicy policy = {REPLAY_YIELD_MIN_US * SCAN_CPU_MHZ, REPLAY_YIELD_MAX_US * SCAN_CPU_MHZ,
+                                    REPLAY_WAKE_MARGIN_US * SCAN_CPU_MHZ};
+
+    // A blind run is a sleep. The trace doesn't say which kind, so every
+    // wake is judged like a gap-yield wake (scanFrameWoke): still on the
+    // address it slept on means nothing was missed.
+    uint64_t windows = 0, window_cycles = 0;
+    uint8_t addr_now = 0xFF; // Address of the previous run (runs also split on Key Return)
+    bool woke        = false;
+    bool ok          = forEachRun(tf, [&](uint32_t ts, uint8_t key, uint32_t) {
+        if (key == SCAN_TRACE_BLIND) {
+            woke = true;
+            return;
+        }
+        uint8_t addr = key & 0x7F;
+        bool resync  = woke;
+        if (woke) {
+            woke = false;
+            scanFrameWoke(ft, addr);
+            if (ft.dirty) scanFrameStatsSlept(fs);
+        }
+        if (addr == addr_now) {
+            if (resync) scanPredictResync(pred, core, addr);
+            return;
+        }
+        resync   = resync || addr_now == 0xFF;
+        addr_now = addr;
+        if (key & 0x80) scanKeySet(key_bits, addr);
+        bool wrap = scanFrameChange(ft, addr, ts);
+        scanFrameStatsChange(fs, addr, ts, wrap);
+        if (resync) {
+            scanPredictResync(pred, core, addr);
+        } else {
+            scanPredictAdvance(pred, core, addr, scanKeyTest(key_bits, addr));
+        }
+        uint32_t w = scanYieldWindow(ft, addr, policy);
+        if (w) {
+            windows++;
+            window_cycles += w;
+        }
+    });
+
+    printf("replay:\n");
+    printf("  frames           %u seen, %u missed, %u scored\n", ft.frames, ft.frames_missed, fs.frames);
+    if (fs.frames) {
+        printf("  period           %.2f us (%u-%u cyc)\n", (double)fs.period_sum / fs.frames / SCAN_CPU_MHZ,
+               fs.period_min, fs.period_max);
+    }
+    printf("  jitter           p50 %u  p90 %u  p99 %u  max %u cyc (%u samples)\n", scanFrameStatsJitter(fs, 50),
+           scanFrameStatsJitter(fs, 90), scanFrameStatsJitter(fs, 99), fs.jitter_max, fs.jitter_n);
+    printf("  order            sig 0x%08X len %u, %u repeats, %u changes\n", fs.last_sig, fs.last_len,
+           fs.sig_repeats, fs.sig_changes);
+    uint32_t scored = pred.hits + pred.misses;
+    printf("  prediction       %u hit, %u miss (%.2f%%), %u learning\n", pred.hits, pred.misses,
+           scored ? 100.0 * pred.hits / scored : 0.0, pred.cold);
+    printf("  gap yields       %llu windows, avg %.1f us\n", (unsigned long long)windows,
+           windows ? cyclesToUs(window_cycles) / windows : 0.0);
+    printf("  keys asserted   ");
+    for (int a = 0; a < SCAN_ADDR_COUNT; a++) {
+        if (scanKeyTest(key_bits, a)) printf(" 0x%02X", a);
+    }
+    printf("\n");
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argv[1][0] == '-') {
+        printf("usage: scan_trace FILE [--csv | --replay]\n");
+        return argc < 2 ? 1 : 0;
+    }
+    static TraceFile tf;
+    if (!loadTrace(argv[1], tf)) return 1;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0) return printCsv(tf);
+        if (strcmp(argv[i], "--replay") == 0) return replay(tf);
+    }
+    return printSummary(tf);
+}
@@ -0,0 +1,620 @@
+/*
+ * wyse_cosim.cpp — Scan core against an emulated 8031 scan routine (host only)
+ *
+ * Runs a keyboard scan routine modelled on the Wyse 50's on the MCS-51
+ * emulator in mcs51.h, wired to scan_core.h through a virtual J3:
+ * P1.0-P1.6 drive A0-A6, and P3.2 reads Key Return, active low as the
+ * 2N7000 pulls it. The routine puts each address out, samples Key Return
+ * two machine cycles later, and only believes a key that reads the same
+ * on two sweeps in a row (debounce). Each press or release it decodes
+ * goes out of SBUF, standing in for the terminal's key buffer, and that
+ * is what this tool scores: taps the terminal never decoded, keys it
+ * decoded that nobody pressed, and press-to-decode latency in 8031
+ * machine cycles.
+ *
+ * The ESP32 side is the firmware's polling loop: decode, settle filter,
+ * frame-boundary commits from the staged key image (press latch,
+ * rollover shaper), Key Return write, and parking at a frame boundary
+ * with nothing held until a press wakes it. Taps reach the staged image
+ * the way HID reports do.
+ *
+ *   wyse_cosim [--seconds=5] [--xtal-mhz=11.0592] [--gap-us=5000]
+ *              [--tap-ms=100] [--hold-ms=40] [--latch=2] [--rollover=0]
+ *              [--loop-cycles=60] [--jitter=8] [--yield-every=0]
+ *              [--yield-us=1000] [--skew-ns=0] [--settle-ns=0] [--seed=1]
+ *              [--events] [--text[=STRING]] [--hold-frames=3]
+ *              [--gap-frames=3] [--poll-us=1000] [--text-park]
+ *
+ * --gap-us    the routine's idle time between sweeps (the terminal's
+ *             other work); the sweep itself is whatever the code costs
+ * --tap-ms    one tap of a random key every N ms, held --hold-ms
+ * --events    print every key event the terminal decodes
+ * --text      type a string through text_inject.h instead of tapping,
+ *             stepped every --poll-us as the firmware's loop task does,
+ *             through a keymap giving each usage its own address; the
+ *             terminal must decode exactly those keys in order, each
+ *             with Shift and Ctrl as they stand after the sweep that
+ *             decodes it. Reports characters/second.
+ * --text-park let the responder park between keys as if nothing were
+ *             typing: frames stop, and typing stalls after one key
+ *
+ * Exit status is non-zero if a tap was missed or a key was decoded that
+ * was never pressed (or, with --text, the keys decoded differ).
+ */
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "bus_model.h"
+#include "mcs51.h"
+#include "text_inject.h"
+
+// ============================================================
+// THE TERMINAL'S SCAN ROUTINE
+// ============================================================
+
+// Just enough assembler for a hand-written routine: raw bytes plus
+// relative branches resolved against labels
+struct Rom {
+    std::vector<uint8_t> b;
+    std::map<std::string, size_t> labels;
+    std::vector<std::pair<size_t, std::string>> fixups; // rel byte → target
+
+    void op(std::initializer_list<uint8_t> bytes) { b.insert(b.end(), bytes); }
+    void label(const char *name) { labels[name] = b.size(); }
+    void rel(const char *name) { // Always an instruction's last byte
+        fixups.push_back({b.size(), name});
+        b.push_back(0);
+    }
+    bool resolve() {
+        for (auto &f : fixups) {
+            long off = (long)labels.at(f.second) - (long)(f.first + 1);
+            if (off < -128 || off > 127) return false;
+            b[f.first] = (uint8_t)(int8_t)off;
+        }
+        return true;
+    }
+};
+
+// Internal RAM: raw sweep 30h-3Fh, previous sweep 40h-4Fh, debounced
+// key state 50h-5Fh (bit n of byte k = address 8k+n)
+static bool buildScanRom(Rom &r, uint8_t gap_loops) {
+    r.op({0x75, 0x81, 0x6F}); //         MOV  SP,#6Fh
+    r.label("SCAN");
+    r.op({0x78, 0x00});       //         MOV  R0,#0       ; address
+    r.op({0x79, 0x30});       //         MOV  R1,#30h     ; raw sweep
+    r.label("BYTE");
+    r.op({0x7A, 0x08});       //         MOV  R2,#8
+    r.label("BIT");
+    r.op({0xE8});             //         MOV  A,R0
+    r.op({0xF5, 0x90});       //         MOV  P1,A        ; address out
+    r.op({0x00});             //         NOP              ; keyboard decodes it
+    r.op({0x00});             //         NOP
+    r.op({0xA2, 0xB2});       //         MOV  C,P3.2      ; Key Return
+    r.op({0xB3});             //         CPL  C           ; active low
+    r.op({0xEB});             //         MOV  A,R3
+    r.op({0x13});             //         RRC  A
+    r.op({0xFB});             //         MOV  R3,A
+    r.op({0x08});             //         INC  R0
+    r.op({0xDA}); r.rel("BIT"); //       DJNZ R2,BIT
+    r.op({0xEB});             //         MOV  A,R3
+    r.op({0xF7});             //         MOV  @R1,A
+    r.op({0x09});             //         INC  R1
+    r.op({0xB8, 0x80}); r.rel("BYTE"); // CJNE R0,#80h,BYTE
+
+    // Debounce: a bit that reads the same on two sweeps becomes the
+    // key's state; every state change is one key event
+    r.op({0x78, 0x30});       //         MOV  R0,#30h
+    r.op({0x79, 0x40});       //         MOV  R1,#40h
+    r.op({0x7C, 0x00});       //         MOV  R4,#0       ; first address of the byte
+    r.label("PROC");
+    r.op({0xE6});             //         MOV  A,@R0
+    r.op({0xFD});             //         MOV  R5,A        ; raw
+    r.op({0x67});             //         XRL  A,@R1
+    r.op({0xF4});             //         CPL  A
+    r.op({0xFE});             //         MOV  R6,A        ; stable = ~(raw ^ prev)
+    r.op({0xED});             //         MOV  A,R5
+    r.op({0xF7});             //         MOV  @R1,A       ; prev = raw
+    r.op({0xE9});             //         MOV  A,R1
+    r.op({0x24, 0x10});       //         ADD  A,#10h
+    r.op({0xF9});             //         MOV  R1,A        ; → state
+    r.op({0xE7});             //         MOV  A,@R1
+    r.op({0xFF});             //         MOV  R7,A        ; old state
+    r.op({0xED});             //         MOV  A,R5
+    r.op({0x5E});             //         ANL  A,R6
+    r.op({0xFD});             //         MOV  R5,A
+    r.op({0xEE});             //         MOV  A,R6
+    r.op({0xF4});             //         CPL  A
+    r.op({0x5F});             //         ANL  A,R7
+    r.op({0x4D});             //         ORL  A,R5        ; stable ? raw : old
+    r.op({0xF7});             //         MOV  @R1,A
+    r.op({0x6F});             //         XRL  A,R7        ; changed bits
+    r.op({0x60}); r.rel("NEXT"); //      JZ   NEXT
+    r.op({0xFD});             //         MOV  R5,A
+    r.op({0xE7});             //         MOV  A,@R1
+    r.op({0xFE});             //         MOV  R6,A
+    r.op({0xEC});             //         MOV  A,R4
+    r.op({0xFB});             //         MOV  R3,A
+    r.op({0x7A, 0x08});       //         MOV  R2,#8
+    r.label("EBIT");
+    r.op({0xED});             //         MOV  A,R5
+    r.op({0x30, 0xE0}); r.rel("ESKIP"); // JNB ACC.0,ESKIP
+    r.op({0xEE});             //         MOV  A,R6
+    r.op({0x54, 0x01});       //         ANL  A,#1
+    r.op({0x03});             //         RR   A           ; 80h = press
+    r.op({0x4B});             //         ORL  A,R3
+    r.op({0xF5, 0x99});       //         MOV  SBUF,A      ; key event
+    r.label("ESKIP");
+    r.op({0xED});             //         MOV  A,R5
+    r.op({0x03});             //         RR   A
+    r.op({0xFD});             //         MOV  R5,A
+    r.op({0xEE});             //         MOV  A,R6
+    r.op({0x03});             //         RR   A
+    r.op({0xFE});             //         MOV  R6,A
+    r.op({0x0B});             //         INC  R3
+    r.op({0xDA}); r.rel("EBIT"); //      DJNZ R2,EBIT
+    r.label("NEXT");
+    r.op({0xE9});             //         MOV  A,R1
+    r.op({0x24, 0xF1});       //         ADD  A,#0F1h     ; back to prev, next byte
+    r.op({0xF9});             //         MOV  R1,A
+    r.op({0x08});             //         INC  R0
+    r.op({0xEC});             //         MOV  A,R4
+    r.op({0x24, 0x08});       //         ADD  A,#8
+    r.op({0xFC});             //         MOV  R4,A
+    r.op({0xB8, 0x40}); r.rel("PROC"); // CJNE R0,#40h,PROC
+
+    // The rest of the terminal's work: 515 machine cycles a loop
+    r.op({0x7A, gap_loops});  //         MOV  R2,#gap
+    r.label("GAP");
+    r.op({0x7B, 0x00});       //         MOV  R3,#0
+    r.label("GAPI");
+    r.op({0xDB}); r.rel("GAPI"); //      DJNZ R3,GAPI
+    r.op({0xDA}); r.rel("GAP"); //       DJNZ R2,GAP
+    r.op({0x02, 0x00, (uint8_t)r.labels["SCAN"]}); // LJMP SCAN
+    return r.resolve();
+}
+
+#define COSIM_KR_BIT 0x04 // P3.2
+
+// --text keymap: every usage text_inject.h types presses the address of
+// the same number, Shift and Ctrl sit where no usage reaches (and below
+// 0x7E/0x7F, which the bus trace reserves)
+#define COSIM_TEXT_SHIFT 0x7D
+#define COSIM_TEXT_CTRL  0x7C
+
+// Repeats, shifted runs, a Ctrl key and CR LF
+static const char COSIM_TEXT[] = "Hello, World!\r\nls -la ~/src | grep '\"x\"' && echo $((6*7))\r\n"
+                                 "AAaa  ``~~\x03\tOK\r\n";
+
+// ============================================================
+// CO-SIMULATION
+// ============================================================
+
+struct Tap {
+    uint8_t addr;
+    uint64_t press_t, release_t; // ESP32 cycles
+    uint64_t decoded_mc;         // Press event from the terminal (0 = none yet)
+    bool released;               // ...and its release event
+};
+
+struct KeyEvent {
+    uint64_t t; // ESP32 cycles
+    uint8_t addr;
+    bool press;
+};
+
+struct Cosim {
+    double esp_per_mc; // ESP32 cycles per 8031 machine cycle
+    uint32_t skew_cycles[SCAN_ADDR_BITS];
+
+    // Address bus: P1 as it was before and after its last write
+    uint8_t bus_prev, bus_cur;
+    uint64_t bus_t;
+
+    // Key Return as driven by the responder, (time, level) in order
+    std::vector<std::pair<uint64_t, bool>> kr;
+
+    // Terminal side
+    std::vector<std::pair<uint64_t, uint8_t>> decoded; // (machine cycle, SBUF byte)
+    uint64_t last_out_mc, sample_mc_sum, samples;
+    uint64_t frame_mc, frames, frame_mc_sum;
+    std::vector<uint64_t> frame_starts; // Machine cycle of each sweep's first address
+
+    uint64_t esp(uint64_t mc) const { return (uint64_t)(mc * esp_per_mc); }
+};
+
+static uint8_t cosimPinIn(void *ctx, uint8_t port, uint64_t t) {
+    Cosim &c = *(Cosim *)ctx;
+    if (port != 3) return 0xFF;
+    uint64_t at = c.esp(t);
+    bool level  = false;
+    for (auto it = c.kr.rbegin(); it != c.kr.rend(); ++it) {
+        if (it->first <= at) {
+            level = it->second;
+            break;
+        }
+    }
+    c.sample_mc_sum += t - c.last_out_mc;
+    c.samples++;
+    return level ? (uint8_t)~COSIM_KR_BIT : 0xFF;
+}
+
+static void cosimIoOut(void *ctx, uint8_t sfr, uint8_t v, uint64_t t) {
+    Cosim &c = *(Cosim *)ctx;
+    if (sfr == MCS_SBUF) {
+        c.decoded.push_back({t, v});
+    } else if (sfr == MCS_P1) {
+        uint8_t addr = v & 0x7F;
+        if (addr == 0 && c.bus_cur != 0) {
+            if (c.frames++) c.frame_mc_sum += t - c.frame_mc;
+            c.frame_mc = t;
+            c.frame_starts.push_back(t);
+        }
+        c.bus_prev    = c.bus_cur;
+        c.bus_cur     = addr;
+        c.bus_t       = c.esp(t);
+        c.last_out_mc = t;
+    }
+}
+
+// GPIO_IN_REG image: line i shows the new address skew_cycles[i] after the write
+static uint32_t cosimGpio(const Cosim &c, const ScanCore &core, uint64_t t) {
+    uint32_t gpio_in = 0;
+    for (int i = 0; i < SCAN_ADDR_BITS; i++) {
+        uint8_t a = t >= c.bus_t + c.skew_cycles[i] ? c.bus_cur : c.bus_prev;
+        if (a & (1 << i)) gpio_in |= core.addr_masks[i];
+    }
+    return gpio_in;
+}
+
+static double pctOf(std::vector<uint64_t> &v, double pct) {
+    if (v.empty()) return 0;
+    size_t i = (size_t)(v.size() * pct / 100.0);
+    return (double)v[std::min(i, v.size() - 1)];
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0) {
+            printf("usage: wyse_cosim [--seconds=5] [--xtal-mhz=11.0592] [--gap-us=5000]\n"
+                   "                  [--tap-ms=100] [--hold-ms=40] [--latch=2] [--rollover=0]\n"
+                   "                  [--loop-cycles=60] [--jitter=8] [--yield-every=0]\n"
+                   "                  [--yield-us=1000] [--skew-ns=0] [--settle-ns=0] [--seed=1]\n"
+                   "                  [--events] [--text[=STRING]] [--hold-frames=3]\n"
+                   "                  [--gap-frames=3] [--poll-us=1000] [--text-park]\n");
+            return 0;
+        }
+    }
+    const char *text = simArgStr(argc, argv, "text");
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--text") == 0) text = COSIM_TEXT;
+    }
+    double seconds       = simArgNum(argc, argv, "seconds", text ? 60 : 5);
+    double xtal_mhz      = simArgNum(argc, argv, "xtal-mhz", 11.0592);
+    double gap_us        = simArgNum(argc, argv, "gap-us", 5000);
+    double tap_ms        = simArgNum(argc, argv, "tap-ms", 100);
+    double hold_ms       = simArgNum(argc, argv, "hold-ms", 40);
+    uint8_t latch        = (uint8_t)simArgNum(argc, argv, "latch", 2);
+    uint8_t rollover     = (uint8_t)simArgNum(argc, argv, "rollover", 0);
+    uint32_t loop_cycles = (uint32_t)simArgNum(argc, argv, "loop-cycles", 60);
+    uint32_t jitter      = (uint32_t)simArgNum(argc, argv, "jitter", 8);
+    uint32_t yield_every = (uint32_t)simArgNum(argc, argv, "yield-every", 0);
+    uint64_t yield_cyc   = (uint64_t)(simArgNum(argc, argv, "yield-us", 1000) * SIM_CPU_MHZ);
+    double skew_ns       = simArgNum(argc, argv, "skew-ns", 0);
+    uint16_t settle_ns   = (uint16_t)simArgNum(argc, argv, "settle-ns", 0);
+    uint32_t rng         = (uint32_t)simArgNum(argc, argv, "seed", 1) | 1;
+    uint8_t hold_frames  = (uint8_t)simArgNum(argc, argv, "hold-frames", TEXT_HOLD_FRAMES);
+    uint8_t gap_frames   = (uint8_t)simArgNum(argc, argv, "gap-frames", TEXT_GAP_FRAMES);
+    uint64_t poll_cyc    = (uint64_t)(simArgNum(argc, argv, "poll-us", 1000) * SIM_CPU_MHZ);
+    bool show_events     = false;
+    bool text_park       = false;
+    for (int i = 1; i < argc; i++) {
+        show_events |= strcmp(argv[i], "--events") == 0;
+        text_park |= strcmp(argv[i], "--text-park") == 0;
+    }
+    if (xtal_mhz <= 0 || tap_ms <= 0 || hold_ms <= 0 || seconds <= 0 || loop_cycles == 0 || poll_cyc == 0) {
+        fprintf(stderr, "bad arguments\n");
+        return 1;
+    }
+
+    // The terminal
+    double mc_us      = 12.0 / xtal_mhz;
+    int gap_loops     = (int)(gap_us / mc_us / 515 + 0.5);
+    gap_loops         = std::max(1, std::min(255, gap_loops));
+    static Rom rom;
+    if (!buildScanRom(rom, (uint8_t)gap_loops)) {
+        fprintf(stderr, "scan routine: branch out of range\n");
+        return 1;
+    }
+    static Mcs51 cpu;
+    mcsLoad(cpu, rom.b.data(), rom.b.size());
+    mcsReset(cpu);
+
+    Cosim c        = {};
+    c.esp_per_mc   = SIM_CPU_MHZ * mc_us;
+    c.bus_prev     = 0x7F;
+    c.bus_cur      = 0x7F; // Port reset: all ones
+    for (int i = 0; i < SCAN_ADDR_BITS; i++) c.skew_cycles[i] = (uint32_t)(skew_ns * SIM_CPU_MHZ / 1000 * i / 6);
+    c.kr.push_back({0, false});
+    cpu.ctx    = &c;
+    cpu.pin_in = cosimPinIn;
+    cpu.io_out = cosimIoOut;
+
+    // The adapter
+    static volatile uint32_t key_bits[SCAN_KEY_WORDS];
+    ScanCore core;
+    scanCoreInit(core, SCAN_J3_PINS, 18, key_bits);
+    static ScanKeyStage stage;
+    scanKeyStageInit(stage, latch, rollover);
+    ScanFrameTracker ft;
+    scanFrameReset(ft);
+    ScanSettle settle;
+    scanSettleInit(settle, scanSettleCycles(settle_ns));
+
+    // Text: the keys it should come out as, addr | TEXT_MOD_* << 8
+    static KeyMap text_map;
+    static KeyMapState text_state;
+    TextInject job = {};
+    std::vector<uint16_t> want;
+    if (text) {
+        std::vector<KeyRule> rules;
+        for (int u = 0x04; u < COSIM_TEXT_CTRL; u++) rules.push_back(KEY_RULE((uint8_t)u, (uint8_t)u, 0));
+        rules.push_back(KEY_RULE(0xE0, COSIM_TEXT_CTRL, 0));
+        rules.push_back(KEY_RULE(0xE1, COSIM_TEXT_SHIFT, 0));
+        keyMapCompile(text_map, rules.data(), rules.size(), COSIM_TEXT_SHIFT, COSIM_TEXT_CTRL);
+        keyMapStateReset(text_state);
+        textInjectStart(job, text, strlen(text), hold_frames, gap_frames);
+        for (TextInject scan = job; scan.pos < scan.len;) {
+            uint16_t key = textNextKey(scan);
+            if (key) want.push_back(key);
+        }
+    }
+
+    // Taps, none starting in the last 200ms so every one can finish
+    uint64_t end_t = (uint64_t)(seconds * 1e6 * SIM_CPU_MHZ);
+    std::vector<Tap> taps;
+    for (uint64_t t = (uint64_t)(tap_ms * 1000 * SIM_CPU_MHZ); !text && t + 200000ULL * SIM_CPU_MHZ < end_t;
+         t += (uint64_t)(tap_ms * 1000 * SIM_CPU_MHZ)) {
+        uint8_t addr;
+        bool busy;
+        do { // Not a key still held from an earlier tap
+            addr = (uint8_t)(simRand(rng) % SCAN_ADDR_COUNT);
+            busy = false;
+            for (const Tap &p : taps) busy |= p.addr == addr && p.release_t + 50000ULL * SIM_CPU_MHZ > t;
+        } while (busy);
+        taps.push_back({addr, t, t + (uint64_t)(hold_ms * 1000 * SIM_CPU_MHZ), 0, false});
+    }
+    std::vector<KeyEvent> feed;
+    for (const Tap &p : taps) {
+        feed.push_back({p.press_t, p.addr, true});
+        feed.push_back({p.release_t, p.addr, false});
+    }
+    std::sort(feed.begin(), feed.end(), [](const KeyEvent &x, const KeyEvent &y) { return x.t < y.t; });
+
+    uint64_t t       = 0; // Responder's next iteration
+    size_t next_feed = 0;
+    uint8_t last     = 0xFF;
+    uint32_t iter    = 0;
+    uint64_t forced  = 0;
+    bool level       = false;
+    bool parked = false, notified = false; // Idle parking, and a press to wake it
+    uint64_t parks = 0;
+    uint64_t next_poll = poll_cyc, text_t0 = 0, text_done_t = 0; // Text: first press, last gap over
+    uint32_t text_f0 = 0, text_frames = 0;
+    uint32_t text_seen_frames = 0;
+    uint64_t text_seen_t      = 0; // Stall watch, as textPoll() keeps it
+    bool text_stalled         = false;
+    while (!cpu.fault && c.esp(cpu.cycles) < end_t &&
+           !(text_done_t && c.esp(cpu.cycles) > text_done_t + 100000ULL * SIM_CPU_MHZ)) {
+        uint64_t until = c.esp(cpu.cycles + MCS_CYCLES[cpu.code[cpu.pc]]);
+        while (t < until) {
+            if (text && !text_done_t && t >= next_poll) { // The loop task's turn
+                next_poll = t + poll_cyc;
+                if (ft.frames != text_seen_frames) {
+                    text_seen_frames = ft.frames;
+                    text_seen_t      = t;
+                } else if (t - text_seen_t > (uint64_t)TEXT_STALL_MS * 1000 * SIM_CPU_MHZ) {
+                    text_stalled = true;
+                }
+                uint32_t down[HID_KEY_WORDS];
+                if (text_stalled) {
+                    text_done_t = t;
+                } else if (textInjectStep(job, text_map, ft.frames, down)) {
+                    if (!text_t0) {
+                        text_t0 = t;
+                        text_f0 = ft.frames;
+                    }
+                    scanKeyEditBegin(stage);
+                    keyMapDiff(text_state, down, text_map, [&notified](uint8_t addr, bool press) {
+                        if (press) {
+                            scanKeyStagePress(stage, 0, addr);
+                            notified = true; // scanKeyPress() notifies the scan task
+                        } else {
+                            scanKeyStageRelease(stage, 0, addr);
+                        }
+                    });
+                    scanKeyEditEnd(stage);
+                }
+                if (job.phase == TEXT_DONE && !text_done_t) {
+                    text_done_t = t;
+                    text_frames = ft.frames - text_f0;
+                }
+            }
+            for (; next_feed < feed.size() && feed[next_feed].t <= t; next_feed++) {
+                const KeyEvent &e = feed[next_feed];
+                scanKeyEditBegin(stage);
+                if (e.press) {
+                    scanKeyStagePress(stage, 0, e.addr);
+                    notified = true;
+                } else {
+                    scanKeyStageRelease(stage, 0, e.addr);
+                }
+                scanKeyEditEnd(stage);
+            }
+            if (parked) { // Blocked in scanPark(), Key Return low, until a press
+                if (!notified) {
+                    t += loop_cycles;
+                    continue;
+                }
+                parked = false;
+                last   = 0xFF;
+            }
+            notified     = false;
+            uint8_t addr = scanDecodeAddr(core, cosimGpio(c, core, t));
+            if (settle.window) addr = scanSettleStep(settle, addr, (uint32_t)t);
+            bool changed = addr != last;
+            bool wrap    = changed && scanFrameChange(ft, addr, (uint32_t)t);
+            if (wrap) scanKeyCommit(stage, key_bits);
+            // The scan loop's park rule: a frame boundary with nothing held
+            // or staged, and no text typing (its gaps are counted in frames)
+            bool typing = text && !text_done_t && !text_park;
+            if (wrap && !typing && scanKeysIdle(key_bits) && !scanKeyPending(stage)) {
+                parked = true;
+                parks++;
+                scanFrameSlept(ft);
+                if (level) {
+                    level = false;
+                    c.kr.push_back({t, false});
+                }
+                t += loop_cycles;
+                continue;
+            }
+            bool pressed = scanKeyTest(key_bits, addr) != 0;
+            if (changed && pressed) scanKeySeen(stage, addr);
+            last          = addr;
+            uint32_t cost = loop_cycles + (jitter ? simRand(rng) % (jitter + 1) : 0);
+            if (pressed != level) {
+                level = pressed;
+                c.kr.push_back({t + cost, level});
+            }
+            t += cost;
+            if (yield_every && ++iter >= yield_every) {
+                iter = 0;
+                t += yield_cyc;
+                scanFrameSlept(ft);
+                forced++;
+            }
+        }
+        if (c.kr.size() > 64) c.kr.erase(c.kr.begin(), c.kr.end() - 16); // Older than any sample
+        mcsStep(cpu);
+    }
+    if (cpu.fault) {
+        fprintf(stderr, "8031 fault at PC %04X\n", cpu.pc);
+        return 1;
+    }
+
+    printf("KeyBridge vs an emulated 8031 scan routine (%.1f s)\n", c.esp(cpu.cycles) / (SIM_CPU_MHZ * 1e6));
+    printf("  8031             %.4f MHz, %.3f us/machine cycle, %zu-byte routine\n", xtal_mhz, mc_us, rom.b.size());
+    printf("  scan             %.0f MC/frame (%.2f ms), Key Return sampled %.1f MC after the address\n",
+           c.frames > 1 ? (double)c.frame_mc_sum / (c.frames - 1) : 0.0,
+           c.frames > 1 ? (double)c.frame_mc_sum / (c.frames - 1) * mc_us / 1000 : 0.0,
+           c.samples ? (double)c.sample_mc_sum / c.samples : 0.0);
+    printf("  responder        %u cyc/iter (+0..%u), latch %u, rollover %u, settle %u ns, %llu forced yields, "
+           "%llu parks\n",
+           loop_cycles, jitter, stage.latch_frames, rollover, settle_ns, (unsigned long long)forced,
+           (unsigned long long)parks);
+
+    // Text: the keys the terminal decoded, each with Shift and Ctrl as
+    // they stand once the sweep that decoded it has been processed
+    if (text) {
+        std::vector<uint16_t> got;
+        uint8_t mods = 0, down[SCAN_ADDR_COUNT] = {};
+        for (size_t i = 0; i < c.decoded.size(); i++) {
+            uint8_t addr = c.decoded[i].second & 0x7F;
+            bool press   = c.decoded[i].second & 0x80;
+            if (show_events) {
+                printf("  %10.3f ms  %-7s 0x%02X\n", c.decoded[i].first * mc_us / 1000, press ? "press" : "release",
+                       addr);
+            }
+            down[addr] = press;
+            if (addr == COSIM_TEXT_SHIFT || addr == COSIM_TEXT_CTRL) {
+                uint8_t bit = addr == COSIM_TEXT_SHIFT ? TEXT_MOD_SHIFT : TEXT_MOD_CTRL;
+                mods        = (uint8_t)(press ? mods | bit : mods & ~bit);
+                continue;
+            }
+            if (!press) continue;
+            auto next   = std::upper_bound(c.frame_starts.begin(), c.frame_starts.end(), c.decoded[i].first);
+            uint8_t now = mods;
+            for (size_t j = i + 1; j < c.decoded.size() && (next == c.frame_starts.end() || c.decoded[j].first < *next);
+                 j++) {
+                uint8_t a = c.decoded[j].second & 0x7F;
+                if (a != COSIM_TEXT_SHIFT && a != COSIM_TEXT_CTRL) continue;
+                uint8_t bit = a == COSIM_TEXT_SHIFT ? TEXT_MOD_SHIFT : TEXT_MOD_CTRL;
+                now         = (uint8_t)(c.decoded[j].second & 0x80 ? now | bit : now & ~bit);
+            }
+            got.push_back((uint16_t)(addr | now << 8));
+        }
+        uint32_t wrong = 0, stuck = 0;
+        for (size_t i = 0; i < std::max(want.size(), got.size()); i++) {
+            wrong += i >= want.size() || i >= got.size() || want[i] != got[i];
+        }
+        for (uint8_t d : down) stuck += d;
+        double ms = text_done_t > text_t0 ? (text_done_t - text_t0) / (SIM_CPU_MHZ * 1000.0) : 0;
+        printf("  text             %zu bytes, %zu keys, hold %u + gap %u frames, stepped every %.0f us\n",
+               strlen(text), want.size(), hold_frames, gap_frames, (double)poll_cyc / SIM_CPU_MHZ);
+        printf("  typed            %u chars in %.1f ms: %.1f chars/s, %.2f frames/char%s\n", job.typed, ms,
+               ms > 0 ? job.typed * 1000.0 / ms : 0.0, job.typed ? (double)text_frames / job.typed : 0.0,
+               text_stalled ? " (stalled)" : text_done_t ? "" : " (unfinished)");
+        printf("  decoded          %zu keys, %u wrong or missing, %u left down\n", got.size(), wrong, stuck);
+        if (wrong || stuck || !text_done_t || text_stalled) {
+            printf("FAIL\n");
+            return 1;
+        }
+        printf("OK\n");
+        return 0;
+    }
+
+    // Score the terminal's key events against the taps
+    uint32_t spurious = 0, missed = 0, unreleased = 0;
+    std::vector<uint64_t> lat;
+    for (auto &d : c.decoded) {
+        uint8_t addr = d.second & 0x7F;
+        bool press   = d.second & 0x80;
+        uint64_t at  = c.esp(d.first);
+        Tap *hit     = nullptr;
+        for (Tap &p : taps) {
+            if (p.addr != addr || p.press_t > at) continue;
+            if (press ? p.decoded_mc == 0 : (p.decoded_mc && !p.released)) {
+                hit = &p;
+                break;
+            }
+        }
+        if (show_events) {
+            printf("  %10.3f ms  %-7s 0x%02X%s\n", d.first * mc_us / 1000, press ? "press" : "release", addr,
+                   hit ? "" : "  (no tap)");
+        }
+        if (!hit) {
+            spurious++;
+        } else if (press) {
+            hit->decoded_mc = d.first;
+            lat.push_back(d.first - (uint64_t)(hit->press_t / c.esp_per_mc));
+        } else {
+            hit->released = true;
+        }
+    }
+    for (const Tap &p : taps) {
+        missed += p.decoded_mc == 0;
+        unreleased += p.decoded_mc && !p.released;
+    }
+    std::sort(lat.begin(), lat.end());
+    double lat_avg = 0;
+    for (uint64_t l : lat) lat_avg += l;
+    if (!lat.empty()) lat_avg /= lat.size();
+
+    printf("  taps             %zu every %.0f ms, held %.0f ms\n", taps.size(), tap_ms, hold_ms);
+    printf("  decoded          %zu presses, %u missed, %u never released, %u with no tap\n", lat.size(), missed,
+           unreleased, spurious);
+    if (!lat.empty()) {
+        printf("  latency (MC)     min %llu  avg %.0f  p50 %.0f  p99 %.0f  max %llu  (avg %.2f ms)\n",
+               (unsigned long long)lat.front(), lat_avg, pctOf(lat, 50), pctOf(lat, 99),
+               (unsigned long long)lat.back(), lat_avg * mc_us / 1000);
+    }
+    if (missed || spurious) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}